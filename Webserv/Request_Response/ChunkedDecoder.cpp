@@ -0,0 +1,153 @@
+#include "ChunkedDecoder.hpp"
+#include "HttpScan.hpp"
+#include <cstring>
+
+ChunkedDecoder::ChunkedDecoder()
+{
+    reset();
+}
+
+void ChunkedDecoder::reset()
+{
+    state_ = S_SIZE;
+    remaining_ = 0;
+    decoded_ = 0;
+    trailer_bytes_ = 0;
+    error_code_ = 0;
+    error_ = "";
+}
+
+ChunkedDecoder::Status ChunkedDecoder::fail(int code, const char* why)
+{
+    state_ = S_ERROR;
+    error_code_ = code;
+    error_ = why;
+    return CHUNK_ERROR;
+}
+
+// chunk-size [ BWS ";" chunk-ext ] (CR already stripped)
+bool ChunkedDecoder::parseSizeLine(const char* line, size_t len, size_t limit)
+{
+    size_t size = 0;
+    bool overflow = false;
+    size_t i = scan::parseHex(line, len, size, overflow);
+    if (i == 0)
+    {
+        fail(400, "Invalid chunk size line");
+        return false;
+    }
+    // Leading zeros are fine; only the value counts against the limit
+    if (overflow || size > limit)
+    {
+        fail(413, "Chunked body exceeds client_max_body_size");
+        return false;
+    }
+    while (i < len && (line[i] == ' ' || line[i] == '\t'))
+        ++i;
+    if (i < len && line[i] != ';')
+    {
+        fail(400, "Invalid chunk size line");
+        return false;
+    }
+
+    if (size > limit || decoded_ > limit - size)
+    {
+        fail(413, "Chunked body exceeds client_max_body_size");
+        return false;
+    }
+    remaining_ = size;
+    state_ = size == 0 ? S_TRAILER : S_DATA;
+    return true;
+}
+
+ChunkedDecoder::Status ChunkedDecoder::decode(const char* data, size_t len, RequestBody& body,
+                                              size_t limit, size_t& consumed)
+{
+    size_t pos = 0;
+    consumed = 0;
+
+    while (state_ != S_DONE && state_ != S_ERROR)
+    {
+        if (state_ == S_DATA)
+        {
+            size_t n = len - pos < remaining_ ? len - pos : remaining_;
+            if (n == 0)
+                break;
+            if (!body.append(data + pos, n))
+            {
+                consumed = pos;
+                return fail(500, "Could not store request body");
+            }
+            pos += n;
+            remaining_ -= n;
+            decoded_ += n;
+            if (remaining_ == 0)
+                state_ = S_DATA_CRLF;
+            continue;
+        }
+        if (state_ == S_DATA_CRLF)
+        {
+            if (len - pos < 2)
+                break;
+            if (data[pos] != '\r' || data[pos + 1] != '\n')
+            {
+                consumed = pos;
+                return fail(400, "Chunk data not followed by CRLF");
+            }
+            pos += 2;
+            state_ = S_SIZE;
+            continue;
+        }
+
+        // S_SIZE and S_TRAILER work on whole lines
+        const char* nl = static_cast<const char*>(std::memchr(data + pos, '\n', len - pos));
+        if (!nl)
+        {
+            if (len - pos > MAX_LINE)
+            {
+                consumed = pos;
+                return fail(400, state_ == S_SIZE ? "Chunk size line too long" : "Trailer line too long");
+            }
+            break;
+        }
+        size_t end = static_cast<size_t>(nl - data);
+        size_t line_len = end - pos;
+        if (line_len > 0 && data[end - 1] == '\r')
+            --line_len;
+        const char* line = data + pos;
+        if (line_len > MAX_LINE)
+        {
+            consumed = pos;
+            return fail(400, "Chunk line too long");
+        }
+        pos = end + 1;
+
+        if (state_ == S_SIZE)
+        {
+            if (!parseSizeLine(line, line_len, limit))
+            {
+                consumed = pos;
+                return CHUNK_ERROR;
+            }
+        }
+        else if (line_len == 0)
+            state_ = S_DONE;
+        else
+        {
+            // Trailer fields are read past, not interpreted
+            trailer_bytes_ += line_len;
+            if (trailer_bytes_ > MAX_TRAILER_BYTES)
+            {
+                consumed = pos;
+                return fail(400, "Trailer section too large");
+            }
+        }
+    }
+
+    consumed = pos;
+    if (state_ == S_DONE)
+        return CHUNK_DONE;
+    if (state_ == S_ERROR)
+        return CHUNK_ERROR;
+    return CHUNK_NEED_MORE;
+}
@@ -0,0 +1,56 @@
+#ifndef CHUNKEDDECODER_HPP
+#define CHUNKEDDECODER_HPP
+
+#include <cstddef>
+#include <string>
+#include "RequestBody.hpp"
+
+// Resumable decoder for a "Transfer-Encoding: chunked" body. It is fed the
+// bytes that followed the request head as they arrive, appends the chunk
+// data to the body sink and keeps its place across calls, so every byte is
+// looked at once however many reads the body takes. Input it reports as
+// consumed is never needed again and can be dropped by the caller; only an
+// incomplete size or trailer line is left for the next call.
+class ChunkedDecoder {
+public:
+    enum Status {
+        CHUNK_NEED_MORE,   // body incomplete, call again after the next read
+        CHUNK_DONE,        // last chunk and trailer section seen
+        CHUNK_ERROR        // errorCode()/errorText() say why
+    };
+
+    // A chunk size line (extensions included) or trailer line longer than
+    // this is rejected with 400
+    static const size_t MAX_LINE = 4096;
+    static const size_t MAX_TRAILER_BYTES = 16 * 1024;
+
+    ChunkedDecoder();
+
+    void   reset();
+    // Decodes data[0, len) into body. consumed is set to the number of input
+    // bytes used. A body growing past limit fails with 413 as soon as the
+    // offending chunk size is read; a body that cannot be stored, with 500.
+    Status decode(const char* data, size_t len, RequestBody& body, size_t limit, size_t& consumed);
+
+    bool   inProgress() const { return state_ != S_SIZE || decoded_ != 0; }
+    size_t decodedBytes() const { return decoded_; }
+
+    int         errorCode() const { return error_code_; }
+    const char* errorText() const { return error_; }
+
+private:
+    enum State { S_SIZE, S_DATA, S_DATA_CRLF, S_TRAILER, S_DONE, S_ERROR };
+
+    Status fail(int code, const char* why);
+    bool   parseSizeLine(const char* line, size_t len, size_t limit);
+
+    State  state_;
+    size_t remaining_;      // chunk bytes still to copy in S_DATA
+    size_t decoded_;        // body bytes produced so far
+    size_t trailer_bytes_;
+
+    int         error_code_;
+    const char* error_;
+};
+
+#endif
@@ -0,0 +1,441 @@
+#include "HttpScan.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SCAN_X86 1
+# include <immintrin.h>
+# define SCAN_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace scan {
+
+// --- Byte classes shared by the scalar kernels ---
+
+enum {
+    C_STOP  = 1,   // ends or breaks a head line
+    C_TCHAR = 2,   // token character
+    C_HEX   = 4
+};
+
+static unsigned char g_class[256];
+static unsigned char g_hex[256];
+
+static void buildTables()
+{
+    const char* extra = "!#$%&'*+-.^_`|~";
+    for (int c = 0; c < 256; ++c)
+    {
+        unsigned char k = 0;
+        if ((c < 0x20 && c != '\t') || c == 0x7F)
+            k |= C_STOP;
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c != 0 && std::strchr(extra, c)))
+            k |= C_TCHAR;
+        g_hex[c] = 0;
+        if (c >= '0' && c <= '9')
+            g_hex[c] = static_cast<unsigned char>(c - '0');
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            g_hex[c] = static_cast<unsigned char>((c | 0x20) - 'a' + 10);
+        if ((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'))
+            k |= C_HEX;
+        g_class[c] = k;
+    }
+}
+
+static inline unsigned char cls(char c) { return g_class[static_cast<unsigned char>(c)]; }
+
+// --- Scalar kernels ---
+
+static size_t lineStopScalar(const char* p, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        if (cls(p[i]) & C_STOP)
+            return i;
+    return n;
+}
+
+static size_t findCrlfCrlfScalar(const char* p, size_t n)
+{
+    for (size_t i = 0; i + 4 <= n; ++i)
+    {
+        const char* q = static_cast<const char*>(std::memchr(p + i, '\r', n - i - 3));
+        if (!q)
+            break;
+        i = static_cast<size_t>(q - p);
+        if (q[1] == '\n' && q[2] == '\r' && q[3] == '\n')
+            return i;
+    }
+    return n;
+}
+
+static bool isTokenScalar(const char* p, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        if (!(cls(p[i]) & C_TCHAR))
+            return false;
+    return n != 0;
+}
+
+// Chunk sizes are a handful of digits, over before a vector load would pay
+// off (a 16-byte SSE2 version measured slower), so every level uses this.
+static size_t parseHexScalar(const char* p, size_t n, size_t& value, bool& overflow)
+{
+    size_t v = 0;
+    size_t i = 0;
+    overflow = false;
+    for (; i < n && (cls(p[i]) & C_HEX); ++i)
+    {
+        if (v > (static_cast<size_t>(-1) >> 4))
+            overflow = true;
+        v = (v << 4) | g_hex[static_cast<unsigned char>(p[i])];
+    }
+    value = v;
+    return i;
+}
+
+static size_t findBoundaryScalar(const char* hay, size_t n, const char* needle, size_t m)
+{
+    if (n < m)
+        return n;
+    const char last = needle[m - 1];
+    const size_t end = n - m + 1;   // candidate starts are [0, end)
+    size_t i = 0;
+    while (i < end)
+    {
+        const char* q = static_cast<const char*>(std::memchr(hay + i, needle[0], end - i));
+        if (!q)
+            break;
+        i = static_cast<size_t>(q - hay);
+        if (q[m - 1] == last && std::memcmp(q + 1, needle + 1, m - 2) == 0)
+            return i;
+        ++i;
+    }
+    return n;
+}
+
+#ifdef SCAN_X86
+
+// Unsigned byte compares built from min/max: SSE2 and AVX2 only have signed
+// greater-than.
+SCAN_TARGET("sse2")
+static inline __m128i inRange128(__m128i x, char lo, char hi)
+{
+    __m128i c = _mm_max_epu8(_mm_min_epu8(x, _mm_set1_epi8(hi)), _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(c, x);
+}
+
+SCAN_TARGET("avx2")
+static inline __m256i inRange256(__m256i x, char lo, char hi)
+{
+    __m256i c = _mm256_max_epu8(_mm256_min_epu8(x, _mm256_set1_epi8(hi)), _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(c, x);
+}
+
+static inline unsigned lowBit(unsigned m) { return static_cast<unsigned>(__builtin_ctz(m)); }
+
+// --- SSE2 kernels ---
+
+SCAN_TARGET("sse2")
+static size_t lineStopSse2(const char* p, size_t n)
+{
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i del = _mm_set1_epi8(0x7F);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i stop = _mm_andnot_si128(_mm_cmpeq_epi8(x, tab), inRange128(x, 0, 0x1F));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(x, del));
+        unsigned m = static_cast<unsigned>(_mm_movemask_epi8(stop));
+        if (m)
+            return i + lowBit(m);
+    }
+    return i + lineStopScalar(p + i, n - i);
+}
+
+SCAN_TARGET("sse2")
+static size_t findCrlfCrlfSse2(const char* p, size_t n)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 19 <= n; i += 16)
+    {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), cr);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 1)), lf);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 2)), cr);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 3)), lf);
+        unsigned m = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d))));
+        if (m)
+            return i + lowBit(m);
+    }
+    size_t r = findCrlfCrlfScalar(p + i, n - i);
+    return r == n - i ? n : i + r;
+}
+
+// Token bytes are 0x21-0x7E minus the separators "(),/:;<=>?@[\]{}
+SCAN_TARGET("sse2")
+static __m128i notTchar128(__m128i x)
+{
+    __m128i bad = _mm_or_si128(inRange128(x, 0, 0x20), inRange128(x, 0x7F, static_cast<char>(0xFF)));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+    bad = _mm_or_si128(bad, inRange128(x, '(', ')'));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8(',')));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8('/')));
+    bad = _mm_or_si128(bad, inRange128(x, ':', '@'));
+    bad = _mm_or_si128(bad, inRange128(x, '[', ']'));
+    bad = _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8('{')));
+    return _mm_or_si128(bad, _mm_cmpeq_epi8(x, _mm_set1_epi8('}')));
+}
+
+SCAN_TARGET("sse2")
+static bool isTokenSse2(const char* p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        if (_mm_movemask_epi8(notTchar128(x)))
+            return false;
+    }
+    return n != 0 && (i == n || isTokenScalar(p + i, n - i));
+}
+
+SCAN_TARGET("sse2")
+static size_t findBoundarySse2(const char* hay, size_t n, const char* needle, size_t m)
+{
+    if (n < m)
+        return n;
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i)), first);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + m - 1)), last);
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(a, b)));
+        while (mask)
+        {
+            size_t at = i + lowBit(mask);
+            if (std::memcmp(hay + at + 1, needle + 1, m - 2) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+    size_t r = findBoundaryScalar(hay + i, n - i, needle, m);
+    return r == n - i ? n : i + r;
+}
+
+// --- AVX2 kernels: the SSE2 ones at twice the width ---
+// Tails are done with one last 32-byte window that overlaps bytes already
+// looked at, never by calling the SSE2 kernels: mixing legacy SSE with
+// dirty upper AVX state costs a transition stall on many CPUs.
+
+// Drops the match bits of window positions below `from`
+static inline unsigned above(unsigned m, size_t window, size_t from)
+{
+    return m & (~0u << (from - window));
+}
+
+SCAN_TARGET("avx2")
+static size_t lineStopAvx2(const char* p, size_t n)
+{
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, tab), inRange256(x, 0, 0x1F));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(x, del));
+        unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(stop));
+        if (m)
+            return i + lowBit(m);
+    }
+    if (i == n || n < 32)
+        return i + lineStopScalar(p + i, n - i);
+    size_t w = n - 32;
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + w));
+    __m256i stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, tab), inRange256(x, 0, 0x1F));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(x, del));
+    unsigned m = above(static_cast<unsigned>(_mm256_movemask_epi8(stop)), w, i);
+    return m ? w + lowBit(m) : n;
+}
+
+SCAN_TARGET("avx2")
+static size_t findCrlfCrlfAvx2(const char* p, size_t n)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    if (n < 35)
+        return findCrlfCrlfScalar(p, n);
+    size_t i = 0;
+    for (;; i += 32)
+    {
+        size_t w = i + 35 <= n ? i : n - 35;   // last window overlaps
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + w)), cr);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + w + 1)), lf);
+        __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + w + 2)), cr);
+        __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + w + 3)), lf);
+        unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, d))));
+        if (w != i)
+            m = above(m, w, i);
+        if (m)
+            return w + lowBit(m);
+        if (w != i || i + 35 == n)
+            return n;
+    }
+}
+
+SCAN_TARGET("avx2")
+static __m256i notTchar256(__m256i x)
+{
+    __m256i bad = _mm256_or_si256(inRange256(x, 0, 0x20), inRange256(x, 0x7F, static_cast<char>(0xFF)));
+    bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+    bad = _mm256_or_si256(bad, inRange256(x, '(', ')'));
+    bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(',')));
+    bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('/')));
+    bad = _mm256_or_si256(bad, inRange256(x, ':', '@'));
+    bad = _mm256_or_si256(bad, inRange256(x, '[', ']'));
+    bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('{')));
+    return _mm256_or_si256(bad, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('}')));
+}
+
+SCAN_TARGET("avx2")
+static bool isTokenAvx2(const char* p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        if (_mm256_movemask_epi8(notTchar256(x)))
+            return false;
+    }
+    if (i == n)
+        return n != 0;
+    if (n < 32)
+        return isTokenScalar(p, n);
+    // Rechecking bytes already known to be fine is harmless
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n - 32));
+    return _mm256_movemask_epi8(notTchar256(x)) == 0;
+}
+
+SCAN_TARGET("avx2")
+static size_t findBoundaryAvx2(const char* hay, size_t n, const char* needle, size_t m)
+{
+    if (n < m)
+        return n;
+    const size_t end = n - m + 1;   // candidate starts are [0, end)
+    if (end < 32)
+        return findBoundaryScalar(hay, n, needle, m);
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    for (size_t i = 0;; i += 32)
+    {
+        size_t w = i + 32 <= end ? i : end - 32;   // last window overlaps
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + w)), first);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + w + m - 1)), last);
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(a, b)));
+        if (w != i)
+            mask = above(mask, w, i);
+        while (mask)
+        {
+            size_t at = w + lowBit(mask);
+            if (std::memcmp(hay + at + 1, needle + 1, m - 2) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+        if (w != i || i + 32 == end)
+            return n;
+    }
+}
+
+#endif // SCAN_X86
+
+// --- Dispatch ---
+
+struct Kernels {
+    size_t (*lineStop)(const char*, size_t);
+    size_t (*findCrlfCrlf)(const char*, size_t);
+    bool   (*isToken)(const char*, size_t);
+    size_t (*parseHex)(const char*, size_t, size_t&, bool&);
+    size_t (*findBoundary)(const char*, size_t, const char*, size_t);
+};
+
+static const Kernels kScalar = {
+    lineStopScalar, findCrlfCrlfScalar, isTokenScalar, parseHexScalar, findBoundaryScalar
+};
+#ifdef SCAN_X86
+static const Kernels kSse2 = {
+    lineStopSse2, findCrlfCrlfSse2, isTokenSse2, parseHexScalar, findBoundarySse2
+};
+static const Kernels kAvx2 = {
+    lineStopAvx2, findCrlfCrlfAvx2, isTokenAvx2, parseHexScalar, findBoundaryAvx2
+};
+#endif
+
+static Level supportedLevel()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SSE2;
+#endif
+    return SCALAR;
+}
+
+static Level          g_level = SCALAR;
+static const Kernels* g_kernels = &kScalar;
+
+Level setLevel(Level want)
+{
+    Level best = supportedLevel();
+    g_level = want < best ? want : best;
+#ifdef SCAN_X86
+    g_kernels = g_level == AVX2 ? &kAvx2 : g_level == SSE2 ? &kSse2 : &kScalar;
+#else
+    g_kernels = &kScalar;
+#endif
+    return g_level;
+}
+
+// Runs before main(), so worker threads only ever read the choice
+static Level initialLevel()
+{
+    buildTables();
+    const char* env = std::getenv("WEBSERV_SCAN");
+    Level want = AVX2;
+    if (env && std::strcmp(env, "scalar") == 0)
+        want = SCALAR;
+    else if (env && std::strcmp(env, "sse2") == 0)
+        want = SSE2;
+    return setLevel(want);
+}
+
+static const Level g_initial = initialLevel();
+
+Level level() { return g_level; }
+
+const char* levelName(Level l)
+{
+    return l == AVX2 ? "avx2" : l == SSE2 ? "sse2" : "scalar";
+}
+
+size_t lineStop(const char* p, size_t n) { return g_kernels->lineStop(p, n); }
+size_t findCrlfCrlf(const char* p, size_t n) { return g_kernels->findCrlfCrlf(p, n); }
+bool   isToken(const char* p, size_t n) { return g_kernels->isToken(p, n); }
+
+size_t parseHex(const char* p, size_t n, size_t& value, bool& overflow)
+{
+    return g_kernels->parseHex(p, n, value, overflow);
+}
+
+size_t findBoundary(const char* hay, size_t n, const char* needle, size_t m)
+{
+    return g_kernels->findBoundary(hay, n, needle, m);
+}
+
+} // namespace scan
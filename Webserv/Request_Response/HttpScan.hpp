@@ -0,0 +1,44 @@
+#ifndef HTTPSCAN_HPP
+#define HTTPSCAN_HPP
+
+#include <cstddef>
+
+// Byte-scanning kernels for the HTTP parsers. Each has a scalar version and,
+// on x86, SSE2 and AVX2 versions that test 16 or 32 bytes per step; the best
+// one the CPU supports is picked once at startup. WEBSERV_SCAN=scalar|sse2|avx2
+// in the environment caps the choice. All versions return the same results
+// (bench/scan_bench checks them against the scalar ones).
+namespace scan {
+
+enum Level { SCALAR, SSE2, AVX2 };
+
+Level       level();
+const char* levelName(Level l);
+// Switches every kernel to l (or the best supported level below it) and
+// returns the level now in use. Meant for benchmarks; not thread-safe.
+Level       setLevel(Level l);
+
+// Offset of the first byte in p[0, n) that ends or breaks a head line:
+// CR, LF, DEL or any other control byte except HTAB. n if there is none.
+size_t lineStop(const char* p, size_t n);
+
+// Offset of the first "\r\n\r\n" in p[0, n), or n
+size_t findCrlfCrlf(const char* p, size_t n);
+
+// True when p[0, n) is a non-empty token (RFC 9110 tchar only)
+bool   isToken(const char* p, size_t n);
+
+// Reads the hex digits at the start of p[0, n) into value and returns how
+// many there were. overflow is set when the number does not fit a size_t
+// (value is then meaningless); leading zeros never overflow. Chunk sizes are
+// too short for vectors to pay off, so this one is scalar at every level.
+size_t parseHex(const char* p, size_t n, size_t& value, bool& overflow);
+
+// Offset of the first occurrence of needle[0, m) (m >= 2) in hay[0, n), or n.
+// Candidates are found by testing the needle's first and last byte at 16/32
+// positions at once, then confirmed with memcmp.
+size_t findBoundary(const char* hay, size_t n, const char* needle, size_t m);
+
+} // namespace scan
+
+#endif
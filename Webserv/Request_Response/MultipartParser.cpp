@@ -0,0 +1,279 @@
+#include "MultipartParser.hpp"
+#include "HttpScan.hpp"
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+
+static const size_t NPOS = static_cast<size_t>(-1);
+
+MultipartParser::MultipartParser(const std::string& boundary, MultipartHandler& handler)
+    : delim_("\r\n--" + boundary), handler_(handler), state_(S_PREAMBLE),
+      status_(PART_NEED_MORE), error_(""),
+      carry_("\r\n"),   // lets a delimiter on the body's first line match
+      headers_(), tail_()
+{
+    const size_t d = delim_.size();
+    for (size_t c = 0; c < 256; ++c)
+        skip_[c] = d;
+    for (size_t j = 0; j + 1 < d; ++j)
+        skip_[static_cast<unsigned char>(delim_[j])] = d - 1 - j;
+}
+
+MultipartParser::Status MultipartParser::fail(Status st, const char* why)
+{
+    status_ = st;
+    error_ = why;
+    return st;
+}
+
+// With AVX2, scan::findBoundary tests 32 positions per step. Otherwise
+// Boyer-Moore-Horspool, which at 16 positions per step is as fast as the
+// SSE2 kernel for a typical 40-byte delimiter: compare the window's last
+// byte, then shift by how far that byte sits from the end of the delimiter.
+size_t MultipartParser::search(const char* hay, size_t n) const
+{
+    const size_t d = delim_.size();
+    if (n < d)
+        return NPOS;
+    if (scan::level() == scan::AVX2)
+    {
+        size_t at = scan::findBoundary(hay, n, delim_.data(), d);
+        return at == n ? NPOS : at;
+    }
+    const char* pat = delim_.data();
+    const char last = pat[d - 1];
+    size_t i = 0;
+    while (i <= n - d)
+    {
+        char c = hay[i + d - 1];
+        if (c == last && std::memcmp(hay + i, pat, d - 1) == 0)
+            return i;
+        i += skip_[static_cast<unsigned char>(c)];
+    }
+    return NPOS;
+}
+
+bool MultipartParser::emit(const char* data, size_t len)
+{
+    // Preamble bytes are dropped
+    if (state_ != S_BODY || len == 0)
+        return true;
+    if (!handler_.onPartData(data, len))
+    {
+        fail(PART_ABORTED, "Part data rejected");
+        return false;
+    }
+    return true;
+}
+
+// Looks for the next delimiter in carry_ + data[pos, len). Bytes that cannot
+// belong to it are emitted. Returns true with pos just past the delimiter,
+// false once the input is used up or a handler aborted.
+bool MultipartParser::scanForDelimiter(const char* data, size_t len, size_t& pos)
+{
+    const size_t d = delim_.size();
+
+    if (!carry_.empty())
+    {
+        // A delimiter may start in the carried tail and end in this block
+        std::string joined = carry_;
+        joined.append(data + pos, std::min(len - pos, d - 1));
+        size_t m = search(joined.data(), joined.size());
+        if (m != NPOS && m < carry_.size())
+        {
+            if (!emit(joined.data(), m))
+                return false;
+            pos += m + d - carry_.size();
+            carry_.clear();
+            return true;
+        }
+        if (joined.size() < carry_.size() + d - 1)
+        {
+            // Not enough input yet to rule the tail out: keep the last d-1 bytes
+            size_t k = joined.size() > d - 1 ? joined.size() - (d - 1) : 0;
+            if (!emit(joined.data(), k))
+                return false;
+            carry_.assign(joined, k, std::string::npos);
+            pos = len;
+            return false;
+        }
+        if (!emit(carry_.data(), carry_.size()))
+            return false;
+        carry_.clear();
+    }
+
+    size_t m = search(data + pos, len - pos);
+    if (m != NPOS)
+    {
+        if (!emit(data + pos, m))
+            return false;
+        pos += m + d;
+        return true;
+    }
+    size_t rest = len - pos;
+    size_t k = rest > d - 1 ? rest - (d - 1) : 0;
+    if (!emit(data + pos, k))
+        return false;
+    carry_.assign(data + pos + k, rest - k);
+    pos = len;
+    return false;
+}
+
+bool MultipartParser::delimiterFound()
+{
+    if (state_ == S_BODY && !handler_.onPartEnd())
+    {
+        fail(PART_ABORTED, "Part rejected");
+        return false;
+    }
+    state_ = S_DELIM_TAIL;
+    tail_.clear();
+    return true;
+}
+
+static std::string trim(const std::string& s)
+{
+    size_t b = s.find_first_not_of(" \t");
+    if (b == std::string::npos)
+        return "";
+    size_t e = s.find_last_not_of(" \t");
+    return s.substr(b, e - b + 1);
+}
+
+// Value of a parameter (name="x" or name=x) in a header like
+// Content-Disposition; empty when absent
+static std::string headerParam(const std::string& value, const char* key)
+{
+    const size_t klen = std::strlen(key);
+    size_t i = value.find(';');
+    while (i != std::string::npos)
+    {
+        size_t start = value.find_first_not_of(" \t", i + 1);
+        if (start == std::string::npos)
+            break;
+        size_t eq = value.find('=', start);
+        if (eq == std::string::npos)
+            break;
+        std::string name = trim(value.substr(start, eq - start));
+        size_t v = value.find_first_not_of(" \t", eq + 1);
+        std::string result;
+        if (v != std::string::npos && value[v] == '"')
+        {
+            size_t q = v + 1;
+            while (q < value.size() && value[q] != '"')
+            {
+                if (value[q] == '\\' && q + 1 < value.size())
+                    ++q;
+                result += value[q++];
+            }
+            i = value.find(';', q);
+        }
+        else
+        {
+            i = value.find(';', eq);
+            if (v != std::string::npos)
+                result = trim(value.substr(v, (i == std::string::npos ? value.size() : i) - v));
+        }
+        if (name.size() == klen && strncasecmp(name.c_str(), key, klen) == 0)
+            return result;
+    }
+    return "";
+}
+
+// headers_ holds CRLF + header lines + CRLF CRLF
+bool MultipartParser::parseHeaders()
+{
+    std::string name, filename, type;
+    size_t pos = 2;
+    while (pos < headers_.size())
+    {
+        size_t eol = headers_.find("\r\n", pos);
+        if (eol == std::string::npos || eol == pos)
+            break;
+        std::string line = headers_.substr(pos, eol - pos);
+        pos = eol + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string key = trim(line.substr(0, colon));
+        std::string value = trim(line.substr(colon + 1));
+        if (strcasecmp(key.c_str(), "Content-Disposition") == 0)
+        {
+            name = headerParam(value, "name");
+            filename = headerParam(value, "filename");
+        }
+        else if (strcasecmp(key.c_str(), "Content-Type") == 0)
+            type = value;
+    }
+    state_ = S_BODY;
+    if (!handler_.onPartBegin(name, filename, type))
+    {
+        fail(PART_ABORTED, "Part rejected");
+        return false;
+    }
+    return true;
+}
+
+MultipartParser::Status MultipartParser::feed(const char* data, size_t len)
+{
+    size_t pos = 0;
+    while (pos < len && status_ == PART_NEED_MORE)
+    {
+        switch (state_)
+        {
+        case S_PREAMBLE:
+        case S_BODY:
+            if (scanForDelimiter(data, len, pos))
+                delimiterFound();
+            break;
+
+        case S_DELIM_TAIL:
+        {
+            // "--" closes the body; otherwise optional padding, then CRLF
+            tail_ += data[pos++];
+            if (tail_ == "--")
+            {
+                state_ = S_EPILOGUE;
+                status_ = PART_DONE;
+            }
+            else if (tail_.size() >= 2 && tail_.compare(tail_.size() - 2, 2, "\r\n") == 0)
+            {
+                if (tail_.find_first_not_of(" \t", 0) != tail_.size() - 2)
+                    return fail(PART_ERROR, "Malformed multipart delimiter line");
+                state_ = S_HEADERS;
+                headers_ = "\r\n";
+            }
+            else if (tail_ != "-" && tail_.find_first_not_of(" \t\r") != std::string::npos)
+                return fail(PART_ERROR, "Malformed multipart delimiter line");
+            else if (tail_.size() > 256)
+                return fail(PART_ERROR, "Malformed multipart delimiter line");
+            break;
+        }
+
+        case S_HEADERS:
+        {
+            size_t from = headers_.size() >= 3 ? headers_.size() - 3 : 0;
+            size_t take = std::min(len - pos, MAX_PART_HEADERS + 4 - std::min(headers_.size(), MAX_PART_HEADERS + 4));
+            headers_.append(data + pos, take);
+            size_t end = from + scan::findCrlfCrlf(headers_.data() + from, headers_.size() - from);
+            if (end == headers_.size())
+            {
+                if (headers_.size() >= MAX_PART_HEADERS + 4)
+                    return fail(PART_ERROR, "Multipart part headers too large");
+                pos += take;
+                break;
+            }
+            // Give back what was copied past the header section
+            pos += take - (headers_.size() - (end + 4));
+            headers_.resize(end + 4);
+            parseHeaders();
+            break;
+        }
+
+        case S_EPILOGUE:
+            pos = len;
+            break;
+        }
+    }
+    return status_;
+}
@@ -0,0 +1,66 @@
+#ifndef MULTIPARTPARSER_HPP
+#define MULTIPARTPARSER_HPP
+
+#include <cstddef>
+#include <string>
+
+// Receives the parts of a multipart body as the parser finds them. Part
+// data may arrive in any number of pieces; returning false from a callback
+// stops the parse (the parser then reports PART_ABORTED).
+class MultipartHandler {
+public:
+    virtual ~MultipartHandler() {}
+    virtual bool onPartBegin(const std::string& name, const std::string& filename,
+                             const std::string& contentType) = 0;
+    virtual bool onPartData(const char* data, size_t len) = 0;
+    virtual bool onPartEnd() = 0;
+};
+
+// Streaming multipart/form-data parser (RFC 7578). The body is fed in
+// blocks of any size; part data is handed on as soon as it cannot be the
+// start of a delimiter, so memory use is one delimiter's length plus the
+// part headers, whatever the size of the parts. Delimiters are found with
+// the AVX2 scan::findBoundary kernel where the CPU has it, else with
+// Boyer-Moore-Horspool, which skips up to a whole delimiter per probe.
+class MultipartParser {
+public:
+    enum Status {
+        PART_NEED_MORE,   // keep feeding
+        PART_DONE,        // closing delimiter seen; the rest is epilogue
+        PART_ERROR,       // malformed body
+        PART_ABORTED      // a handler callback returned false
+    };
+
+    static const size_t MAX_PART_HEADERS = 16 * 1024;
+
+    MultipartParser(const std::string& boundary, MultipartHandler& handler);
+
+    Status feed(const char* data, size_t len);
+    Status status() const { return status_; }
+    const char* errorText() const { return error_; }
+
+private:
+    enum State { S_PREAMBLE, S_DELIM_TAIL, S_HEADERS, S_BODY, S_EPILOGUE };
+
+    MultipartParser(const MultipartParser&);
+    MultipartParser& operator=(const MultipartParser&);
+
+    Status fail(Status st, const char* why);
+    size_t search(const char* hay, size_t len) const;
+    bool   emit(const char* data, size_t len);
+    bool   scanForDelimiter(const char* data, size_t len, size_t& pos);
+    bool   delimiterFound();
+    bool   parseHeaders();
+
+    std::string       delim_;        // CRLF "--" boundary
+    size_t            skip_[256];    // Horspool shift table for delim_
+    MultipartHandler& handler_;
+    State             state_;
+    Status            status_;
+    const char*       error_;
+    std::string       carry_;        // tail that may start a delimiter
+    std::string       headers_;      // part headers being collected
+    std::string       tail_;         // bytes after a delimiter ("--" or CRLF)
+};
+
+#endif
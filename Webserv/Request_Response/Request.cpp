@@ -6,21 +6,25 @@
 #include <sstream>
 #include <iterator>
 #include <iomanip>
-
-
-// Constructor: Parses the raw HTTP request data
-Request::Request(const std::string& raw_data) : content_length(0) {
-    // Safety check and logging for raw_data
-        std::ostringstream oss;
-        oss << "raw_data size: " << raw_data.size();
-        Logger::log(LOG_INFO, "Request::Request", oss.str());
-    if (raw_data.size() > 100*1024*1024) {
-        Logger::log(LOG_ERROR, "Request::Request", "raw_data too large, possible buffer corruption");
-        throw std::runtime_error("raw_data too large");
-    }
-    // Optionally log first 200 bytes for debugging
-    Logger::log(LOG_INFO, "Request::Request", std::string("raw_data preview: ") + raw_data.substr(0, std::min((size_t)200, raw_data.size())));
-    parseRequest(raw_data);
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+
+
+// Constructor: builds the request from a head parsed in place by
+// RequestParser. The body was collected separately and is swapped in.
+Request::Request(const std::string& buf, const RequestParser& head, RequestBody& body)
+    : method(buf, head.method().off, head.method().len),
+      path(buf, head.target().off, head.target().len),
+      version(buf, head.version().off, head.version().len),
+      body_(),
+      content_length(head.contentLength()),
+      buf_(&buf),
+      head_(&head),
+      location_(NULL),
+      rel_off_(0) {
+    body_.swap(body);
+    Logger::log(LOG_INFO, "Request::Request", method + " " + path + " " + version);
 }
 
 
@@ -30,164 +34,59 @@ std::string Request::getPath() const { return path; }
 std::string Request::getVersion() const { return version; }
 
 
-// Returns the value of a header by key, or empty string if not found
+// Returns the value of a header by key (case-insensitive), or empty string
+// if not found. Known fields are one slot lookup; others scan the slices.
 std::string Request::getHeader(const std::string& key) const {
-    // Case-insensitive header lookup
-    for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it) {
-        if (strcasecmp(it->first.c_str(), key.c_str()) == 0) {
-            return it->second;
-        }
+    KnownHeader id = RequestParser::classify(key.data(), key.size());
+    if (id != HDR_OTHER)
+        return getHeader(id);
+
+    const std::vector<HeaderSlice>& h = head_->headers();
+    for (size_t i = h.size(); i-- > 0; ) {
+        if (h[i].name.len == key.size() &&
+            strncasecmp(buf_->data() + h[i].name.off, key.data(), key.size()) == 0)
+            return buf_->substr(h[i].value.off, h[i].value.len);
     }
     return "";
 }
 
-
-// Returns the request body
-std::string Request::getBody() const { return body; }
-
-
-// Parses the raw HTTP request string into method, path, version, headers, and body
-void Request::parseRequest(const std::string& raw_data) {
-
-    std::istringstream stream(raw_data);
-    std::string line;
-
-    // Reset previous state
-    method.clear();
-    path.clear();
-    version.clear();
-    headers.clear();
-    content_length = 0;
-    body.clear();
-
-    try {
-        // --- Parse request line ---
-        if (!std::getline(stream, line))
-            throw std::runtime_error("Empty request line");
-        if (!line.empty() && line[line.size() - 1] == '\r')
-            line.erase(line.size() - 1);
-
-        std::istringstream request_line(line);
-        request_line >> method >> path >> version;
-        if (method.empty() || path.empty() || version.empty())
-            throw std::runtime_error("Malformed request line");
-
-        // Validate HTTP version format and support
-        if (!isValidHttpVersionFormat(version))
-            throw std::runtime_error("Invalid HTTP version");
-        if (version.compare(0, 8, "HTTP/1.1") != 0)
-            throw std::runtime_error("HTTP Version Not Supported");
-
-        // --- Parse headers ---
-        int cl_found = 0;
-        while (std::getline(stream, line)) {
-            if (!line.empty() && line[line.size() - 1] == '\r')
-                line.erase(line.size() - 1);
-            if (line.empty())
-                break; // end of headers
-
-            size_t colon = line.find(':');
-            if (colon == std::string::npos)
-                throw std::runtime_error("Malformed header line (missing colon)");
-
-            std::string key = line.substr(0, colon);
-            std::string value = line.substr(colon + 1);
-
-            // Trim whitespace from key and value
-            key.erase(0, key.find_first_not_of(" \t"));
-            key.erase(key.find_last_not_of(" \t") + 1);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t") + 1);
-
-            if (key.empty())
-                throw std::runtime_error("Malformed header line (empty key)");
-
-            headers[key] = value;
-
-            // Parse Content-Length if present (case-insensitive)
-            if (strcasecmp(key.c_str(), "Content-Length") == 0) {
-                cl_found++;
-                long cl_val = -1;
-                std::istringstream iss(value);
-                if (!(iss >> cl_val) || cl_val < 0 || cl_val > 100L*1024L*1024L) // 100MB limit
-                    throw std::runtime_error("Invalid or too large Content-Length value");
-                content_length = static_cast<int>(cl_val);
-            }
-        }
-        if (cl_found > 1)
-            throw std::runtime_error("Multiple Content-Length headers");
-
-        // Debug: print all parsed headers
-        Logger::log(LOG_INFO, "Request::parseRequest", "\033[1;33m[Request] Parsed headers:\033[0m");
-        for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it) {
-            std::ostringstream oss;
-            oss << "  '" << it->first << "': '" << it->second << "'";
-            Logger::log(LOG_INFO, "Request::parseRequest", std::string("\033[1;33m") + oss.str() + "\033[0m");
-        }
-
-        // --- Read body ---
-        std::string raw_body;
-        raw_body.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
-
-        // Body assignment: chunked already validated by buffer logic
-        if (isChunked()) {
-            body = raw_body;
-        } else if (strcasecmp(getHeader("Content-Length").c_str(), "") != 0) {
-            // Content-Length header is present (any value, including zero)
-            if (content_length < 0 || content_length > 100L*1024L*1024L)
-                throw std::runtime_error("Invalid or too large Content-Length value");
-            if (static_cast<long>(raw_body.size()) < content_length)
-                throw std::runtime_error("Incomplete body");
-            body = raw_body.substr(0, content_length);
-        } else {
-            body = raw_body;
-        }
-
-    } catch (const std::runtime_error& e) {
-        Logger::log(LOG_ERROR, "Request::parseRequest", e.what());
-        throw; // propagate exception to server to send 400 response
-    }
+std::string Request::getHeader(KnownHeader id) const {
+    const HeaderSlice* h = head_->header(id);
+    return h ? buf_->substr(h->value.off, h->value.len) : std::string();
 }
 
+bool Request::headerEquals(KnownHeader id, const char* value) const {
+    const HeaderSlice* h = head_->header(id);
+    size_t n = std::strlen(value);
+    return h && h->value.len == n && strncasecmp(buf_->data() + h->value.off, value, n) == 0;
+}
 
+bool Request::headerContains(KnownHeader id, const char* needle) const {
+    const HeaderSlice* h = head_->header(id);
+    if (!h)
+        return false;
+    const char* v = buf_->data() + h->value.off;
+    return std::search(v, v + h->value.len, needle, needle + std::strlen(needle)) != v + h->value.len;
+}
 
-// Sets the request body
-void Request::setBody(const std::string& newBody) { body = newBody; }
 
-// Returns the Content-Length value
-int Request::getContentLength() const { return content_length; }
+// Returns the request body
+std::string Request::getBody() const {
+    std::string out;
+    if (!body_.readAll(out))
+        Logger::log(LOG_ERROR, "Request::getBody", "Could not read spooled request body");
+    return out;
+}
 
 
-// Returns true if Transfer-Encoding is chunked
-bool Request::isChunked() const {
 
-    std::string te = getHeader("Transfer-Encoding");
-    if (te.empty()) return false;
+// Returns the Content-Length value
+long Request::getContentLength() const { return content_length; }
 
-    // Split by comma and trim spaces
-    std::vector<std::string> encodings;
-    std::istringstream iss(te);
-    std::string part;
-    while (std::getline(iss, part, ',')) {
-        part.erase(0, part.find_first_not_of(" \t"));
-        part.erase(part.find_last_not_of(" \t") + 1);
-        if (!part.empty()) encodings.push_back(part);
-    }
 
-    if (encodings.size() > 1) {
-        throw std::runtime_error("501: Multiple Transfer-Encoding values: " + te);
-    }
-    if (encodings.size() == 1) {
-        std::string val = encodings[0];
-        // Lowercase for comparison
-        for (size_t i = 0; i < val.size(); ++i) val[i] = std::tolower(val[i]);
-        if (val != "chunked") {
-            throw std::runtime_error("501: Unsupported Transfer-Encoding: " + te);
-        }
-        return true;
-    }
-    return false;
-}
+// Returns true if Transfer-Encoding is chunked (the parser already
+// rejected any other coding with 501)
+bool Request::isChunked() const { return head_->isChunked(); }
 
 
 // Checks if the HTTP version string is valid (format: HTTP/x.y)
@@ -219,12 +118,5 @@ bool Request::isValidHttpVersionFormat(const std::string& version) const {
 
 // Returns true if the Expect header is "100-continue" (case-insensitive)
 bool Request::hasExpectContinue() const {
-    std::string expect = getHeader("Expect");
-    // Convert to lowercase for case-insensitive comparison
-    for (size_t i = 0; i < expect.length(); ++i) {
-        if (expect[i] >= 'A' && expect[i] <= 'Z') {
-            expect[i] = expect[i] - 'A' + 'a';
-        }
-    }
-    return expect == "100-continue";
+    return headerEquals(HDR_EXPECT, "100-continue");
 }
@@ -2,35 +2,57 @@
 #define REQUEST_HPP
 
 #include <string>
-#include <map>
 #include <sstream>
 #include <iostream>
+#include "RequestParser.hpp"
+#include "RequestBody.hpp"
+#include "LocationPlan.hpp"
 
 //This file defines the Request class — it represents a parsed HTTP request from the client.
+// Header fields are not copied: they are read through the parser's slices
+// into the connection's receive buffer, so a Request must not outlive the
+// processing of that buffer (it is built and handled in one call).
 class Request {
 public:
-    Request(const std::string& raw_data);
+    // Takes over body (swapped out, leaving it empty)
+    Request(const std::string& buf, const RequestParser& head, RequestBody& body);
     std::string getMethod() const;
     std::string getPath() const;
     std::string getVersion() const;
     std::string getHeader (const std::string& key) const;
-    std::string getBody() const;
-    void setBody(const std::string& newBody);
+    std::string getHeader (KnownHeader id) const;
+    bool hasHeader(KnownHeader id) const { return head_->header(id) != NULL; }
+    // Case-insensitive equality / case-sensitive substring test on a known
+    // field's value, without copying it
+    bool headerEquals(KnownHeader id, const char* value) const;
+    bool headerContains(KnownHeader id, const char* needle) const;
+    std::string getBody() const;           // copies; may read a spooled body back
+    const RequestBody& body() const { return body_; }
+    size_t getBodySize() const { return body_.size(); }
 	bool isChunked() const;
     bool isValidHttpVersionFormat(const std::string& version) const;
     bool hasExpectContinue() const;
 
-    int getContentLength() const; // <-- Add this
+    long getContentLength() const; // declared Content-Length, 0 if none
+
+    // Location the request was routed to (NULL: none) and where the path
+    // continues below it; set once by process_request()
+    void setRoute(const LocationPlan* loc, size_t rel) { location_ = loc; rel_off_ = rel; }
+    const LocationPlan* location() const { return location_; }
+    // Path below the location without its leading '/', e.g. "a/b.txt" for
+    // /upload/a/b.txt routed to location /upload
+    std::string getRelativePath() const { return path.substr(rel_off_ < path.size() ? rel_off_ : path.size()); }
 
 private:
     std::string method;
     std::string path;
     std::string version;
-    std::map<std::string, std::string> headers;
-    std::string body;
-    int content_length; // <-- Add this
-
-    void parseRequest(const std::string& raw_data);
+    RequestBody body_;
+    long content_length;
+    const std::string* buf_;     // receive buffer the header slices point into
+    const RequestParser* head_;
+    const LocationPlan* location_;
+    size_t rel_off_;
 };
 
 #endif
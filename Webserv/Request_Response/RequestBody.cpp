@@ -0,0 +1,167 @@
+#include "RequestBody.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+RequestBody::RequestBody()
+    : mem_(), fd_(-1), size_(0), threshold_(DEFAULT_SPILL_THRESHOLD), consumer_(NULL) {}
+
+RequestBody::~RequestBody()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    delete consumer_;
+}
+
+void RequestBody::reset()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+    size_ = 0;
+    delete consumer_;
+    consumer_ = NULL;
+    // Keep a small buffer around for the next request on the connection
+    if (mem_.capacity() > DEFAULT_SPILL_THRESHOLD)
+        std::string().swap(mem_);
+    else
+        mem_.clear();
+}
+
+static bool writeAll(int fd, const char* p, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// An anonymous file in $TMPDIR (or /tmp). O_TMPFILE never gives it a name;
+// where the filesystem lacks it, a mkstemp() name is unlinked right away.
+static int openSpoolFile()
+{
+    const char* dir = std::getenv("TMPDIR");
+    if (!dir || !*dir)
+        dir = "/tmp";
+    int fd;
+#ifdef O_TMPFILE
+    fd = ::open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        return fd;
+#endif
+    std::string tmpl = std::string(dir) + "/webserv-body-XXXXXX";
+    fd = ::mkstemp(&tmpl[0]);
+    if (fd < 0)
+        return -1;
+    ::unlink(tmpl.c_str());
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+bool RequestBody::spill()
+{
+    int fd = openSpoolFile();
+    if (fd < 0)
+        return false;
+    if (!writeAll(fd, mem_.data(), mem_.size()))
+    {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return false;
+    }
+    fd_ = fd;
+    std::string().swap(mem_);
+    return true;
+}
+
+void RequestBody::streamTo(BodyConsumer* consumer)
+{
+    delete consumer_;
+    consumer_ = consumer;
+}
+
+bool RequestBody::append(const char* data, size_t len)
+{
+    if (len == 0)
+        return true;
+    if (consumer_)
+    {
+        if (!consumer_->consume(data, len))
+            return false;
+        size_ += len;
+        return true;
+    }
+    if (fd_ < 0 && size_ + len > threshold_ && !spill())
+        return false;
+    if (fd_ >= 0)
+    {
+        if (!writeAll(fd_, data, len))
+            return false;
+    }
+    else
+        mem_.append(data, len);
+    size_ += len;
+    return true;
+}
+
+bool RequestBody::readAll(std::string& out) const
+{
+    if (fd_ < 0)
+    {
+        out = mem_;
+        return true;
+    }
+    out.resize(size_);
+    size_t done = 0;
+    while (done < size_)
+    {
+        ssize_t n = ::pread(fd_, &out[done], size_ - done, static_cast<off_t>(done));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool RequestBody::writeTo(int out_fd) const
+{
+    if (fd_ < 0)
+        return writeAll(out_fd, mem_.data(), mem_.size());
+
+    // pread keeps the spool file's own offset untouched
+    char buf[64 * 1024];
+    off_t off = 0;
+    while (static_cast<size_t>(off) < size_)
+    {
+        ssize_t n = ::pread(fd_, buf, sizeof(buf), off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0 || !writeAll(out_fd, buf, static_cast<size_t>(n)))
+            return false;
+        off += n;
+    }
+    return true;
+}
+
+void RequestBody::swap(RequestBody& other)
+{
+    mem_.swap(other.mem_);
+    std::swap(fd_, other.fd_);
+    std::swap(size_, other.size_);
+    std::swap(threshold_, other.threshold_);
+    std::swap(consumer_, other.consumer_);
+}
@@ -0,0 +1,68 @@
+#ifndef REQUESTBODY_HPP
+#define REQUESTBODY_HPP
+
+#include <cstddef>
+#include <string>
+
+// Takes the bytes of a request body as they are received, in place of
+// RequestBody storing them (a multipart upload parsed on arrival)
+class BodyConsumer {
+public:
+    virtual ~BodyConsumer() {}
+    // false when the bytes cannot be taken (errno set)
+    virtual bool consume(const char* data, size_t len) = 0;
+};
+
+// Body of a request as it is received. Bodies up to the spill threshold
+// (client_body_buffer_size) stay in memory; the append that would go past
+// it moves everything to an unlinked temporary file, so an upload of any
+// size costs one descriptor and a page-cache footprint rather than heap.
+// Readers either get the bytes (data()/readAll()), have them copied to
+// another descriptor (writeTo()) or, when file-backed, take the descriptor
+// itself, e.g. as a CGI's stdin. A body handed to a BodyConsumer is not
+// stored at all.
+class RequestBody {
+public:
+    static const size_t DEFAULT_SPILL_THRESHOLD = 16 * 1024;
+
+    RequestBody();
+    ~RequestBody();
+
+    // Drop the contents, close the spool file and delete the consumer, if any
+    void   reset();
+    void   setSpillThreshold(size_t bytes) { threshold_ = bytes; }
+    // Bytes appended from here on go to consumer (which the body now owns)
+    // and are only counted
+    void   streamTo(BodyConsumer* consumer);
+    BodyConsumer* consumer() const { return consumer_; }
+
+    // false when the spool file could not be created or written (errno set)
+    bool   append(const char* data, size_t len);
+
+    size_t size() const { return size_; }
+    bool   empty() const { return size_ == 0; }
+    bool   inMemory() const { return fd_ < 0; }
+    int    fd() const { return fd_; }                     // -1 when in memory
+    const std::string& data() const { return mem_; }      // in-memory bodies only
+
+    // Whole body as a string, whichever way it is stored
+    bool   readAll(std::string& out) const;
+    // Writes the whole body to out_fd (a file or blocking pipe)
+    bool   writeTo(int out_fd) const;
+
+    void   swap(RequestBody& other);
+
+private:
+    RequestBody(const RequestBody&);
+    RequestBody& operator=(const RequestBody&);
+
+    bool   spill();
+
+    std::string mem_;
+    int         fd_;
+    size_t      size_;
+    size_t      threshold_;
+    BodyConsumer* consumer_;
+};
+
+#endif
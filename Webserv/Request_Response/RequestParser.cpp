@@ -0,0 +1,287 @@
+#include "RequestParser.hpp"
+#include "HttpScan.hpp"
+#include <cstring>
+#include <strings.h>
+
+static bool isWs(char c) { return c == ' ' || c == '\t'; }
+
+// Case-insensitive compare of a buffer slice against a literal
+static bool sliceIs(const char* base, const Slice& s, const char* lit)
+{
+    size_t n = std::strlen(lit);
+    return s.len == n && strncasecmp(base + s.off, lit, n) == 0;
+}
+
+// Perfect hash over the known names: (length + lowercased first letter +
+// 7 * lowercased last letter) & 15 puts each of them in its own bucket, so
+// classifying a name costs one table load and at most one strncasecmp. Keep
+// the table in sync with knownBucket() when adding a name.
+static size_t knownBucket(const char* name, size_t len)
+{
+    return (len + (static_cast<unsigned char>(name[0]) | 0x20) +
+            7 * (static_cast<unsigned char>(name[len - 1]) | 0x20)) & 15;
+}
+
+struct KnownName {
+    const char* name;
+    size_t      len;
+    KnownHeader id;
+};
+
+static const KnownName kKnownNames[16] = {
+    { NULL, 0, HDR_OTHER },
+    { "Accept-Encoding", 15, HDR_ACCEPT_ENCODING },     // 15 + 'a' + 7 * 'g' = 833
+    { "Content-Type", 12, HDR_CONTENT_TYPE },           // 12 + 'c' + 7 * 'e' = 818
+    { "Accept", 6, HDR_ACCEPT },                        //  6 + 'a' + 7 * 't' = 915
+    { "If-Range", 8, HDR_IF_RANGE },                    //  8 + 'i' + 7 * 'e' = 820
+    { NULL, 0, HDR_OTHER },
+    { "Transfer-Encoding", 17, HDR_TRANSFER_ENCODING }, // 17 + 't' + 7 * 'g' = 854
+    { "Expect", 6, HDR_EXPECT },                        //  6 + 'e' + 7 * 't' = 919
+    { "Host", 4, HDR_HOST },                            //  4 + 'h' + 7 * 't' = 920
+    { "Content-Length", 14, HDR_CONTENT_LENGTH },       // 14 + 'c' + 7 * 'h' = 841
+    { "Range", 5, HDR_RANGE },                          //  5 + 'r' + 7 * 'e' = 826
+    { NULL, 0, HDR_OTHER },
+    { NULL, 0, HDR_OTHER },
+    { "If-Modified-Since", 17, HDR_IF_MODIFIED_SINCE }, // 17 + 'i' + 7 * 'e' = 829
+    { "If-None-Match", 13, HDR_IF_NONE_MATCH },         // 13 + 'i' + 7 * 'h' = 846
+    { "Connection", 10, HDR_CONNECTION },               // 10 + 'c' + 7 * 'n' = 879
+};
+
+KnownHeader RequestParser::classify(const char* name, size_t len)
+{
+    if (len == 0)
+        return HDR_OTHER;
+    const KnownName& k = kKnownNames[knownBucket(name, len)];
+    if (k.len == len && strncasecmp(name, k.name, len) == 0)
+        return k.id;
+    return HDR_OTHER;
+}
+
+RequestParser::RequestParser()
+{
+    reset();
+}
+
+void RequestParser::reset()
+{
+    state_ = S_REQUEST_LINE;
+    pos_ = 0;
+    scan_ = 0;
+    head_bytes_ = 0;
+    method_ = Slice();
+    target_ = Slice();
+    version_ = Slice();
+    headers_.clear();
+    for (int i = 0; i < HDR_COUNT; ++i)
+        known_[i] = -1;
+    content_length_ = 0;
+    cl_count_ = 0;
+    chunked_ = false;
+    error_code_ = 0;
+    error_ = "";
+}
+
+RequestParser::Status RequestParser::fail(int code, const char* why)
+{
+    state_ = S_ERROR;
+    error_code_ = code;
+    error_ = why;
+    return PARSE_ERROR;
+}
+
+RequestParser::Status RequestParser::parse(const std::string& buf)
+{
+    if (state_ == S_DONE)
+        return PARSE_DONE;
+    if (state_ == S_ERROR)
+        return PARSE_ERROR;
+
+    const char* base = buf.data();
+    const size_t size = buf.size();
+
+    while (scan_ < size)
+    {
+        // One pass finds the line end and rejects control bytes in the head
+        size_t end = scan_ + scan::lineStop(base + scan_, size - scan_);
+        if (end == size)
+        {
+            scan_ = size;
+            break;
+        }
+        if (base[end] == '\r')
+        {
+            if (end + 1 == size)
+            {
+                scan_ = end;   // its '\n' has not arrived yet
+                break;
+            }
+            if (base[end + 1] != '\n')
+                return fail(400, "Bare CR in request head");
+            ++end;
+        }
+        else if (base[end] != '\n')
+            return fail(400, "Control character in request head");
+        // end is now the index of '\n'
+        if (end >= MAX_HEAD_BYTES)
+            return fail(431, "Request head too large");
+        size_t len = end - pos_;
+        if (len > 0 && base[end - 1] == '\r')
+            --len;
+        size_t line = pos_;
+        pos_ = scan_ = end + 1;
+
+        if (state_ == S_REQUEST_LINE)
+        {
+            if (len == 0)
+                continue; // stray CRLF between pipelined requests
+            if (!parseRequestLine(base, line, len))
+                return PARSE_ERROR;
+            state_ = S_HEADERS;
+        }
+        else if (len == 0)
+        {
+            state_ = S_DONE;
+            head_bytes_ = pos_;
+            if (cl_count_ > 1)
+                return fail(400, "Multiple Content-Length headers");
+            return PARSE_DONE;
+        }
+        else if (!parseHeaderLine(base, line, len))
+            return PARSE_ERROR;
+    }
+
+    if (scan_ >= MAX_HEAD_BYTES)
+        return fail(431, "Request head too large");
+    return PARSE_NEED_MORE;
+}
+
+// METHOD SP request-target SP HTTP/x.y
+bool RequestParser::parseRequestLine(const char* base, size_t off, size_t len)
+{
+    Slice parts[3];
+    size_t n = 0;
+    size_t i = off, end = off + len;
+    while (i < end)
+    {
+        while (i < end && isWs(base[i]))
+            ++i;
+        if (i == end)
+            break;
+        size_t start = i;
+        while (i < end && !isWs(base[i]))
+            ++i;
+        if (n == 3)
+        {
+            fail(400, "Malformed request line");
+            return false;
+        }
+        parts[n++] = Slice(start, i - start);
+    }
+    if (n != 3)
+    {
+        fail(400, "Malformed request line");
+        return false;
+    }
+    method_ = parts[0];
+    target_ = parts[1];
+    version_ = parts[2];
+    if (!scan::isToken(base + method_.off, method_.len))
+    {
+        fail(400, "Invalid method");
+        return false;
+    }
+
+    const char* v = base + version_.off;
+    if (version_.len != 8 || std::memcmp(v, "HTTP/", 5) != 0 || v[6] != '.' ||
+        v[5] < '0' || v[5] > '9' || v[7] < '0' || v[7] > '9')
+    {
+        fail(400, "Invalid HTTP version");
+        return false;
+    }
+    if (v[5] != '1' || v[7] != '1')
+    {
+        fail(505, "HTTP Version Not Supported");
+        return false;
+    }
+    return true;
+}
+
+// name ":" OWS value OWS
+bool RequestParser::parseHeaderLine(const char* base, size_t off, size_t len)
+{
+    if (isWs(base[off]))
+    {
+        fail(400, "Obsolete header line folding");
+        return false;
+    }
+    const char* colon = static_cast<const char*>(std::memchr(base + off, ':', len));
+    if (!colon)
+    {
+        fail(400, "Malformed header line (missing colon)");
+        return false;
+    }
+
+    size_t name_end = static_cast<size_t>(colon - base);
+    while (name_end > off && isWs(base[name_end - 1]))
+        --name_end;
+    if (name_end == off)
+    {
+        fail(400, "Malformed header line (empty key)");
+        return false;
+    }
+    if (!scan::isToken(base + off, name_end - off))
+    {
+        fail(400, "Invalid header name");
+        return false;
+    }
+
+    size_t v = static_cast<size_t>(colon - base) + 1;
+    size_t v_end = off + len;
+    while (v < v_end && isWs(base[v]))
+        ++v;
+    while (v_end > v && isWs(base[v_end - 1]))
+        --v_end;
+
+    HeaderSlice h;
+    h.name = Slice(off, name_end - off);
+    h.value = Slice(v, v_end - v);
+    headers_.push_back(h);
+
+    KnownHeader id = classify(base + h.name.off, h.name.len);
+    if (id == HDR_OTHER)
+        return true;
+    known_[id] = static_cast<int>(headers_.size() - 1);
+
+    // Fields that decide how the body is framed are interpreted right away
+    if (id == HDR_CONTENT_LENGTH)
+    {
+        ++cl_count_;
+        if (h.value.len == 0 || h.value.len > 15)
+        {
+            fail(400, "Invalid or too large Content-Length value");
+            return false;
+        }
+        long n = 0;
+        for (size_t i = h.value.off; i < h.value.off + h.value.len; ++i)
+        {
+            if (base[i] < '0' || base[i] > '9')
+            {
+                fail(400, "Invalid or too large Content-Length value");
+                return false;
+            }
+            n = n * 10 + (base[i] - '0');
+        }
+        content_length_ = n;
+    }
+    else if (id == HDR_TRANSFER_ENCODING)
+    {
+        // Only a single "chunked" coding is supported
+        if (!sliceIs(base, h.value, "chunked"))
+        {
+            fail(501, "Unsupported Transfer-Encoding");
+            return false;
+        }
+        chunked_ = true;
+    }
+    return true;
+}
@@ -0,0 +1,110 @@
+#ifndef REQUESTPARSER_HPP
+#define REQUESTPARSER_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// A piece of the connection's receive buffer: [off, off + len)
+struct Slice {
+    size_t off;
+    size_t len;
+
+    Slice() : off(0), len(0) {}
+    Slice(size_t o, size_t l) : off(o), len(l) {}
+};
+
+struct HeaderSlice {
+    Slice name;
+    Slice value;   // surrounding whitespace already trimmed
+};
+
+// Header fields the server consults. The parser resolves them to a slot
+// while parsing, so looking one up later is a single array index.
+enum KnownHeader {
+    HDR_HOST,
+    HDR_CONTENT_LENGTH,
+    HDR_TRANSFER_ENCODING,
+    HDR_CONNECTION,
+    HDR_EXPECT,
+    HDR_ACCEPT,
+    HDR_CONTENT_TYPE,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_ACCEPT_ENCODING,
+    HDR_COUNT,
+    HDR_OTHER = HDR_COUNT
+};
+
+// Resumable parser for a request head (request line + header fields).
+// It is fed the connection's read buffer after every read and continues
+// where the previous call stopped, so each byte is scanned once and each
+// line is parsed once. Results are offsets into that buffer; nothing is
+// copied. The buffer may grow between calls, but bytes before the current
+// request must not move until reset().
+class RequestParser {
+public:
+    enum Status {
+        PARSE_NEED_MORE,   // head incomplete, call again after the next read
+        PARSE_DONE,        // head complete: accessors below are valid
+        PARSE_ERROR        // malformed: errorCode()/errorText() say why
+    };
+
+    // Heads larger than this are rejected with 431
+    static const size_t MAX_HEAD_BYTES = 64 * 1024;
+
+    RequestParser();
+
+    // Forget the current request; the next one starts at buffer offset 0
+    void   reset();
+    Status parse(const std::string& buf);
+    bool   inProgress() const { return state_ != S_REQUEST_LINE || pos_ != 0; }
+
+    size_t headBytes() const { return head_bytes_; }
+    const Slice& method() const { return method_; }
+    const Slice& target() const { return target_; }
+    const Slice& version() const { return version_; }
+    const std::vector<HeaderSlice>& headers() const { return headers_; }
+    // Last occurrence of a known field, or NULL when the request has none
+    const HeaderSlice* header(KnownHeader id) const
+    { return known_[id] < 0 ? NULL : &headers_[known_[id]]; }
+
+    // Which known field a name is (case-insensitive), or HDR_OTHER
+    static KnownHeader classify(const char* name, size_t len);
+
+    bool   hasContentLength() const { return cl_count_ > 0; }
+    long   contentLength() const { return content_length_; }
+    bool   isChunked() const { return chunked_; }
+
+    int         errorCode() const { return error_code_; }
+    const char* errorText() const { return error_; }
+
+private:
+    enum State { S_REQUEST_LINE, S_HEADERS, S_DONE, S_ERROR };
+
+    Status fail(int code, const char* why);
+    bool   parseRequestLine(const char* base, size_t off, size_t len);
+    bool   parseHeaderLine(const char* base, size_t off, size_t len);
+
+    State  state_;
+    size_t pos_;        // start of the first line not parsed yet
+    size_t scan_;       // where the search for its '\n' resumes
+    size_t head_bytes_;
+
+    Slice  method_;
+    Slice  target_;
+    Slice  version_;
+    std::vector<HeaderSlice> headers_;
+    int    known_[HDR_COUNT];   // index into headers_, -1 when absent
+
+    long   content_length_;
+    int    cl_count_;
+    bool   chunked_;
+
+    int         error_code_;
+    const char* error_;
+};
+
+#endif
@@ -13,6 +13,13 @@ static std::map<int, std::string> createStatusMessages() {
     messages[200] = "OK";
     messages[201] = "Created";
     messages[204] = "No Content";
+    messages[206] = "Partial Content";
+    messages[304] = "Not Modified";
+    messages[301] = "Moved Permanently";
+    messages[302] = "Found";
+    messages[303] = "See Other";
+    messages[307] = "Temporary Redirect";
+    messages[308] = "Permanent Redirect";
     messages[400] = "Bad Request";
     messages[401] = "Unauthorized";
     messages[403] = "Forbidden";
@@ -21,6 +28,9 @@ static std::map<int, std::string> createStatusMessages() {
     messages[408] = "Request Timeout";
     messages[411] = "Length Required";
     messages[413] = "Payload Too Large";
+    messages[414] = "URI Too Long";
+    messages[416] = "Range Not Satisfiable";
+    messages[431] = "Request Header Fields Too Large";
     messages[500] = "Internal Server Error";
     messages[501] = "Not Implemented";
     messages[502] = "Bad Gateway";
@@ -137,9 +147,10 @@ std::map<std::string, std::string> redirect_headers(const std::string& url) {
     return m;
 }
 
-void Response::applyConnectionHeaders(bool keepAlive) {
+// maxRequests: how many more requests the connection will accept
+void Response::applyConnectionHeaders(bool keepAlive, int timeoutSec, int maxRequests) {
     setHeader("Connection", keepAlive ? "keep-alive" : "close");
     if (keepAlive) {
-        setHeader("Keep-Alive", "timeout=5, max=100");
+        setHeader("Keep-Alive", "timeout=" + to_str(timeoutSec) + ", max=" + to_str(maxRequests));
     }
 }
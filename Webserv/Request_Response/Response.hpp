@@ -19,7 +19,7 @@ public:
     void setHeader(const std::string& key, const std::string& value);
     void setBody(const std::string& body);
     std::string toString() const;
-    void applyConnectionHeaders(bool keepAlive);
+    void applyConnectionHeaders(bool keepAlive, int timeoutSec, int maxRequests);
 
     // New helpers
     static std::string getStatusMessage(int code);
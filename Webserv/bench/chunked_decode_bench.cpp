@@ -0,0 +1,299 @@
+// Chunked request bodies: the resumable ChunkedDecoder against the path it
+// replaced, which on every read rescanned the body from its first byte with
+// find_chunked_terminator() and, once the terminator showed up, decoded the
+// whole body again through istringstream in decode_chunked_body().
+//
+//   make bench
+//
+// The body arrives in 64 KiB reads, as the event loop hands it over. Both
+// paths must decode every sample to the same bytes before timing. The old
+// path also rejected any chunked body more than 1000 bytes past the head;
+// that cutoff is left out here so the algorithms can be compared at all.
+
+#include "ChunkedDecoder.hpp"
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/time.h>
+
+namespace {
+
+volatile long g_sink; // keeps the decode loops from being optimised away
+
+double nowSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+const size_t READ_SIZE = 64 * 1024;
+
+// --- The previous path, copied from utils/utils.cpp ---
+namespace legacy {
+
+#define CHUNKED_ERROR_MARKER (static_cast<size_t>(-2))
+
+size_t find_chunked_terminator(const std::string& buf, size_t body_start) {
+    size_t pos = body_start;
+    
+    while (pos < buf.size()) {
+        // Find the next chunk size line
+        size_t line_end = buf.find("\r\n", pos);
+        if (line_end == std::string::npos) {
+            return std::string::npos; // need more data
+        }
+        
+        // Extract chunk size line
+        std::string chunk_line = buf.substr(pos, line_end - pos);
+        
+        // Parse chunk size (ignore chunk extensions after semicolon)
+        size_t semicolon_pos = chunk_line.find(';');
+        if (semicolon_pos != std::string::npos) {
+            chunk_line = chunk_line.substr(0, semicolon_pos);
+        }
+        
+        // Convert hex chunk size - validate it's proper hex
+        size_t chunk_size = 0;
+        
+        // Check for unreasonably long chunk size lines (security measure)
+        if (chunk_line.size() > 16) { // Max 16 hex digits is reasonable (2^64)
+            return CHUNKED_ERROR_MARKER;
+        }
+        
+        // Define a reasonable maximum for chunk size to prevent overflow
+        const size_t MAX_CHUNK_SIZE = static_cast<size_t>(-1) / 16; // SIZE_MAX / 16 in C++98
+        
+        for (size_t i = 0; i < chunk_line.size(); ++i) {
+            char c = chunk_line[i];
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
+                // Check for potential overflow before multiplication
+                if (chunk_size > MAX_CHUNK_SIZE) {
+                    return CHUNKED_ERROR_MARKER; // Would overflow
+                }
+                
+                size_t old_size = chunk_size;
+                chunk_size = chunk_size * 16;
+                
+                if (c >= '0' && c <= '9') chunk_size += (c - '0');
+                else if (c >= 'a' && c <= 'f') chunk_size += (c - 'a' + 10);
+                else chunk_size += (c - 'A' + 10);
+                
+                // Additional overflow check
+                if (chunk_size < old_size) {
+                    return CHUNKED_ERROR_MARKER; // Overflow detected
+                }
+            } else if (c == ' ' || c == '\t') {
+                // Skip whitespace
+                continue;
+            } else {
+                // Invalid hex character
+                return CHUNKED_ERROR_MARKER;
+            }
+        }
+        
+        // If chunk size is 0, this is the final chunk
+        if (chunk_size == 0) {
+            // Look for the final \r\n\r\n after possible trailing headers
+            size_t final_pos = line_end + 2; // after chunk size line
+            
+            // Skip any trailing headers
+            while (final_pos < buf.size()) {
+                size_t header_end = buf.find("\r\n", final_pos);
+                if (header_end == std::string::npos) {
+                    return std::string::npos; // need more data
+                }
+                
+                // If we found an empty line, we're done
+                if (header_end == final_pos) {
+                    return header_end + 2; // return position after final \r\n
+                }
+                
+                final_pos = header_end + 2;
+            }
+            return std::string::npos; // need more data for final \r\n
+        }
+        
+        // Calculate where this chunk's data should end
+        size_t chunk_data_start = line_end + 2;
+        size_t chunk_data_end = chunk_data_start + chunk_size;
+        size_t chunk_end_with_crlf = chunk_data_end + 2; // + \r\n after data
+        
+        // Check if we have enough data for this chunk
+        if (chunk_end_with_crlf > buf.size()) {
+            return std::string::npos; // need more data
+        }
+        
+        // Validate that the chunk data is followed by \r\n
+        if (buf.substr(chunk_data_end, 2) != "\r\n") {
+            return CHUNKED_ERROR_MARKER; // malformed - chunk size doesn't match data
+        }
+        
+        // Move to the next chunk
+        pos = chunk_end_with_crlf;
+    }
+    
+    return std::string::npos; // need more data
+}
+
+std::string decode_chunked_body(const std::string& raw) {
+    std::istringstream in(raw);
+    std::string decoded;
+    std::string line;
+    bool first_line = true;
+    while (true) {
+        // Read chunk size line
+        if (!std::getline(in, line))
+            throw std::runtime_error("400: Malformed chunked body (missing chunk size line)");
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        // Ignore chunk extensions
+        size_t semi = line.find(';');
+        std::string size_str = (semi == std::string::npos) ? line : line.substr(0, semi);
+        size_str.erase(0, size_str.find_first_not_of(" \t"));
+        size_str.erase(size_str.find_last_not_of(" \t") + 1);
+        if (size_str.empty())
+            throw std::runtime_error("400: Malformed chunked body (empty chunk size)");
+        int chunk_size = 0;
+        std::istringstream iss;
+        iss.str(size_str);
+        iss >> std::hex >> chunk_size;
+        if (iss.fail() || chunk_size < 0) {
+            if (first_line) {
+                throw std::runtime_error("400: Malformed chunked body (body does not start with valid chunk size line)");
+            } else {
+                throw std::runtime_error("400: Malformed chunked body (invalid chunk size)");
+            }
+        }
+        first_line = false;
+        if (chunk_size == 0) {
+            // Last chunk, expect CRLF after
+            if (!std::getline(in, line))
+                throw std::runtime_error("400: Malformed chunked body (missing final CRLF)");
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            if (!line.empty())
+                throw std::runtime_error("400: Malformed chunked body (extra data after last chunk)");
+            break;
+        }
+        // Read chunk data
+        std::string chunk(chunk_size, '\0');
+        in.read(&chunk[0], chunk_size);
+        if (in.gcount() != chunk_size)
+            throw std::runtime_error("400: Malformed chunked body (incomplete chunk data)");
+        decoded += chunk;
+        // Expect CRLF after chunk data
+        if (!std::getline(in, line))
+            throw std::runtime_error("400: Malformed chunked body (missing CRLF after chunk data)");
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty())
+            throw std::runtime_error("400: Malformed chunked body (extra data after chunk data)");
+    }
+    // If any data remains, it's a malformed chunked body
+    if (in.peek() != EOF) {
+        std::string extra;
+        std::getline(in, extra);
+        if (!extra.empty())
+            throw std::runtime_error("400: Malformed chunked body (unexpected data after last chunk)");
+    }
+    return decoded;
+}
+
+// Every read: look for the terminator from the start of the body; decode once found
+std::string receive(const std::string& wire)
+{
+    std::string buffer;
+    for (size_t off = 0; off < wire.size(); off += READ_SIZE) {
+        buffer.append(wire, off, READ_SIZE);
+        size_t needed = find_chunked_terminator(buffer, 0);
+        if (needed == CHUNKED_ERROR_MARKER)
+            throw std::runtime_error("malformed");
+        if (needed != std::string::npos)
+            return decode_chunked_body(buffer.substr(0, needed));
+    }
+    throw std::runtime_error("body never completed");
+}
+
+} // namespace legacy
+
+// Every read: decode the new bytes into the body and drop them from the buffer
+std::string receive(const std::string& wire)
+{
+    ChunkedDecoder dec;
+    std::string buffer;
+    RequestBody body;
+    body.setSpillThreshold(static_cast<size_t>(-1)); // in memory, like the old path
+    for (size_t off = 0; off < wire.size(); off += READ_SIZE) {
+        buffer.append(wire, off, READ_SIZE);
+        size_t consumed = 0;
+        ChunkedDecoder::Status st = dec.decode(buffer.data(), buffer.size(), body,
+                                               static_cast<size_t>(-1), consumed);
+        buffer.erase(0, consumed);
+        if (st == ChunkedDecoder::CHUNK_ERROR)
+            throw std::runtime_error(dec.errorText());
+        if (st == ChunkedDecoder::CHUNK_DONE)
+            return body.data();
+    }
+    throw std::runtime_error("body never completed");
+}
+
+// total bytes of payload in chunks of chunk_size (a client streaming a file)
+std::string encode(size_t total, size_t chunk_size)
+{
+    std::string wire;
+    for (size_t done = 0; done < total; ) {
+        size_t n = total - done < chunk_size ? total - done : chunk_size;
+        char line[32];
+        std::snprintf(line, sizeof(line), "%lx\r\n", (unsigned long)n);
+        wire += line;
+        for (size_t i = 0; i < n; ++i)
+            wire += static_cast<char>('a' + (done + i) % 26);
+        wire += "\r\n";
+        done += n;
+    }
+    return wire + "0\r\n\r\n";
+}
+
+void run(size_t total, size_t chunk_size, int iters)
+{
+    const std::string wire = encode(total, chunk_size);
+    if (legacy::receive(wire) != receive(wire)) {
+        std::printf("MISMATCH %lu bytes in chunks of %lu\n", (unsigned long)total, (unsigned long)chunk_size);
+        throw std::runtime_error("mismatch");
+    }
+    long sink = 0;
+
+    double t0 = nowSec();
+    for (int i = 0; i < iters; ++i)
+        sink += legacy::receive(wire).size();
+    double t_legacy = nowSec() - t0;
+
+    t0 = nowSec();
+    for (int i = 0; i < iters; ++i)
+        sink += receive(wire).size();
+    double t_decoder = nowSec() - t0;
+    g_sink = sink;
+
+    double mb = double(wire.size()) * iters / (1024.0 * 1024.0);
+    std::printf("  %6lu KiB body, %6lu B chunks   legacy %8.1f MB/s   decoder %8.1f MB/s   x%.1f\n",
+                (unsigned long)(total / 1024), (unsigned long)chunk_size,
+                mb / t_legacy, mb / t_decoder, t_legacy / t_decoder);
+}
+
+} // namespace
+
+int main()
+{
+    std::printf("chunked_decode_bench: rescan + istringstream decode vs ChunkedDecoder\n");
+    try {
+        run(64 * 1024, 4096, 200);
+        run(1024 * 1024, 4096, 20);
+        run(1024 * 1024, 64 * 1024, 20);
+        run(8 * 1024 * 1024, 64 * 1024, 3);
+    } catch (const std::exception&) {
+        return 1;
+    }
+    return 0;
+}
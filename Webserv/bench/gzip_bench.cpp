@@ -0,0 +1,233 @@
+// gzip content coding (server/Gzip): compression ratio and speed per level
+// on the site's own text files, and the streamed path of the WriteQueue
+// (a file compressed piece by piece into chunks) checked end to end.
+//
+//   make bench
+//
+// The streamed file goes through a socketpair; the reader undoes the
+// chunked framing and inflates, and the result must equal the file. The same
+// holds behind a partly sent head, through a send buffer small enough to cut
+// every writev() short. A queue that loses count can spin inside flush(), so
+// an alarm turns a hang into a failure.
+
+#include "Gzip.hpp"
+#include "WriteQueue.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace {
+
+double nowSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+bool readFile(const char* path, std::string& out)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    char buf[65536];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        out.append(buf, static_cast<size_t>(n));
+    close(fd);
+    return true;
+}
+
+bool gunzip(const std::string& in, std::string& out)
+{
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = static_cast<uInt>(in.size());
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return false;
+    char buf[65536];
+    int rc;
+    do
+    {
+        zs.next_out = reinterpret_cast<Bytef*>(buf);
+        zs.avail_out = sizeof(buf);
+        rc = inflate(&zs, Z_NO_FLUSH);
+        out.append(buf, sizeof(buf) - zs.avail_out);
+    } while (rc == Z_OK);
+    inflateEnd(&zs);
+    return rc == Z_STREAM_END;
+}
+
+// Undoes chunked framing up to the last chunk; false if malformed
+bool unchunk(const std::string& in, std::string& out)
+{
+    size_t pos = 0;
+    for (;;)
+    {
+        size_t eol = in.find("\r\n", pos);
+        if (eol == std::string::npos)
+            return false;
+        unsigned long n = std::strtoul(in.c_str() + pos, NULL, 16);
+        pos = eol + 2;
+        if (n == 0)
+            return in.compare(pos, std::string::npos, "\r\n") == 0;
+        if (pos + n + 2 > in.size())
+            return false;
+        out.append(in, pos, n);
+        pos += n + 2;
+    }
+}
+
+// An unlinked temporary file holding text; -1 on failure
+int tempFile(const std::string& text)
+{
+    char path[] = "/tmp/gzip_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size()))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Flushes q into a socketpair until it drains, reading the other end as it
+// goes; false on a flush error
+bool drain(WriteQueue& q, std::string& wire, int sndbuf)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+        return false;
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    if (sndbuf > 0)
+        setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    char buf[65536];
+    bool ok = true;
+    while (!q.empty())
+    {
+        size_t written;
+        if (q.flush(sv[0], written) == WriteQueue::FLUSH_ERROR)
+        {
+            ok = false;
+            break;
+        }
+        ssize_t n;
+        while ((n = read(sv[1], buf, sizeof(buf))) > 0)
+            wire.append(buf, static_cast<size_t>(n));
+    }
+    close(sv[0]);
+    close(sv[1]);
+    return ok;
+}
+
+// A large text file through WriteQueue::appendGzipFile and a socketpair
+bool streamedRoundTrip(const std::string& text, double& mbps)
+{
+    int fd = tempFile(text);
+    if (fd < 0)
+        return false;
+    WriteQueue q;
+    q.appendGzipFile(fd, 0, text.size(), 1);
+    std::string wire;
+    double t0 = nowSec();
+    if (!drain(q, wire, 0))
+        return false;
+    double t1 = nowSec();
+    mbps = text.size() / (t1 - t0) / 1e6;
+
+    std::string gz, plain;
+    return unchunk(wire, gz) && gunzip(gz, plain) && plain == text;
+}
+
+// A gzip segment left empty behind a batch of memory segments (writev()
+// takes at most 64) is only refilled after the head of that batch went out
+// partly: the refill must not disturb the head's send offset
+bool partialHeadThenRefill(const std::string& text)
+{
+    int fd = tempFile(text);
+    if (fd < 0)
+        return false;
+    WriteQueue q;
+    std::string expect;
+    for (int k = 0; k < 70; ++k)
+    {
+        std::string seg(5000, static_cast<char>('a' + k % 26));
+        q.append(seg);
+        expect += seg;
+    }
+    q.appendGzipFile(fd, 0, text.size(), 1);
+    std::string wire;
+    if (!drain(q, wire, 4096) || wire.compare(0, expect.size(), expect) != 0)
+        return false;
+    std::string gz, plain;
+    return unchunk(wire.substr(expect.size()), gz) && gunzip(gz, plain) && plain == text;
+}
+
+} // namespace
+
+int main()
+{
+    alarm(60);
+    const char* files[] = { "www/index.html", "www/feature-methods-demo.html",
+                            "www/scripts/feature-photobook.js", "www/styles/feature-error-codes.css" };
+    std::string corpus;
+    for (size_t f = 0; f < sizeof(files) / sizeof(files[0]); ++f)
+        readFile(files[f], corpus);
+    if (corpus.empty())
+    {
+        std::printf("gzip_bench: no www files (run from the project root)\n");
+        return 1;
+    }
+
+    std::printf("gzip_bench: %lu bytes of site HTML/JS/CSS\n", static_cast<unsigned long>(corpus.size()));
+    const int ROUNDS = 50;
+    for (int level = 1; level <= 9; level += 4)
+    {
+        std::string out;
+        double t0 = nowSec();
+        for (int r = 0; r < ROUNDS; ++r)
+        {
+            out.clear();
+            gzipString(corpus, level, out);
+        }
+        double t1 = nowSec();
+        std::string back;
+        if (!gunzip(out, back) || back != corpus)
+        {
+            std::printf("FAIL: level %d does not round-trip\n", level);
+            return 1;
+        }
+        std::printf("  level %d  %6lu bytes (%.1fx)  %7.1f MB/s\n", level, static_cast<unsigned long>(out.size()),
+                    static_cast<double>(corpus.size()) / out.size(), corpus.size() * ROUNDS / (t1 - t0) / 1e6);
+    }
+
+    std::string big;
+    while (big.size() < 8 * 1024 * 1024)
+        big += corpus;
+    double mbps;
+    if (!streamedRoundTrip(big, mbps))
+    {
+        std::printf("FAIL: streamed gzip does not round-trip\n");
+        return 1;
+    }
+    std::printf("  streamed %lu MiB through WriteQueue at level 1: %.1f MB/s\n",
+                static_cast<unsigned long>(big.size() >> 20), mbps);
+    if (!partialHeadThenRefill(corpus))
+    {
+        std::printf("FAIL: refill behind a partly sent segment corrupts the stream\n");
+        return 1;
+    }
+    std::printf("  gzip refill behind a partly sent head: ok\n");
+    return 0;
+}
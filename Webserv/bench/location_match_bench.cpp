@@ -0,0 +1,193 @@
+// Location matching: the radix-tree LocationRouter (config/) against the
+// linear match_location() it replaced.
+//
+//   make bench
+//
+// A differential pass builds random location sets (nested paths, "/", empty
+// and trailing-slash paths, duplicates, prefixes that stop mid-segment) and
+// requires the router to pick the same location and strip the same prefix as
+// the old code for random request paths. Lookups are then timed for growing
+// numbers of locations.
+
+#include "LocationRouter.hpp"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+namespace {
+
+volatile long g_sink; // keeps the timed loops from being optimised away
+
+double nowSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned g_seed = 12345;
+unsigned rnd()
+{
+    g_seed = g_seed * 1103515245u + 12345u;
+    return g_seed >> 8;
+}
+
+// The former utils.cpp match_location(), verbatim apart from returning an index
+int linearMatch(const std::vector<LocationConfig>& locations, const std::string& path)
+{
+    int best = -1;
+    size_t bestLen = 0;
+
+    for (size_t i = 0; i < locations.size(); ++i) {
+        const std::string& loc = locations[i].path;
+        if (path.compare(0, loc.length(), loc) != 0)
+            continue;
+        if (path.length() > loc.length() && loc != "/" && path[loc.length()] != '/')
+            continue;
+        if (loc.length() > bestLen) {
+            bestLen = loc.length();
+            best = static_cast<int>(i);
+        }
+    }
+    return best;
+}
+
+// The prefix stripping the former resolve_path() did after match_location()
+std::string linearRelative(const std::vector<LocationConfig>& locations, int idx, const std::string& path)
+{
+    std::string rel = path;
+    if (idx >= 0 && locations[idx].path != "/" && rel.find(locations[idx].path) == 0)
+        rel = rel.substr(locations[idx].path.length());
+    if (!rel.empty() && rel[0] == '/')
+        rel = rel.substr(1);
+    return rel;
+}
+
+const char* const SEGMENTS[] = { "api", "apx", "a", "static", "img", "images", "v1", "v2",
+                                 "upload", "cgi-bin", "docs", "d", "users", "u" };
+const size_t NSEG = sizeof(SEGMENTS) / sizeof(SEGMENTS[0]);
+
+std::string randomPath(size_t maxDepth)
+{
+    std::string p;
+    size_t depth = 1 + rnd() % maxDepth;
+    for (size_t i = 0; i < depth; ++i)
+    {
+        p += "/";
+        p += SEGMENTS[rnd() % NSEG];
+    }
+    unsigned r = rnd() % 10;
+    if (r == 0)
+        p += "/";                                     // trailing slash
+    else if (r == 1)
+        p.erase(p.size() - 1 - rnd() % 2);           // stops mid-segment
+    return p;
+}
+
+std::vector<LocationConfig> randomLocations(size_t n)
+{
+    std::vector<LocationConfig> locs;
+    for (size_t i = 0; i < n; ++i)
+    {
+        LocationConfig l;
+        unsigned r = rnd() % 40;
+        if (r == 0)
+            l.path = "/";
+        else if (r == 1)
+            l.path = "";
+        else if (r == 2 && !locs.empty())
+            l.path = locs[rnd() % locs.size()].path;  // duplicate
+        else
+            l.path = randomPath(4);
+        locs.push_back(l);
+    }
+    return locs;
+}
+
+void differential()
+{
+    long cases = 0;
+    for (int set = 0; set < 2000; ++set)
+    {
+        std::vector<LocationConfig> locs = randomLocations(rnd() % 60);
+        LocationRouter router;
+        router.build(locs);
+        for (int q = 0; q < 200; ++q)
+        {
+            std::string path = rnd() % 20 ? randomPath(6) : (rnd() % 2 ? "/" : "");
+            if (rnd() % 4 == 0)
+                path += "/file.html";
+            size_t rel;
+            int got = router.match(path, rel);
+            int want = linearMatch(locs, path);
+            if (got != want || path.substr(rel) != linearRelative(locs, want, path))
+            {
+                std::printf("MISMATCH for \"%s\": router %d rel \"%s\", linear %d rel \"%s\"\n",
+                            path.c_str(), got, path.substr(rel).c_str(), want,
+                            linearRelative(locs, want, path).c_str());
+                throw std::runtime_error("mismatch");
+            }
+            ++cases;
+        }
+    }
+    std::printf("  differential: %ld lookups agree with the linear matcher\n", cases);
+}
+
+void timings()
+{
+    const size_t sizes[] = { 4, 16, 64, 256, 1024 };
+    std::vector<std::string> paths;
+    for (int i = 0; i < 1024; ++i)
+        paths.push_back(randomPath(6) + "/index.html");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+        std::vector<LocationConfig> locs;
+        LocationConfig root;
+        root.path = "/";
+        locs.push_back(root);
+        while (locs.size() < sizes[s])
+        {
+            LocationConfig l;
+            l.path = randomPath(4);
+            locs.push_back(l);
+        }
+        LocationRouter router;
+        router.build(locs);
+
+        const int iters = static_cast<int>(4000000 / (sizes[s] + 16));
+        long sink = 0;
+        double t0 = nowSec();
+        for (int i = 0; i < iters; ++i)
+            sink += linearMatch(locs, paths[i & 1023]);
+        double linear = (nowSec() - t0) * 1e9 / iters;
+
+        t0 = nowSec();
+        for (int i = 0; i < iters; ++i)
+        {
+            size_t rel;
+            sink += router.match(paths[i & 1023], rel) + static_cast<long>(rel);
+        }
+        double trie = (nowSec() - t0) * 1e9 / iters;
+        g_sink = sink;
+        std::printf("  %5lu locations: linear %8.1f ns   router %6.1f ns\n",
+                    (unsigned long)sizes[s], linear, trie);
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::printf("location_match_bench: LocationRouter vs linear match_location\n");
+    try {
+        differential();
+        timings();
+    } catch (const std::exception& e) {
+        std::printf("%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,246 @@
+// Multipart uploads: the streaming MultipartParser against the code it
+// replaced, extract_multipart_file_raw(), which needed the whole body in one
+// string, searched it with std::string::find and copied out only the first
+// file part.
+//
+//   make bench
+//
+// Before timing, the parser is fed every sample in blocks of 1, 7, 64 bytes
+// and 64 KiB, and must return every part exactly as generated (the first one
+// also matching the old extractor). File contents are seeded with partial
+// delimiters ("\r\n--" plus a prefix of the boundary) so that matches
+// straddling block edges get exercised.
+
+#include "MultipartParser.hpp"
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+namespace {
+
+volatile long g_sink; // keeps the parse loops from being optimised away
+
+double nowSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+const std::string BOUNDARY = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+
+// --- The previous extractor, copied from utils/utils.cpp (filename
+// sanitising left out) ---
+namespace legacy {
+
+bool extract_multipart_file_raw(const std::string& body,
+                                       const std::string& boundary,
+                                       std::string& outFilename,
+                                       std::string& outContent)
+{
+    if (boundary.empty()) return false;
+
+    const std::string dashBoundary = std::string("--") + boundary;
+    const std::string CRLF = "\r\n";
+
+    // Find first boundary line
+    size_t pos = body.find(dashBoundary + CRLF);
+    if (pos == std::string::npos) return false;
+    pos += dashBoundary.size() + CRLF.size();
+
+    while (true) {
+        // Find headers end
+        size_t headersEnd = body.find(CRLF + CRLF, pos);
+        if (headersEnd == std::string::npos) return false;
+
+        std::string headers = body.substr(pos, headersEnd - pos);
+
+        // Parse filename from Content-Disposition
+        std::string filename;
+        size_t cd = headers.find("Content-Disposition:");
+        if (cd != std::string::npos) {
+            size_t fn = headers.find("filename=", cd);
+            if (fn != std::string::npos) {
+                size_t q1 = headers.find('"', fn);
+                if (q1 != std::string::npos) {
+                    size_t q2 = headers.find('"', q1 + 1);
+                    if (q2 != std::string::npos) {
+                        filename = headers.substr(q1 + 1, q2 - q1 - 1);
+                    }
+                }
+            }
+        }
+
+        size_t contentStart = headersEnd + 4; // skip \r\n\r\n
+
+        // Next boundary (either middle or closing)
+        size_t next = body.find(CRLF + dashBoundary, contentStart);
+        if (next == std::string::npos) {
+            // Try without preceding CRLF (edge case)
+            next = body.find(dashBoundary, contentStart);
+            if (next == std::string::npos) return false;
+        }
+
+        // Content ends just before the CRLF preceding the next boundary (if present)
+        size_t contentEnd = next;
+        if (contentEnd >= 2 && body.substr(contentEnd - 2, 2) == CRLF)
+            contentEnd -= 2;
+
+        // If this part has a filename, we treat it as the file part
+        if (!filename.empty()) {
+            outFilename = filename;
+            outContent.assign(body.data() + contentStart, body.data() + contentEnd);
+            return true;
+        }
+
+        // Move to the start of the next part
+        size_t afterBoundary = body.find(CRLF, next + dashBoundary.size());
+        if (afterBoundary == std::string::npos) return false;
+        // closing boundary ends with "--"
+        if (body.compare(next, dashBoundary.size() + 2, dashBoundary + "--") == 0)
+            return false; // reached end without finding a file
+        pos = afterBoundary + CRLF.size();
+    }
+}
+
+} // namespace legacy
+
+// Keeps the file parts in memory
+struct Collector : public MultipartHandler {
+    std::vector<std::string> names;
+    std::vector<std::string> files;
+    bool inFile;
+
+    Collector() : inFile(false) {}
+    bool onPartBegin(const std::string&, const std::string& filename, const std::string&) {
+        inFile = !filename.empty();
+        if (inFile) {
+            names.push_back(filename);
+            files.push_back(std::string());
+        }
+        return true;
+    }
+    bool onPartData(const char* data, size_t len) {
+        if (inFile)
+            files.back().append(data, len);
+        return true;
+    }
+    bool onPartEnd() { inFile = false; return true; }
+};
+
+// Only counts bytes, like the server writing parts to disk
+struct Counter : public MultipartHandler {
+    long bytes;
+    Counter() : bytes(0) {}
+    bool onPartBegin(const std::string&, const std::string&, const std::string&) { return true; }
+    bool onPartData(const char*, size_t len) { bytes += static_cast<long>(len); return true; }
+    bool onPartEnd() { return true; }
+};
+
+MultipartParser::Status feedBlocks(MultipartParser& p, const std::string& body, size_t block)
+{
+    for (size_t off = 0; off < body.size() && p.status() == MultipartParser::PART_NEED_MORE; off += block)
+        p.feed(body.data() + off, body.size() - off < block ? body.size() - off : block);
+    return p.status();
+}
+
+std::string fileContent(size_t size, unsigned seed)
+{
+    std::string s;
+    s.reserve(size);
+    const std::string near = "\r\n--" + BOUNDARY.substr(0, BOUNDARY.size() - 1);
+    for (size_t i = 0; s.size() < size; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        if (seed % 997 == 0)
+            s += near.substr(0, seed % near.size() + 1);
+        else
+            s += static_cast<char>(seed >> 16);
+    }
+    s.resize(size);
+    return s;
+}
+
+// A form field, then `count` files of `size` bytes each
+std::string encode(size_t size, int count, std::vector<std::string>& files)
+{
+    std::string body = "preamble\r\n--" + BOUNDARY + "\r\n"
+        "Content-Disposition: form-data; name=\"note\"\r\n\r\nhello";
+    for (int k = 0; k < count; ++k) {
+        char name[32];
+        std::snprintf(name, sizeof(name), "file%d.bin", k);
+        files.push_back(fileContent(size, static_cast<unsigned>(k + 1)));
+        body += "\r\n--" + BOUNDARY + "\r\n"
+            "Content-Disposition: form-data; name=\"f\"; filename=\"" + name + "\"\r\n"
+            "Content-Type: application/octet-stream\r\n\r\n" + files.back();
+    }
+    return body + "\r\n--" + BOUNDARY + "--\r\n";
+}
+
+void check(const std::string& body, const std::vector<std::string>& files)
+{
+    std::string name, first;
+    if (!legacy::extract_multipart_file_raw(body, BOUNDARY, name, first) || first != files[0])
+        throw std::runtime_error("legacy extractor disagrees");
+
+    const size_t blocks[] = { 1, 7, 64, 64 * 1024 };
+    for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); ++b) {
+        if (blocks[b] == 1 && body.size() > (1u << 20))
+            continue;
+        Collector c;
+        MultipartParser p(BOUNDARY, c);
+        if (feedBlocks(p, body, blocks[b]) != MultipartParser::PART_DONE || c.files != files) {
+            std::printf("MISMATCH %lu byte body in %lu byte blocks\n",
+                        (unsigned long)body.size(), (unsigned long)blocks[b]);
+            throw std::runtime_error("mismatch");
+        }
+    }
+}
+
+void run(size_t size, int count, int iters)
+{
+    std::vector<std::string> files;
+    const std::string body = encode(size, count, files);
+    check(body, files);
+    long sink = 0;
+
+    double t0 = nowSec();
+    for (int i = 0; i < iters; ++i) {
+        std::string name, content;
+        legacy::extract_multipart_file_raw(body, BOUNDARY, name, content);
+        sink += content.size();
+    }
+    double t_legacy = nowSec() - t0;
+
+    t0 = nowSec();
+    for (int i = 0; i < iters; ++i) {
+        Counter c;
+        MultipartParser p(BOUNDARY, c);
+        feedBlocks(p, body, 64 * 1024);
+        sink += c.bytes;
+    }
+    double t_stream = nowSec() - t0;
+    g_sink = sink;
+
+    double mb = double(body.size()) * iters / (1024.0 * 1024.0);
+    std::printf("  %6lu KiB x %d file(s)   legacy (first file) %8.1f MB/s   streaming (all) %8.1f MB/s\n",
+                (unsigned long)(size / 1024), count, mb / t_legacy, mb / t_stream);
+}
+
+} // namespace
+
+int main()
+{
+    std::printf("multipart_bench: extract_multipart_file_raw vs streaming MultipartParser\n");
+    try {
+        run(4 * 1024, 1, 2000);
+        run(256 * 1024, 1, 100);
+        run(256 * 1024, 4, 50);
+        run(8 * 1024 * 1024, 1, 5);
+    } catch (const std::exception& e) {
+        std::printf("%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,364 @@
+// Request head parsing: the resumable RequestParser against the pipeline it
+// replaced (find_header_end over the whole buffer on every read, a substr of
+// the headers, has_chunked_encoding on a lowercased copy, Content-Length
+// through istringstream, then Request::parseRequest with getline).
+//
+//   make bench
+//
+// Each request is fed either in one read or trickled in small reads, the way
+// a slow client or a large head arrives. Before timing, both pipelines must
+// agree on method, target, version, headers and body for every sample.
+// The last line compares a header lookup in the old std::map against the
+// parser's known-header slots.
+
+#include "RequestParser.hpp"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <strings.h>
+#include <sys/time.h>
+#include <vector>
+
+namespace {
+
+volatile long g_sink; // keeps the parse loops from being optimised away
+
+struct Parsed {
+    std::string method;
+    std::string path;
+    std::string version;
+    std::map<std::string, std::string> headers;
+    std::string body;
+};
+
+double nowSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// --- The previous pipeline, copied from serverUtils.cpp / Request.cpp ---
+namespace legacy {
+
+size_t find_header_end(const std::string &request_data)
+{
+    return request_data.find("\r\n\r\n");
+}
+
+bool has_chunked_encoding(const std::string& headers)
+{
+    std::string h = headers;
+    for (size_t i = 0; i < h.size(); ++i) {
+        char c = h[i];
+        if (c >= 'A' && c <= 'Z') h[i] = char(c - 'A' + 'a');
+    }
+    return h.find("transfer-encoding:") != std::string::npos
+        && h.find("chunked") != std::string::npos;
+}
+
+int parse_content_length(const std::string &headers)
+{
+    std::istringstream stream(headers);
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (line.find("Content-Length:") != std::string::npos) {
+            std::istringstream linestream(line);
+            std::string key;
+            int content_length = 0;
+            linestream >> key >> content_length;
+            return content_length;
+        }
+    }
+    return 0;
+}
+
+bool isValidHttpVersionFormat(const std::string& version)
+{
+    if (version.length() != 8 || version.substr(0, 5) != "HTTP/" || version[6] != '.')
+        return false;
+    return std::isdigit(version[5]) && std::isdigit(version[7]);
+}
+
+void parseRequest(const std::string& raw_data, Parsed& r)
+{
+    std::istringstream stream(raw_data);
+    std::string line;
+
+    if (!std::getline(stream, line))
+        throw std::runtime_error("Empty request line");
+    if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+    std::istringstream request_line(line);
+    request_line >> r.method >> r.path >> r.version;
+    if (r.method.empty() || r.path.empty() || r.version.empty())
+        throw std::runtime_error("Malformed request line");
+    if (!isValidHttpVersionFormat(r.version))
+        throw std::runtime_error("Invalid HTTP version");
+    if (r.version.compare(0, 8, "HTTP/1.1") != 0)
+        throw std::runtime_error("HTTP Version Not Supported");
+
+    long content_length = 0;
+    bool has_cl = false;
+    while (std::getline(stream, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line.empty())
+            break;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            throw std::runtime_error("Malformed header line (missing colon)");
+        std::string key = line.substr(0, colon);
+        std::string value = line.substr(colon + 1);
+        key.erase(0, key.find_first_not_of(" \t"));
+        key.erase(key.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t") + 1);
+        if (key.empty())
+            throw std::runtime_error("Malformed header line (empty key)");
+        r.headers[key] = value;
+        if (strcasecmp(key.c_str(), "Content-Length") == 0) {
+            std::istringstream iss(value);
+            if (!(iss >> content_length) || content_length < 0)
+                throw std::runtime_error("Invalid or too large Content-Length value");
+            has_cl = true;
+        }
+    }
+
+    std::string raw_body;
+    raw_body.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    r.body = has_cl ? raw_body.substr(0, content_length) : raw_body;
+}
+
+// One read's worth of processBufferedRequests: returns true once a whole
+// request was framed and parsed into r.
+bool step(const std::string& buffer, Parsed& r)
+{
+    size_t hdr_end = find_header_end(buffer);
+    if (hdr_end == std::string::npos)
+        return false;
+    const size_t header_bytes = hdr_end + 4;
+    std::string headers = buffer.substr(0, header_bytes);
+    if (has_chunked_encoding(headers))
+        return false; // not exercised here
+    size_t needed = header_bytes + parse_content_length(headers);
+    if (buffer.size() < needed)
+        return false;
+    std::string frame = buffer.substr(0, needed);
+    parseRequest(frame, r);
+    return true;
+}
+
+// Request::getHeader over the std::map it used to keep
+std::string getHeader(const std::map<std::string, std::string>& headers, const std::string& key)
+{
+    for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it)
+        if (strcasecmp(it->first.c_str(), key.c_str()) == 0)
+            return it->second;
+    return "";
+}
+
+} // namespace legacy
+
+// --- The new pipeline: RequestParser plus what Request's ctor copies ---
+// Request reads header fields through the parser's slices; copying them
+// into r.headers is only done for the differential check.
+bool step(RequestParser& parser, const std::string& buffer, Parsed& r, bool copy_headers)
+{
+    if (parser.parse(buffer) != RequestParser::PARSE_DONE)
+        return false;
+    size_t needed = parser.headBytes() + parser.contentLength();
+    if (buffer.size() < needed)
+        return false;
+    r.method.assign(buffer, parser.method().off, parser.method().len);
+    r.path.assign(buffer, parser.target().off, parser.target().len);
+    r.version.assign(buffer, parser.version().off, parser.version().len);
+    const std::vector<HeaderSlice>& h = parser.headers();
+    for (size_t i = 0; copy_headers && i < h.size(); ++i)
+        r.headers[buffer.substr(h[i].name.off, h[i].name.len)] =
+            buffer.substr(h[i].value.off, h[i].value.len);
+    r.body.assign(buffer, parser.headBytes(), parser.contentLength());
+    return true;
+}
+
+std::string browserGet()
+{
+    return "GET /images/gallery/photo-0042.jpg?size=large&v=3 HTTP/1.1\r\n"
+           "Host: localhost:8080\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+           "Accept: image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+           "Accept-Language: en-US,en;q=0.5\r\n"
+           "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+           "Connection: keep-alive\r\n"
+           "Referer: http://localhost:8080/gallery.html\r\n"
+           "Cookie: session=4f1c2a9be07d44e1a3b5; theme=dark; lang=en\r\n"
+           "Sec-Fetch-Dest: image\r\n"
+           "Sec-Fetch-Mode: no-cors\r\n"
+           "Sec-Fetch-Site: same-origin\r\n"
+           "Priority: u=5, i\r\n"
+           "\r\n";
+}
+
+std::string formPost()
+{
+    std::string body = "name=webserv&comment=" + std::string(900, 'x');
+    std::ostringstream oss;
+    oss << "POST /cgi-bin/echo.py HTTP/1.1\r\n"
+        << "Host: localhost:8080\r\n"
+        << "Content-Type: application/x-www-form-urlencoded\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Origin: http://localhost:8080\r\n"
+        << "\r\n" << body;
+    return oss.str();
+}
+
+std::string bigHead()
+{
+    std::string req = "GET /scripts/app.js HTTP/1.1\r\nHost: localhost:8080\r\n";
+    for (int i = 0; i < 60; ++i) {
+        char line[160];
+        std::snprintf(line, sizeof(line), "X-Trace-%02d:  %s  \r\n", i,
+                      "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01-padding-padding");
+        req += line;
+    }
+    return req + "\r\n";
+}
+
+bool same(const Parsed& a, const Parsed& b)
+{
+    return a.method == b.method && a.path == b.path && a.version == b.version &&
+           a.headers == b.headers && a.body == b.body;
+}
+
+// Feeds req in reads of `chunk` bytes, returning the request once framed
+template <typename Step>
+void feed(const std::string& req, size_t chunk, Step& s, Parsed& out)
+{
+    std::string buffer;
+    buffer.reserve(req.size());
+    for (size_t off = 0; off < req.size(); off += chunk) {
+        buffer.append(req, off, chunk);
+        if (s(buffer, out))
+            return;
+    }
+    throw std::runtime_error("request never completed");
+}
+
+struct LegacyStep {
+    bool operator()(const std::string& b, Parsed& r) { return legacy::step(b, r); }
+};
+
+struct ParserStep {
+    RequestParser parser;
+    bool copy_headers;
+    explicit ParserStep(bool copy = true) : copy_headers(copy) {}
+    bool operator()(const std::string& b, Parsed& r) { return step(parser, b, r, copy_headers); }
+};
+
+bool check(const char* name, const std::string& req)
+{
+    const size_t chunks[] = { 1, 7, 64, 1 << 20 };
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+        Parsed a, b;
+        LegacyStep ls;
+        ParserStep ps;
+        feed(req, chunks[i], ls, a);
+        feed(req, chunks[i], ps, b);
+        if (!same(a, b)) {
+            std::printf("MISMATCH %s (reads of %lu bytes)\n", name, (unsigned long)chunks[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void run(const char* name, const std::string& req, size_t chunk, int iters)
+{
+    long sink = 0;
+
+    double t0 = nowSec();
+    for (int i = 0; i < iters; ++i) {
+        Parsed r;
+        LegacyStep s;
+        feed(req, chunk, s, r);
+        sink += r.headers.size();
+    }
+    double t_legacy = nowSec() - t0;
+
+    t0 = nowSec();
+    for (int i = 0; i < iters; ++i) {
+        Parsed r;
+        ParserStep s(false);
+        feed(req, chunk, s, r);
+        sink += s.parser.headers().size();
+    }
+    double t_parser = nowSec() - t0;
+    g_sink = sink;
+
+    double mb = double(req.size()) * iters / (1024.0 * 1024.0);
+    std::printf("  %-12s %5lu B  reads of %-7lu legacy %8.1f MB/s   parser %8.1f MB/s   x%.1f\n",
+                name, (unsigned long)req.size(),
+                (unsigned long)(chunk > req.size() ? req.size() : chunk),
+                mb / t_legacy, mb / t_parser, t_legacy / t_parser);
+}
+
+// The lookups one request makes: framing, Expect, Connection, Host, Accept
+void runLookups(const std::string& req, int iters)
+{
+    static const char* names[] = { "Transfer-Encoding", "Expect", "Connection", "Host", "Accept" };
+    static const KnownHeader ids[] = { HDR_TRANSFER_ENCODING, HDR_EXPECT, HDR_CONNECTION, HDR_HOST, HDR_ACCEPT };
+    const int n = sizeof(ids) / sizeof(ids[0]);
+
+    Parsed r;
+    LegacyStep ls;
+    feed(req, req.size(), ls, r);
+    RequestParser parser;
+    parser.parse(req);
+    long sink = 0;
+
+    double t0 = nowSec();
+    for (int i = 0; i < iters; ++i)
+        for (int k = 0; k < n; ++k)
+            sink += legacy::getHeader(r.headers, names[k]).size();
+    double t_legacy = nowSec() - t0;
+
+    t0 = nowSec();
+    for (int i = 0; i < iters; ++i)
+        for (int k = 0; k < n; ++k) {
+            const HeaderSlice* h = parser.header(ids[k]);
+            sink += h ? h->value.len : 0;
+        }
+    double t_slot = nowSec() - t0;
+    g_sink = sink;
+
+    double per = 1e9 / (double(iters) * n);
+    std::printf("  header lookup (%lu fields)  legacy %6.1f ns   slot %6.1f ns\n",
+                (unsigned long)r.headers.size(), t_legacy * per, t_slot * per);
+}
+
+} // namespace
+
+int main()
+{
+    const std::string get = browserGet();
+    const std::string post = formPost();
+    const std::string big = bigHead();
+
+    if (!check("browser-get", get) || !check("form-post", post) || !check("big-head", big))
+        return 1;
+
+    std::printf("request_parse_bench: legacy pipeline vs RequestParser\n");
+    run("browser-get", get, 1 << 20, 100000);
+    run("browser-get", get, 64, 20000);
+    run("form-post", post, 1 << 20, 100000);
+    run("form-post", post, 536, 50000);
+    run("big-head", big, 1 << 20, 20000);
+    run("big-head", big, 512, 5000);
+    runLookups(get, 1000000);
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Hit ratio of the ResponseCache (TinyLFU admission) against the same cache
+// admitting everything (plain LRU), on a Zipf-distributed request stream
+// with a scan of one-off large files mixed in, plus the cost of a hit.
+//
+//   make bench
+//
+// 2000 paths of 4-64 KiB with Zipf(0.9) popularity; every 10th request is
+// for a file nobody asks for twice (a crawler, a one-off download).
+
+#include "ResponseCache.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <sys/time.h>
+#include <vector>
+
+namespace {
+
+const size_t PATHS = 2000;
+const size_t REQUESTS = 400000;
+const size_t CAPACITY = 8 * 1024 * 1024;
+
+double nowSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+std::string pathOf(size_t id)
+{
+    std::ostringstream oss;
+    oss << "www/assets/file" << id << ".bin";
+    return oss.str();
+}
+
+struct Workload {
+    std::vector<std::string> paths;
+    std::vector<size_t>      sizes;
+    std::vector<size_t>      stream;   // indexes into paths
+};
+
+Workload makeWorkload()
+{
+    Workload w;
+    srand(42);
+    std::vector<double> cdf(PATHS);
+    double sum = 0;
+    for (size_t i = 0; i < PATHS; ++i)
+    {
+        sum += 1.0 / std::pow(static_cast<double>(i + 1), 0.9);
+        cdf[i] = sum;
+    }
+    for (size_t i = 0; i < PATHS; ++i)
+    {
+        w.paths.push_back(pathOf(i));
+        w.sizes.push_back(4096 + static_cast<size_t>(rand() % (60 * 1024)));
+    }
+    for (size_t r = 0; r < REQUESTS; ++r)
+    {
+        if (r % 10 == 9)
+        {
+            // One-off large file
+            w.paths.push_back(pathOf(PATHS + r));
+            w.sizes.push_back(512 * 1024);
+            w.stream.push_back(w.paths.size() - 1);
+            continue;
+        }
+        double u = (rand() / (RAND_MAX + 1.0)) * sum;
+        size_t lo = 0, hi = PATHS - 1;
+        while (lo < hi)
+        {
+            size_t mid = (lo + hi) / 2;
+            if (cdf[mid] < u)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        w.stream.push_back(lo);
+    }
+    return w;
+}
+
+double run(const Workload& w, bool tinylfu, ResponseCache::Stats& out)
+{
+    ResponseCache cache(CAPACITY, 1024 * 1024);
+    struct stat st;
+    std::memset(&st, 0, sizeof(st));
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nContent-Type: application/octet-stream\r\n";
+    for (size_t r = 0; r < w.stream.size(); ++r)
+    {
+        size_t id = w.stream[r];
+        st.st_ino = static_cast<ino_t>(id + 1);
+        st.st_size = static_cast<off_t>(w.sizes[id]);
+        const std::string* h;
+        SharedBuffer* body;
+        if (cache.find(w.paths[id], st, h, body))
+            continue;
+        if (tinylfu && !cache.admit(w.paths[id], w.sizes[id]))
+            continue;
+        std::string data(w.sizes[id], 'x');
+        SharedBuffer* buf = SharedBuffer::adopt(data);
+        cache.insert(w.paths[id], st, head, buf);
+        buf->release();
+    }
+    out = cache.stats();
+    return 100.0 * out.hits / (out.hits + out.misses);
+}
+
+} // namespace
+
+int main()
+{
+    Workload w = makeWorkload();
+    std::printf("response_cache_bench: %lu requests, %lu hot paths, %lu KiB cache\n",
+                static_cast<unsigned long>(REQUESTS), static_cast<unsigned long>(PATHS),
+                static_cast<unsigned long>(CAPACITY / 1024));
+
+    ResponseCache::Stats lru, tiny;
+    double lru_ratio = run(w, false, lru);
+    double tiny_ratio = run(w, true, tiny);
+    std::printf("  admit all (LRU)   hit ratio %5.1f%%  evictions %lu\n", lru_ratio, lru.evictions);
+    std::printf("  TinyLFU admission hit ratio %5.1f%%  evictions %lu  rejected %lu\n", tiny_ratio,
+                tiny.evictions, tiny.rejected);
+
+    // Cost of a hit: hash, sketch update, map lookup, LRU move
+    ResponseCache cache(CAPACITY, 1024 * 1024);
+    struct stat st;
+    std::memset(&st, 0, sizeof(st));
+    std::string data(16 * 1024, 'x');
+    SharedBuffer* buf = SharedBuffer::adopt(data);
+    for (size_t i = 0; i < 64; ++i)
+        cache.insert(w.paths[i], st, "HTTP/1.1 200 OK\r\n", buf);
+    buf->release();
+    const size_t LOOKUPS = 2000000;
+    unsigned long found = 0;
+    double t0 = nowSec();
+    for (size_t i = 0; i < LOOKUPS; ++i)
+    {
+        const std::string* h;
+        SharedBuffer* body;
+        found += cache.find(w.paths[i & 63], st, h, body);
+    }
+    double t1 = nowSec();
+    std::printf("  hit: %.0f ns/lookup (%lu found)\n", (t1 - t0) / LOOKUPS * 1e9, found);
+
+    if (tiny_ratio < lru_ratio)
+    {
+        std::printf("FAIL: TinyLFU admission below plain LRU\n");
+        return 1;
+    }
+    return 0;
+}
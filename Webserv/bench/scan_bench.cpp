@@ -0,0 +1,266 @@
+// Scan kernels (Request_Response/HttpScan): every SIMD level against the
+// scalar kernels, then per-level throughput on the inputs the parsers feed
+// them.
+//
+//   make bench
+//
+// The differential pass runs each kernel at every supported level on random
+// buffers (random length and alignment, biased towards the bytes the kernels
+// stop at) and requires the scalar answer. Timings follow for each level,
+// with the library calls the kernels stand in for as a reference.
+
+#include "HttpScan.hpp"
+#include "MultipartParser.hpp"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+namespace {
+
+volatile long g_sink; // keeps the timed loops from being optimised away
+
+double nowSec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+unsigned g_seed = 12345;
+unsigned rnd()
+{
+    g_seed = g_seed * 1103515245u + 12345u;
+    return g_seed >> 8;
+}
+
+// Mostly token/hex text with the interesting bytes mixed in
+char randomByte()
+{
+    static const char special[] = "\r\n\t \"(),/:;<=>?@[\\]{}\x7f\x01\x00\x80\xff-";
+    unsigned r = rnd() % 100;
+    if (r < 60)
+        return "0123456789abcdefABCDEFxyzXYZ_.~"[rnd() % 31];
+    if (r < 90)
+        return special[rnd() % (sizeof(special) - 1)];
+    return static_cast<char>(rnd());
+}
+
+struct Result {
+    size_t stop, crlf, hexCount, hexValue, boundary;
+    bool   token, overflow;
+
+    bool operator!=(const Result& o) const
+    {
+        return stop != o.stop || crlf != o.crlf || token != o.token || hexCount != o.hexCount ||
+               overflow != o.overflow || (!overflow && hexValue != o.hexValue) || boundary != o.boundary;
+    }
+};
+
+Result runAll(const char* p, size_t n, const std::string& needle)
+{
+    Result r;
+    r.stop = scan::lineStop(p, n);
+    r.crlf = scan::findCrlfCrlf(p, n);
+    r.token = scan::isToken(p, n);
+    r.hexCount = scan::parseHex(p, n, r.hexValue, r.overflow);
+    r.boundary = scan::findBoundary(p, n, needle.data(), needle.size());
+    return r;
+}
+
+void differential(scan::Level best)
+{
+    const std::string needle = "\r\n--ab";
+    long cases = 0;
+    for (int iter = 0; iter < 200000; ++iter)
+    {
+        size_t n = rnd() % (iter < 100000 ? 80 : 600);
+        size_t align = rnd() % 32;
+        std::string buf(align + n, ' ');
+        unsigned mode = rnd() % 4;
+        for (size_t i = 0; i < n; ++i)
+        {
+            char c = randomByte();
+            if (mode == 1)                        // long token
+                c = "abcXYZ09-_"[rnd() % 10];
+            else if (mode == 2)                   // long hex run
+                c = "0123456789abcdefABCDEF"[rnd() % 22];
+            buf[align + i] = c;
+        }
+        if (mode == 3 && n >= needle.size())      // plant a delimiter late
+            buf.replace(align + n - needle.size() - rnd() % (n - needle.size() + 1), needle.size(), needle);
+        const char* p = buf.data() + align;
+
+        scan::setLevel(scan::SCALAR);
+        Result want = runAll(p, n, needle);
+        for (int l = scan::SSE2; l <= best; ++l)
+        {
+            scan::setLevel(static_cast<scan::Level>(l));
+            if (runAll(p, n, needle) != want)
+            {
+                std::printf("MISMATCH at %s, %lu byte input (mode %u)\n",
+                            scan::levelName(static_cast<scan::Level>(l)), (unsigned long)n, mode);
+                throw std::runtime_error("mismatch");
+            }
+            ++cases;
+        }
+    }
+    std::printf("  differential: %ld cases match the scalar kernels\n", cases);
+}
+
+// A browser-like request head
+std::string sampleHead()
+{
+    return "GET /images/gallery/2024/summer/photo-0042.jpeg?size=large&format=webp HTTP/1.1\r\n"
+           "Host: www.example.com\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+           "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+           "Accept-Language: en-US,en;q=0.9,de;q=0.7\r\n"
+           "Accept-Encoding: gzip, deflate, br\r\n"
+           "Referer: https://www.example.com/gallery/summer?page=3&sort=newest\r\n"
+           "Cookie: session=8f3a9c2e7b1d4f6a0e5c8b2d9f1a3e7c; theme=dark; consent=1\r\n"
+           "Connection: keep-alive\r\n"
+           "Sec-Fetch-Dest: image\r\n"
+           "Sec-Fetch-Mode: no-cors\r\n"
+           "Sec-Fetch-Site: same-origin\r\n"
+           "\r\n";
+}
+
+typedef long (*Work)(const std::string&);
+
+long linesKernel(const std::string& h)
+{
+    long sum = 0;
+    for (size_t pos = 0; pos < h.size(); )
+    {
+        size_t at = pos + scan::lineStop(h.data() + pos, h.size() - pos);
+        sum += at;
+        pos = at + 1;
+    }
+    return sum;
+}
+
+long linesMemchr(const std::string& h)
+{
+    long sum = 0;
+    for (size_t pos = 0; pos < h.size(); )
+    {
+        const char* nl = static_cast<const char*>(std::memchr(h.data() + pos, '\n', h.size() - pos));
+        size_t at = nl ? static_cast<size_t>(nl - h.data()) : h.size();
+        sum += at;
+        pos = at + 1;
+    }
+    return sum;
+}
+
+long namesKernel(const std::string& h)
+{
+    long ok = 0;
+    for (size_t pos = h.find("\r\n") + 2; pos < h.size(); )
+    {
+        size_t colon = h.find(':', pos);
+        if (colon == std::string::npos)
+            break;
+        ok += scan::isToken(h.data() + pos, colon - pos);
+        pos = h.find("\r\n", colon) + 2;
+    }
+    return ok;
+}
+
+long crlfKernel(const std::string& h) { return static_cast<long>(scan::findCrlfCrlf(h.data(), h.size())); }
+long crlfFind(const std::string& h) { return static_cast<long>(h.find("\r\n\r\n")); }
+
+long hexKernel(const std::string& lines)
+{
+    long sum = 0;
+    for (size_t pos = 0; pos < lines.size(); )
+    {
+        size_t v;
+        bool of;
+        size_t n = scan::parseHex(lines.data() + pos, lines.size() - pos, v, of);
+        sum += static_cast<long>(v);
+        pos = lines.find('\n', pos + n) + 1;
+    }
+    return sum;
+}
+
+double timeIt(Work w, const std::string& in, int iters)
+{
+    long sink = 0;
+    double t0 = nowSec();
+    for (int i = 0; i < iters; ++i)
+        sink += w(in);
+    g_sink = sink;
+    return (nowSec() - t0) * 1e9 / iters;
+}
+
+struct Counter : public MultipartHandler {
+    long bytes;
+    Counter() : bytes(0) {}
+    bool onPartBegin(const std::string&, const std::string&, const std::string&) { return true; }
+    bool onPartData(const char*, size_t len) { bytes += static_cast<long>(len); return true; }
+    bool onPartEnd() { return true; }
+};
+
+const std::string BOUNDARY = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+
+long multipartParse(const std::string& body)
+{
+    Counter c;
+    MultipartParser p(BOUNDARY, c);
+    for (size_t off = 0; off < body.size(); off += 64 * 1024)
+        p.feed(body.data() + off, body.size() - off < 64 * 1024 ? body.size() - off : 64 * 1024);
+    if (p.status() != MultipartParser::PART_DONE)
+        throw std::runtime_error("multipart sample did not parse");
+    return c.bytes;
+}
+
+void timings(scan::Level best)
+{
+    const std::string head = sampleHead();
+    std::string heads;
+    for (int i = 0; i < 8; ++i)
+        heads += head.substr(0, head.size() - 2);   // one 6 KiB head
+    heads += "\r\n";
+    std::string hex;
+    for (int i = 0; i < 64; ++i)
+        hex += i % 2 ? "1000\r\n" : "7fa3;name=value;another-extension\r\n";
+    std::string body = "--" + BOUNDARY + "\r\nContent-Disposition: form-data; name=\"f\"; filename=\"a.bin\"\r\n\r\n";
+    for (size_t i = 0; i < 4u << 20; ++i)
+        body += static_cast<char>(rnd());
+    body += "\r\n--" + BOUNDARY + "--\r\n";
+
+    scan::setLevel(scan::SCALAR);
+    std::printf("  %-34s %9.1f ns\n", "memchr line ends (reference)", timeIt(linesMemchr, head, 200000));
+    std::printf("  %-34s %9.1f ns\n", "string::find CRLFCRLF (reference)", timeIt(crlfFind, heads, 50000));
+    for (int l = scan::SCALAR; l <= best; ++l)
+    {
+        scan::setLevel(static_cast<scan::Level>(l));
+        std::printf("  [%s]\n", scan::levelName(scan::level()));
+        std::printf("  %-34s %9.1f ns\n", "lineStop over a 1 KiB head", timeIt(linesKernel, head, 200000));
+        std::printf("  %-34s %9.1f ns\n", "isToken on its 12 names", timeIt(namesKernel, head, 200000));
+        std::printf("  %-34s %9.1f ns\n", "findCrlfCrlf over 6 KiB", timeIt(crlfKernel, heads, 50000));
+        std::printf("  %-34s %9.1f ns\n", "parseHex on 64 size lines", timeIt(hexKernel, hex, 100000));
+        double ns = timeIt(multipartParse, body, 20);
+        std::printf("  %-34s %9.1f MB/s%s\n", "multipart, 4 MiB file part", body.size() / ns * 1e3,
+                    l == scan::AVX2 ? "" : " (Horspool)");
+    }
+}
+
+} // namespace
+
+int main()
+{
+    scan::Level best = scan::setLevel(scan::AVX2);
+    std::printf("scan_bench: HttpScan kernels, best level here: %s\n", scan::levelName(best));
+    try {
+        differential(best);
+        timings(best);
+    } catch (const std::exception& e) {
+        std::printf("%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
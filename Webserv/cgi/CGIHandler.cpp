@@ -3,9 +3,8 @@
  * --------------
  * Implements the CGIHandler class.
  * - Prepares environment and arguments for CGI scripts
- * - Handles pipes for stdin, stdout, and stderr
- * - Manages child process execution
- * - Captures and validates CGI output
+ * - Starts the script with its stdin and stdout on pipes for the event loop
+ * - Validates and parses CGI output
  */
 
 #include "CGIHandler.hpp"
@@ -14,87 +13,114 @@
 
 CGIHandler::CGIHandler(const std::string& scriptPath,
                        const std::map<std::string, std::string>& env,
-                       Connection* conn,
-                       const std::string& inputBody,
+                       const RequestBody& inputBody,
                        const std::string& requestedUri)
     : scriptPath(scriptPath),
       environment(env),
-      conn(conn),
       inputBody(inputBody),
       requestedUri(requestedUri) {}
 
-std::string CGIHandler::execute() {
-    conn->cgi_active = true;
-    std::string absPath = resolve_script_path();
-    int input_pipe[2], output_pipe[2], error_pipe[2];
-    if (!create_pipes(input_pipe, output_pipe, error_pipe)) {
-        Logger::log(LOG_ERROR, "CGIHandler", "Pipe creation failed");
-        throw std::runtime_error("Pipe creation failed");
-    }
-
-    // Set fds only after pipe creation
-    conn->cgi_stdin_fd[0] = input_pipe[0];
-    conn->cgi_stdin_fd[1] = input_pipe[1];
-    conn->cgi_stdout_fd[0] = output_pipe[0];
-    conn->cgi_stdout_fd[1] = output_pipe[1];
+// Both ends are close-on-exec, so no other script inherits them: a stray
+// copy of a write end would keep the reader from ever seeing EOF
+static bool open_pipe(int fds[2]) {
+#ifdef __linux__
+    return pipe2(fds, O_CLOEXEC) == 0;
+#else
+    if (pipe(fds) != 0)
+        return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    return true;
+#endif
+}
 
-    pid_t pid = fork();
-    conn->cgi_pid = pid;
-    if (pid < 0) {
-        Logger::log(LOG_ERROR, "CGIHandler", "Fork failed");
-        throw std::runtime_error("Fork failed");
-    }
+static void close_pipe(int fds[2]) {
+    for (int k = 0; k < 2; ++k)
+        if (fds[k] >= 0)
+            close(fds[k]);
+}
 
-    if (pid == 0) {
-        setup_child_process(absPath, input_pipe, output_pipe, error_pipe);
-    }
+static void set_non_blocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
 
-    close(input_pipe[0]);
-    close(output_pipe[1]);
-    close(error_pipe[1]);
+void CGIHandler::start(CgiState& cgi) {
+    std::string absPath = resolve_script_path();
 
-    int ret2 = send_input_to_cgi(input_pipe[1]);
-    close(input_pipe[1]);
-    if (ret2 == 500) {
-        // Error already logged in send_input_to_cgi
-        return "__CGI_INTERNAL_ERROR__";
+    // A spooled body is read by the script straight from its file, from the start
+    if (!inputBody.inMemory() && lseek(inputBody.fd(), 0, SEEK_SET) < 0) {
+        Logger::log(LOG_ERROR, "CGIHandler", "Cannot rewind spooled request body");
+        throw std::runtime_error("lseek failed");
     }
-    int status = 0;
-    bool timed_out = false;
-    int ret = wait_for_child_with_timeout(pid, status, timed_out);
 
-    if (timed_out) {
-        handle_timeout(pid, status);
-        return "__CGI_TIMEOUT__";
+    // Everything the child needs is built before fork(): another worker
+    // thread may hold the allocator's lock at that moment
+    std::string interpreter;
+    if (absPath.size() >= 4 && absPath.substr(absPath.size() - 4) == ".php") {
+        environment["SCRIPT_FILENAME"] = absPath;
+        interpreter = "/usr/bin/php-cgi"; // Adjust path if needed
     }
 
-    std::string output = read_pipe_to_string(output_pipe[0]);
-    close(output_pipe[0]);
-    std::string error_output = read_from_pipe(error_pipe[0]);
-    close(error_pipe[0]);
+    std::vector<std::string> envStrings;
+    for (std::map<std::string, std::string>::const_iterator it = environment.begin(); it != environment.end(); ++it)
+        envStrings.push_back(it->first + "=" + it->second);
 
-    log_cgi_debug(status, ret, output, error_output);
+    std::vector<char*> envp;
+    for (size_t i = 0; i < envStrings.size(); ++i)
+        envp.push_back(const_cast<char*>(envStrings[i].c_str()));
+    envp.push_back(NULL);
 
-    if (!check_child_status(status, error_output))
-        return "__CGI_INTERNAL_ERROR__";
+    char* argv[3];
+    if (!interpreter.empty()) {
+        argv[0] = const_cast<char*>(interpreter.c_str());
+        argv[1] = NULL;
+    } else {
+        argv[0] = const_cast<char*>(absPath.c_str());
+        argv[1] = const_cast<char*>(requestedUri.c_str());
+        argv[2] = NULL;
+    }
 
-    if (!validate_cgi_headers(output))
-        return "__CGI_MISSING_HEADER__";
+    std::string scriptDir;
+    size_t last_slash = absPath.find_last_of('/');
+    if (last_slash != std::string::npos)
+        scriptDir = absPath.substr(0, last_slash);
 
-    conn->cgi_input_buffer = inputBody;
-    conn->cgi_output_buffer.clear();
+    int input_pipe[2] = { -1, -1 };
+    int output_pipe[2] = { -1, -1 };
+    if ((inputBody.inMemory() && !open_pipe(input_pipe)) || !open_pipe(output_pipe)) {
+        Logger::log(LOG_ERROR, "CGIHandler", "Pipe creation failed");
+        close_pipe(input_pipe);
+        close_pipe(output_pipe);
+        throw std::runtime_error("Pipe creation failed");
+    }
 
-    return output;
-}
+    pid_t pid = fork();
+    if (pid < 0) {
+        Logger::log(LOG_ERROR, "CGIHandler", "Fork failed");
+        close_pipe(input_pipe);
+        close_pipe(output_pipe);
+        throw std::runtime_error("Fork failed");
+    }
 
-std::string CGIHandler::read_pipe_to_string(int fd) const {
-    std::string result;
-    char buffer[4096];
-    ssize_t n;
-    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
-        result.append(buffer, n);
+    if (pid == 0)
+        setup_child_process(scriptDir, input_pipe, output_pipe, argv, &envp[0]);
+
+    close(output_pipe[1]);
+    cgi.pid = pid;
+    cgi.stdout_fd = output_pipe[0];
+    set_non_blocking(cgi.stdout_fd);
+    if (input_pipe[0] >= 0) {
+        close(input_pipe[0]);
+        if (inputBody.empty()) {
+            close(input_pipe[1]); // EOF right away
+        } else {
+            cgi.stdin_fd = input_pipe[1];
+            cgi.input = inputBody.data();
+            set_non_blocking(cgi.stdin_fd);
+        }
     }
-    return result;
 }
 
 // --- Static helpers for CGI logic ---
@@ -168,130 +194,61 @@ void CGIHandler::parse_cgi_output(const std::string& cgi_output, std::map<std::s
     }
 }
 
-bool CGIHandler::create_pipes(int input_pipe[2], int output_pipe[2], int error_pipe[2]) const {
-    bool ok = (pipe(input_pipe) == 0 && pipe(output_pipe) == 0 && pipe(error_pipe) == 0);
-    if (!ok) Logger::log(LOG_ERROR, "CGIHandler", "Pipe creation error");
-    return ok;
-}
-
-void CGIHandler::setup_child_process(const std::string& absPath, int input_pipe[2], int output_pipe[2], int error_pipe[2]) {
-    if (dup2(input_pipe[0], STDIN_FILENO) == -1) {
+// Runs in the forked child; only makes system calls until execve()
+void CGIHandler::redirect_child_stdin(int input_pipe[2]) const {
+    int source = inputBody.inMemory() ? input_pipe[0] : inputBody.fd();
+    if (dup2(source, STDIN_FILENO) == -1) {
         perror("[CGI] dup2 STDIN failed");
-        exit(1);
+        _exit(1);
     }
-    close(input_pipe[0]);
-    close(input_pipe[1]);
+}
 
+void CGIHandler::setup_child_process(const std::string& scriptDir, int input_pipe[2], int output_pipe[2],
+                                     char* const argv[], char* const envp[]) const {
+    // The server ignores SIGPIPE and its worker threads block SIGINT and
+    // SIGTERM; the script starts with the defaults
+    signal(SIGPIPE, SIG_DFL);
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    // The pipes are close-on-exec; the dup2() copies are not. stderr stays
+    // the server's.
+    redirect_child_stdin(input_pipe);
     if (dup2(output_pipe[1], STDOUT_FILENO) == -1) {
         perror("[CGI] dup2 STDOUT failed");
-        exit(1);
+        _exit(1);
     }
-    close(output_pipe[0]);
-    close(output_pipe[1]);
-
-    if (dup2(error_pipe[1], STDERR_FILENO) == -1) {
-        perror("[CGI] dup2 STDERR failed");
-        exit(1);
-    }
-    close(error_pipe[0]);
-    close(error_pipe[1]);
-
-    size_t last_slash = absPath.find_last_of('/');
-    if (last_slash != std::string::npos) {
-        std::string script_dir = absPath.substr(0, last_slash);
-        if (chdir(script_dir.c_str()) != 0) {
-            perror("[CGI] chdir to script directory failed");
-            exit(1);
-        }
-    }
-
-    std::string interpreter;
-    if (absPath.size() >= 4 && absPath.substr(absPath.size() - 4) == ".php") {
-        environment["SCRIPT_FILENAME"] = absPath;
-        interpreter = "/usr/bin/php-cgi"; // Adjust path if needed
-    }
-
-    std::vector<std::string> envStrings;
-    for (std::map<std::string, std::string>::const_iterator it = environment.begin(); it != environment.end(); ++it)
-        envStrings.push_back(it->first + "=" + it->second);
 
-    std::vector<char*> envp;
-    for (size_t i = 0; i < envStrings.size(); ++i)
-        envp.push_back(const_cast<char*>(envStrings[i].c_str()));
-    envp.push_back(NULL);
-
-    char* argv[4];
-    if (!interpreter.empty()) {
-        argv[0] = const_cast<char*>(interpreter.c_str());
-        argv[1] = NULL;
-    } else {
-        argv[0] = const_cast<char*>(absPath.c_str());
-        argv[1] = const_cast<char*>(requestedUri.c_str());
-        argv[2] = NULL;
+    if (!scriptDir.empty() && chdir(scriptDir.c_str()) != 0) {
+        perror("[CGI] chdir to script directory failed");
+        _exit(1);
     }
 
-    if (!interpreter.empty())
-        execve(interpreter.c_str(), argv, &envp[0]);
-    else
-        execve(absPath.c_str(), argv, &envp[0]);
-
+    execve(argv[0], argv, envp);
     perror("[CGI] execve failed");
-    fprintf(stderr, "[CGI] execve failed for script: %s\n", absPath.c_str());
-    exit(127);
-}
-
-int CGIHandler::send_input_to_cgi(int input_fd) const {
-    if (inputBody.empty()) {
-        return 1;
-    }
-
-    ssize_t written = ::write(input_fd, inputBody.c_str(), inputBody.size());
-
-    if (written > 0) {
-        return 1;
-    }
-    else if (written == 0) {
-        return 1;
-    }
-    else { // written < 0
-        close(input_fd);
-        return 500;
-    }
-}
-
-std::string CGIHandler::read_from_pipe(int fd) const {
-    std::string result;
-    char buffer[1024];
-    int bytesRead;
-    while ((bytesRead = read(fd, buffer, sizeof(buffer))) > 0)
-        result.append(buffer, bytesRead);
-    return result;
+    _exit(127);
 }
 
-bool CGIHandler::check_child_status(int status, const std::string& error_output) const {
+// The script's exit status: anything but exit(0) is a failed script (its
+// stderr goes to the server's)
+bool CGIHandler::check_child_status(int status) {
     if (WIFSIGNALED(status)) {
         Logger::log(LOG_ERROR, "CGIHandler", "CGI script killed by signal: " + to_str(WTERMSIG(status)));
-        if (!error_output.empty())
-            Logger::log(LOG_ERROR, "CGIHandler", "CGI script stderr: " + error_output);
         return false;
     }
     if (!WIFEXITED(status)) {
         Logger::log(LOG_ERROR, "CGIHandler", "CGI script did not exit normally.");
-        if (!error_output.empty())
-            Logger::log(LOG_ERROR, "CGIHandler", "CGI script stderr: " + error_output);
         return false;
     }
-    Logger::log(LOG_DEBUG, "CGIHandler", "WIFEXITED: " + to_str(WIFEXITED(status)) + ", WEXITSTATUS: " + to_str(WEXITSTATUS(status)));
     if (WEXITSTATUS(status) != 0) {
         Logger::log(LOG_ERROR, "CGIHandler", "CGI script exited with status: " + to_str(WEXITSTATUS(status)));
-        if (!error_output.empty())
-            Logger::log(LOG_ERROR, "CGIHandler", "CGI script stderr: " + error_output);
         return false;
     }
     return true;
 }
 
-bool CGIHandler::validate_cgi_headers(const std::string& output) const {
+bool CGIHandler::validate_cgi_headers(const std::string& output) {
     size_t header_end = output.find("\r\n\r\n");
     if (header_end == std::string::npos)
         header_end = output.find("\n\n");
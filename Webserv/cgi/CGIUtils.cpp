@@ -1,50 +1,5 @@
 #include "CGIHandler.hpp"
 
-volatile sig_atomic_t g_cgi_alarm_fired = 0;
-void cgi_alarm_handler(int) { g_cgi_alarm_fired = 1; }
-
-int CGIHandler::wait_for_child_with_timeout(pid_t pid, int& status, bool& timed_out) {
-    int ret = 0;
-    int timeout_seconds = 5;
-    struct sigaction sa;
-    sa.sa_handler = cgi_alarm_handler;
-    sa.sa_flags = 0;
-    sigemptyset(&sa.sa_mask);
-    sigaction(SIGALRM, &sa, NULL);
-
-    g_cgi_alarm_fired = 0;
-    alarm(timeout_seconds);
-
-    timed_out = false;
-    while (true) {
-        ret = waitpid(pid, &status, WNOHANG);
-        if (ret == pid) break;
-        if (ret == -1) break;
-        if (g_cgi_alarm_fired) {
-            timed_out = true;
-            break;
-        }
-        usleep(10000); // Sleep 10ms
-    }
-    alarm(0); // Cancel alarm
-    return ret;
-}
-
-void CGIHandler::handle_timeout(pid_t pid, int& status) {
-    Logger::log(LOG_ERROR, "CGIHandler", "CGI script timed out, killing PID " + to_str(pid));
-    kill(pid, SIGKILL);
-    waitpid(pid, &status, 0); // Reap
-}
-
-void CGIHandler::log_cgi_debug(int status, int ret, const std::string& output, const std::string& error_output) const {
-    Logger::log(LOG_DEBUG, "CGIHandler", "waitpid returned: " + to_str(ret) + ", status: " + to_str(status));
-    Logger::log(LOG_DEBUG, "CGIHandler", "WIFEXITED: " + to_str(WIFEXITED(status)) + ", WEXITSTATUS: " + to_str(WEXITSTATUS(status)));
-    Logger::log(LOG_DEBUG, "CGIHandler", "WIFSIGNALED: " + to_str(WIFSIGNALED(status)) + ", WTERMSIG: " + to_str(WTERMSIG(status)));
-
-    Logger::log(LOG_DEBUG, "CGIHandler", "[CGI DEBUG] CGI ERROR output:\n" + error_output + "\n[END]");
-    (void)output;
-}
-
 std::map<std::string, std::string> CGIHandler::build_cgi_env(const Request& request,
                                                              const std::string& script_name,
                                                              const std::string& path_info) {
@@ -73,12 +28,12 @@ std::map<std::string, std::string> CGIHandler::build_cgi_env(const Request& requ
         // CONTENT_LENGTH: Length of the request body (for POST)
         // Tells the script how much data to read from stdin
         std::ostringstream oss;
-        oss << request.getBody().size();
+        oss << request.getBodySize();
         env["CONTENT_LENGTH"] = oss.str();
 
         // CONTENT_TYPE: MIME type of the request body (for POST)
         // Tells the script how to interpret the incoming data
-        env["CONTENT_TYPE"] = request.getHeader("Content-Type");
+        env["CONTENT_TYPE"] = request.getHeader(HDR_CONTENT_TYPE);
     }
 
     // GATEWAY_INTERFACE: CGI version (always "CGI/1.1")
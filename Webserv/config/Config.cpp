@@ -1,13 +1,28 @@
 #include "Config.hpp"
-
-Config::Config() : port(0), root(""), max_body_size(1048576) {}
-
-Config::Config(const std::string &filename) : max_body_size(1048576) { 
+#include <unistd.h>
+
+Config::Config()
+    : port(0), root(""), max_body_size(1048576), body_buffer_size(16384),
+      header_timeout(10), body_timeout(10), keepalive_timeout(5),
+      send_timeout(10), cgi_timeout(5), accept_batch(64),
+      keepalive_requests(100), unmatched(NULL, "") {}
+
+Config::Config(const std::string &filename)
+    : port(0), max_body_size(1048576), body_buffer_size(16384),
+      header_timeout(10), body_timeout(10), keepalive_timeout(5),
+      send_timeout(10), cgi_timeout(5), accept_batch(64),
+      keepalive_requests(100), unmatched(NULL, "") {
     parseConfigFile(filename);
 }
 
 const std::string &Config::getRoot() const { return root; }
 const std::vector<LocationConfig> &Config::getLocations() const { return locations; }
+
+const LocationPlan *Config::matchLocation(const std::string &path, size_t &rel) const
+{
+    int i = router.match(path, rel);
+    return i < 0 ? &unmatched : &plans[i];
+}
 const std::map<int, std::string> &Config::getErrorPages() const {
     return error_pages;
 }
@@ -86,6 +101,13 @@ void Config::handleListenDirective(std::istringstream &iss)
     if (!token.empty() && token[token.size() - 1] == ';')
         token.erase(token.size() - 1);
 
+    // Optional flag: this block answers Hosts no server_name on the address matches
+    std::string flag;
+    iss >> flag;
+    flag = stripSemicolon(flag);
+    if (!flag.empty() && flag != "default_server")
+        throw std::runtime_error("listen: unknown parameter '" + flag + "'");
+
 // must be HOST:PORT
     std::string::size_type colon = token.find(':');
     if (colon == std::string::npos)
@@ -106,6 +128,7 @@ void Config::handleListenDirective(std::istringstream &iss)
 
     ports.push_back(parsed);
     hosts.push_back(host);  // always present now
+    default_listens.push_back(!flag.empty());
 
     // keep your existing "first port is primary" behavior
     if (port == 0)
@@ -120,6 +143,27 @@ void Config::handleListenDirective(std::istringstream &iss)
     }
 }
 
+// server_name: exact names ("example.com") and leading wildcards
+// ("*.example.com"), matched case-insensitively against Host
+void Config::handleServerNameDirective(std::istringstream &iss)
+{
+    std::string name;
+    while (iss >> name)
+    {
+        name = stripSemicolon(name);
+        if (name.empty())
+            continue;
+        for (size_t i = 0; i < name.size(); ++i)
+            if (name[i] >= 'A' && name[i] <= 'Z')
+                name[i] = char(name[i] - 'A' + 'a');
+        size_t star = name.find('*');
+        if (star != std::string::npos && (star != 0 || name.size() < 3 || name[1] != '.' ||
+                                          name.find('*', 1) != std::string::npos))
+            throw std::runtime_error("server_name: wildcard must be a leading '*.': " + name);
+        server_names.push_back(name);
+    }
+}
+
 void Config::handleRootDirective(std::istringstream &iss)
 {
     std::string r;
@@ -178,6 +222,105 @@ void Config::handleClientMaxBodySizeDirective(std::istringstream &iss)
     max_body_size = static_cast<size_t>(n);
 }
 
+// A size in bytes with an optional k/m suffix, 1 to INT_MAX
+static size_t parseByteSize(const std::string &keyword, std::string value)
+{
+    long unit = 1;
+    if (!value.empty() && (value[value.size() - 1] == 'k' || value[value.size() - 1] == 'K'))
+        unit = 1024;
+    else if (!value.empty() && (value[value.size() - 1] == 'm' || value[value.size() - 1] == 'M'))
+        unit = 1024 * 1024;
+    if (unit != 1)
+        value.erase(value.size() - 1);
+
+    if (value.empty() || value.size() > 7 || value.find_first_not_of("0123456789") != std::string::npos)
+        throw std::runtime_error(keyword + ": must be a size in bytes (k/m suffix allowed)");
+    long n = std::atol(value.c_str()) * unit;
+    if (n < 1 || n > INT_MAX)
+        throw std::runtime_error(keyword + ": must be between 1 and 2147483647 bytes");
+    return static_cast<size_t>(n);
+}
+
+// client_body_buffer_size: bytes, optional k/m suffix
+void Config::handleBodyBufferSizeDirective(std::istringstream &iss)
+{
+    std::string value;
+    iss >> value;
+    body_buffer_size = parseByteSize("client_body_buffer_size", stripSemicolon(value));
+}
+
+// client_header_timeout / client_body_timeout / keepalive_timeout /
+// send_timeout / cgi_timeout: whole seconds, optional "s" suffix
+void Config::handleTimeoutDirective(const std::string &keyword, std::istringstream &iss)
+{
+    std::string value;
+    iss >> value;
+    value = stripSemicolon(value);
+    if (!value.empty() && value[value.size() - 1] == 's')
+        value.erase(value.size() - 1);
+
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+        throw std::runtime_error(keyword + ": must be a number of seconds");
+    long n = std::atol(value.c_str());
+    if (n < 1 || n > 3600)
+        throw std::runtime_error(keyword + ": must be between 1 and 3600 seconds");
+
+    if (keyword == "client_header_timeout")
+        header_timeout = static_cast<int>(n);
+    else if (keyword == "client_body_timeout")
+        body_timeout = static_cast<int>(n);
+    else if (keyword == "keepalive_timeout")
+        keepalive_timeout = static_cast<int>(n);
+    else if (keyword == "send_timeout")
+        send_timeout = static_cast<int>(n);
+    else if (keyword == "cgi_timeout")
+        cgi_timeout = static_cast<int>(n);
+}
+
+// accept_batch / keepalive_requests: plain positive counts
+void Config::handleCountDirective(const std::string &keyword, std::istringstream &iss)
+{
+    std::string value;
+    iss >> value;
+    value = stripSemicolon(value);
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+        throw std::runtime_error(keyword + ": must be a positive number");
+
+    const bool batch = (keyword == "accept_batch");
+    long n = std::atol(value.c_str());
+    if (value.size() > 7 || n < 1 || n > (batch ? 4096 : 1000000))
+        throw std::runtime_error(keyword + (batch ? ": must be between 1 and 4096"
+                                                  : ": must be between 1 and 1000000"));
+
+    if (batch)
+        accept_batch = static_cast<int>(n);
+    else
+        keepalive_requests = static_cast<int>(n);
+}
+
+// expires: off, epoch, max (ten years) or a time with an s/m/h/d suffix
+// (seconds without one)
+static long parseExpires(std::string value)
+{
+    if (value == "off")
+        return EXPIRES_OFF;
+    if (value == "epoch")
+        return EXPIRES_EPOCH;
+    if (value == "max")
+        return 10L * 365 * 24 * 3600;
+
+    long unit = 1;
+    char last = value.empty() ? '\0' : value[value.size() - 1];
+    if (last == 's' || last == 'm' || last == 'h' || last == 'd')
+    {
+        unit = last == 'm' ? 60 : last == 'h' ? 3600 : last == 'd' ? 86400 : 1;
+        value.erase(value.size() - 1);
+    }
+    if (value.empty() || value.size() > 6 || value.find_first_not_of("0123456789") != std::string::npos)
+        throw std::runtime_error("expires: must be off, epoch, max or a time (s/m/h/d suffix allowed)");
+    return std::atol(value.c_str()) * unit;
+}
+
 void Config::handleLocationEnd(LocationConfig &currentLocation, bool &insideLocation)
 {
     if (insideLocation)
@@ -203,8 +346,8 @@ void Config::handleLocationDirective(const std::string &keyword, std::istringstr
     else if (keyword == "index")
     {
         std::string indexFile;
-        iss >> indexFile;
-        currentLocation.index = stripSemicolon(indexFile);
+        while (iss >> indexFile)
+            currentLocation.index.push_back(stripSemicolon(indexFile));
     }
     else if (keyword == "methods")
     {
@@ -238,15 +381,135 @@ void Config::handleLocationDirective(const std::string &keyword, std::istringstr
         currentLocation.redirect_code = std::atoi(code_str.c_str());
         currentLocation.redirect_url = stripSemicolon(url);
     }
+    else if (keyword == "expires")
+    {
+        std::string value;
+        iss >> value;
+        currentLocation.expires = parseExpires(stripSemicolon(value));
+    }
+    else if (keyword == "cache_control")
+    {
+        std::string rest;
+        std::getline(iss, rest);
+        rest = stripSemicolon(rest);
+        size_t start = rest.find_first_not_of(" \t");
+        if (start == std::string::npos)
+            throw std::runtime_error("cache_control: missing value");
+        currentLocation.cache_control = rest.substr(start);
+    }
+    else if (keyword == "gzip" || keyword == "gzip_static" || keyword == "zstd_static")
+    {
+        std::string value;
+        iss >> value;
+        bool on = (stripSemicolon(value) == "on");
+        if (keyword == "gzip")
+            currentLocation.gzip = on;
+        else if (keyword == "gzip_static")
+            currentLocation.gzip_static = on;
+        else
+            currentLocation.zstd_static = on;
+    }
+    else if (keyword == "gzip_types")
+    {
+        std::string type;
+        while (iss >> type)
+            currentLocation.gzip_types.push_back(stripSemicolon(type));
+    }
+    else if (keyword == "gzip_min_length")
+    {
+        std::string value;
+        iss >> value;
+        currentLocation.gzip_min_length = parseByteSize("gzip_min_length", stripSemicolon(value));
+    }
+    else if (keyword == "gzip_comp_level")
+    {
+        std::string value;
+        iss >> value;
+        value = stripSemicolon(value);
+        if (value.size() != 1 || value[0] < '1' || value[0] > '9')
+            throw std::runtime_error("gzip_comp_level: must be between 1 and 9");
+        currentLocation.gzip_comp_level = value[0] - '0';
+    }
 }
 
 size_t Config::getMaxBodySize() const {return max_body_size;}
 
+size_t Config::getBodyBufferSize() const {return body_buffer_size;}
+
+int Config::getHeaderTimeout() const {return header_timeout;}
+
+int Config::getBodyTimeout() const {return body_timeout;}
+
+int Config::getKeepaliveTimeout() const {return keepalive_timeout;}
+
+int Config::getSendTimeout() const {return send_timeout;}
+
+int Config::getCgiTimeout() const {return cgi_timeout;}
+
+int Config::getAcceptBatch() const {return accept_batch;}
+
+int Config::getKeepaliveRequests() const {return keepalive_requests;}
+
 const std::vector<int> &Config::getPorts() const {return ports;}
 
 const std::vector<std::string>& Config::getHosts() const {return hosts;}
 
-std::vector<Config> parseConfigFile(const std::string &filename) {
+bool Config::isDefaultListen(size_t i) const {return i < default_listens.size() && default_listens[i];}
+
+const std::vector<std::string>& Config::getServerNames() const {return server_names;}
+
+static int parseWorkerCount(const std::string &keyword, const std::string &value)
+{
+    if (value == "auto")
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? static_cast<int>(n) : 1;
+    }
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos)
+        throw std::runtime_error(keyword + ": must be a positive integer or 'auto'");
+    int n = std::atoi(value.c_str());
+    if (n < 1 || n > 1024)
+        throw std::runtime_error(keyword + ": must be between 1 and 1024");
+    return n;
+}
+
+// Top-level (outside server blocks) directives
+static void handleMainDirective(const std::string &line, MainConfig &main)
+{
+    std::istringstream iss(line);
+    std::string keyword, value;
+    iss >> keyword >> value;
+    value = stripSemicolon(value);
+
+    if (keyword == "worker_threads")
+        main.worker_threads = parseWorkerCount(keyword, value);
+    else if (keyword == "worker_processes")
+        main.worker_processes = parseWorkerCount(keyword, value);
+    else if (keyword == "worker_cpu_affinity")
+    {
+        if (value != "on" && value != "off" && value != "auto")
+            throw std::runtime_error("worker_cpu_affinity: must be on, off or auto");
+        main.worker_cpu_affinity = (value != "off");
+    }
+    else if (keyword == "open_file_cache")
+    {
+        main.open_file_cache = (value == "off") ? 0 : std::atoi(value.c_str());
+        if (main.open_file_cache < 0 || (main.open_file_cache == 0 && value != "off" && value != "0"))
+            throw std::runtime_error("open_file_cache: must be a number of entries or off");
+    }
+    else if (keyword == "open_file_cache_valid")
+    {
+        main.open_file_cache_valid = std::atoi(value.c_str());
+        if (main.open_file_cache_valid < 0 || (main.open_file_cache_valid == 0 && value != "0"))
+            throw std::runtime_error("open_file_cache_valid: must be a number of seconds");
+    }
+    else if (keyword == "response_cache")
+        main.response_cache = (value == "off") ? 0 : parseByteSize(keyword, value);
+    else if (keyword == "response_cache_max_entry")
+        main.response_cache_max_entry = parseByteSize(keyword, value);
+}
+
+std::vector<Config> parseConfigFile(const std::string &filename, MainConfig *main) {
     std::ifstream file(filename.c_str());
     if (!file.is_open())
         throw std::runtime_error("Could not open config file");
@@ -267,6 +530,8 @@ std::vector<Config> parseConfigFile(const std::string &filename) {
             cfg.parseServerBlock(file);
             servers.push_back(cfg);
         }
+        else if (main)
+            handleMainDirective(trimmed, *main);
     }
     return servers;
 }
@@ -318,14 +583,31 @@ void Config::parseServerBlock(std::ifstream &file) {
         else {
             if (keyword == "listen")
                 handleListenDirective(iss);
+            else if (keyword == "server_name")
+                handleServerNameDirective(iss);
             else if (keyword == "root")
                 handleRootDirective(iss);
             else if (keyword == "error_page")
                 handleErrorPageDirective(iss);
             else if (keyword == "client_max_body_size")
                 handleClientMaxBodySizeDirective(iss);
+            else if (keyword == "client_body_buffer_size")
+                handleBodyBufferSizeDirective(iss);
+            else if (keyword == "client_header_timeout" || keyword == "client_body_timeout" ||
+                     keyword == "keepalive_timeout" || keyword == "send_timeout" ||
+                     keyword == "cgi_timeout")
+                handleTimeoutDirective(keyword, iss);
+            else if (keyword == "accept_batch" || keyword == "keepalive_requests")
+                handleCountDirective(keyword, iss);
         }
     }
     if (!ports.empty())
         port = ports.front();
+    router.build(locations);
+
+    // Compile the locations for request dispatch
+    plans.clear();
+    for (size_t i = 0; i < locations.size(); ++i)
+        plans.push_back(LocationPlan(&locations[i], root));
+    unmatched = LocationPlan(NULL, root);
 }
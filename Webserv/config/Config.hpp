@@ -2,6 +2,8 @@
 #define CONFIG_HPP
 
 #include "LocationConfig.hpp"
+#include "LocationPlan.hpp"
+#include "LocationRouter.hpp"
 #include "../logger/Logger.hpp"
 #include <string>
 #include <vector>
@@ -15,6 +17,21 @@
 #include <stdexcept>
 #include <cstdlib>
 
+// Process-wide settings: directives that appear outside of any server block
+struct MainConfig {
+    int  worker_threads;      // event loops (threads); "auto" = one per online CPU
+    int  worker_processes;    // >0: pre-forked worker processes under a master
+    bool worker_cpu_affinity; // pin worker N to CPU N % ncpu
+    int  open_file_cache;     // paths whose lookups each server keeps; 0 = off
+    int  open_file_cache_valid; // seconds a kept lookup is trusted
+    size_t response_cache;    // bytes of static responses each server keeps in memory; 0 = off
+    size_t response_cache_max_entry; // larger files are always sent from disk
+
+    MainConfig() : worker_threads(1), worker_processes(0), worker_cpu_affinity(false),
+                   open_file_cache(1024), open_file_cache_valid(5),
+                   response_cache(16 * 1024 * 1024), response_cache_max_entry(1024 * 1024) {}
+};
+
 class Config {
 public:
 
@@ -27,11 +44,33 @@ public:
     const std::vector<int>& getPorts() const;
     std::vector<std::string> hosts;
     const std::vector<std::string>& getHosts() const;
+    // listen i was marked default_server
+    bool isDefaultListen(size_t i) const;
+    // server_name values, lowercased ("*.example.com" for wildcards)
+    const std::vector<std::string>& getServerNames() const;
     const std::string& getRoot() const;
     const std::vector<LocationConfig>& getLocations() const;
+    // Plan of the longest location matching a request path, or of the server
+    // root when none does (never NULL); rel receives the offset of the path
+    // below it (see LocationRouter::match)
+    const LocationPlan* matchLocation(const std::string& path, size_t& rel) const;
     const std::map<int, std::string>& getErrorPages() const;
 	const std::string* getErrorPage(int code) const;
     size_t getMaxBodySize() const;
+    // Request bodies larger than this are spooled to a temporary file
+    size_t getBodyBufferSize() const;
+
+    // Timeouts, in seconds
+    int getHeaderTimeout() const;     // whole request head must arrive within this
+    int getBodyTimeout() const;       // max gap between two body reads
+    int getKeepaliveTimeout() const;  // idle time between requests
+    int getSendTimeout() const;       // max gap between two successful writes
+    int getCgiTimeout() const;        // CGI script run time
+
+    // Max connections taken off a listening socket per readiness event
+    int getAcceptBatch() const;
+    // Requests served on one connection before it is closed
+    int getKeepaliveRequests() const;
 
     //Helper Validating functions
 	int parseListenDirective(const std::string& token);
@@ -40,21 +79,38 @@ public:
 
 private:
     void handleListenDirective(std::istringstream& iss);
+    void handleServerNameDirective(std::istringstream& iss);
     void handleRootDirective(std::istringstream& iss);
     void handleErrorPageDirective(std::istringstream& iss);
     void handleLocationStart(std::istringstream& iss, LocationConfig& currentLocation, bool& insideLocation);
     void handleClientMaxBodySizeDirective(std::istringstream& iss);
+    void handleBodyBufferSizeDirective(std::istringstream& iss);
+    void handleTimeoutDirective(const std::string& keyword, std::istringstream& iss);
+    void handleCountDirective(const std::string& keyword, std::istringstream& iss);
     void handleLocationEnd(LocationConfig& currentLocation, bool& insideLocation);
     void handleLocationDirective(const std::string& keyword, std::istringstream& iss, LocationConfig& currentLocation);
 
     int port;                                 // Port the server will listen on
+    std::vector<bool> default_listens;        // per listen: default_server given
+    std::vector<std::string> server_names;    // Host names this block answers
     std::string root;                         // Global root directory for the server
     std::vector<LocationConfig> locations;    // List of all location blocks (e.g. "/cgi-bin", "/upload")
+    LocationRouter router;                    // locations compiled for lookup, built with the server block
     std::map<int, std::string> error_pages;   // Map of error codes to file paths (e.g., 404 → /404.html)
 	size_t max_body_size;
+	size_t body_buffer_size;
+	int header_timeout;
+	int body_timeout;
+	int keepalive_timeout;
+	int send_timeout;
+	int cgi_timeout;
+	int accept_batch;
+	int keepalive_requests;
+    std::vector<LocationPlan> plans;          // locations[i] compiled, built with the server block
+    LocationPlan unmatched;                   // requests no location matches
 
 };
 
-std::vector<Config> parseConfigFile(const std::string& filename);
+std::vector<Config> parseConfigFile(const std::string& filename, MainConfig* main = NULL);
 
 #endif
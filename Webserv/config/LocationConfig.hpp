@@ -4,18 +4,34 @@
 #include <string>
 #include <vector>
 
+// LocationConfig::expires besides a number of seconds
+enum {
+    EXPIRES_OFF   = -2,   // no Cache-Control/Expires headers
+    EXPIRES_EPOCH = -1    // already expired: clients revalidate every time
+};
+
 struct LocationConfig {
     std::string path;
     std::string root;
     std::vector<std::string> allowed_methods;
-    std::string index;
+    std::vector<std::string> index;   // index files, in the order they are tried
     std::string cgi_extension;
     std::string upload_dir;
 	std::string redirect_url; 
 	int redirect_code; 
 	bool autoindex;  
+    long expires;                // seconds static files may be cached, or EXPIRES_*
+    std::string cache_control;   // Cache-Control value; overrides what expires implies
+    bool gzip;                   // compress responses for clients that accept gzip
+    std::vector<std::string> gzip_types;   // besides text/html; "*" for any type
+    size_t gzip_min_length;      // shorter bodies are sent as they are
+    int gzip_comp_level;         // 1 (fastest) to 9 (smallest)
+    bool gzip_static;            // send file.gz instead of file when it exists
+    bool zstd_static;            // send file.zst instead of file when it exists
 
-    LocationConfig() : autoindex(false) {} 
+    LocationConfig() : redirect_code(0), autoindex(false), expires(EXPIRES_OFF), gzip(false),
+                       gzip_min_length(256), gzip_comp_level(1), gzip_static(false),
+                       zstd_static(false) {} 
 };
 
 #endif
@@ -0,0 +1,219 @@
+#include "LocationPlan.hpp"
+#include "../Request_Response/Response.hpp"
+#include <algorithm>
+#include <fcntl.h>
+#include <sstream>
+#include <strings.h>
+#include <unistd.h>
+
+unsigned methodBit(const std::string& method)
+{
+    if (method == "GET")
+        return METHOD_GET;
+    if (method == "POST")
+        return METHOD_POST;
+    if (method == "DELETE")
+        return METHOD_DELETE;
+    if (method == "HEAD")
+        return METHOD_HEAD;
+    return 0;
+}
+
+static int openRoot(const std::string& root)
+{
+    if (root.empty())
+        return -1;
+    return open(root.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+LocationPlan::LocationPlan(const LocationConfig* loc, const std::string& server_root)
+    : methods(METHOD_GET | METHOD_POST | METHOD_DELETE), kind(HANDLER_STATIC),
+      root(server_root), root_fd(-1), autoindex(false), expires(EXPIRES_OFF), gzip(false),
+      gzip_min_length(0), gzip_comp_level(1), gzip_static(false), zstd_static(false), redirect_code(0),
+      redirect_local_(false)
+{
+    if (loc)
+    {
+        path = loc->path;
+        methods = 0;
+        for (size_t i = 0; i < loc->allowed_methods.size(); ++i)
+            methods |= methodBit(loc->allowed_methods[i]);
+        if (!loc->root.empty())
+            root = loc->root;
+        index = loc->index;
+        autoindex = loc->autoindex;
+        upload_dir = loc->upload_dir;
+        expires = loc->expires;
+        cache_control = loc->cache_control;
+        gzip = loc->gzip;
+        gzip_types = loc->gzip_types;
+        gzip_min_length = loc->gzip_min_length;
+        gzip_comp_level = loc->gzip_comp_level;
+        gzip_static = loc->gzip_static;
+        zstd_static = loc->zstd_static;
+        redirect_url = loc->redirect_url;
+        redirect_code = loc->redirect_code;
+
+        if (!loc->cgi_extension.empty())
+            kind = HANDLER_CGI;
+        else if (!redirect_url.empty())
+            kind = HANDLER_REDIRECT;
+        else if (!upload_dir.empty())
+            kind = HANDLER_UPLOAD;
+    }
+    // HEAD is answered from what GET would send, except on CGI locations:
+    // there it would run the script only to drop its output
+    if ((methods & METHOD_GET) && kind != HANDLER_CGI)
+        methods |= METHOD_HEAD;
+    gzip_types.push_back("text/html");
+    if (index.empty())
+        index.push_back("index.html");
+    if (!redirect_url.empty())
+        compileRedirect();
+    root_fd = openRoot(root);
+}
+
+LocationPlan::LocationPlan(const LocationPlan& other)
+    : path(other.path), methods(other.methods), kind(other.kind), root(other.root),
+      root_fd(other.root_fd >= 0 ? fcntl(other.root_fd, F_DUPFD_CLOEXEC, 0) : -1),
+      index(other.index), autoindex(other.autoindex), upload_dir(other.upload_dir),
+      expires(other.expires), cache_control(other.cache_control), gzip(other.gzip),
+      gzip_types(other.gzip_types), gzip_min_length(other.gzip_min_length),
+      gzip_comp_level(other.gzip_comp_level), gzip_static(other.gzip_static),
+      zstd_static(other.zstd_static), redirect_code(other.redirect_code), redirect_url(other.redirect_url),
+      redirect_head(other.redirect_head), redirect_body(other.redirect_body),
+      redirect_host_(other.redirect_host_), redirect_local_(other.redirect_local_)
+{
+}
+
+LocationPlan& LocationPlan::operator=(const LocationPlan& other)
+{
+    if (this != &other)
+    {
+        LocationPlan copy(other);
+        std::swap(root_fd, copy.root_fd);   // copy closes our old fd
+        path = other.path;
+        methods = other.methods;
+        kind = other.kind;
+        root = other.root;
+        index = other.index;
+        autoindex = other.autoindex;
+        upload_dir = other.upload_dir;
+        expires = other.expires;
+        cache_control = other.cache_control;
+        gzip = other.gzip;
+        gzip_types = other.gzip_types;
+        gzip_min_length = other.gzip_min_length;
+        gzip_comp_level = other.gzip_comp_level;
+        gzip_static = other.gzip_static;
+        zstd_static = other.zstd_static;
+        redirect_code = other.redirect_code;
+        redirect_url = other.redirect_url;
+        redirect_head = other.redirect_head;
+        redirect_body = other.redirect_body;
+        redirect_host_ = other.redirect_host_;
+        redirect_local_ = other.redirect_local_;
+    }
+    return *this;
+}
+
+LocationPlan::~LocationPlan()
+{
+    if (root_fd >= 0)
+        close(root_fd);
+}
+
+// rel as a path relative to root_fd: no leading '/' (which would escape
+// the directory), "." for the root itself
+static const char* belowRoot(const std::string& rel)
+{
+    size_t skip = rel.find_first_not_of('/');
+    return skip == std::string::npos ? "." : rel.c_str() + skip;
+}
+
+bool LocationPlan::statBelowRoot(const std::string& rel, struct stat& st) const
+{
+    if (root_fd < 0)
+        return stat((root + "/" + rel).c_str(), &st) == 0;
+    return fstatat(root_fd, belowRoot(rel), &st, 0) == 0;
+}
+
+bool LocationPlan::accessBelowRoot(const std::string& rel, int mode) const
+{
+    if (root_fd < 0)
+        return access((root + "/" + rel).c_str(), mode) == 0;
+    return faccessat(root_fd, belowRoot(rel), mode, 0) == 0;
+}
+
+int LocationPlan::openBelowRoot(const std::string& rel, int flags) const
+{
+    if (root_fd < 0)
+        return open((root + "/" + rel).c_str(), flags);
+    return openat(root_fd, belowRoot(rel), flags);
+}
+
+// Serializes everything of the redirect response but the connection headers
+void LocationPlan::compileRedirect()
+{
+    if (redirect_code < 300 || redirect_code > 399)
+        redirect_code = 301;
+
+    std::ostringstream body;
+    body << "<html><head><title>" << redirect_code << " Redirect</title></head><body>"
+         << "<h1>" << redirect_code << " Redirect</h1>"
+         << "<p>Redirecting to <a href=\"" << redirect_url << "\">" << redirect_url << "</a></p>"
+         << "</body></html>";
+    redirect_body = body.str();
+
+    std::ostringstream head;
+    head << "HTTP/1.1 " << redirect_code << " " << Response::getStatusMessage(redirect_code) << "\r\n"
+         << "Cache-Control: no-store, no-cache, must-revalidate, max-age=0\r\n"
+         << "Content-Length: " << redirect_body.size() << "\r\n"
+         << "Content-Type: text/html\r\n"
+         << "Expires: 0\r\n"
+         << "Location: " << redirect_url << "\r\n"
+         << "Pragma: no-cache\r\n";
+    redirect_head = head.str();
+
+    // "/path" stays on this server; "http://host[:port]/..." stays only when
+    // host[:port] is what the client asked for
+    redirect_local_ = redirect_url[0] == '/';
+    size_t start = std::string::npos;
+    if (redirect_url.compare(0, 7, "http://") == 0 || redirect_url.compare(0, 8, "https://") == 0)
+        start = redirect_url.find("://") + 3;
+    if (start != std::string::npos)
+        redirect_host_ = redirect_url.substr(start, redirect_url.find('/', start) - start);
+}
+
+bool LocationPlan::redirectLeavesHost(const std::string& host) const
+{
+    if (redirect_local_)
+        return false;
+    if (redirect_host_.empty() || host.size() != redirect_host_.size())
+        return true;
+    for (size_t i = 0; i < host.size(); ++i)
+    {
+        char a = host[i], b = redirect_host_[i];
+        if ('A' <= a && a <= 'Z')
+            a = char(a - 'A' + 'a');
+        if ('A' <= b && b <= 'Z')
+            b = char(b - 'A' + 'a');
+        if (a != b)
+            return true;
+    }
+    return false;
+}
+
+bool LocationPlan::compresses(const std::string& content_type, size_t length) const
+{
+    if (!gzip || length < gzip_min_length)
+        return false;
+    // The media type without parameters ("; charset=...")
+    size_t end = content_type.find(';');
+    std::string type = content_type.substr(0, end);
+    type.erase(type.find_last_not_of(" \t") + 1);
+    for (size_t i = 0; i < gzip_types.size(); ++i)
+        if (gzip_types[i] == "*" || strcasecmp(gzip_types[i].c_str(), type.c_str()) == 0)
+            return true;
+    return false;
+}
@@ -0,0 +1,89 @@
+#ifndef LOCATIONPLAN_HPP
+#define LOCATIONPLAN_HPP
+
+#include "LocationConfig.hpp"
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+// Request methods as bits, so allowed-method checks are one AND
+enum MethodBit {
+    METHOD_GET    = 1 << 0,
+    METHOD_POST   = 1 << 1,
+    METHOD_DELETE = 1 << 2,
+    METHOD_HEAD   = 1 << 3    // allowed wherever GET is, CGI locations aside
+};
+
+// The METHOD_* bit of a request method, 0 for a method the server does not
+// implement
+unsigned methodBit(const std::string& method);
+
+// What a location does with the requests routed to it. A location with
+// several of the directives takes the first kind listed.
+enum HandlerKind {
+    HANDLER_CGI,       // cgi_extension: executables below root are run
+    HANDLER_REDIRECT,  // return <code> <url>
+    HANDLER_UPLOAD,    // upload_dir: POST bodies are stored there
+    HANDLER_STATIC     // files, index files and autoindex below root
+};
+
+// A location block compiled once at config load: everything dispatch needs,
+// in the form it needs it, so a request never goes back to the directive
+// strings. The server root stands in for a missing location root, and a
+// plan without a location (path "") serves requests no location matched.
+class LocationPlan {
+public:
+    LocationPlan(const LocationConfig* loc, const std::string& server_root);
+    LocationPlan(const LocationPlan& other);
+    LocationPlan& operator=(const LocationPlan& other);
+    ~LocationPlan();
+
+    bool allows(unsigned method) const { return (methods & method) != 0; }
+
+    // stat(), access() and open() of rel (a path below root) through
+    // root_fd, so the lookup starts at the root instead of walking it from
+    // the cwd
+    bool statBelowRoot(const std::string& rel, struct stat& st) const;
+    bool accessBelowRoot(const std::string& rel, int mode) const;
+    int  openBelowRoot(const std::string& rel, int flags) const;
+
+    // Whether a request from a client that addressed us as host has to leave
+    // this server to follow the redirect
+    bool redirectLeavesHost(const std::string& host) const;
+
+    // Whether a body of this Content-Type and length is gzip coded for
+    // clients that accept it
+    bool compresses(const std::string& content_type, size_t length) const;
+
+    std::string              path;        // location prefix, "" for the fallback plan
+    unsigned                 methods;     // METHOD_* bits
+    HandlerKind              kind;
+    std::string              root;
+    int                      root_fd;     // root opened as an O_PATH directory, -1 if that failed
+    std::vector<std::string> index;       // tried in order for a directory
+    bool                     autoindex;
+    std::string              upload_dir;
+    long                     expires;        // static files: seconds, or EXPIRES_*
+    std::string              cache_control;  // static files: Cache-Control override
+    bool                     gzip;
+    std::vector<std::string> gzip_types;     // text/html included
+    size_t                   gzip_min_length;
+    int                      gzip_comp_level;
+    bool                     gzip_static;    // file.gz sidecars are sent when accepted
+    bool                     zstd_static;    // file.zst sidecars likewise
+
+    // HANDLER_REDIRECT: the response minus the connection headers, which
+    // depend on the connection (see WebServer::send_redirect_response)
+    int                      redirect_code;
+    std::string              redirect_url;
+    std::string              redirect_head;  // status line and header lines
+    std::string              redirect_body;
+
+private:
+    void compileRedirect();
+
+    std::string              redirect_host_;   // host[:port] of an absolute URL
+    bool                     redirect_local_;  // URL is a path on this server
+};
+
+#endif
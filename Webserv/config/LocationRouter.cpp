@@ -0,0 +1,124 @@
+#include "LocationRouter.hpp"
+#include <cstring>
+#include <map>
+
+LocationRouter::LocationRouter() {}
+
+namespace {
+
+// Tree as it is built: one node per distinct prefix that ends a location
+// or branches, children keyed by the first byte of their label
+struct BuildNode {
+    std::string         label;
+    int                 loc;
+    std::map<char, int> kids;
+
+    explicit BuildNode(const std::string& l, int i = -1) : label(l), loc(i) {}
+};
+
+void insert(std::vector<BuildNode>& tree, const std::string& key, int loc)
+{
+    int n = 0;
+    size_t i = 0;
+    while (i < key.size())
+    {
+        std::map<char, int>::iterator it = tree[n].kids.find(key[i]);
+        if (it == tree[n].kids.end())
+        {
+            tree.push_back(BuildNode(key.substr(i), loc));
+            tree[n].kids[key[i]] = static_cast<int>(tree.size() - 1);
+            return;
+        }
+        int c = it->second;
+        const std::string label = tree[c].label;
+        size_t k = 0;
+        while (k < label.size() && i + k < key.size() && label[k] == key[i + k])
+            ++k;
+        if (k < label.size())
+        {
+            // The key leaves the edge part-way: split it at k
+            tree.push_back(BuildNode(label.substr(0, k)));
+            int mid = static_cast<int>(tree.size() - 1);
+            tree[c].label = label.substr(k);
+            tree[mid].kids[label[k]] = c;
+            tree[n].kids[key[i]] = mid;
+            c = mid;
+        }
+        n = c;
+        i += k;
+    }
+    if (tree[n].loc < 0)   // first declaration of a path wins
+        tree[n].loc = loc;
+}
+
+} // namespace
+
+void LocationRouter::build(const std::vector<LocationConfig>& locations)
+{
+    std::vector<BuildNode> tree(1, BuildNode(""));
+    for (size_t i = 0; i < locations.size(); ++i)
+        if (!locations[i].path.empty())   // an empty path never matched
+            insert(tree, locations[i].path, static_cast<int>(i));
+
+    // Lay the tree out breadth-first so every node's children are adjacent
+    nodes_.clear();
+    labels_.clear();
+    kid_first_.clear();
+    std::vector<int> order(1, 0);
+    for (size_t q = 0; q < order.size(); ++q)
+    {
+        const BuildNode& b = tree[order[q]];
+        Node n;
+        n.label_off = labels_.size();
+        n.label_len = b.label.size();
+        n.loc = b.loc;
+        n.any_suffix = b.loc >= 0 && locations[b.loc].path == "/";
+        n.kids = order.size();
+        n.kid_count = b.kids.size();
+        labels_ += b.label;
+        for (std::map<char, int>::const_iterator it = b.kids.begin(); it != b.kids.end(); ++it)
+            order.push_back(it->second);
+        nodes_.push_back(n);
+        kid_first_ += b.label.empty() ? '\0' : b.label[0];
+    }
+}
+
+int LocationRouter::match(const std::string& path, size_t& rel) const
+{
+    const char* p = path.data();
+    const size_t len = path.size();
+    int best = -1;
+    size_t best_depth = 0;
+    bool best_any = false;
+    size_t n = 0, depth = 0;
+
+    while (n < nodes_.size())
+    {
+        const Node& node = nodes_[n];
+        if (node.loc >= 0 && (depth == len || node.any_suffix || p[depth] == '/'))
+        {
+            best = node.loc;
+            best_depth = depth;
+            best_any = node.any_suffix;
+        }
+        if (depth == len || node.kid_count == 0)
+            break;
+        const char* k = static_cast<const char*>(
+            std::memchr(kid_first_.data() + node.kids, p[depth], node.kid_count));
+        if (!k)
+            break;
+        size_t c = static_cast<size_t>(k - kid_first_.data());
+        const Node& kid = nodes_[c];
+        if (len - depth < kid.label_len ||
+            std::memcmp(p + depth, labels_.data() + kid.label_off, kid.label_len) != 0)
+            break;
+        depth += kid.label_len;
+        n = c;
+    }
+
+    // "/" (and no match at all) maps the whole path onto a root
+    rel = best < 0 || best_any ? 0 : best_depth;
+    if (rel < len && p[rel] == '/')
+        ++rel;
+    return best;
+}
@@ -0,0 +1,46 @@
+#ifndef LOCATIONROUTER_HPP
+#define LOCATIONROUTER_HPP
+
+#include "LocationConfig.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Location lookup compiled from a server's location blocks. The paths are
+// stored in a radix tree (edges labelled with path fragments, children of a
+// node laid out next to each other), so finding the longest matching
+// location is one walk down the request path, whatever the number of
+// locations. The rules are the ones of the former linear match_location():
+// a location matches when its path is a prefix of the request path that
+// ends the path or is followed by '/', or when it is "/"; the longest wins
+// and, among equal paths, the first declared.
+//
+// The router holds indices, not pointers, so it stays valid when the owning
+// Config is copied.
+class LocationRouter {
+public:
+    LocationRouter();
+
+    void build(const std::vector<LocationConfig>& locations);
+
+    // Index into the locations it was built from, or -1. rel is set to where
+    // the request path continues below the location, past one '/': the part
+    // that maps onto the location's root (or the server root without a match).
+    int  match(const std::string& path, size_t& rel) const;
+
+private:
+    struct Node {
+        size_t label_off;   // edge label from the parent, in labels_
+        size_t label_len;
+        int    loc;         // location ending here, -1 if none
+        bool   any_suffix;  // location "/" (matches without a boundary)
+        size_t kids;        // first child; children are contiguous
+        size_t kid_count;
+    };
+
+    std::vector<Node> nodes_;      // nodes_[0] is the root (empty label)
+    std::string       labels_;
+    std::string       kid_first_;  // first label byte of nodes_[i], for child search
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "VirtualHosts.hpp"
+#include "Config.hpp"
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+// FNV-1a
+static unsigned hashName(const char* p, size_t n)
+{
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < n; ++i)
+    {
+        h ^= static_cast<unsigned char>(p[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+VirtualHosts::VirtualHosts(const std::string& host, int port)
+    : host_(host), port_(port), default_(NULL), has_default_(false) {}
+
+void VirtualHosts::add(const Config& server, bool is_default)
+{
+    if (servers_.empty() || servers_.back() != &server)
+        servers_.push_back(&server);
+    if (is_default)
+    {
+        if (has_default_ && default_ != &server)
+        {
+            std::ostringstream oss;
+            oss << "listen: more than one default_server for " << host_ << ":" << port_;
+            throw std::runtime_error(oss.str());
+        }
+        default_ = &server;
+        has_default_ = true;
+    }
+    else if (!default_)
+        default_ = &server;
+}
+
+void VirtualHosts::insert(std::vector<Slot>& table, unsigned hash, const std::string& name,
+                          const Config* server)
+{
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        if (!table[i].server)
+        {
+            table[i].hash = hash;
+            table[i].name = name;
+            table[i].server = server;
+            return;
+        }
+        if (table[i].hash == hash && table[i].name == name)
+        {
+            if (table[i].server != server)
+                Logger::log(LOG_ERROR, "VirtualHosts", "server_name " + name + " is used by an earlier "
+                            "server block on the same address; ignored");
+            return;
+        }
+    }
+}
+
+// Tables are at most half full, so the probe always reaches an empty slot
+const Config* VirtualHosts::find(const std::vector<Slot>& table, const char* name, size_t len)
+{
+    if (table.empty())
+        return NULL;
+    unsigned hash = hashName(name, len);
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask; table[i].server; i = (i + 1) & mask)
+        if (table[i].hash == hash && table[i].name.size() == len &&
+            table[i].name.compare(0, len, name, len) == 0)
+            return table[i].server;
+    return NULL;
+}
+
+static size_t tableSize(size_t names)
+{
+    size_t n = 8;
+    while (n < names * 2)
+        n *= 2;
+    return n;
+}
+
+void VirtualHosts::build()
+{
+    size_t exact = 0, wild = 0;
+    for (size_t s = 0; s < servers_.size(); ++s)
+    {
+        const std::vector<std::string>& names = servers_[s]->getServerNames();
+        for (size_t i = 0; i < names.size(); ++i)
+            (names[i][0] == '*' ? wild : exact)++;
+    }
+    exact_.assign(exact ? tableSize(exact) : 0, Slot());
+    wildcard_.assign(wild ? tableSize(wild) : 0, Slot());
+
+    for (size_t s = 0; s < servers_.size(); ++s)
+    {
+        const std::vector<std::string>& names = servers_[s]->getServerNames();
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            // "*.example.com" is kept as ".example.com", the form select() probes
+            std::string key = names[i][0] == '*' ? names[i].substr(1) : names[i];
+            insert(names[i][0] == '*' ? wildcard_ : exact_, hashName(key.data(), key.size()), key,
+                   servers_[s]);
+        }
+    }
+}
+
+const Config& VirtualHosts::select(const char* host, size_t len) const
+{
+    if (exact_.empty() && wildcard_.empty())
+        return *default_;
+
+    // "name:port" -> "name", "name." -> "name"
+    for (size_t i = len; i > 0; --i)
+    {
+        char c = host[i - 1];
+        if (c == ':')
+        {
+            len = i - 1;
+            break;
+        }
+        if (c < '0' || c > '9')
+            break;
+    }
+    if (len > 0 && host[len - 1] == '.')
+        --len;
+
+    char name[256];
+    if (len == 0 || len > sizeof(name))
+        return *default_;
+    for (size_t i = 0; i < len; ++i)
+    {
+        char c = host[i];
+        name[i] = (c >= 'A' && c <= 'Z') ? char(c - 'A' + 'a') : c;
+    }
+
+    if (const Config* server = find(exact_, name, len))
+        return *server;
+    // Leftmost dot first: the longest wildcard wins
+    if (!wildcard_.empty())
+        for (size_t i = 1; i < len; ++i)
+            if (name[i] == '.')
+                if (const Config* server = find(wildcard_, name + i, len - i))
+                    return *server;
+    return *default_;
+}
+
+std::vector<VirtualHosts> groupListeners(const std::vector<Config>& servers)
+{
+    std::vector<VirtualHosts> groups;
+    std::map<std::string, size_t> byAddress;
+
+    for (size_t s = 0; s < servers.size(); ++s)
+    {
+        const std::vector<int>& ports = servers[s].getPorts();
+        const std::vector<std::string>& hosts = servers[s].getHosts();
+        for (size_t i = 0; i < ports.size(); ++i)
+        {
+            std::string host = i < hosts.size() ? hosts[i] : std::string();
+            std::ostringstream key;
+            key << (host == "localhost" ? std::string("127.0.0.1") : host) << ":" << ports[i];
+
+            std::map<std::string, size_t>::iterator it = byAddress.find(key.str());
+            if (it == byAddress.end())
+            {
+                it = byAddress.insert(std::make_pair(key.str(), groups.size())).first;
+                groups.push_back(VirtualHosts(host, ports[i]));
+            }
+            groups[it->second].add(servers[s], servers[s].isDefaultListen(i));
+        }
+    }
+    for (size_t g = 0; g < groups.size(); ++g)
+        groups[g].build();
+    return groups;
+}
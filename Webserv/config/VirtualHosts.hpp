@@ -0,0 +1,63 @@
+#ifndef VIRTUALHOSTS_HPP
+#define VIRTUALHOSTS_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class Config;
+
+// The server blocks that listen on one address, and which of them answers
+// a given Host header. Exact server_names and "*.suffix" wildcards each go
+// into an open-addressing hash table, so picking a server costs one probe
+// for the name plus one per dot in it, whatever the number of blocks. Order
+// of precedence: exact name, longest wildcard, then the default server (the
+// block whose listen says default_server, else the first one).
+//
+// Holds pointers to the Configs it was built from; they must outlive it.
+class VirtualHosts {
+public:
+    VirtualHosts(const std::string& host, int port);
+
+    const std::string& host() const { return host_; }
+    int                port() const { return port_; }
+    size_t             size() const { return servers_.size(); }
+
+    const Config& defaultServer() const { return *default_; }
+
+    // The server for the Host header value host[0, len) ("name" or
+    // "name:port", any case); the default server when no name matches
+    const Config& select(const char* host, size_t len) const;
+
+private:
+    friend std::vector<VirtualHosts> groupListeners(const std::vector<Config>& servers);
+
+    struct Slot {
+        unsigned      hash;
+        std::string   name;
+        const Config* server;   // NULL: empty slot
+
+        Slot() : hash(0), server(NULL) {}
+    };
+
+    void add(const Config& server, bool is_default);
+    void build();
+    static void insert(std::vector<Slot>& table, unsigned hash, const std::string& name,
+                       const Config* server);
+    static const Config* find(const std::vector<Slot>& table, const char* name, size_t len);
+
+    std::string                 host_;
+    int                         port_;
+    std::vector<const Config*>  servers_;     // in config order
+    const Config*               default_;
+    bool                        has_default_; // set by an explicit default_server
+    std::vector<Slot>           exact_;       // size is a power of two
+    std::vector<Slot>           wildcard_;    // keyed by ".suffix"
+};
+
+// One VirtualHosts per distinct listen address (localhost and 127.0.0.1 are
+// the same address), in order of first appearance. Throws on two
+// default_server blocks for one address.
+std::vector<VirtualHosts> groupListeners(const std::vector<Config>& servers);
+
+#endif
@@ -1,5 +1,6 @@
 #include "WebServer.hpp"
 #include "Config.hpp"
+#include "VirtualHosts.hpp"
 #include "CGIHandler.hpp"
 #include "Request.hpp"
 #include "logger/Logger.hpp" // Add this include
@@ -9,10 +10,14 @@
 #include <sys/wait.h>
 #include <unistd.h>
 #include <vector>
-#include <poll.h>
+#include "EventLoop.hpp"
 #include <ctime>
+#include <cerrno>
 #include <sstream>
+#include <cstdlib>
 #include <algorithm>
+#include <pthread.h>
+#include <sched.h>
 
 struct ClientState {
     std::string buffer;
@@ -21,18 +26,46 @@ struct ClientState {
     // maybe more...
 };
 
-volatile bool g_running = true;
+// Set by the signal handler; only read by the thread that takes the signal
+static volatile sig_atomic_t g_stop = 0;
+// The loop run by that thread, if it runs one (single worker, worker process)
+static EventLoop *volatile g_signal_loop = NULL;
 std::vector<WebServer *> g_servers;
 
+// One event loop with its own servers (listening sockets + connections).
+// Nothing in here is shared with another worker.
+struct Worker {
+    int                      id;
+    int                      cpu;      // -1 = not pinned
+    pthread_t                thread;
+    EventLoop               *loop;     // threads: created by the main thread, which stops it
+    std::vector<WebServer *> servers;
+
+    Worker() : id(0), cpu(-1), thread(), loop(NULL), servers() {}
+};
+
 static void sigint_handler(int /*signum*/)
 {
-    g_running = false;
-    // Shut down all servers immediately
-    for (size_t i = 0; i < g_servers.size(); ++i)
+    // Flag and wake only: the loop returns from wait() and the servers are
+    // shut down from normal context afterwards
+    int saved = errno;
+    g_stop = 1;
+    if (g_signal_loop)
+        g_signal_loop->stop();
+    errno = saved;
+}
+
+// For its lifetime, the signal handler wakes loop: the calling thread takes
+// SIGINT/SIGTERM and runs it
+struct SignalLoopGuard {
+    explicit SignalLoopGuard(EventLoop &loop)
     {
-        g_servers[i]->shutdown();
+        g_signal_loop = &loop;
+        if (g_stop)
+            loop.stop(); // the signal came before the handler knew the loop
     }
-}
+    ~SignalLoopGuard() { g_signal_loop = NULL; }
+};
 
 /**
  * Log configuration details for debugging purposes
@@ -77,246 +110,335 @@ static void setupSignalHandlers()
     sigaction(SIGINT, &sa, 0);
     // Register the handler for SIGTERM (kill)
     sigaction(SIGTERM, &sa, 0);
+    // A keep-alive peer can reset the connection while a response is
+    // queued; let write() fail with EPIPE instead of killing the server
+    signal(SIGPIPE, SIG_IGN);
 }
 
 /**
- * Create WebServer instances for each configuration
+ * Create one WebServer per listen address; it serves every server block
+ * that listens there
  */
-static void createServers(const std::vector<Config> &configs)
+static void createServers(const std::vector<VirtualHosts> &listeners, const MainConfig &main,
+                          std::vector<WebServer *> &out, bool reusePort)
 {
-    for (size_t i = 0; i < configs.size(); ++i)
+    for (size_t i = 0; i < listeners.size(); ++i)
     {
-        WebServer *srv = new WebServer(configs[i]);
+        WebServer *srv = new WebServer(listeners[i], main, reusePort);
         g_servers.push_back(srv);
+        out.push_back(srv);
     }
 }
 
 /**
- * Build poll file descriptors for all servers
+ * Register every listening socket with the event loop (once)
+ */
+static void attachServers(EventLoop *loop, const std::vector<WebServer *> &servers)
+{
+    for (size_t si = 0; si < servers.size(); ++si)
+        servers[si]->attachEventLoop(loop);
+}
+
+/**
+ * Cleanup all servers and free memory
  */
-static void buildPollFds(std::vector<struct pollfd> &fds)
+static void cleanupServers()
 {
-    fds.clear();
-    
     for (size_t si = 0; si < g_servers.size(); ++si)
     {
-        WebServer *srv = g_servers[si];
+        // The loop may already be gone (exception path); closing the fds is enough
+        g_servers[si]->attachEventLoop(NULL);
+        delete g_servers[si];
+    }
+    g_servers.clear();
+}
+
+/**
+ * Dispatch the ready file descriptors reported by the event loop.
+ * The owner of each fd comes from its registered handle (one array lookup).
+ */
+static void handleEvents(EventLoop &loop, const std::vector<IoEvent> &events)
+{
+    for (size_t ei = 0; ei < events.size(); ++ei)
+    {
+        const IoEvent &e = events[ei];
+        // Copy: handling the event may release (and a later accept re-bind) the slot
+        FdHandle h = loop.handle(e.fd);
 
-        // listening sockets (only care about new connections)
-        const std::vector<int> &ls = srv->getListeningSockets();
-        for (size_t j = 0; j < ls.size(); ++j)
+        switch (h.kind)
         {
-            struct pollfd pfd;
-            pfd.fd = ls[j];
-            pfd.events = POLLIN;
-            pfd.revents = 0;
-            fds.push_back(pfd);
-        }
+        case FD_LISTENER:
+            if (e.events & IO_READ)
+                h.owner->handleNewConnection(e.fd);
+            break;
 
-        // client sockets (watch for read *and* conditional write)
-        std::vector<int> cs = srv->getClientSockets();
-        for (size_t j = 0; j < cs.size(); ++j)
-        {
-            int fd = cs[j];
-            struct pollfd pfd;
-            pfd.fd = fd;
-            pfd.events = POLLIN | (srv->hasPendingWrite(fd) ? POLLOUT : 0);
-            pfd.revents = 0;
-            fds.push_back(pfd);
-        }
+        case FD_CLIENT:
+            // 1) Incoming data? (hang-ups are reported as readable)
+            if (e.events & IO_READ)
+                h.owner->handleClientDataOn(e.fd);
+            // 2) Ready to write? Skip if the read path already closed it.
+            if ((e.events & IO_WRITE) && loop.handle(e.fd).kind == FD_CLIENT)
+                h.owner->flushPendingWrites(e.fd);
+            break;
 
-        std::map<int, Connection>& connections = srv->getConnections();
-        for (std::map<int, Connection>::iterator it = connections.begin(); it != connections.end(); ++it) {
-            Connection &conn = it->second;
-            if (conn.cgi_active) {
-                // POLLOUT for writing to CGI stdin (write end)
-                if (conn.cgi_stdin_fd[1] != -1 && !conn.cgi_input_buffer.empty()) {
-                    struct pollfd pfd;
-                    pfd.fd = conn.cgi_stdin_fd[1];
-                    pfd.events = POLLOUT;
-                    pfd.revents = 0;
-                    fds.push_back(pfd);
-                }
-                // POLLIN for reading from CGI stdout (read end)
-                if (conn.cgi_stdout_fd[0] != -1) {
-                    struct pollfd pfd;
-                    pfd.fd = conn.cgi_stdout_fd[0];
-                    pfd.events = POLLIN;
-                    pfd.revents = 0;
-                    fds.push_back(pfd);
-                }
-            }
+        case FD_CGI_STDIN:
+            // Writable, or the script closed its end (reported as an error)
+            h.owner->onCgiInput(h.client_fd);
+            break;
+
+        case FD_CGI_STDOUT:
+            // Output or EOF
+            h.owner->onCgiOutput(h.client_fd);
+            break;
+
+        case FD_NONE:
+            // Closed earlier in this batch; stale readiness
+            break;
         }
     }
 }
 
 /**
- * Handle incoming connections and data
+ * Fire every connection deadline that is due. Only expired entries are
+ * touched; the rest of the heap is not visited.
  */
-static void handlePollIn(int fd)
+static void expireTimers(EventLoop &loop)
 {
-    bool handled = false;
+    long now = TimerQueue::now();
+    TimerEntry t;
+    while (loop.timers().popExpired(now, t))
+        t.owner->onTimer(t, now);
+}
 
-    // a) New connection?
-    for (size_t si = 0; si < g_servers.size(); ++si)
+/**
+ * Main server loop: wait for readiness and dispatch events until stop()
+ */
+static void runServerLoop(EventLoop &loop)
+{
+    std::vector<IoEvent> events;
+    while (!loop.stopped())
     {
-        WebServer *srv = g_servers[si];
-        const std::vector<int> &ls = srv->getListeningSockets();
-        for (size_t j = 0; j < ls.size(); ++j)
-        {
-            if (ls[j] == fd)
-            {
-                srv->handleNewConnection(fd);
-                handled = true;
-                break;
-            }
-        }
-        if (handled)
-            break;
-    }
+        // Sleep until the nearest deadline, or until stop() wakes the loop
+        int timeout = loop.timers().timeoutMs(TimerQueue::now(), -1);
+        loop.wait(events, timeout);
 
-    // b) Existing client data?
-    if (!handled)
-    {
-        for (size_t si = 0; si < g_servers.size(); ++si)
-        {
-            WebServer *srv = g_servers[si];
-            std::vector<int> cs = srv->getClientSockets();
-            for (size_t j = 0; j < cs.size(); ++j)
-            {
-                if (cs[j] == fd)
-                {
-                    srv->handleClientDataOn(fd);
-                    break;
-                }
-            }
-        }
+        // Handle ready file descriptors
+        handleEvents(loop, events);
+
+        expireTimers(loop);
     }
 }
 
-static void handlePollOut(int fd)
+/**
+ * Run one worker's event loop on the calling thread
+ */
+static void runWorker(Worker &w, EventLoop &loop)
 {
-    // Find which server owns this fd and flush its buffer
-    for (size_t si = 0; si < g_servers.size(); ++si)
+    attachServers(&loop, w.servers);
+    runServerLoop(loop);
+    attachServers(NULL, w.servers);
+}
+
+static void pinWorker(const Worker &w)
+{
+    if (w.cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w.cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        Logger::log(LOG_ERROR, "main", "worker " + to_str(w.id) + ": could not pin to CPU " + to_str(w.cpu));
+}
+
+static void *workerMain(void *arg)
+{
+    Worker *w = static_cast<Worker *>(arg);
+
+    pinWorker(*w);
+
+    try
     {
-        WebServer *srv = g_servers[si];
-        // If this fd belongs to srv, it will handle it
-        std::vector<int> cs = srv->getClientSockets();
-        if (std::find(cs.begin(), cs.end(), fd) != cs.end())
-        {
-            srv->flushPendingWrites(fd);
-            break;
-        }
+        runWorker(*w, *w->loop);
     }
+    catch (const std::exception &e)
+    {
+        Logger::log(LOG_ERROR, "main", "worker " + to_str(w->id) + " failed: " + e.what());
+        // The main thread takes the signal and stops the other workers
+        kill(getpid(), SIGTERM);
+    }
+    return NULL;
 }
 
 /**
- * Handle poll events for all file descriptors
+ * worker_threads > 1: one event loop per thread, each with its own
+ * SO_REUSEPORT listeners and connection tables.
  */
-static void handlePollEvents(const std::vector<struct pollfd> &fds)
+static void runThreadedWorkers(const std::vector<VirtualHosts> &listeners, const MainConfig &main)
 {
-    for (size_t pi = 0; pi < fds.size(); ++pi)
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+        ncpu = 1;
+
+    std::vector<Worker> workers(main.worker_threads);
+    for (size_t i = 0; i < workers.size(); ++i)
     {
-        const struct pollfd &p = fds[pi];
-        bool cgi_event = false;
-        for (size_t si = 0; si < g_servers.size(); ++si) {
-            WebServer *srv = g_servers[si];
-            std::map<int, Connection>& connections = srv->getConnections();
-            for (std::map<int, Connection>::iterator it = connections.begin(); it != connections.end(); ++it) {
-                Connection &conn = it->second;
-                if (conn.cgi_active) {
-                    if (p.fd == conn.cgi_stdin_fd[1] && (p.revents & POLLOUT)) {
-                        std::cout << "[DEBUG] POLLOUT on CGI stdin fd=" << p.fd << " for client fd=" << it->first << std::endl;
-                        cgi_event = true;
-                    }
-                    if (p.fd == conn.cgi_stdout_fd[0] && (p.revents & POLLIN)) {
-                        std::cout << "[DEBUG] POLLIN on CGI stdout fd=" << p.fd << " for client fd=" << it->first << std::endl;
-                        cgi_event = true;
-                    }
-                }
-            }
-        }
-        // 1) Incoming connection or data?
-        if (p.revents & POLLIN)
-        {
-            handlePollIn(p.fd);
-        }
+        workers[i].id = static_cast<int>(i);
+        workers[i].cpu = main.worker_cpu_affinity ? static_cast<int>(i % ncpu) : -1;
+        workers[i].loop = new EventLoop();
+        createServers(listeners, main, workers[i].servers, true);
+    }
+
+    // Workers inherit a mask with SIGINT/SIGTERM blocked; the main thread
+    // takes the signal and stops each worker's loop.
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
 
-        // 2) Ready to write?
-        if (p.revents & POLLOUT)
+    size_t started = 0;
+    for (; started < workers.size(); ++started)
+    {
+        if (pthread_create(&workers[started].thread, NULL, workerMain, &workers[started]) != 0)
         {
-            handlePollOut(p.fd);
-        }
-        if (cgi_event) {
-            std::cout << "[DEBUG] CGI event handled for fd=" << p.fd << std::endl;
+            Logger::log(LOG_ERROR, "main", "pthread_create failed for worker " + to_str(started));
+            g_stop = 1;
+            break;
         }
     }
+    Logger::log(LOG_INFO, "main", "Started " + to_str(started) + " worker threads");
+
+    while (!g_stop)
+        sigsuspend(&old);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    for (size_t i = 0; i < started; ++i)
+        workers[i].loop->stop();
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(workers[i].thread, NULL);
+    for (size_t i = 0; i < workers.size(); ++i)
+        delete workers[i].loop;
 }
 
-static void checkClientTimeouts()
+/**
+ * Child side of the pre-fork model: serve on the inherited listeners until
+ * told to stop. Never returns.
+ */
+static void runWorkerProcess(Worker &w)
 {
-    time_t now = time(NULL);
-    int client_timeout = 10; // test value
-
-    for (size_t si = 0; si < g_servers.size(); ++si)
+    int code = 0;
+    pinWorker(w);
+    try
     {
-        WebServer *srv = g_servers[si];
-        std::vector<int> cs = srv->getClientSockets();
-
-        for (int j = static_cast<int>(cs.size()) - 1; j >= 0; --j)
-        {
-            int fd = cs[j];
-            time_t last_active = srv->getClientLastActive(fd);
-            if (last_active > 0 && (now - last_active) > client_timeout)
-            {
-                Logger::log(LOG_INFO, "main",
-                    "Client fd=" + to_str(fd) + " timed out after " +
-                    to_str(now - last_active) + " seconds");
-
-                // Enqueue 408; DO NOT write or close here
-                srv->send_error_response(fd, 408, "Request Timeout", si);
-                srv->markCloseAfterWrite(fd);   // close once buffer drains via POLLOUT
-            }
-        }
+        EventLoop loop;
+        SignalLoopGuard guard(loop);
+        runWorker(w, loop);
+    }
+    catch (const std::exception &e)
+    {
+        Logger::log(LOG_ERROR, "main", "worker process " + to_str(w.id) + " failed: " + e.what());
+        code = 1;
     }
+    cleanupServers();
+    std::exit(code);
 }
 
+static pid_t spawnWorkerProcess(Worker &w)
+{
+    std::cout.flush(); // don't let the child replay buffered output
+    pid_t pid = fork();
+    if (pid == 0)
+        runWorkerProcess(w);
+    if (pid < 0)
+        Logger::log(LOG_ERROR, "main", "fork failed for worker process " + to_str(w.id));
+    else
+        Logger::log(LOG_INFO, "main", "Worker process " + to_str(w.id) + " started (pid " + to_str(pid) + ")");
+    return pid;
+}
 
 /**
- * Main server loop that handles all polling and events
+ * worker_processes N: the master opens the listening sockets once, forks N
+ * workers that each run the event loop on them, and restarts any worker
+ * that dies. A crash (e.g. in request or CGI handling) costs one worker's
+ * connections, not the whole server.
  */
-static void runServerLoop()
+static void runWorkerProcesses(const std::vector<VirtualHosts> &listeners, const MainConfig &main)
 {
-    while (g_running)
-    {
-        std::vector<struct pollfd> fds;
-        buildPollFds(fds);
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1)
+        ncpu = 1;
+
+    std::vector<Worker> slots(main.worker_processes);
+    std::map<pid_t, size_t> children;      // pid -> slot
+    std::vector<time_t> started(slots.size(), 0);
 
-        int ret = poll(&fds[0], fds.size(), 1000); // wait 1 second max
+    // Listeners are created once in the master and inherited by every worker
+    Worker master;
+    master.id = -1;
+    master.cpu = -1;
+    createServers(listeners, main, master.servers, false);
 
-        if (ret < 0 && errno == EINTR)
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        slots[i].id = static_cast<int>(i);
+        slots[i].cpu = main.worker_cpu_affinity ? static_cast<int>(i % ncpu) : -1;
+        slots[i].servers = master.servers;
+        pid_t pid = spawnWorkerProcess(slots[i]);
+        if (pid > 0)
         {
-            break;
+            children[pid] = i;
+            started[i] = time(NULL);
         }
+    }
 
-        // Handle ready file descriptors
-        handlePollEvents(fds);
+    while (!g_stop && !children.empty())
+    {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+                continue; // signal: g_stop decides
+            break;
+        }
+        std::map<pid_t, size_t>::iterator it = children.find(pid);
+        if (it == children.end())
+            continue;
+        size_t slot = it->second;
+        children.erase(it);
+        if (g_stop)
+            break;
 
-        // Check for client timeouts
-        checkClientTimeouts();
+        if (WIFSIGNALED(status))
+            Logger::log(LOG_ERROR, "main", "Worker process " + to_str(slot) + " (pid " + to_str(pid) +
+                        ") killed by signal " + to_str(WTERMSIG(status)) + "; restarting");
+        else
+            Logger::log(LOG_ERROR, "main", "Worker process " + to_str(slot) + " (pid " + to_str(pid) +
+                        ") exited with status " + to_str(WEXITSTATUS(status)) + "; restarting");
+
+        // Don't spin if a worker dies right after start (e.g. bad environment)
+        if (time(NULL) - started[slot] < 1)
+            sleep(1);
+        pid_t again = spawnWorkerProcess(slots[slot]);
+        if (again > 0)
+        {
+            children[again] = slot;
+            started[slot] = time(NULL);
+        }
     }
-}
 
-/**
- * Cleanup all servers and free memory
- */
-static void cleanupServers()
-{
-    for (size_t si = 0; si < g_servers.size(); ++si)
+    // Graceful stop: forward the signal, then reap everyone
+    for (std::map<pid_t, size_t>::iterator it = children.begin(); it != children.end(); ++it)
+        kill(it->first, SIGTERM);
+    while (!children.empty())
     {
-        delete g_servers[si];
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid > 0)
+            children.erase(pid);
+        else if (errno != EINTR)
+            break;
     }
-    g_servers.clear();
 }
 
 int main(int argc, char **argv)
@@ -336,20 +458,39 @@ int main(int argc, char **argv)
             std::cout << "If you do not provide any argument, default config file will be used." << std::endl;
             return 1;
         }
-        // 2) Parse all server blocks
-        std::vector<Config> configs = parseConfigFile(config_file);
+        // 2) Parse all server blocks (+ top-level directives)
+        MainConfig mainCfg;
+        std::vector<Config> configs = parseConfigFile(config_file, &mainCfg);
 
         // 3) Log configuration details
         logConfigurationDetails(configs);
 
+        // Server blocks that share a listen address share its socket
+        std::vector<VirtualHosts> listeners = groupListeners(configs);
+
         // 4) Install signal handlers for graceful shutdown
         setupSignalHandlers();
 
-        // 5) Instantiate one WebServer per Config
-        createServers(configs);
-
-        // 6) Unified non-blocking loop
-        runServerLoop();
+        // 5) + 6) One WebServer per listen address per worker, each worker
+        //         with its own non-blocking loop
+        if (mainCfg.worker_processes > 0)
+        {
+            if (mainCfg.worker_threads > 1)
+                Logger::log(LOG_INFO, "main", "worker_processes set; ignoring worker_threads");
+            runWorkerProcesses(listeners, mainCfg);
+        }
+        else if (mainCfg.worker_threads > 1)
+            runThreadedWorkers(listeners, mainCfg);
+        else
+        {
+            Worker w;
+            w.id = 0;
+            w.cpu = -1;
+            createServers(listeners, mainCfg, w.servers, false);
+            EventLoop loop;
+            SignalLoopGuard guard(loop);
+            runWorker(w, loop);
+        }
 
         // 7) Cleanup
         cleanupServers();
@@ -1,41 +1,134 @@
 #pragma once
 
 #include <string>
-#include <vector>
-#include <map>
 #include <ctime>  // for time_t and time()
-#include <netinet/in.h>  // sockaddr_in
-#include <netdb.h>      // gethostbyname
-#include <arpa/inet.h>  // inet_aton, htons
-#include <cstring>  
-#include "../logger/Logger.hpp"
-#include "Config.hpp"
-#include "LocationConfig.hpp"
-#include "Request.hpp"
-#include "Response.hpp"
-#include "CGIHandler.hpp"
-#include "utils.hpp"
+#include <sys/types.h>  // pid_t
+#include "WriteQueue.hpp"
+#include "RequestParser.hpp"
+#include "ChunkedDecoder.hpp"
 
+class Config;
+
+// What the connection is waiting for from the peer; picks the read timeout
+enum ReadPhase {
+    PHASE_HEADER,    // request head not complete yet (client_header_timeout)
+    PHASE_BODY,      // head parsed, body still arriving (client_body_timeout)
+    PHASE_IDLE       // between requests (keepalive_timeout)
+};
+
+class LocationPlan;
+
+// A CGI script running for the connection. Its pipes are registered with
+// the event loop (FD_CGI_STDIN / FD_CGI_STDOUT) and the response is sent
+// once stdout is at EOF and the script has been reaped. Most connections
+// never run a script, so this lives outside Connection and is only
+// allocated when one does.
+struct CgiState {
+    pid_t               pid;         // -1 once reaped
+    int                 stdin_fd;    // write end of the script's stdin, -1 once closed
+    int                 stdout_fd;   // read end of the script's stdout, -1 at EOF
+    std::string         input;       // request body, written as the pipe takes it
+    size_t              input_off;
+    std::string         output;      // everything the script has printed so far
+    long                deadline;    // cgi_timeout runs out (TimerQueue::now() milliseconds)
+    long                poll_at;     // stdout at EOF but no exit status yet: look again then
+    const LocationPlan* loc;         // location that ran it (response compression)
+    std::string         accept_encoding;
+    std::string         script;      // for the log
+
+    CgiState()
+        : pid(-1), stdin_fd(-1), stdout_fd(-1), input(), input_off(0), output(),
+          deadline(0), poll_at(0), loc(NULL), accept_encoding(), script() {}
+
+    // When the connection's timer has to look at the script next
+    long wakeAt() const { return (poll_at != 0 && poll_at < deadline) ? poll_at : deadline; }
+};
+
+// One slot of the ConnectionTable. Fields touched on every event come
+// first; slots are reused, so reset() must restore every one of them.
 struct Connection {
-    std::string readBuf;
-    std::string writeBuf;
-    bool        shouldCloseAfterWrite;
-    time_t      last_active;
-    pid_t       cgi_pid;
-    int         cgi_stdin_fd[2];
-    int         cgi_stdout_fd[2];
-    bool        cgi_active;
-    std::string cgi_input_buffer;
-    std::string cgi_output_buffer;
+    bool          in_use;
+    bool          shouldCloseAfterWrite;
+    bool          head_only;   // answering a HEAD request: responses are queued without body
+    ReadPhase     read_phase;
+    size_t        live_idx;    // position in ConnectionTable's list of open fds
+
+    // Timeouts (TimerQueue::now() milliseconds). While writeBuf is non-empty
+    // send_deadline applies, otherwise read_deadline.
+    long          read_deadline;
+    long          send_deadline;
+    long          timer_at;    // deadline of our entry in the timer queue, 0 = none
+    unsigned long serial;      // tells a reused fd apart from the connection that armed a timer
+    time_t        last_active;
+    unsigned      requests;    // requests started on this connection
+    const Config* server;      // server block of the current request (by Host)
+
+    std::string   readBuf;
+    RequestParser parser;      // head of the request at the front of readBuf
+    ChunkedDecoder chunks;     // chunked body of that request, decoded into body
+    RequestBody   body;        // body of that request, moved out of readBuf as it arrives
+    WriteQueue    writeBuf;
 
     Connection()
-        : readBuf(), writeBuf(), shouldCloseAfterWrite(false), last_active(time(NULL)),
-          cgi_pid(-1), cgi_active(false)
+        : in_use(false), shouldCloseAfterWrite(false), head_only(false), read_phase(PHASE_HEADER),
+          live_idx(0), read_deadline(0), send_deadline(0), timer_at(0), serial(0),
+          last_active(0), requests(0), server(NULL), readBuf(), parser(), chunks(), body(), writeBuf(), cgi_(NULL) {}
+
+    ~Connection() { delete cgi_; }
+
+    void reset()
     {
-        cgi_stdin_fd[0] = -1;
-        cgi_stdin_fd[1] = -1;
-        cgi_stdout_fd[0] = -1;
-        cgi_stdout_fd[1] = -1;
+        in_use = false;
+        shouldCloseAfterWrite = false;
+        head_only = false;
+        read_phase = PHASE_HEADER;
+        live_idx = 0;
+        read_deadline = 0;
+        send_deadline = 0;
+        timer_at = 0;
+        serial = 0;
+        last_active = time(NULL);
+        requests = 0;
+        server = NULL;
+        // Keep a modest read buffer for the next client on this fd; give
+        // back whatever a large upload grew it to
+        if (readBuf.capacity() > 16384)
+            std::string().swap(readBuf);
+        else
+            readBuf.clear();
+        resetRequest();
+        writeBuf.clear();
+        releaseCgi();
     }
-};
 
+    // Forget the request being read; the next one starts at readBuf[0]
+    void resetRequest()
+    {
+        parser.reset();
+        chunks.reset();
+        body.reset();
+    }
+
+    // The running script, or NULL
+    CgiState* cgiState() { return cgi_; }
+    bool      cgiRunning() const { return cgi_ != NULL; }
+
+    CgiState& cgi()
+    {
+        if (!cgi_)
+            cgi_ = new CgiState();
+        return *cgi_;
+    }
+
+    void releaseCgi()
+    {
+        delete cgi_;
+        cgi_ = NULL;
+    }
+
+private:
+    Connection(const Connection&);
+    Connection& operator=(const Connection&);
+
+    CgiState*     cgi_;
+};
@@ -0,0 +1,45 @@
+#include "ConnectionTable.hpp"
+
+ConnectionTable::~ConnectionTable()
+{
+    for (size_t i = 0; i < slabs_.size(); ++i)
+        delete[] slabs_[i];
+}
+
+Connection& ConnectionTable::open(int fd)
+{
+    size_t s = static_cast<size_t>(fd) >> SLAB_SHIFT;
+    if (s >= slabs_.size())
+        slabs_.resize(s + 1, NULL);
+    if (!slabs_[s])
+        slabs_[s] = new Connection[SLAB_SIZE];
+
+    Connection& c = slabs_[s][fd & (SLAB_SIZE - 1)];
+    c.reset();
+    c.in_use = true;
+    c.live_idx = live_.size();
+    live_.push_back(fd);
+    return c;
+}
+
+void ConnectionTable::close(int fd)
+{
+    Connection* c = find(fd);
+    if (!c)
+        return;
+
+    // Swap the last open fd into the hole so live_ stays dense
+    int last = live_.back();
+    live_[c->live_idx] = last;
+    slot(last)->live_idx = c->live_idx;
+    live_.pop_back();
+
+    c->reset();
+}
+
+void ConnectionTable::clear()
+{
+    for (size_t i = 0; i < live_.size(); ++i)
+        slot(live_[i])->reset();
+    live_.clear();
+}
@@ -0,0 +1,61 @@
+#ifndef CONNECTIONTABLE_HPP
+#define CONNECTIONTABLE_HPP
+
+#include <cstddef>
+#include <vector>
+#include "Connection.hpp"
+
+// All client connections of one server, indexed directly by fd. Slots live
+// in fixed-size slabs that are allocated once and never move, so a lookup
+// is two array indexes and a Connection& stays valid while other fds are
+// opened. Closed slots are reset and reused by the next accept on that fd.
+class ConnectionTable {
+public:
+    ConnectionTable() {}
+    ~ConnectionTable();
+
+    Connection*       find(int fd);
+    const Connection* find(int fd) const;
+    Connection&       open(int fd);      // fd must not be open already
+    void              close(int fd);     // no-op if fd is not open
+    void              clear();
+
+    size_t            size() const { return live_.size(); }
+    // Open fds, in no particular order
+    const std::vector<int>& fds() const { return live_; }
+
+private:
+    enum { SLAB_SHIFT = 10, SLAB_SIZE = 1 << SLAB_SHIFT };
+
+    ConnectionTable(const ConnectionTable&);
+    ConnectionTable& operator=(const ConnectionTable&);
+
+    Connection* slot(int fd) const;
+
+    std::vector<Connection*> slabs_;   // each one is new Connection[SLAB_SIZE]
+    std::vector<int>         live_;    // open fds; Connection::live_idx points here
+};
+
+inline Connection* ConnectionTable::slot(int fd) const
+{
+    if (fd < 0)
+        return NULL;
+    size_t s = static_cast<size_t>(fd) >> SLAB_SHIFT;
+    if (s >= slabs_.size() || !slabs_[s])
+        return NULL;
+    return &slabs_[s][fd & (SLAB_SIZE - 1)];
+}
+
+inline Connection* ConnectionTable::find(int fd)
+{
+    Connection* c = slot(fd);
+    return (c && c->in_use) ? c : NULL;
+}
+
+inline const Connection* ConnectionTable::find(int fd) const
+{
+    const Connection* c = slot(fd);
+    return (c && c->in_use) ? c : NULL;
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include "EventLoop.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#ifdef WEBSERV_HAVE_EPOLL
+
+static uint32_t toEpoll(int events)
+{
+	uint32_t ev = 0;
+	if (events & IO_READ)
+		ev |= EPOLLIN;
+	if (events & IO_WRITE)
+		ev |= EPOLLOUT;
+	return ev;
+}
+
+EventLoop::EventLoop()
+	: stopped_(false), epfd_(-1), registered_(0)
+{
+	epfd_ = epoll_create(1024);
+	if (epfd_ < 0)
+		throw std::runtime_error(std::string("epoll_create: ") + std::strerror(errno));
+	events_.resize(256);
+	try
+	{
+		openWakeup();
+	}
+	catch (...)
+	{
+		::close(epfd_);
+		throw;
+	}
+}
+
+EventLoop::~EventLoop()
+{
+	closeWakeup();
+	if (epfd_ >= 0)
+		::close(epfd_);
+}
+
+bool EventLoop::add(int fd, int events, const FdHandle& handle)
+{
+	if (fd < 0)
+		return false;
+	if (static_cast<size_t>(fd) >= interest_.size())
+		interest_.resize(fd + 1, 0);
+	if (interest_[fd])
+	{
+		registry_.bind(fd, handle);
+		return modify(fd, events);
+	}
+
+	struct epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = toEpoll(events);
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return false;
+	interest_[fd] = events;
+	registry_.bind(fd, handle);
+	++registered_;
+	if (registered_ > events_.size())
+		events_.resize(registered_ * 2);
+	return true;
+}
+
+bool EventLoop::modify(int fd, int events)
+{
+	if (!watches(fd))
+		return false;
+	if (interest_[fd] == events)
+		return true; // no transition, no syscall
+
+	struct epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = toEpoll(events);
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev) < 0)
+		return false;
+	interest_[fd] = events;
+	return true;
+}
+
+void EventLoop::remove(int fd)
+{
+	if (!watches(fd))
+		return;
+	struct epoll_event ev; // non-NULL for pre-2.6.9 kernels
+	std::memset(&ev, 0, sizeof(ev));
+	epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, &ev);
+	interest_[fd] = 0;
+	registry_.release(fd);
+	--registered_;
+}
+
+int EventLoop::wait(std::vector<IoEvent>& ready, int timeout_ms)
+{
+	ready.clear();
+	int n = epoll_wait(epfd_, &events_[0], static_cast<int>(events_.size()), timeout_ms);
+	if (n <= 0)
+		return n;
+
+	ready.reserve(n);
+	for (int i = 0; i < n; ++i)
+	{
+		IoEvent e;
+		e.fd = events_[i].data.fd;
+		if (isWakeup(e.fd))
+			continue;
+		e.events = 0;
+		if (events_[i].events & EPOLLIN)
+			e.events |= IO_READ;
+		if (events_[i].events & EPOLLOUT)
+			e.events |= IO_WRITE;
+		// Hang-ups and errors surface as readable so the read path sees EOF/error
+		if (events_[i].events & (EPOLLERR | EPOLLHUP))
+			e.events |= IO_READ | IO_ERROR;
+		ready.push_back(e);
+	}
+	return static_cast<int>(ready.size());
+}
+
+#else // poll() fallback
+
+static short toPoll(int events)
+{
+	short ev = 0;
+	if (events & IO_READ)
+		ev |= POLLIN;
+	if (events & IO_WRITE)
+		ev |= POLLOUT;
+	return ev;
+}
+
+EventLoop::EventLoop()
+	: stopped_(false)
+{
+	openWakeup();
+}
+
+EventLoop::~EventLoop()
+{
+	closeWakeup();
+}
+
+bool EventLoop::add(int fd, int events, const FdHandle& handle)
+{
+	if (fd < 0)
+		return false;
+	if (static_cast<size_t>(fd) >= interest_.size())
+	{
+		interest_.resize(fd + 1, 0);
+		slot_.resize(fd + 1, -1);
+	}
+	if (interest_[fd])
+	{
+		registry_.bind(fd, handle);
+		return modify(fd, events);
+	}
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = toPoll(events);
+	pfd.revents = 0;
+	slot_[fd] = static_cast<int>(pollfds_.size());
+	pollfds_.push_back(pfd);
+	interest_[fd] = events;
+	registry_.bind(fd, handle);
+	return true;
+}
+
+bool EventLoop::modify(int fd, int events)
+{
+	if (!watches(fd))
+		return false;
+	pollfds_[slot_[fd]].events = toPoll(events);
+	interest_[fd] = events;
+	return true;
+}
+
+void EventLoop::remove(int fd)
+{
+	if (!watches(fd))
+		return;
+	// Swap the last entry into the hole so the array stays dense
+	int idx = slot_[fd];
+	int last = static_cast<int>(pollfds_.size()) - 1;
+	if (idx != last)
+	{
+		pollfds_[idx] = pollfds_[last];
+		slot_[pollfds_[idx].fd] = idx;
+	}
+	pollfds_.pop_back();
+	slot_[fd] = -1;
+	interest_[fd] = 0;
+	registry_.release(fd);
+}
+
+int EventLoop::wait(std::vector<IoEvent>& ready, int timeout_ms)
+{
+	ready.clear();
+	int n = poll(pollfds_.empty() ? NULL : &pollfds_[0], pollfds_.size(), timeout_ms);
+	if (n <= 0)
+		return n;
+
+	ready.reserve(n);
+	for (size_t i = 0; i < pollfds_.size(); ++i)
+	{
+		short re = pollfds_[i].revents;
+		if (!re || isWakeup(pollfds_[i].fd))
+			continue;
+		IoEvent e;
+		e.fd = pollfds_[i].fd;
+		e.events = 0;
+		if (re & POLLIN)
+			e.events |= IO_READ;
+		if (re & POLLOUT)
+			e.events |= IO_WRITE;
+		if (re & (POLLERR | POLLHUP | POLLNVAL))
+			e.events |= IO_READ | IO_ERROR;
+		ready.push_back(e);
+	}
+	return static_cast<int>(ready.size());
+}
+
+#endif
+
+// The wakeup pipe is registered like any fd but never reported: wait()
+// consumes its readiness itself
+void EventLoop::openWakeup()
+{
+	if (pipe(wake_) < 0)
+		throw std::runtime_error(std::string("pipe: ") + std::strerror(errno));
+	for (int k = 0; k < 2; ++k)
+	{
+		fcntl(wake_[k], F_SETFL, fcntl(wake_[k], F_GETFL, 0) | O_NONBLOCK);
+		fcntl(wake_[k], F_SETFD, FD_CLOEXEC);
+	}
+	add(wake_[0], IO_READ, FdHandle());
+}
+
+void EventLoop::closeWakeup()
+{
+	remove(wake_[0]);
+	::close(wake_[0]);
+	::close(wake_[1]);
+}
+
+void EventLoop::stop()
+{
+	// A full pipe already holds a pending wakeup
+	ssize_t n;
+	do {
+		n = ::write(wake_[1], "x", 1);
+	} while (n < 0 && errno == EINTR);
+}
+
+bool EventLoop::isWakeup(int fd)
+{
+	if (fd != wake_[0])
+		return false;
+	char buf[64];
+	while (::read(wake_[0], buf, sizeof(buf)) > 0)
+		;
+	stopped_ = true;
+	return true;
+}
+
+bool EventLoop::watches(int fd) const
+{
+	return fd >= 0 && static_cast<size_t>(fd) < interest_.size() && interest_[fd] != 0;
+}
@@ -0,0 +1,84 @@
+#ifndef EVENTLOOP_HPP
+#define EVENTLOOP_HPP
+
+#include <vector>
+#include "FdRegistry.hpp"
+#include "TimerQueue.hpp"
+
+// The reactor uses epoll on Linux. Build with -DWEBSERV_USE_POLL to force the
+// portable poll() backend (same interface, same semantics).
+#if defined(__linux__) && !defined(WEBSERV_USE_POLL)
+# define WEBSERV_HAVE_EPOLL 1
+# include <sys/epoll.h>
+#else
+# include <poll.h>
+#endif
+
+// Interest / readiness bits, independent of the backend in use
+enum IoInterest {
+    IO_READ  = 1,
+    IO_WRITE = 2,
+    IO_ERROR = 4   // only reported, never requested (HUP/ERR)
+};
+
+struct IoEvent {
+    int fd;
+    int events;
+};
+
+// Owns the kernel-side interest set. File descriptors are registered once
+// (add), their interest is changed only on state transitions (modify), and
+// they are dropped before close (remove). wait() only returns ready fds, so
+// an idle keep-alive connection costs nothing per iteration.
+// Every registered fd carries a tagged handle (what it is, which server owns
+// it) so the dispatcher never has to search for the owner.
+class EventLoop {
+public:
+    EventLoop();
+    ~EventLoop();
+
+    bool add(int fd, int events, const FdHandle& handle);
+    bool modify(int fd, int events);
+    void remove(int fd);
+    bool watches(int fd) const;
+    const FdHandle& handle(int fd) const { return registry_.lookup(fd); }
+
+    // Connection deadlines of every server attached to this loop
+    TimerQueue& timers() { return timers_; }
+
+    // Asks the loop to stop: the current or next wait() returns at once and
+    // stopped() turns true in the loop's thread. Safe from another thread
+    // and from a signal handler (it only write()s to a pipe).
+    void stop();
+    bool stopped() const { return stopped_; }
+
+    // Returns the number of ready fds (0 on timeout or when only stop() woke
+    // it, -1 on error with errno set)
+    int  wait(std::vector<IoEvent>& ready, int timeout_ms);
+
+private:
+    EventLoop(const EventLoop&);
+    EventLoop& operator=(const EventLoop&);
+
+    void openWakeup();
+    void closeWakeup();
+    bool isWakeup(int fd);   // drains the pipe and sets stopped_ if fd is its read end
+
+    // fd -> current interest mask (0 = not registered)
+    std::vector<int>                interest_;
+    FdRegistry                      registry_;
+    TimerQueue                      timers_;
+    int                             wake_[2];  // self-pipe written by stop()
+    bool                            stopped_;
+
+#ifdef WEBSERV_HAVE_EPOLL
+    int                             epfd_;
+    std::vector<struct epoll_event> events_;
+    size_t                          registered_;
+#else
+    std::vector<struct pollfd>      pollfds_;
+    std::vector<int>                slot_;     // fd -> index in pollfds_, -1 if absent
+#endif
+};
+
+#endif
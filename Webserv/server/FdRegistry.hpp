@@ -0,0 +1,59 @@
+#ifndef FDREGISTRY_HPP
+#define FDREGISTRY_HPP
+
+#include <cstddef>
+#include <vector>
+
+class WebServer;
+
+// What a registered file descriptor is, so an event can be dispatched without
+// searching every server for it.
+enum FdKind {
+    FD_NONE = 0,
+    FD_LISTENER,
+    FD_CLIENT,
+    FD_CGI_STDIN,   // write end of a CGI script's stdin pipe
+    FD_CGI_STDOUT   // read end of a CGI script's stdout pipe
+};
+
+struct FdHandle {
+    FdKind     kind;
+    WebServer* owner;
+    int        client_fd;   // for CGI pipes: the client connection they serve
+
+    FdHandle() : kind(FD_NONE), owner(NULL), client_fd(-1) {}
+    FdHandle(FdKind k, WebServer* o, int client = -1)
+        : kind(k), owner(o), client_fd(client) {}
+};
+
+// Dense fd-indexed table: lookup is a single array index.
+class FdRegistry {
+public:
+    void bind(int fd, const FdHandle& h)
+    {
+        if (fd < 0)
+            return;
+        if (static_cast<size_t>(fd) >= table_.size())
+            table_.resize(fd + 1);
+        table_[fd] = h;
+    }
+
+    void release(int fd)
+    {
+        if (fd >= 0 && static_cast<size_t>(fd) < table_.size())
+            table_[fd] = FdHandle();
+    }
+
+    const FdHandle& lookup(int fd) const
+    {
+        static const FdHandle none;
+        if (fd < 0 || static_cast<size_t>(fd) >= table_.size())
+            return none;
+        return table_[fd];
+    }
+
+private:
+    std::vector<FdHandle> table_;
+};
+
+#endif
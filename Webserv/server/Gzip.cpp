@@ -0,0 +1,100 @@
+#include "Gzip.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+// deflate output is collected this many bytes at a time
+static const size_t OUT_CHUNK = 16 * 1024;
+
+GzipEncoder::GzipEncoder(int level) : ok_(false), finished_(false)
+{
+    std::memset(&zs_, 0, sizeof(zs_));
+    // windowBits 15 + 16: gzip header and trailer instead of zlib's
+    ok_ = deflateInit2(&zs_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+GzipEncoder::~GzipEncoder()
+{
+    if (ok_)
+        deflateEnd(&zs_);
+}
+
+bool GzipEncoder::write(const char* data, size_t len, std::string& out, Flush flush)
+{
+    if (!ok_ || finished_)
+        return false;
+    zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs_.avail_in = static_cast<uInt>(len);
+    for (;;)
+    {
+        size_t used = out.size();
+        out.resize(used + OUT_CHUNK);
+        zs_.next_out = reinterpret_cast<Bytef*>(&out[used]);
+        zs_.avail_out = static_cast<uInt>(OUT_CHUNK);
+        int rc = deflate(&zs_, flush);
+        out.resize(used + (OUT_CHUNK - zs_.avail_out));
+        if (rc == Z_STREAM_END)
+        {
+            finished_ = true;
+            return true;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR)
+        {
+            deflateEnd(&zs_);
+            ok_ = false;
+            return false;
+        }
+        // Output space left over: deflate has taken all the input and
+        // emitted all it is going to for this flush mode
+        if (zs_.avail_out != 0 && zs_.avail_in == 0)
+            return true;
+    }
+}
+
+bool gzipString(const std::string& in, int level, std::string& out)
+{
+    GzipEncoder enc(level);
+    out.reserve(out.size() + in.size() / 3 + 64);
+    return enc.write(in.data(), in.size(), out, GzipEncoder::GZ_FINISH);
+}
+
+// q of one Accept-Encoding element ("gzip;q=0.5"); 1 when absent
+static double qualityOf(const std::string& params)
+{
+    size_t q = params.find("q=");
+    if (q == std::string::npos)
+        return 1.0;
+    return std::atof(params.c_str() + q + 2);
+}
+
+bool acceptsEncoding(const std::string& accept_encoding, const char* coding)
+{
+    bool gzip_alias = strcasecmp(coding, "gzip") == 0;
+    double named = -1, any = -1;
+    size_t pos = 0;
+    while (pos < accept_encoding.size())
+    {
+        size_t end = accept_encoding.find(',', pos);
+        if (end == std::string::npos)
+            end = accept_encoding.size();
+        std::string item = accept_encoding.substr(pos, end - pos);
+        pos = end + 1;
+
+        size_t first = item.find_first_not_of(" \t");
+        if (first == std::string::npos)
+            continue;
+        size_t semi = item.find(';', first);
+        size_t last = item.find_last_not_of(" \t", semi == std::string::npos ? std::string::npos : semi - 1);
+        if (last == std::string::npos || last < first)
+            continue;
+        std::string name = item.substr(first, last + 1 - first);
+        double q = semi == std::string::npos ? 1.0 : qualityOf(item.substr(semi));
+        if (strcasecmp(name.c_str(), coding) == 0 || (gzip_alias && strcasecmp(name.c_str(), "x-gzip") == 0))
+            named = q;
+        else if (name == "*")
+            any = q;
+    }
+    if (named >= 0)
+        return named > 0;
+    return any > 0;
+}
@@ -0,0 +1,45 @@
+#ifndef GZIP_HPP
+#define GZIP_HPP
+
+#include <cstddef>
+#include <string>
+#include <zlib.h>
+
+// gzip content coding (RFC 1952) on top of zlib's deflate, fed piece by
+// piece so a large body is compressed as it is sent instead of into a
+// second full-size buffer.
+class GzipEncoder {
+public:
+    enum Flush {
+        GZ_NONE = Z_NO_FLUSH,    // zlib decides when output appears
+        GZ_SYNC = Z_SYNC_FLUSH,  // everything fed so far comes out now
+        GZ_FINISH = Z_FINISH     // ends the stream with the gzip trailer
+    };
+
+    // level: 1 (fastest) to 9 (smallest)
+    explicit GzipEncoder(int level);
+    ~GzipEncoder();
+
+    // Compresses len bytes of data, appending what deflate emits to out.
+    // false on a zlib error, after which the encoder is unusable.
+    bool write(const char* data, size_t len, std::string& out, Flush flush);
+    bool finished() const { return finished_; }
+
+private:
+    GzipEncoder(const GzipEncoder&);
+    GzipEncoder& operator=(const GzipEncoder&);
+
+    z_stream zs_;
+    bool     ok_;
+    bool     finished_;
+};
+
+// in as one complete gzip stream, appended to out
+bool gzipString(const std::string& in, int level, std::string& out);
+
+// Whether an Accept-Encoding value lets the response be coded with coding
+// ("gzip", which x-gzip also names, or "zstd"): it is listed with a
+// non-zero q, or "*" is and coding is not refused by name
+bool acceptsEncoding(const std::string& accept_encoding, const char* coding);
+
+#endif
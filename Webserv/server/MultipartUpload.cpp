@@ -0,0 +1,65 @@
+#include "MultipartUpload.hpp"
+#include "../logger/Logger.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+UploadSink::~UploadSink()
+{
+    if (fd_ >= 0)
+        close(fd_);
+    for (size_t k = 0; k < parts_.size(); ++k)
+        if (!parts_[k].tmp_path.empty())
+            unlink(parts_[k].tmp_path.c_str());
+}
+
+bool UploadSink::onPartBegin(const std::string&, const std::string& filename, const std::string&)
+{
+    if (filename.empty())
+        return true;   // plain form field, not stored
+    std::string tmpl = dir_ + "/.upload-XXXXXX";
+    fd_ = mkstemp(&tmpl[0]);
+    if (fd_ < 0)
+    {
+        Logger::log(LOG_ERROR, "UploadSink", "Cannot create temp file in " + dir_ + ": " + strerror(errno));
+        return false;
+    }
+    fcntl(fd_, F_SETFD, FD_CLOEXEC);
+    fchmod(fd_, 0644);
+    Part p;
+    p.tmp_path = tmpl;
+    size_t slash = filename.find_last_of("/\\");
+    p.filename = slash == std::string::npos ? filename : filename.substr(slash + 1);
+    parts_.push_back(p);
+    return true;
+}
+
+bool UploadSink::onPartData(const char* data, size_t len)
+{
+    while (fd_ >= 0 && len > 0)
+    {
+        ssize_t n = write(fd_, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+        {
+            Logger::log(LOG_ERROR, "UploadSink", "Write failed: " + std::string(strerror(errno)));
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool UploadSink::onPartEnd()
+{
+    if (fd_ < 0)
+        return true;
+    int rc = close(fd_);
+    fd_ = -1;
+    return rc == 0;
+}
@@ -0,0 +1,63 @@
+#ifndef MULTIPARTUPLOAD_HPP
+#define MULTIPARTUPLOAD_HPP
+
+#include "MultipartParser.hpp"
+#include "RequestBody.hpp"
+#include <string>
+#include <vector>
+
+// Collects the file parts of a multipart upload. Each file part goes to a
+// hidden temporary file in the upload directory as its bytes are parsed;
+// handle_multipart_upload() renames the finished files into place. Files
+// that never get renamed (bad or rejected upload) are removed with the sink.
+class UploadSink : public MultipartHandler {
+public:
+    struct Part {
+        std::string tmp_path;   // cleared once the file has been moved into place
+        std::string filename;   // as sent by the client, without directories
+    };
+
+    explicit UploadSink(const std::string& dir) : dir_(dir), fd_(-1) {}
+    ~UploadSink();
+
+    bool onPartBegin(const std::string& name, const std::string& filename, const std::string& contentType);
+    bool onPartData(const char* data, size_t len);
+    bool onPartEnd();
+
+    std::vector<Part>& parts() { return parts_; }
+
+private:
+    UploadSink(const UploadSink&);
+    UploadSink& operator=(const UploadSink&);
+
+    std::string       dir_;
+    int               fd_;   // file of the part being written, -1 between parts
+    std::vector<Part> parts_;
+};
+
+// A multipart/form-data body parsed while it is received: the request body
+// hands over every block read from the socket, so the parts reach their
+// temporary files as they arrive and the body itself is never stored.
+class MultipartUpload : public BodyConsumer {
+public:
+    MultipartUpload(const std::string& dir, const std::string& boundary)
+        : sink_(dir), parser_(boundary, sink_) {}
+
+    // false once a part could not be written
+    bool consume(const char* data, size_t len)
+    {
+        return parser_.feed(data, len) != MultipartParser::PART_ABORTED;
+    }
+
+    UploadSink&            sink() { return sink_; }
+    const MultipartParser& parser() const { return parser_; }
+
+private:
+    MultipartUpload(const MultipartUpload&);
+    MultipartUpload& operator=(const MultipartUpload&);
+
+    UploadSink      sink_;
+    MultipartParser parser_;
+};
+
+#endif
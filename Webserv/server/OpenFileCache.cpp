@@ -0,0 +1,94 @@
+#include "OpenFileCache.hpp"
+#include "LocationPlan.hpp"
+#include "TimerQueue.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+
+OpenFileCache::File::~File()
+{
+    if (fd >= 0)
+        close(fd);
+}
+
+void OpenFileCache::Handle::release()
+{
+    if (f_ && --f_->refs_ == 0)
+        delete f_;
+    f_ = NULL;
+}
+
+OpenFileCache::OpenFileCache(size_t max_entries, long valid_ms)
+    : max_(max_entries), valid_ms_(valid_ms), generation_(0) {}
+
+OpenFileCache::Handle OpenFileCache::load(const LocationPlan& loc, const std::string& rel)
+{
+    Handle h(new File);
+    File& f = *h.f_;
+    if (!loc.statBelowRoot(rel, f.st))
+    {
+        f.err = errno;
+        return h;
+    }
+    f.err = 0;
+    if (!S_ISREG(f.st.st_mode))
+        return h;
+    f.fd = loc.openBelowRoot(rel, O_RDONLY | O_CLOEXEC);
+    // The file may have been replaced since the stat(); describe the one
+    // that was opened
+    if (f.fd >= 0)
+        fstat(f.fd, &f.st);
+    return h;
+}
+
+// Same inode, and neither its data nor its attributes (permissions
+// included) changed: the open descriptor still serves the right bytes
+static bool unchanged(const struct stat& a, const struct stat& b)
+{
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec &&
+           a.st_ctim.tv_sec == b.st_ctim.tv_sec && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+}
+
+// A changed file gets a new answer; handles to the old one keep it
+void OpenFileCache::revalidate(Handle& f, const LocationPlan& loc, const std::string& rel)
+{
+    struct stat st;
+    if (f->exists() && loc.statBelowRoot(rel, st) && unchanged(st, f->st))
+        return;
+    f = load(loc, rel);
+}
+
+OpenFileCache::Handle OpenFileCache::lookup(const std::string& path, const LocationPlan& loc,
+                                            const std::string& rel)
+{
+    if (max_ == 0)
+        return load(loc, rel);
+
+    long now = TimerQueue::now();
+    Map::iterator it = entries_.find(path);
+    if (it != entries_.end())
+    {
+        Entry& e = it->second;
+        if (e.generation != generation_ || now - e.checked >= valid_ms_)
+        {
+            revalidate(e.file, loc, rel);
+            e.checked = now;
+            e.generation = generation_;
+        }
+        lru_.splice(lru_.begin(), lru_, e.lru);
+        return e.file;
+    }
+
+    if (entries_.size() >= max_)
+    {
+        entries_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    Entry& e = entries_.insert(std::make_pair(path, Entry())).first->second;
+    lru_.push_front(path);
+    e.lru = lru_.begin();
+    e.checked = now;
+    e.generation = generation_;
+    e.file = load(loc, rel);
+    return e.file;
+}
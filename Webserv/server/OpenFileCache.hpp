@@ -0,0 +1,111 @@
+#ifndef OPENFILECACHE_HPP
+#define OPENFILECACHE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+
+class LocationPlan;
+
+// What the static file path needs to know about a file system path: whether
+// it exists (a failed lookup is remembered too), its stat() data and, for a
+// readable regular file, an open descriptor. Answers are trusted for
+// valid_ms after they were checked; after that the next lookup stat()s the
+// path again and keeps the descriptor if the file is unchanged. So a hot
+// file costs no path syscalls at all, and an edit shows within valid_ms.
+//
+// One cache per WebServer, used from its event loop thread only. At most
+// max_entries paths are kept, least recently used dropped first; with
+// max_entries 0 nothing is kept and every lookup goes to the file system.
+class OpenFileCache {
+public:
+    // A lookup's answer. Reference counted like SharedBuffer (not
+    // atomically: one event loop thread); the descriptor is closed with the
+    // last reference, so an answer outlives its entry being evicted or
+    // reloaded.
+    class File {
+    public:
+        int         err;   // 0: the path exists; else the stat() errno
+        struct stat st;    // err == 0
+        int         fd;    // regular file opened O_RDONLY, -1 for anything
+                           // else or when open() failed (not readable)
+
+        bool exists() const { return err == 0; }
+
+    private:
+        friend class OpenFileCache;
+        File() : err(ENOENT), fd(-1), refs_(1) {}
+        ~File();
+        File(const File&);
+        File& operator=(const File&);
+
+        unsigned refs_;
+    };
+
+    // One reference to a File, dropped when the handle goes
+    class Handle {
+    public:
+        Handle() : f_(NULL) {}
+        Handle(const Handle& other) : f_(other.f_) { retain(); }
+        Handle& operator=(const Handle& other)
+        {
+            if (other.f_ != f_)
+            {
+                release();
+                f_ = other.f_;
+                retain();
+            }
+            return *this;
+        }
+        ~Handle() { release(); }
+
+        const File& operator*() const { return *f_; }
+        const File* operator->() const { return f_; }
+
+    private:
+        friend class OpenFileCache;
+        explicit Handle(File* f) : f_(f) {}   // takes f's first reference
+        void retain() { if (f_) ++f_->refs_; }
+        void release();
+
+        File* f_;
+    };
+
+    OpenFileCache(size_t max_entries, long valid_ms);
+
+    // path (loc.root + "/" + rel) is the key; a lookup goes through loc's
+    // root directory fd
+    Handle lookup(const std::string& path, const LocationPlan& loc, const std::string& rel);
+
+    // Every entry is checked again on its next use (after this server
+    // changed files itself)
+    void invalidate() { ++generation_; }
+
+    size_t size() const { return entries_.size(); }
+
+private:
+    struct Entry {
+        Handle                           file;
+        long                             checked;     // TimerQueue::now() of the last check
+        unsigned                         generation;
+        std::list<std::string>::iterator lru;
+    };
+    typedef std::map<std::string, Entry> Map;
+
+    OpenFileCache(const OpenFileCache&);
+    OpenFileCache& operator=(const OpenFileCache&);
+
+    static Handle load(const LocationPlan& loc, const std::string& rel);
+    static void   revalidate(Handle& f, const LocationPlan& loc, const std::string& rel);
+
+    size_t                 max_;
+    long                   valid_ms_;
+    unsigned               generation_;
+    Map                    entries_;
+    std::list<std::string> lru_;       // most recently used first
+};
+
+#endif
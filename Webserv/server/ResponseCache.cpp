@@ -0,0 +1,171 @@
+#include "ResponseCache.hpp"
+
+// Sketch rows; each is indexed by a different hash of the path
+static const size_t ROWS = 4;
+// Counted against max_bytes on top of the body: the head, the key (held by
+// the map and the LRU list) and the nodes
+static const size_t ENTRY_OVERHEAD = 256;
+
+// FNV-1a
+static unsigned hashPath(const std::string& s)
+{
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        h ^= static_cast<unsigned char>(s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+ResponseCache::ResponseCache(size_t max_bytes, size_t max_entry)
+    : max_bytes_(max_bytes), max_entry_(max_entry), bytes_(0), width_mask_(0), samples_(0),
+      sample_limit_(0)
+{
+    if (!enabled())
+        return;
+    // About four counters per entry the cache could hold at 8 KiB apiece
+    size_t width = 1024;
+    while (width < max_bytes / 2048 && width < (1u << 20))
+        width *= 2;
+    sketch_.assign(ROWS * width, 0);
+    width_mask_ = width - 1;
+    sample_limit_ = 10 * width;
+}
+
+ResponseCache::~ResponseCache()
+{
+    for (Map::iterator it = entries_.begin(); it != entries_.end(); ++it)
+        it->second.body->release();
+}
+
+// Counts one request for path; every sample_limit_ requests all counters are
+// halved, so the sketch follows what is popular now
+void ResponseCache::touch(const std::string& path)
+{
+    unsigned h1 = hashPath(path);
+    unsigned h2 = ((h1 >> 17) | (h1 << 15)) | 1u;
+    size_t width = width_mask_ + 1;
+    for (size_t r = 0; r < ROWS; ++r)
+    {
+        unsigned char& c = sketch_[r * width + ((h1 + r * h2) & width_mask_)];
+        if (c < 15)
+            ++c;
+    }
+    if (++samples_ >= sample_limit_)
+    {
+        for (size_t i = 0; i < sketch_.size(); ++i)
+            sketch_[i] >>= 1;
+        samples_ = 0;
+    }
+}
+
+// The smallest of path's counters: never below its true recent count, and
+// above it only when every row collides
+unsigned ResponseCache::frequency(const std::string& path) const
+{
+    unsigned h1 = hashPath(path);
+    unsigned h2 = ((h1 >> 17) | (h1 << 15)) | 1u;
+    size_t width = width_mask_ + 1;
+    unsigned f = 15;
+    for (size_t r = 0; r < ROWS; ++r)
+    {
+        unsigned c = sketch_[r * width + ((h1 + r * h2) & width_mask_)];
+        if (c < f)
+            f = c;
+    }
+    return f;
+}
+
+void ResponseCache::erase(Map::iterator it)
+{
+    bytes_ -= it->second.charge;
+    it->second.body->release();
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
+
+bool ResponseCache::find(const std::string& path, const struct stat& st, const std::string*& head,
+                         SharedBuffer*& body)
+{
+    if (!enabled())
+        return false;
+    touch(path);
+    Map::iterator it = entries_.find(path);
+    if (it == entries_.end())
+    {
+        ++stats_.misses;
+        return false;
+    }
+    Entry& e = it->second;
+    if (e.dev != st.st_dev || e.ino != st.st_ino || e.file_size != st.st_size ||
+        e.mtime.tv_sec != st.st_mtim.tv_sec || e.mtime.tv_nsec != st.st_mtim.tv_nsec)
+    {
+        // Built from an older version of the file
+        erase(it);
+        ++stats_.misses;
+        return false;
+    }
+    ++stats_.hits;
+    lru_.splice(lru_.begin(), lru_, e.lru);
+    head = &e.head;
+    body = e.body;
+    return true;
+}
+
+bool ResponseCache::admit(const std::string& path, size_t size)
+{
+    if (!enabled() || size > max_entry_)
+        return false;
+    size_t charge = size + ENTRY_OVERHEAD;
+    if (charge > max_bytes_)
+        return false;
+    if (bytes_ + charge <= max_bytes_)
+        return true;
+
+    // The victims insert() would take, least recently used first: each must
+    // be less popular than the newcomer
+    unsigned f = frequency(path);
+    size_t freed = 0;
+    for (std::list<std::string>::reverse_iterator it = lru_.rbegin();
+         it != lru_.rend() && bytes_ - freed + charge > max_bytes_; ++it)
+    {
+        if (frequency(*it) >= f)
+        {
+            ++stats_.rejected;
+            return false;
+        }
+        freed += entries_.find(*it)->second.charge;
+    }
+    return true;
+}
+
+void ResponseCache::insert(const std::string& path, const struct stat& st, const std::string& head,
+                           SharedBuffer* body)
+{
+    size_t charge = body->size() + ENTRY_OVERHEAD;
+    if (!enabled() || charge > max_bytes_)
+        return;
+    Map::iterator old = entries_.find(path);
+    if (old != entries_.end())
+        erase(old);
+    while (bytes_ + charge > max_bytes_)
+    {
+        erase(entries_.find(lru_.back()));
+        ++stats_.evictions;
+    }
+
+    Entry& e = entries_[path];
+    e.dev = st.st_dev;
+    e.ino = st.st_ino;
+    e.file_size = st.st_size;
+    e.mtime = st.st_mtim;
+    e.head = head;
+    e.body = body;
+    body->retain();
+    e.charge = charge;
+    lru_.push_front(path);
+    e.lru = lru_.begin();
+    bytes_ += charge;
+    ++stats_.inserts;
+}
@@ -0,0 +1,99 @@
+#ifndef RESPONSECACHE_HPP
+#define RESPONSECACHE_HPP
+
+#include "SharedBuffer.hpp"
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+// Static file responses kept in memory: the serialized head (all but the
+// connection headers, which depend on the connection) and the body as a
+// SharedBuffer that every connection sending it references.
+//
+// Bounded by max_bytes. Which responses stay is decided TinyLFU style: a
+// count-min sketch estimates how often each path was asked for lately (its
+// counters are halved every few thousand requests, so popularity fades), a
+// newcomer evicts the least recently used entries only if it is asked for
+// more often than each of them, and one-off requests for large files never
+// push the hot set out. An entry is dropped as soon as the file it was built
+// from changed (inode, size or mtime).
+//
+// One cache per WebServer, used from its event loop thread only.
+class ResponseCache {
+public:
+    struct Stats {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long inserts;
+        unsigned long rejected;   // refused by the admission policy
+        unsigned long evictions;
+
+        Stats() : hits(0), misses(0), inserts(0), rejected(0), evictions(0) {}
+    };
+
+    // max_entry: larger responses are never cached. max_bytes 0 disables
+    // the cache.
+    ResponseCache(size_t max_bytes, size_t max_entry);
+    ~ResponseCache();
+
+    bool enabled() const { return max_bytes_ > 0; }
+
+    // The cached response for path if it was built from the file st
+    // describes. Counts as a request for path either way. body stays valid
+    // until the next insert(); retain() it to keep it longer.
+    bool find(const std::string& path, const struct stat& st, const std::string*& head,
+              SharedBuffer*& body);
+
+    // Whether a response of size bytes for path (just missed in find())
+    // should be built and inserted: it fits, and the space it needs can be
+    // taken from entries asked for less often
+    bool admit(const std::string& path, size_t size);
+
+    // Stores the response (the cache takes its own reference to body),
+    // evicting least recently used entries as needed
+    void insert(const std::string& path, const struct stat& st, const std::string& head,
+                SharedBuffer* body);
+
+    const Stats& stats() const { return stats_; }
+    size_t       bytes() const { return bytes_; }
+    size_t       size() const { return entries_.size(); }
+
+private:
+    struct Entry {
+        dev_t                            dev;
+        ino_t                            ino;
+        off_t                            file_size;
+        struct timespec                  mtime;
+        std::string                      head;
+        SharedBuffer*                    body;
+        size_t                           charge;   // bytes counted against max_bytes
+        std::list<std::string>::iterator lru;
+    };
+    typedef std::map<std::string, Entry> Map;
+
+    ResponseCache(const ResponseCache&);
+    ResponseCache& operator=(const ResponseCache&);
+
+    void     touch(const std::string& path);
+    unsigned frequency(const std::string& path) const;
+    void     erase(Map::iterator it);
+
+    size_t                     max_bytes_;
+    size_t                     max_entry_;
+    size_t                     bytes_;
+    Map                        entries_;
+    std::list<std::string>     lru_;        // most recently used first
+
+    // Count-min sketch: ROWS rows of counters saturating at 15
+    std::vector<unsigned char> sketch_;
+    size_t                     width_mask_;
+    unsigned long              samples_;    // touches since the last halving
+    unsigned long              sample_limit_;
+
+    Stats                      stats_;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SHAREDBUFFER_HPP
+#define SHAREDBUFFER_HPP
+
+#include <string>
+
+// Immutable bytes with a reference count, so a cached response body is
+// queued on any number of connections without being copied. The count is
+// not atomic: every reference belongs to one event loop thread (a worker's
+// response cache and that worker's connections).
+class SharedBuffer {
+public:
+    // Takes data over (swapped out, not copied); the caller holds the first
+    // reference
+    static SharedBuffer* adopt(std::string& data)
+    {
+        SharedBuffer* b = new SharedBuffer;
+        b->data_.swap(data);
+        return b;
+    }
+
+    const std::string& data() const { return data_; }
+    size_t             size() const { return data_.size(); }
+
+    void retain() { ++refs_; }
+    void release()
+    {
+        if (--refs_ == 0)
+            delete this;
+    }
+
+private:
+    SharedBuffer() : refs_(1) {}
+    ~SharedBuffer() {}
+    SharedBuffer(const SharedBuffer&);
+    SharedBuffer& operator=(const SharedBuffer&);
+
+    std::string data_;
+    unsigned    refs_;
+};
+
+#endif
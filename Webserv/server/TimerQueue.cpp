@@ -0,0 +1,54 @@
+#include "TimerQueue.hpp"
+#include <algorithm>
+#include <ctime>
+#include <sys/time.h>
+
+namespace {
+    // std heap algorithms build a max-heap; invert to keep the earliest on top
+    struct LaterDeadline {
+        bool operator()(const TimerEntry& a, const TimerEntry& b) const
+        {
+            return a.deadline > b.deadline;
+        }
+    };
+}
+
+long TimerQueue::now()
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return static_cast<long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+#endif
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<long>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+void TimerQueue::schedule(const TimerEntry& entry)
+{
+    heap_.push_back(entry);
+    std::push_heap(heap_.begin(), heap_.end(), LaterDeadline());
+}
+
+int TimerQueue::timeoutMs(long now, int cap) const
+{
+    if (heap_.empty())
+        return cap;
+    long delta = heap_.front().deadline - now;
+    if (delta <= 0)
+        return 0;
+    if (cap >= 0 && delta > cap)
+        return cap;
+    return static_cast<int>(delta);
+}
+
+bool TimerQueue::popExpired(long now, TimerEntry& out)
+{
+    if (heap_.empty() || heap_.front().deadline > now)
+        return false;
+    out = heap_.front();
+    std::pop_heap(heap_.begin(), heap_.end(), LaterDeadline());
+    heap_.pop_back();
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef TIMERQUEUE_HPP
+#define TIMERQUEUE_HPP
+
+#include <cstddef>
+#include <vector>
+
+class WebServer;
+
+// One pending deadline. The queue never removes entries early: a connection
+// that closes or whose deadline moves simply leaves its entry behind, and the
+// owner recognises it as stale when it fires (serial / deadline mismatch).
+struct TimerEntry {
+    long          deadline;   // TimerQueue::now() milliseconds
+    WebServer*    owner;
+    int           fd;
+    unsigned long serial;     // identifies the connection that armed it
+
+    TimerEntry() : deadline(0), owner(NULL), fd(-1), serial(0) {}
+    TimerEntry(long d, WebServer* o, int f, unsigned long s)
+        : deadline(d), owner(o), fd(f), serial(s) {}
+};
+
+// Binary min-heap keyed on deadline. Arming is O(log n), looking at the
+// nearest deadline is O(1) and expiring k timers is O(k log n) - idle
+// connections are never visited until their deadline is due.
+class TimerQueue {
+public:
+    // Monotonic clock in milliseconds
+    static long now();
+
+    void   schedule(const TimerEntry& entry);
+
+    // Milliseconds until the nearest deadline, clamped to [0, cap] (a
+    // negative cap: no upper bound); cap when nothing is armed
+    int    timeoutMs(long now, int cap) const;
+
+    // Pops the nearest entry if it is due
+    bool   popExpired(long now, TimerEntry& out);
+
+    size_t size() const { return heap_.size(); }
+
+private:
+    std::vector<TimerEntry> heap_;
+};
+
+#endif
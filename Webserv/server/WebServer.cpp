@@ -6,72 +6,88 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <cstdio>
-
-WebServer::WebServer(const Config &cfg)
-	: config_(&cfg)
+#include <netinet/tcp.h>
+
+// One read() fills at most READ_CHUNK bytes; a connection gets at most
+// READ_BUDGET bytes per wakeup so a fast uploader cannot starve the others
+// (the level-triggered loop reports it again next iteration).
+static const size_t READ_CHUNK = 64 * 1024;
+static const size_t READ_BUDGET = 1024 * 1024;
+
+// Serves every server block of vhosts on its one listening socket; the
+// block for a request is picked by its Host header.
+// reusePort: bind with SO_REUSEPORT so every worker thread can own its own
+// listening socket on the same address (the kernel balances accepts).
+WebServer::WebServer(const VirtualHosts &vhosts, const MainConfig &main, bool reusePort)
+	: config_(&vhosts.defaultServer()), vhosts_(&vhosts), loop_(NULL), next_serial_(0),
+	  rx_buf_(READ_CHUNK),
+	  files_(static_cast<size_t>(main.open_file_cache), main.open_file_cache_valid * 1000L),
+	  responses_(main.response_cache, main.response_cache_max_entry)
 {
-	std::vector<int> ports = config_->getPorts();
-	std::vector<std::string> hosts = config_->getHosts();
-
-	if (hosts.size() < ports.size())
-		hosts.resize(ports.size(), std::string());
+	const int port = vhosts.port();
+	const std::string &host = vhosts.host();
 
-	for (size_t idx = 0; idx < ports.size(); ++idx)
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
 	{
-		int port = ports[idx];
-		const std::string &host = hosts[idx];
-
-		int sock = socket(AF_INET, SOCK_STREAM, 0);
-		if (sock < 0)
-		{
-			perror("socket");
-			continue;
-		}
+		perror("socket");
+		return;
+	}
 
-		make_socket_non_blocking(sock);
+	make_socket_non_blocking(sock);
 
-		int opt = 1;
-		if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-		{
-			perror("setsockopt");
-			// close(sock);
-			continue;
-		}
-
-		sockaddr_in addr;
-		std::memset(&addr, 0, sizeof(addr));
-		addr.sin_family = AF_INET;
+	int opt = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
+	{
+		perror("setsockopt");
+		close(sock);
+		return;
+	}
+#ifdef SO_REUSEPORT
+	if (reusePort && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+	{
+		perror("setsockopt(SO_REUSEPORT)");
+		close(sock);
+		return;
+	}
+#else
+	(void)reusePort;
+#endif
+
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = INADDR_ANY;
+	addr.sin_port = htons(port);
+
+	in_addr resolved;
+	if (!host.empty() && resolve_ipv4(host, &resolved))
+	{
+		addr.sin_addr = resolved;
+	}
+	else
+	{
 		addr.sin_addr.s_addr = INADDR_ANY;
-		addr.sin_port = htons(port);
-
-		in_addr resolved;
-		if (!host.empty() && resolve_ipv4(host, &resolved))
-		{
-			addr.sin_addr = resolved;
-		}
-		else
-		{
-			addr.sin_addr.s_addr = INADDR_ANY;
-		}
-
-		if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0)
-		{
-			perror("bind");
-			close(sock);
-			continue;
-		}
+	}
 
-		if (listen(sock, SOMAXCONN) < 0)
-		{
-			perror("listen");
-			close(sock);
-			continue;
-		}
+	if (bind(sock, (sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		perror("bind");
+		close(sock);
+		return;
+	}
 
-		Logger::log(LOG_INFO, "WebServer",
-					"Server listening on http://" + (host.empty() ? std::string("0.0.0.0") : host) + ":" + to_str(port));
-		listening_sockets.push_back(sock);
+	if (listen(sock, SOMAXCONN) < 0)
+	{
+		perror("listen");
+		close(sock);
+		return;
 	}
+
+	Logger::log(LOG_INFO, "WebServer",
+				"Server listening on http://" + (host.empty() ? std::string("0.0.0.0") : host) + ":" + to_str(port) +
+				(vhosts.size() > 1 ? " (" + to_str(static_cast<int>(vhosts.size())) + " virtual hosts)" : ""));
+	listening_sockets.push_back(sock);
 }
 
 WebServer::~WebServer()
@@ -79,35 +95,43 @@ WebServer::~WebServer()
 	shutdown();
 }
 
-// Closes all open file descriptors except stdin(0), stdout(1), stderr(2)
-void closeAllOpenFDs()
+// Registers the listening sockets; client sockets are added as they are accepted
+void WebServer::attachEventLoop(EventLoop *loop)
 {
-	long max_fd = sysconf(_SC_OPEN_MAX);
-	for (int fd = 3; fd < max_fd; ++fd)
-	{
-		// Check if fd is open
-		if (fcntl(fd, F_GETFD) != -1)
-		{
-			close(fd);
-		}
-	}
+	loop_ = loop;
+	if (!loop_)
+		return;
+	for (size_t i = 0; i < listening_sockets.size(); ++i)
+		loop_->add(listening_sockets[i], IO_READ, FdHandle(FD_LISTENER, this));
 }
 
 void WebServer::shutdown()
 {
 	for (size_t i = 0; i < listening_sockets.size(); ++i)
 	{
+		if (loop_)
+			loop_->remove(listening_sockets[i]);
 		::close(listening_sockets[i]);
 	}
 	listening_sockets.clear();
 
-	for (std::map<int, Connection>::iterator it = conns_.begin();
-		 it != conns_.end(); ++it)
+	const std::vector<int> &open_fds = conns_.fds();
+	for (size_t i = 0; i < open_fds.size(); ++i)
 	{
-		::close(it->first);
+		stopCgi(*conns_.find(open_fds[i]));
+		if (loop_)
+			loop_->remove(open_fds[i]);
+		::close(open_fds[i]);
 	}
 	conns_.clear();
-	closeAllOpenFDs();
+	const ResponseCache::Stats &st = responses_.stats();
+	if (st.hits + st.misses > 0)
+	{
+		std::ostringstream oss;
+		oss << "Response cache: " << st.hits << " hits, " << st.misses << " misses, " << st.inserts
+			<< " inserts, " << st.rejected << " rejected, " << st.evictions << " evictions";
+		Logger::log(LOG_INFO, "WebServer", oss.str());
+	}
 	Logger::log(LOG_INFO, "WebServer", "All sockets closed.");
 }
 
@@ -118,69 +142,142 @@ void WebServer::make_socket_non_blocking(int fd)
 		throw std::runtime_error("Failed to make socket non-blocking");
 }
 
+// accept4 hands back a non-blocking, close-on-exec socket in one syscall
+static int acceptClient(int listen_fd)
+{
+#ifdef SOCK_NONBLOCK
+	return accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd >= 0)
+	{
+		int flags = fcntl(fd, F_GETFL, 0);
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	return fd;
+#endif
+}
+
+// Takes connections until the backlog is empty or accept_batch is reached.
+// Returns how many were accepted.
 int WebServer::handleNewConnection(int listen_fd)
 {
-	sockaddr_in client_addr;
-	socklen_t addrlen = sizeof(client_addr);
-	int client_fd = accept(listen_fd, (sockaddr *)&client_addr, &addrlen);
-	if (client_fd < 0)
-		return -1;
-
-	make_socket_non_blocking(client_fd);
-	conns_[client_fd]; // Create new connection (last_active already set in constructor)
-	Logger::log(LOG_INFO, "WebServer", "Accepted FD=" + to_str(client_fd));
-	return client_fd;
+	const int budget = config_->getAcceptBatch();
+	int accepted = 0;
+
+	while (accepted < budget)
+	{
+		int client_fd = acceptClient(listen_fd);
+		if (client_fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				Logger::log(LOG_ERROR, "WebServer", std::string("accept: ") + std::strerror(errno));
+			break;
+		}
+
+		// Responses go out as soon as they are queued; file bodies are
+		// corked explicitly (see WriteQueue)
+		int one = 1;
+		setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		Connection &conn = conns_.open(client_fd);
+		conn.serial = ++next_serial_;
+		// Until a request names its Host, the default server's settings apply
+		conn.server = config_;
+		if (loop_)
+			loop_->add(client_fd, IO_READ, FdHandle(FD_CLIENT, this));
+		// The header timeout runs from accept, not from the first byte
+		conn.read_deadline = TimerQueue::now() + config_->getHeaderTimeout() * 1000L;
+		armTimer(client_fd, conn);
+		Logger::log(LOG_INFO, "WebServer", "Accepted FD=" + to_str(client_fd));
+		++accepted;
+	}
+	return accepted;
 }
 
 void WebServer::handleClientDataOn(int client_fd)
 {
-	// Read data from socket
-	char buf[4096];
-	ssize_t bytes_read;
-
-	if (!readClientData(client_fd, buf, sizeof(buf), bytes_read))
+	Connection *conn = conns_.find(client_fd);
+	if (!conn)
 		return;
 
-	// Update client activity
-	updateClientActivity(client_fd);
+	// Drain the socket until it would block, a short read shows it is empty,
+	// or this connection has used up its share of the wakeup
+	size_t total = 0;
+	ssize_t bytes_read = 0;
+	int read_errno = 0;
+	bool got_data = false;
+	// Once a response that ends the connection is queued, nothing the peer
+	// sends afterwards is answered
+	const bool closing = conn->shouldCloseAfterWrite;
+	while (total < READ_BUDGET)
+	{
+		if (!readClientData(client_fd, &rx_buf_[0], rx_buf_.size(), bytes_read))
+		{
+			read_errno = errno;
+			break;
+		}
+		total += static_cast<size_t>(bytes_read);
 
-	// Find connection
-	std::map<int, Connection>::iterator it = conns_.find(client_fd);
-	if (it == conns_.end())
-		return;
+		if (closing)
+			continue;
+		std::string &data = conn->readBuf;
+		// Validate buffer size limits
+		if (!validateBufferSize(client_fd, data.size(), static_cast<size_t>(bytes_read)))
+			return;
+		data.append(&rx_buf_[0], static_cast<size_t>(bytes_read));
+		got_data = true;
+		if (static_cast<size_t>(bytes_read) < rx_buf_.size())
+			break;
+	}
 
-	std::string &data = it->second.readBuf;
+	if (got_data)
+	{
+		updateClientActivity(client_fd);
 
-	// Validate buffer size limits
-	if (!validateBufferSize(client_fd, data.size(), static_cast<size_t>(bytes_read)))
-		return;
+		// A new request starts once the idle connection receives bytes
+		if (conn->read_phase == PHASE_IDLE)
+			enterReadPhase(*conn, PHASE_HEADER);
+
+		// Process all complete requests in buffer
+		processBufferedRequests(client_fd);
+	}
 
-	// Append new data to buffer
-	data.append(buf, static_cast<size_t>(bytes_read));
-	// Logger::log(LOG_DEBUG, "WebServer",
-	//"FD=" + to_str(client_fd) + " buffer size after append: " + to_str(data.size()));
+	// EOF or a hard error ends the connection once buffered requests are handled
+	if (bytes_read == 0 || (bytes_read < 0 && read_errno != EAGAIN && read_errno != EWOULDBLOCK))
+	{
+		handlePeerGone(client_fd, bytes_read == 0 ? 0 : read_errno);
+		return;
+	}
 
-	// Process all complete requests in buffer
-	processBufferedRequests(client_fd);
+	// Processing may have closed the connection
+	conn = conns_.find(client_fd);
+	if (conn)
+		armTimer(client_fd, *conn);
 }
 
 // --- Main request processing function (now modular) ---
 void WebServer::process_request(Request &request, int client_fd, size_t i)
 {
+	// Route once; the handlers take the location and relative path from here
+	size_t rel = 0;
+	const LocationPlan* loc = serverFor(client_fd).matchLocation(request.getPath(), rel);
+	request.setRoute(loc, rel);
+
 	// Setup connection policy
 	setupConnectionPolicy(request, client_fd);
 
 	// Perform basic validation
-	if (!performBasicValidation(request, client_fd, i))
+	if (!performBasicValidation(request, loc, client_fd, i))
 		return;
 
 	// Handle Expect: 100-continue
 	if (!handleExpectContinue(request, client_fd, i))
 		return;
 
-	std::string uri = request.getPath();
-	const LocationConfig *loc = match_location(config_->getLocations(), uri);
-
 	// Handle CGI requests for GET/DELETE
 	if (handleCGIRequest(request, loc, client_fd, i))
 		return;
@@ -191,30 +288,25 @@ void WebServer::process_request(Request &request, int client_fd, size_t i)
 
 	// Dispatch to method-specific handlers
 	dispatchMethodHandler(request, loc, client_fd, i);
-
-	// Finalize request processing
-	finalizeRequestProcessing(client_fd);
 }
 
 bool WebServer::validate_post_request(Request &request, int client_fd, size_t i)
 {
 	long contentLength = request.getContentLength();
 	bool isChunked = request.isChunked();
-	long maxBodySize = config_->getMaxBodySize();
+	long maxBodySize = serverFor(client_fd).getMaxBodySize();
 
 	// Must have either Content-Length or chunked, but not both
 	if (contentLength && isChunked)
 	{
 		send_error_response(client_fd, 400, "Bad Request", i);
-		if (conns_.count(client_fd))
-			conns_[client_fd].shouldCloseAfterWrite = true;
+		markCloseAfterWrite(client_fd);
 		return false;
 	}
 	if (!contentLength && !isChunked)
 	{
 		send_error_response(client_fd, 411, "Length Required", i);
-		if (conns_.count(client_fd))
-			conns_[client_fd].shouldCloseAfterWrite = true;
+		markCloseAfterWrite(client_fd);
 		return false;
 	}
 
@@ -224,15 +316,13 @@ bool WebServer::validate_post_request(Request &request, int client_fd, size_t i)
 		if (contentLength < 0 || contentLength > maxBodySize)
 		{
 			send_error_response(client_fd, 413, "Payload Too Large", i);
-			if (conns_.count(client_fd))
-				conns_[client_fd].shouldCloseAfterWrite = true;
+			markCloseAfterWrite(client_fd);
 			return false;
 		}
-		if (contentLength != static_cast<long>(request.getBody().size()))
+		if (contentLength != static_cast<long>(request.getBodySize()))
 		{
 			send_error_response(client_fd, 400, "Bad Request", i);
-			if (conns_.count(client_fd))
-				conns_[client_fd].shouldCloseAfterWrite = true;
+			markCloseAfterWrite(client_fd);
 			return false;
 		}
 	}
@@ -244,167 +334,263 @@ bool WebServer::validate_post_request(Request &request, int client_fd, size_t i)
 void WebServer::cleanup_client(int client_fd, int i)
 {
 	(void)i;
+	if (Connection *conn = conns_.find(client_fd))
+		stopCgi(*conn);
+	if (loop_)
+		loop_->remove(client_fd);
 	::close(client_fd);
-	conns_.erase(client_fd);
+	conns_.close(client_fd);
 	Logger::log(LOG_INFO, "WebServer", "Cleaned up client FD=" + to_str(client_fd));
 }
 
 void WebServer::queueResponse(int client_fd,
 							  const std::string &rawResponse)
 {
-	Connection &conn = conns_[client_fd];
-	conn.writeBuf += rawResponse;
+	Connection *c = conns_.find(client_fd);
+	if (!c)
+		return; // closed while the response was being built
+	Connection &conn = *c;
+	bool wasIdle = conn.writeBuf.empty();
+	size_t head_end;
+	if (conn.head_only && (head_end = rawResponse.find("\r\n\r\n")) != std::string::npos)
+		conn.writeBuf.append(rawResponse.substr(0, head_end + 4));
+	else
+		conn.writeBuf.append(rawResponse);
+	// Only the empty -> pending transition changes what we wait for
+	if (wasIdle && !conn.writeBuf.empty())
+		startWriting(client_fd, conn);
+}
+
+void WebServer::queueFileResponse(int client_fd, const std::string &head,
+								  int file_fd, off_t off, size_t len)
+{
+	Connection *c = conns_.find(client_fd);
+	if (!c)
+	{
+		::close(file_fd);
+		return;
+	}
+	Connection &conn = *c;
+	bool wasIdle = conn.writeBuf.empty();
+	conn.writeBuf.append(head);
+	if (conn.head_only)
+		::close(file_fd);
+	else
+		conn.writeBuf.appendFile(file_fd, off, len);
+	if (wasIdle && !conn.writeBuf.empty())
+		startWriting(client_fd, conn);
+}
+
+void WebServer::queueSharedResponse(int client_fd, const std::string &head, SharedBuffer *body)
+{
+	Connection *c = conns_.find(client_fd);
+	if (!c)
+		return;
+	Connection &conn = *c;
+	bool wasIdle = conn.writeBuf.empty();
+	conn.writeBuf.append(head);
+	if (!conn.head_only)
+		conn.writeBuf.appendShared(body);
+	if (wasIdle && !conn.writeBuf.empty())
+		startWriting(client_fd, conn);
+}
+
+void WebServer::queueGzipFileResponse(int client_fd, const std::string &head, int file_fd,
+									  size_t len, int level)
+{
+	Connection *c = conns_.find(client_fd);
+	if (!c)
+	{
+		::close(file_fd);
+		return;
+	}
+	Connection &conn = *c;
+	bool wasIdle = conn.writeBuf.empty();
+	conn.writeBuf.append(head);
+	if (conn.head_only)
+		::close(file_fd);
+	else
+		conn.writeBuf.appendGzipFile(file_fd, 0, len, level);
+	if (wasIdle && !conn.writeBuf.empty())
+		startWriting(client_fd, conn);
+}
+
+// The queue went from empty to pending: wait for writability, with the
+// send timeout running
+void WebServer::startWriting(int client_fd, Connection &conn)
+{
+	if (loop_)
+		loop_->modify(client_fd, IO_READ | IO_WRITE);
+	conn.send_deadline = TimerQueue::now() + conn.server->getSendTimeout() * 1000L;
+	armTimer(client_fd, conn);
 }
 
 bool WebServer::hasPendingWrite(int client_fd) const
 {
-	std::map<int, Connection>::const_iterator it = conns_.find(client_fd);
-	if (it == conns_.end())
-		return false;
-	return !it->second.writeBuf.empty();
+	const Connection *conn = conns_.find(client_fd);
+	return conn && !conn->writeBuf.empty();
 }
 
 void WebServer::flushPendingWrites(int client_fd)
 {
-	std::map<int, Connection>::iterator it = conns_.find(client_fd);
-	if (it == conns_.end())
+	Connection *c = conns_.find(client_fd);
+	if (!c)
 		return;
 
-	Connection &conn = it->second;
+	Connection &conn = *c;
 
-	// Nothing to send? Let the next buildPollFds() omit POLLOUT.
+	// Nothing to send? Stop waiting for writability.
 	if (conn.writeBuf.empty())
+	{
+		if (loop_)
+			loop_->modify(client_fd, IO_READ);
 		return;
+	}
 
-	// EXACTLY ONE write() attempt per POLLOUT event
-	ssize_t n = ::write(client_fd, conn.writeBuf.data(), conn.writeBuf.size());
+	// Write until the queue drains or the socket buffer is full
+	size_t written = 0;
+	WriteQueue::FlushResult res = conn.writeBuf.flush(client_fd, written);
 
-	if (n > 0)
+	if (res == WriteQueue::FLUSH_ERROR)
 	{
-		// Consume written bytes
-		conn.writeBuf.erase(0, static_cast<size_t>(n));
-		updateClientActivity(client_fd);
+		Logger::log(LOG_INFO, "flush", "fd=" + to_str(client_fd) + " write failed: " + std::strerror(errno));
+		closeClient(client_fd);
+		return;
+	}
 
-		// If we fully drained the buffer, decide whether to close
-		if (conn.writeBuf.empty())
-		{
-			if (conn.shouldCloseAfterWrite)
-			{
-				// Close now; next poll build won’t include this fd
-				closeClient(client_fd); // or cleanup_client(client_fd, 0);
-				return;
-			}
-			// Drained but keeping open (keep-alive). No POLLOUT next time.
-			// Logger::log(LOG_DEBUG, "flush", "fd=" + to_str(client_fd) + " drained; keeping open");
-		}
-		return; // one write done this cycle
+	if (written > 0)
+	{
+		updateClientActivity(client_fd);
+		conn.send_deadline = TimerQueue::now() + conn.server->getSendTimeout() * 1000L;
 	}
 
-	if (n == 0)
+	if (res == WriteQueue::FLUSH_AGAIN)
 	{
-		// Peer closed the write side; remove client.
-		closeClient(client_fd); // or cleanup_client(client_fd, 0);
-		return;
+		armTimer(client_fd, conn);
+		return; // wait for the next writability event
 	}
 
-	if (n < 0)
+	// Fully drained: decide whether to close
+	if (conn.shouldCloseAfterWrite)
 	{
-		Logger::log(LOG_INFO, "flush", "fd=" + to_str(client_fd) + " write made no progress; will retry");
+		// Close now; closeClient() also drops it from the event loop
 		closeClient(client_fd);
 		return;
 	}
-
-	return;
+	// Drained but keeping open (keep-alive). Stop waiting for POLLOUT.
+	if (loop_)
+		loop_->modify(client_fd, IO_READ);
+	// Idle time counts from the end of the response, not of the request
+	if (conn.read_phase == PHASE_IDLE)
+		enterReadPhase(conn, PHASE_IDLE);
+	armTimer(client_fd, conn);
 }
 
 // Timeout management methods
-time_t WebServer::getClientLastActive(int client_fd) const
-{
-	std::map<int, Connection>::const_iterator it = conns_.find(client_fd);
-	if (it == conns_.end())
-		return 0;
-	return it->second.last_active;
-}
 
-void WebServer::updateClientActivity(int client_fd)
+// Header timeout covers the whole request head, so re-entering PHASE_HEADER
+// does not extend it; body and idle deadlines restart on every call.
+void WebServer::enterReadPhase(Connection &conn, ReadPhase phase)
 {
-	std::map<int, Connection>::iterator it = conns_.find(client_fd);
-	if (it != conns_.end())
-	{
-		it->second.last_active = time(NULL);
-	}
-}
+	if (phase == PHASE_HEADER && conn.read_phase == PHASE_HEADER)
+		return;
 
-void WebServer::closeClient(int client_fd)
-{
-	std::map<int, Connection>::iterator it = conns_.find(client_fd);
-	if (it != conns_.end())
-	{
-		::close(client_fd);
-		conns_.erase(it);
-		Logger::log(LOG_INFO, "Webserv", "Closed client fd=" + to_str(client_fd));
-	}
+	int seconds = conn.server->getHeaderTimeout();
+	if (phase == PHASE_BODY)
+		seconds = conn.server->getBodyTimeout();
+	else if (phase == PHASE_IDLE)
+		seconds = conn.server->getKeepaliveTimeout();
+	conn.read_phase = phase;
+	conn.read_deadline = TimerQueue::now() + seconds * 1000L;
 }
 
-bool WebServer::isAbsoluteHttpUrl(const std::string &s)
+// Makes sure the timer queue holds an entry no later than the connection's
+// current deadline. A deadline that moved later keeps its old entry: when it
+// fires, onTimer() sees the connection is not due yet and re-arms it.
+void WebServer::armTimer(int client_fd, Connection &conn)
 {
-	return (s.compare(0, 7, "http://") == 0) ||
-		   (s.compare(0, 8, "https://") == 0) ||
-		   (s.compare(0, 2, "//") == 0);
+	long deadline = conn.writeBuf.empty() ? conn.read_deadline : conn.send_deadline;
+	// A running script holds the request open: no read timeout applies, only
+	// the script's own deadline
+	const CgiState *cgi = conn.cgiState();
+	if (cgi && (conn.writeBuf.empty() || cgi->wakeAt() < deadline))
+		deadline = cgi->wakeAt();
+	if (!loop_ || deadline == 0)
+		return;
+	if (conn.timer_at != 0 && conn.timer_at <= deadline)
+		return;
+	conn.timer_at = deadline;
+	loop_->timers().schedule(TimerEntry(deadline, this, client_fd, conn.serial));
 }
 
-std::string WebServer::hostportFromUrl(const std::string &url)
+void WebServer::onTimer(const TimerEntry &entry, long now)
 {
+	Connection *c = conns_.find(entry.fd);
+	if (!c || c->serial != entry.serial)
+		return; // connection already gone (fd may have been reused)
+
+	Connection &conn = *c;
+	if (entry.deadline != conn.timer_at)
+		return; // superseded by an earlier entry
+	conn.timer_at = 0;
 
-	std::string s = url;
-	size_t start = 0;
-	if (s.compare(0, 2, "//") == 0)
+	CgiState *cgi = conn.cgiState();
+	if (cgi && (conn.writeBuf.empty() || conn.send_deadline > now))
 	{
-		start = 2;
+		if (cgi->deadline <= now)
+			return onCgiTimeout(entry.fd, conn);
+		if (cgi->poll_at == 0 || cgi->poll_at > now)
+			return armTimer(entry.fd, conn);
+		cgi->poll_at = 0;
+		return collectCgi(entry.fd, conn);
 	}
-	else
+
+	if (!conn.writeBuf.empty())
 	{
-		size_t p = s.find("://");
-		if (p != std::string::npos)
-			start = p + 3;
+		if (conn.send_deadline > now)
+			return armTimer(entry.fd, conn);
+		Logger::log(LOG_INFO, "Timeout", "fd=" + to_str(entry.fd) + " send timed out; closing");
+		closeClient(entry.fd);
+		return;
 	}
-	size_t end = s.find('/', start);
-	if (end == std::string::npos)
-		end = s.size();
-	return s.substr(start, end - start);
-}
 
-bool WebServer::iequals(const std::string &a, const std::string &b)
-{
-	if (a.size() != b.size())
-		return false;
-	for (size_t i = 0; i < a.size(); ++i)
+	if (conn.read_deadline > now)
+		return armTimer(entry.fd, conn);
+
+	if (conn.read_phase == PHASE_IDLE)
 	{
-		char ca = a[i], cb = b[i];
-		if ('A' <= ca && ca <= 'Z')
-			ca = char(ca - 'A' + 'a');
-		if ('A' <= cb && cb <= 'Z')
-			cb = char(cb - 'A' + 'a');
-		if (ca != cb)
-			return false;
+		Logger::log(LOG_INFO, "Timeout", "fd=" + to_str(entry.fd) + " keep-alive idle; closing");
+		closeClient(entry.fd);
+		return;
 	}
-	return true;
+
+	Logger::log(LOG_INFO, "Timeout", "fd=" + to_str(entry.fd) +
+				(conn.read_phase == PHASE_HEADER ? " header" : " body") + " read timed out");
+	conn.readBuf.clear();
+	conn.resetRequest();
+	conn.shouldCloseAfterWrite = true;
+	send_error_response(entry.fd, 408, "Request Timeout", 0);
 }
 
-bool WebServer::isExternalRedirect(const std::string &location, const std::string &reqHost)
+void WebServer::updateClientActivity(int client_fd)
 {
-	if (!location.empty() && location[0] == '/')
-		return false;
+	Connection *conn = conns_.find(client_fd);
+	if (conn)
+		conn->last_active = time(NULL);
+}
 
-	if (isAbsoluteHttpUrl(location))
+void WebServer::closeClient(int client_fd)
+{
+	if (Connection *conn = conns_.find(client_fd))
 	{
-		std::string hp = hostportFromUrl(location);
-		if (reqHost.empty())
-			return true;
-		return !iequals(hp, reqHost);
+		// A script still running for the request is killed with it
+		stopCgi(*conn);
+		if (loop_)
+			loop_->remove(client_fd);
+		::close(client_fd);
+		conns_.close(client_fd);
+		Logger::log(LOG_INFO, "Webserv", "Closed client fd=" + to_str(client_fd));
 	}
-
-	return true;
 }
 
 bool WebServer::resolve_ipv4(const std::string &host, in_addr *out)
@@ -442,7 +628,43 @@ bool WebServer::resolve_ipv4(const std::string &host, in_addr *out)
 
 void WebServer::markCloseAfterWrite(int fd)
 {
-	std::map<int, Connection>::iterator it = conns_.find(fd);
-	if (it != conns_.end())
-		it->second.shouldCloseAfterWrite = true;
+	Connection *conn = conns_.find(fd);
+	if (conn)
+		conn->shouldCloseAfterWrite = true;
+}
+
+bool WebServer::willCloseAfterWrite(int fd) const
+{
+	const Connection *conn = conns_.find(fd);
+	return !conn || conn->shouldCloseAfterWrite;
+}
+
+// Connection / Keep-Alive headers for the response about to be queued on fd.
+// max= is what is left of keepalive_requests after the current request.
+void WebServer::applyConnectionPolicy(Response &resp, int client_fd) const
+{
+	const Connection *conn = conns_.find(client_fd);
+	bool keepAlive = conn && !conn->shouldCloseAfterWrite;
+	int left = 0;
+	if (conn)
+		left = conn->server->getKeepaliveRequests() - static_cast<int>(conn->requests);
+	resp.applyConnectionHeaders(keepAlive, serverFor(client_fd).getKeepaliveTimeout(), left);
+}
+
+// Server block of the request on fd (the default server before the first
+// request head, or once the connection is gone)
+const Config &WebServer::serverFor(int client_fd) const
+{
+	const Connection *conn = conns_.find(client_fd);
+	return conn && conn->server ? *conn->server : *config_;
+}
+
+std::string WebServer::connectionHeaderLines(int client_fd) const
+{
+	const Connection *conn = conns_.find(client_fd);
+	if (!conn || conn->shouldCloseAfterWrite)
+		return "Connection: close\r\n";
+	int left = conn->server->getKeepaliveRequests() - static_cast<int>(conn->requests);
+	return "Connection: keep-alive\r\nKeep-Alive: timeout=" + to_str(conn->server->getKeepaliveTimeout()) +
+		   ", max=" + to_str(left) + "\r\n";
 }
@@ -11,73 +11,98 @@
 #include <cstring>
 #include "../logger/Logger.hpp"
 #include "Config.hpp"
+#include "VirtualHosts.hpp"
 #include "LocationConfig.hpp"
 #include "Request.hpp"
 #include "Response.hpp"
 #include "CGIHandler.hpp"
 #include "utils.hpp"
 #include "Connection.hpp"
+#include "ConnectionTable.hpp"
+#include "EventLoop.hpp"
+#include "OpenFileCache.hpp"
+#include "ResponseCache.hpp"
 
 
 class Config;
+struct MainConfig;
+
+// One byte range of a Range request, both ends inclusive and inside the file
+struct ByteRange {
+    off_t first;
+    off_t last;
+};
 
 class WebServer {
 public:
     // ...existing public methods...
-    explicit WebServer(const Config& cfg);
+    WebServer(const VirtualHosts& vhosts, const MainConfig& main, bool reusePort = false);
     ~WebServer();
     void shutdown();
+    void attachEventLoop(EventLoop* loop);
     int  handleNewConnection(int listen_fd);
     void handleClientDataOn(int client_fd);
     const std::vector<int>& getListeningSockets() const { return listening_sockets; }
-    std::vector<int> getClientSockets() const {
-        std::vector<int> v;
-        v.reserve(conns_.size());
-
-    for (std::map<int,Connection>::const_iterator it = conns_.begin();
-             it != conns_.end();
-             ++it)
-        {
-            v.push_back(it->first);
-        }
-        return v;
-    }
-    std::string read_file(const std::string& path);
     void queueResponse(int client_fd,
                       const std::string& rawResponse);
+    // head, then len bytes of file_fd from off (sent with sendfile(); the
+    // connection's queue takes ownership of file_fd)
+    void queueFileResponse(int client_fd, const std::string& head,
+                           int file_fd, off_t off, size_t len);
+    // head, then the bytes of body (referenced, not copied)
+    void queueSharedResponse(int client_fd, const std::string& head, SharedBuffer* body);
+    // head, then len bytes of file_fd from its start gzip coded at level and
+    // chunked (compressed as the socket takes them; the queue owns file_fd)
+    void queueGzipFileResponse(int client_fd, const std::string& head, int file_fd, size_t len, int level);
     bool hasPendingWrite(int client_fd) const;
     void flushPendingWrites(int client_fd);
+    // Readiness of the CGI pipes of client_fd's script
+    void onCgiInput(int client_fd);
+    void onCgiOutput(int client_fd);
 
     // Timeout management
-    time_t getClientLastActive(int client_fd) const;
+    void onTimer(const TimerEntry& entry, long now);
     void updateClientActivity(int client_fd);
     void closeClient(int client_fd);
     void send_continue_response(int client_fd);
 	void send_error_response  (int, int, const std::string&, size_t);
     void markCloseAfterWrite(int fd);
+    bool willCloseAfterWrite(int fd) const;
+    void applyConnectionPolicy(Response& resp, int client_fd) const;
+    // The same policy as ready-made header lines, for pre-serialized responses
+    std::string connectionHeaderLines(int client_fd) const;
+    const Config& serverFor(int client_fd) const;
     // int check_headers(const std::string &headers, long maxBodySize);
-    std::map<int, Connection> conns_;
-	std::map<int, Connection>& getConnections() { return conns_; }
+    ConnectionTable conns_;
 private:
     bool validate_post_request(Request &request, int client_fd, size_t i);
     // Helper functions for handleClientDataOn modularity
     bool readClientData(int client_fd, char* buf, size_t buf_size, ssize_t& bytes_read);
+    void handlePeerGone(int client_fd, int read_errno);
     bool validateBufferSize(int client_fd, size_t current_size, size_t new_bytes);
-    bool validateContentLength(int client_fd, const std::string& headers);
-    size_t calculateRequestSize(const std::string& buffer, size_t header_bytes, const std::string& headers);
-    bool processCompleteRequest(int client_fd, const std::string& frame);
+    bool validateContentLength(int client_fd, long len);
+    bool processCompleteRequest(int client_fd, Request& req);
+    void streamMultipartUpload(Connection& conn, const Config& server);
     void processBufferedRequests(int client_fd);
+    void enterReadPhase(Connection& conn, ReadPhase phase);
+    void armTimer(int client_fd, Connection& conn);
+    void startWriting(int client_fd, Connection& conn);
 
     // Helper functions for process_request modularity
 	void setupConnectionPolicy(Request& request, int client_fd);
-	bool performBasicValidation(Request& request, int client_fd, size_t i);
+	bool performBasicValidation(Request& request, const LocationPlan* loc, int client_fd, size_t i);
 	bool handleExpectContinue(Request& request, int client_fd, size_t i);
-	bool handleCGIRequest(Request& request, const LocationConfig* loc, int client_fd, size_t i);
-	bool handleRedirection(Request& request, const LocationConfig* loc, int client_fd, size_t i);
-	void dispatchMethodHandler(Request& request, const LocationConfig* loc, int client_fd, size_t i);
-    void finalizeRequestProcessing(int client_fd);
-
-	const Config*                 config_;
+	bool handleCGIRequest(Request& request, const LocationPlan* loc, int client_fd, size_t i);
+	bool handleRedirection(Request& request, const LocationPlan* loc, int client_fd, size_t i);
+	void dispatchMethodHandler(Request& request, const LocationPlan* loc, int client_fd, size_t i);
+
+	const Config*                 config_;      // default server of the address
+	const VirtualHosts*           vhosts_;      // every server block on it
+	EventLoop*                    loop_;
+	unsigned long                 next_serial_;
+	std::vector<char>             rx_buf_;      // scratch for socket reads
+	OpenFileCache                 files_;       // static file lookups
+	ResponseCache                 responses_;   // hot static responses
 
 	std::vector<int>              listening_sockets;
     void make_socket_non_blocking(int fd);
@@ -85,48 +110,56 @@ private:
 
     // Getter for connections map
 
-    std::string resolve_path(const std::string& raw_path,
-                             const std::string& method,
-                             const LocationConfig* loc);
+    std::string resolve_path(const Request& request, const LocationPlan* loc);
 
     // Helpers that drive GET/POST/DELETE/CGI/etc.
-    void handle_get    (const Request&, const LocationConfig*, int, size_t);
-    void handle_post   (const Request&, const LocationConfig*, int, size_t);
-    void handle_delete (const Request&, const LocationConfig*, int, size_t);
-    void handle_cgi    (const LocationConfig*, const Request&, int, size_t);
-
-    void handle_directory_request(const std::string&, const std::string&,
-                                  const LocationConfig*, int, size_t);
-    void handle_file_request     (const std::string&, int, size_t);
-
-    bool handle_upload            (const Request&, const LocationConfig*, int, size_t);
-    bool is_valid_upload_request  (const Request&, const LocationConfig*);
-    void process_upload_content   (const Request&, std::string&, std::string&);
+    void handle_get    (const Request&, const LocationPlan*, int, size_t);
+    void handle_post   (const Request&, const LocationPlan*, int, size_t);
+    void handle_delete (const Request&, const LocationPlan*, int, size_t);
+    void handle_cgi    (const LocationPlan*, const Request&, int, size_t);
+    void collectCgi    (int client_fd, Connection& conn);
+    void finishCgi     (int client_fd, Connection& conn, bool exited_ok);
+    void onCgiTimeout  (int client_fd, Connection& conn);
+    void resumeAfterCgi(int client_fd);
+    void stopCgi       (Connection& conn);
+    void closeCgiPipe  (int& fd);
+
+    void handle_directory_request(const Request&, const std::string&, const std::string&,
+                                  const LocationPlan*, int, size_t);
+    void handle_file_request     (const Request&, const LocationPlan*, const std::string&,
+                                  const std::string&, const OpenFileCache::File&, int, size_t);
+
+    bool handle_upload            (const Request&, const LocationPlan*, int, size_t);
+    bool is_valid_upload_request  (const Request&, const LocationPlan*);
+    void handle_multipart_upload  (const Request&, const LocationPlan*, const std::string&, int, size_t);
     std::string make_upload_filename(const std::string&);
-    bool write_upload_file        (const std::string&, const std::string&);
-    void send_upload_success_response(int, const std::string&, size_t);
-    void send_upload_success_json(int client_fd, const std::string &full_filename, size_t i); // JESS: handles post request for frontend
+    bool write_upload_file        (const std::string&, const RequestBody&);
+    void send_upload_success      (const Request&, const std::vector<std::string>&, int, size_t);
+    void send_upload_success_response(int, const std::vector<std::string>&, size_t);
+    void send_upload_success_json(int client_fd, const std::vector<std::string> &paths, size_t i); // JESS: handles post request for frontend
     
     void send_ok_response     (int, const std::string&, const std::map<std::string,std::string>&, size_t);
-    void send_file_response   (int, const std::string&, size_t);
-    void send_redirect_response(int, int, const std::string&, size_t);
+    void send_file_response   (int, const Request&, const LocationPlan&, const std::string&,
+                               const std::string&, const OpenFileCache::File&, size_t);
+    void send_sidecar_response(int, const Request&, const LocationPlan&, const std::string&,
+                               const OpenFileCache::File&, const char*, size_t);
+    void send_range_response  (int, const std::string&, const OpenFileCache::File&,
+                               const std::vector<ByteRange>&, const std::string&, size_t);
+    void send_gzip_file_response(int, const Request&, const LocationPlan&, const std::string&,
+                                 const OpenFileCache::File&, const std::string&, size_t);
+    void gzip_body            (const std::string&, const LocationPlan&, std::string&,
+                               std::map<std::string, std::string>&);
+    void send_redirect_response(int, const LocationPlan&, size_t);
     void send_created_response(int client_fd,
                                const std::string &body,
                                const std::map<std::string, std::string> &headers,
                                size_t i);
     void send_no_content_response(int client_fd, size_t i);
 
-    size_t find_header_end          (const std::string&);
     bool   read_and_append_client_data(int, size_t);
-    int    parse_content_length     (const std::string&);
-    bool   is_full_body_received    (const Request&, const std::string&, size_t);
     void   process_request          (Request&, int, size_t);
     static std::string timestamp();
 
-    static bool isAbsoluteHttpUrl(const std::string& s);
-    static std::string hostportFromUrl(const std::string& url);
-    static bool iequals(const std::string& a, const std::string& b);
-    static bool isExternalRedirect(const std::string& location, const std::string& reqHost);
     bool resolve_ipv4(const std::string& host, in_addr* out);
 };
 
@@ -0,0 +1,362 @@
+#include "WriteQueue.hpp"
+#include "Gzip.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Small writes (status lines, short error pages) are merged into the last
+// segment so a burst of them still fits in one iovec
+static const size_t COALESCE_LIMIT = 4096;
+// Segments handed to one writev(); well below IOV_MAX everywhere
+static const int MAX_IOV = 64;
+// One sendfile() call moves at most this much, and one flush() at most
+// FILE_BUDGET of file data: a client on a fast link gets the rest on the
+// next writability event instead of holding the loop for a whole file
+static const size_t FILE_CHUNK = 1024 * 1024;
+static const size_t FILE_BUDGET = 4 * 1024 * 1024;
+// A gzip segment is refilled from this much file data at a time, and one
+// flush() compresses at most COMPRESS_BUDGET of it, for the same reason
+static const size_t COMPRESS_CHUNK = 64 * 1024;
+static const size_t COMPRESS_BUDGET = 1024 * 1024;
+
+struct WriteQueue::GzipFile {
+    GzipEncoder enc;
+    int         fd;
+    off_t       off;    // next byte to compress
+    size_t      left;   // bytes not compressed yet
+
+    GzipFile(int f, off_t o, size_t len, int level) : enc(level), fd(f), off(o), left(len) {}
+    ~GzipFile() { close(fd); }
+};
+
+void WriteQueue::append(const std::string& data)
+{
+    if (data.empty())
+        return;
+    if (head_ < segs_.size() && segs_.back().file < 0 && !segs_.back().shared && !segs_.back().gzip &&
+        data.size() <= COALESCE_LIMIT &&
+        segs_.back().data.size() + data.size() <= COALESCE_LIMIT)
+        segs_.back().data += data;
+    else
+    {
+        segs_.push_back(Segment());
+        segs_.back().data = data;
+    }
+    bytes_ += data.size();
+}
+
+void WriteQueue::appendFile(int fd, off_t off, size_t len)
+{
+    if (len == 0)
+    {
+        close(fd);
+        return;
+    }
+    segs_.push_back(Segment());
+    segs_.back().file = fd;
+    segs_.back().file_off = off;
+    segs_.back().file_len = len;
+    bytes_ += len;
+}
+
+void WriteQueue::appendShared(SharedBuffer* buf)
+{
+    if (buf->size() == 0)
+        return;
+    buf->retain();
+    segs_.push_back(Segment());
+    segs_.back().shared = buf;
+    bytes_ += buf->size();
+}
+
+void WriteQueue::appendGzipFile(int fd, off_t off, size_t len, int level)
+{
+    segs_.push_back(Segment());
+    segs_.back().gzip = new GzipFile(fd, off, len, level);
+    ++streams_;
+}
+
+// Drops what the segment owns: its file descriptor, shared reference or
+// compression stream
+void WriteQueue::release(Segment& s)
+{
+    if (s.file >= 0)
+        close(s.file);
+    if (s.shared)
+        s.shared->release();
+    if (s.gzip)
+    {
+        delete s.gzip;
+        --streams_;
+    }
+    s.file = -1;
+    s.file_len = 0;
+    s.shared = NULL;
+    s.gzip = NULL;
+}
+
+// Compresses the next piece of a gzip segment whose data was sent (or not
+// made yet) into one chunk. The last piece also carries the last chunk, and
+// the segment becomes a plain memory segment. false: the file could not be
+// read or zlib failed.
+bool WriteQueue::refill(Segment& s)
+{
+    GzipFile& gz = *s.gzip;
+    std::string out;
+    char buf[COMPRESS_CHUNK];
+    size_t fed = 0;
+    while (out.empty() && !gz.enc.finished())
+    {
+        size_t want = gz.left < sizeof(buf) ? gz.left : sizeof(buf);
+        ssize_t got = 0;
+        if (want > 0)
+        {
+            got = ::pread(gz.fd, buf, want, gz.off);
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+            {
+                if (got == 0)
+                    errno = EIO;   // the file shrank under us
+                return false;
+            }
+            gz.off += got;
+            gz.left -= static_cast<size_t>(got);
+            fed += static_cast<size_t>(got);
+        }
+        // Highly compressible input can keep deflate quiet for a long
+        // time; past a budget's worth, make it emit what it has
+        GzipEncoder::Flush mode = gz.left == 0 ? GzipEncoder::GZ_FINISH
+                                  : fed >= COMPRESS_BUDGET ? GzipEncoder::GZ_SYNC
+                                                           : GzipEncoder::GZ_NONE;
+        if (!gz.enc.write(buf, static_cast<size_t>(got), out, mode))
+        {
+            errno = EIO;
+            return false;
+        }
+    }
+    compress_budget_ = fed < compress_budget_ ? compress_budget_ - fed : 0;
+
+    s.data.clear();
+    if (!out.empty())
+    {
+        char size_line[24];
+        std::snprintf(size_line, sizeof(size_line), "%lx\r\n", static_cast<unsigned long>(out.size()));
+        s.data = size_line;
+        s.data += out;
+        s.data += "\r\n";
+    }
+    if (gz.enc.finished())
+    {
+        s.data += "0\r\n\r\n";
+        delete s.gzip;
+        s.gzip = NULL;
+        --streams_;
+    }
+    // A segment behind the head may be refilled while the head is partly
+    // sent; head_off_ belongs to the head
+    if (&s == &segs_[head_])
+        head_off_ = 0;
+    bytes_ += s.data.size();
+    return true;
+}
+
+void WriteQueue::clear()
+{
+    for (size_t i = head_; i < segs_.size(); ++i)
+        release(segs_[i]);
+    segs_.clear();
+    head_ = 0;
+    head_off_ = 0;
+    bytes_ = 0;
+    corked_ = false;
+}
+
+void WriteQueue::consume(size_t n)
+{
+    bytes_ -= n;
+    while (n > 0)
+    {
+        Segment& s = segs_[head_];
+        size_t left = s.file >= 0 ? s.file_len : s.bytes().size() - head_off_;
+        if (n < left)
+        {
+            if (s.file >= 0)
+            {
+                s.file_off += static_cast<off_t>(n);
+                s.file_len -= n;
+            }
+            else
+                head_off_ += n;
+            return;
+        }
+        n -= left;
+        if (s.gzip)
+        {
+            // More to compress: the segment stays at the head, empty
+            // until refill(). It always ends a writev() batch, so n is 0.
+            s.data.clear();
+            head_off_ = 0;
+            break;
+        }
+        release(s);
+        std::string().swap(s.data);  // free sent data right away
+        ++head_;
+        head_off_ = 0;
+    }
+    if (bytes_ == 0 && streams_ == 0)
+    {
+        segs_.clear();
+        head_ = 0;
+    }
+    else if (head_ >= 64 && head_ * 2 >= segs_.size())
+    {
+        // A peer that keeps pipelining never lets the queue run empty;
+        // drop the sent (already emptied) slots now and then
+        segs_.erase(segs_.begin(), segs_.begin() + head_);
+        head_ = 0;
+    }
+}
+
+// TCP_CORK holds partial frames until it is lifted, so a response head and
+// the start of its file body share packets. Fails harmlessly on non-TCP fds.
+void WriteQueue::cork(int fd, bool on)
+{
+    int v = on ? 1 : 0;
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &v, sizeof(v));
+    corked_ = on;
+}
+
+// Memory segments from the head up to the next file segment, in writev()
+// batches. A gzip segment is refilled before it goes out and ends its
+// batch. FLUSH_DONE: they are all sent.
+WriteQueue::FlushResult WriteQueue::flushMemory(int fd, size_t& written)
+{
+    while (head_ < segs_.size() && segs_[head_].file < 0)
+    {
+        struct iovec iov[MAX_IOV];
+        int cnt = 0;
+        size_t want = 0;
+        size_t i = head_;
+        while (i < segs_.size() && segs_[i].file < 0 && cnt < MAX_IOV)
+        {
+            Segment& s = segs_[i];
+            if (s.gzip && s.data.empty())
+            {
+                if (compress_budget_ == 0 && cnt == 0)
+                    return FLUSH_AGAIN;
+                if (compress_budget_ == 0)
+                    break;
+                if (!refill(s))
+                    return FLUSH_ERROR;
+            }
+            const std::string& bytes = s.bytes();
+            size_t off = (i == head_) ? head_off_ : 0;
+            iov[cnt].iov_base = const_cast<char*>(bytes.data()) + off;
+            iov[cnt].iov_len = bytes.size() - off;
+            want += iov[cnt].iov_len;
+            ++cnt;
+            ++i;
+            if (s.gzip)
+                break;
+        }
+        if (i < segs_.size() && segs_[i].file >= 0 && !corked_)
+            cork(fd, true);
+
+        ssize_t n = ::writev(fd, iov, cnt);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return FLUSH_AGAIN;
+            return FLUSH_ERROR;
+        }
+        if (n == 0)
+            return FLUSH_ERROR;
+
+        consume(static_cast<size_t>(n));
+        written += static_cast<size_t>(n);
+        // A short write means the socket buffer is full; asking again
+        // would only return EAGAIN
+        if (static_cast<size_t>(n) < want)
+            return FLUSH_AGAIN;
+    }
+    return FLUSH_DONE;
+}
+
+// The file segment at the head. FLUSH_DONE: it is sent completely.
+WriteQueue::FlushResult WriteQueue::flushFile(int fd, size_t& written)
+{
+    size_t budget = FILE_BUDGET;
+    while (head_ < segs_.size() && segs_[head_].file >= 0)
+    {
+        if (budget == 0)
+            return FLUSH_AGAIN;
+        Segment& s = segs_[head_];
+        size_t want = s.file_len < FILE_CHUNK ? s.file_len : FILE_CHUNK;
+        if (want > budget)
+            want = budget;
+
+        off_t off = s.file_off;
+        ssize_t n = ::sendfile(fd, s.file, &off, want);
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            // File system without sendfile support: copy through a buffer
+            char buf[64 * 1024];
+            ssize_t got = ::pread(s.file, buf, want < sizeof(buf) ? want : sizeof(buf), s.file_off);
+            if (got <= 0)
+            {
+                if (got == 0)
+                    errno = EIO;
+                return FLUSH_ERROR;
+            }
+            n = ::write(fd, buf, static_cast<size_t>(got));
+            want = static_cast<size_t>(got);
+        }
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return FLUSH_AGAIN;
+            return FLUSH_ERROR;
+        }
+        if (n == 0)
+        {
+            errno = EIO;   // the file shrank under us; the response cannot be completed
+            return FLUSH_ERROR;
+        }
+
+        bool last = static_cast<size_t>(n) == s.file_len;
+        consume(static_cast<size_t>(n));
+        written += static_cast<size_t>(n);
+        budget -= static_cast<size_t>(n);
+        // Body complete: let its last partial packet go
+        if (last && corked_)
+            cork(fd, false);
+        if (static_cast<size_t>(n) < want)
+            return FLUSH_AGAIN;
+    }
+    return FLUSH_DONE;
+}
+
+WriteQueue::FlushResult WriteQueue::flush(int fd, size_t& written)
+{
+    written = 0;
+    compress_budget_ = COMPRESS_BUDGET;
+    while (bytes_ > 0 || streams_ > 0)
+    {
+        FlushResult res = segs_[head_].file >= 0 ? flushFile(fd, written) : flushMemory(fd, written);
+        if (res != FLUSH_DONE)
+            return res;
+    }
+    if (corked_)
+        cork(fd, false);
+    return FLUSH_DONE;
+}
@@ -0,0 +1,96 @@
+#ifndef WRITEQUEUE_HPP
+#define WRITEQUEUE_HPP
+
+#include "SharedBuffer.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+// Outgoing bytes of one connection, kept as a list of segments (a response
+// head, a body, the next pipelined response...). Sent bytes are consumed by
+// advancing an offset into the front segment, never by erasing from the
+// front of a string, so draining a large response stays linear.
+//
+// A segment can also be a range of an open file: it is sent with sendfile()
+// straight from the page cache, so a download costs no buffer memory
+// whatever the file size. While such a range is queued behind a response
+// head the socket is corked, so the head leaves in the same packet as the
+// first body bytes.
+//
+// A segment can also reference a SharedBuffer (a body from the response
+// cache): it is sent from the shared bytes, which stay alive until every
+// queue holding them has sent them.
+//
+// And a segment can be a file range sent gzip coded: it is compressed a
+// piece at a time as the socket takes it, each piece framed as an HTTP/1.1
+// chunk, so memory stays bounded whatever the file size.
+class WriteQueue {
+public:
+    enum FlushResult {
+        FLUSH_DONE,    // queue is empty
+        FLUSH_AGAIN,   // socket buffer full (or this round's file budget
+                       // used up); wait for writability
+        FLUSH_ERROR    // write failed (errno set) or peer is gone
+    };
+
+    WriteQueue() : head_(0), head_off_(0), bytes_(0), streams_(0), compress_budget_(0), corked_(false) {}
+    ~WriteQueue() { clear(); }
+
+    void   append(const std::string& data);
+    // Queues len bytes of fd from offset off. The queue owns fd from here
+    // and closes it once the range is sent or the queue is cleared.
+    void   appendFile(int fd, off_t off, size_t len);
+    // Queues the bytes of buf, holding a reference to it until they are sent
+    void   appendShared(SharedBuffer* buf);
+    // Queues len bytes of fd from offset off as a gzip stream at level, in
+    // chunked transfer coding up to and including the last chunk. Owns fd
+    // like appendFile().
+    void   appendGzipFile(int fd, off_t off, size_t len, int level);
+    bool   empty() const { return bytes_ == 0 && streams_ == 0; }
+    size_t size() const { return bytes_; }
+    void   clear();
+
+    // writev()/sendfile() in a loop until the queue drains or the socket
+    // would block. written receives the number of bytes sent by this call.
+    FlushResult flush(int fd, size_t& written);
+
+private:
+    struct GzipFile;
+
+    struct Segment {
+        std::string   data;
+        SharedBuffer* shared;    // non-NULL: the bytes are shared->data()
+        GzipFile*     gzip;      // non-NULL: data is the next piece of a
+                                 // compressed file, refilled once sent
+        int           file;      // -1: the bytes are in memory
+        off_t         file_off;  // file: next byte to send
+        size_t        file_len;  // file: bytes left
+
+        Segment() : shared(NULL), gzip(NULL), file(-1), file_off(0), file_len(0) {}
+        const std::string& bytes() const { return shared ? shared->data() : data; }
+        size_t size() const { return file >= 0 ? file_len : bytes().size(); }
+    };
+
+    WriteQueue(const WriteQueue&);
+    WriteQueue& operator=(const WriteQueue&);
+
+    void        consume(size_t n);
+    void        release(Segment& s);
+    bool        refill(Segment& s);
+    FlushResult flushMemory(int fd, size_t& written);
+    FlushResult flushFile(int fd, size_t& written);
+    void        cork(int fd, bool on);
+
+    // segs_[head_] is the oldest unsent segment. An empty vector allocates
+    // nothing, so idle connections carry no queue storage.
+    std::vector<Segment> segs_;
+    size_t               head_;
+    size_t               head_off_;  // bytes of segs_[head_] already sent (memory segments)
+    size_t               bytes_;     // unsent bytes across all segments
+    size_t               streams_;   // gzip segments not compressed to the end yet
+    size_t               compress_budget_;  // file bytes this flush() may still compress
+    bool                 corked_;    // TCP_CORK set on the socket by us
+};
+
+#endif
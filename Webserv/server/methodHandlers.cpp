@@ -1,63 +1,80 @@
 #include "WebServer.hpp"
 #include "Connection.hpp"
+#include "MultipartUpload.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// A script that has closed its stdout is usually reaped within this many ms
+static const long CGI_POLL_MS = 5;
 
 // HTTP method handlers for WebServer. Each function processes a specific HTTP request type.
 
 // --- GET Handler ---
 // Handles HTTP GET requests: resolves path, serves file or directory, or sends 404.
 void WebServer::handle_get(const Request& req,
-                           const LocationConfig* loc,
+                           const LocationPlan* loc,
                            int client_fd,
                            size_t idx)
 {
-    //JESS: just storing the req.getPath() in uri for cleaner code (instead of passing the fuction 3 times as an arg)
-    std::string uri = req.getPath();
-    std::string fs_path = resolve_path(uri,
-                                       req.getMethod(),
-                                       loc);
-
-    /*stat is a system call that checks if a file or directory exists and gathers its metadata.
-    If the path does not exist or cannot be accessed, stat returns a value less than 0.
-    If stat succeeds, the st structure is filled with information about the file or directory
-    (such as its type, permissions, size, etc.)*/
-    struct stat st;
-    if (stat(fs_path.c_str(), &st) < 0) {
+    // The path below the root as is, else with ".html" appended (as
+    // resolve_path() does). The open-file cache answers both, usually
+    // without touching the file system.
+    std::string rel = req.getRelativePath();
+    std::string fs_path = loc->root;
+    if (!rel.empty())
+        fs_path += "/" + rel;
+    OpenFileCache::Handle file = files_.lookup(fs_path, *loc, rel);
+    if (!file->exists()) {
+        rel += ".html";
+        fs_path += ".html";
+        file = files_.lookup(fs_path, *loc, rel);
+    }
+    if (!file->exists()) {
         send_error_response(client_fd, 404, "Not Found", idx);
         return;
     }
 
-    if (S_ISDIR(st.st_mode)) {
+    if (S_ISDIR(file->st.st_mode)) {
         // JESS: if statement to check if get request comes from client
         if (wants_json(req))
         {
             std::string json = generate_directory_listing_json(fs_path);
-            send_ok_response(client_fd, json, json_headers(), idx);
+            std::map<std::string, std::string> headers = json_headers();
+            gzip_body(req.getHeader(HDR_ACCEPT_ENCODING), *loc, json, headers);
+            send_ok_response(client_fd, json, headers, idx);
             std::cout << "[JSON] json requested and sent to client " << std::endl;
             return;
         }
-        handle_directory_request(fs_path, uri, loc, client_fd, idx);
+        handle_directory_request(req, fs_path, rel, loc, client_fd, idx);
     }
     else {
-        handle_file_request(fs_path, client_fd, idx);
+        handle_file_request(req, loc, fs_path, rel, *file, client_fd, idx);
     }
 }
 
 // --- Directory Handler ---
 // Handles directory requests: serves index file, autoindex, or 403 Forbidden.
-void WebServer::handle_directory_request(const std::string& path, const std::string& uri, const LocationConfig* loc, int client_fd, size_t i) {
-    // Use the configured index if set, otherwise default to index.html
-    const std::string index_file = (loc && !loc->index.empty()) ? loc->index : "index.html";
-
-    std::string index_path = path + "/" + index_file;
-    if (file_exists(index_path)) {
-        //Logger::log(LOG_DEBUG, "handle_directory_request", "Serving index: " + index_path);
-        send_file_response(client_fd, index_path, i);
-        return;
+// rel is path below the location root.
+void WebServer::handle_directory_request(const Request& req, const std::string& path, const std::string& rel, const LocationPlan* loc, int client_fd, size_t i) {
+    // The configured index files in order (index.html when none is set)
+    for (size_t k = 0; k < loc->index.size(); ++k) {
+        std::string index_path = path + "/" + loc->index[k];
+        std::string index_rel = rel + "/" + loc->index[k];
+        OpenFileCache::Handle index = files_.lookup(index_path, *loc, index_rel);
+        if (index->exists()) {
+            //Logger::log(LOG_DEBUG, "handle_directory_request", "Serving index: " + index_path);
+            handle_file_request(req, loc, index_path, index_rel, *index, client_fd, i);
+            return;
+        }
     }
-    if (loc && loc->autoindex) {
+    if (loc->autoindex) {
         //Logger::log(LOG_DEBUG, "handle_directory_request", "Autoindex enabled for: " + path);
-        std::string html = generate_directory_listing(path, uri);
-        send_ok_response(client_fd, html, content_type_html(), i);
+        std::string html = generate_directory_listing(path, req.getPath());
+        std::map<std::string, std::string> headers = content_type_html();
+        gzip_body(req.getHeader(HDR_ACCEPT_ENCODING), *loc, html, headers);
+        send_ok_response(client_fd, html, headers, i);
         return;
     }
     Logger::log(LOG_ERROR, "handle_directory_request", "Forbidden: " + path);
@@ -66,24 +83,26 @@ void WebServer::handle_directory_request(const std::string& path, const std::str
 
 // --- File Handler ---
 // Handles file requests: checks existence/readability, serves file or error.
-void WebServer::handle_file_request(const std::string& path, int client_fd, size_t i) {
-    if (!file_exists(path)) {
+// file is the open-file cache's answer for path (rel below the location root).
+void WebServer::handle_file_request(const Request& req, const LocationPlan* loc, const std::string& path, const std::string& rel, const OpenFileCache::File& file, int client_fd, size_t i) {
+    if (!file.exists() || !S_ISREG(file.st.st_mode)) {
         Logger::log(LOG_ERROR, "handle_file_request", "File not found: " + path);
         send_error_response(client_fd, 404, "Not Found", i);
         return;
     }
-    if (access(path.c_str(), R_OK) != 0) {
+    if (file.fd < 0) {
         Logger::log(LOG_ERROR, "handle_file_request", "File not readable: " + path);
         send_error_response(client_fd, 403, "Forbidden", i);
         return;
     }
     Logger::log(LOG_INFO, "handle_file_request", "Serving file: " + path);
-    send_file_response(client_fd, path, i);
+    send_file_response(client_fd, req, *loc, path, rel, file, i);
 }
 
 // --- CGI Handler --- Common Gateway Interface
-// Handles CGI requests: finds script, sets env, executes, parses output, sends response.
-void WebServer::handle_cgi(const LocationConfig* loc, const Request& request, int client_fd, size_t i) {
+// Handles CGI requests: finds the script, sets env and starts it. The
+// response is sent from the pipe handlers below once the script is done.
+void WebServer::handle_cgi(const LocationPlan* loc, const Request& request, int client_fd, size_t i) {
     std::string script_path, script_name, path_info;
     if (!CGIHandler::find_cgi_script(loc->root, loc->path, request.getPath(), script_path, script_name, path_info)) {
         Logger::log(LOG_ERROR, "handle_cgi", "CGI Script Not Found: " + request.getPath());
@@ -92,54 +111,189 @@ void WebServer::handle_cgi(const LocationConfig* loc, const Request& request, in
     }
 
     std::map<std::string, std::string> env = CGIHandler::build_cgi_env(request, script_name, path_info);
-    std::map<int, Connection> connections = this->getConnections();
-    Connection &conn = connections[client_fd];
-	CGIHandler handler(script_path, env, &conn, request.getBody(), request.getPath());    std::string cgi_output = handler.execute();
+    Connection *conn = conns_.find(client_fd);
+    if (!conn)
+        return;
+    CgiState &cgi = conn->cgi();
+    cgi.loc = loc;
+    cgi.accept_encoding = request.getHeader(HDR_ACCEPT_ENCODING);
+    cgi.script = script_path;
+    CGIHandler handler(script_path, env, request.body(), request.getPath());
+    try {
+        handler.start(cgi);
+    } catch (const std::exception&) {
+        conn->releaseCgi();
+        send_error_response(client_fd, 500, "Internal Server Error", i);
+        return;
+    }
 
-    if (cgi_output == "__CGI_TIMEOUT__") {
-        Logger::log(LOG_ERROR, "handle_cgi", "CGI Timeout: " + script_path);
-        send_error_response(client_fd, 504, "Gateway Timeout", i);
+    cgi.deadline = TimerQueue::now() + conn->server->getCgiTimeout() * 1000L;
+    armTimer(client_fd, *conn);
+    if (loop_) {
+        if (cgi.stdin_fd >= 0)
+            loop_->add(cgi.stdin_fd, IO_WRITE, FdHandle(FD_CGI_STDIN, this, client_fd));
+        loop_->add(cgi.stdout_fd, IO_READ, FdHandle(FD_CGI_STDOUT, this, client_fd));
+    }
+    Logger::log(LOG_INFO, "handle_cgi", "CGI started: " + script_path + " (pid " + to_str(cgi.pid) + ")");
+}
+
+// --- CGI pipes ---
+// The script runs while the loop serves other connections: its stdin is fed
+// and its stdout drained as the pipes become ready, and the response is
+// built once stdout is at EOF and the script has exited.
+void WebServer::onCgiInput(int client_fd) {
+    Connection *conn = conns_.find(client_fd);
+    if (!conn || !conn->cgiRunning())
         return;
+    CgiState &cgi = conn->cgi();
+    while (cgi.input_off < cgi.input.size()) {
+        ssize_t n = ::write(cgi.stdin_fd, cgi.input.data() + cgi.input_off, cgi.input.size() - cgi.input_off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return; // the script has not read the last of it yet
+        if (n < 0) {
+            // It stopped reading (EPIPE); what it prints still decides
+            Logger::log(LOG_DEBUG, "CGI", "stdin of " + cgi.script + " closed early: " + std::strerror(errno));
+            break;
+        }
+        cgi.input_off += static_cast<size_t>(n);
     }
+    // EOF on stdin tells the script the body is complete
+    closeCgiPipe(cgi.stdin_fd);
+    std::string().swap(cgi.input);
+}
 
-    if (cgi_output == "__CGI_MISSING_HEADER__") {
-        Logger::log(LOG_ERROR, "handle_cgi", "CGI Missing Header: " + script_path);
-        send_error_response(client_fd, 500, "Internal Server Error", i);
+void WebServer::onCgiOutput(int client_fd) {
+    Connection *conn = conns_.find(client_fd);
+    if (!conn || !conn->cgiRunning())
         return;
+    CgiState &cgi = conn->cgi();
+    for (;;) {
+        ssize_t n = ::read(cgi.stdout_fd, &rx_buf_[0], rx_buf_.size());
+        if (n > 0) {
+            cgi.output.append(&rx_buf_[0], static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        break; // EOF: the script is done writing
     }
+    closeCgiPipe(cgi.stdout_fd);
+    collectCgi(client_fd, *conn);
+}
 
-	if (cgi_output == "__CGI_INTERNAL_ERROR__") {
-        Logger::log(LOG_ERROR, "502", "CGI Internal Error: " + script_path);
-        send_error_response(client_fd, 502, "Bad Gateway", i);
+// stdout is at EOF; the response is built once the script has exited. A
+// script closes stdout a moment before it can be reaped, so one that is not
+// done yet is looked at again shortly (from onTimer()).
+void WebServer::collectCgi(int client_fd, Connection &conn) {
+    CgiState &cgi = conn.cgi();
+    int status = 0;
+    pid_t r;
+    do {
+        r = waitpid(cgi.pid, &status, WNOHANG);
+    } while (r < 0 && errno == EINTR);
+    if (r == 0) {
+        cgi.poll_at = TimerQueue::now() + CGI_POLL_MS;
+        armTimer(client_fd, conn);
         return;
     }
+    if (r < 0)
+        Logger::log(LOG_ERROR, "CGI", "waitpid for " + cgi.script + ": " + std::strerror(errno));
+    cgi.pid = -1;
+    finishCgi(client_fd, conn, r > 0 && CGIHandler::check_child_status(status));
+}
+
+// cgi_timeout ran out (from onTimer()): the script is killed and reaped and
+// the client gets 504
+void WebServer::onCgiTimeout(int client_fd, Connection &conn) {
+    Logger::log(LOG_ERROR, "handle_cgi", "CGI Timeout: " + conn.cgi().script + ", killing PID " +
+                to_str(conn.cgi().pid));
+    stopCgi(conn);
+    files_.invalidate();
+    send_error_response(client_fd, 504, "Gateway Timeout", 0);
+    resumeAfterCgi(client_fd);
+}
+
+// Answers the request the script ran for
+void WebServer::finishCgi(int client_fd, Connection &conn, bool exited_ok) {
+    CgiState &cgi = conn.cgi();
+    std::string output, accept, script = cgi.script;
+    output.swap(cgi.output);
+    accept.swap(cgi.accept_encoding);
+    const LocationPlan *loc = cgi.loc;
+    stopCgi(conn);
+    // The script may have changed files the open-file cache knows
+    files_.invalidate();
 
     std::map<std::string, std::string> cgi_headers;
     std::string body;
-    CGIHandler::parse_cgi_output(cgi_output, cgi_headers, body);
-    if (cgi_headers.empty() && body.empty()) {
-        Logger::log(LOG_ERROR, "handle_cgi", "CGI Output Empty: " + script_path);
-        send_error_response(client_fd, 500, "Internal Server Error", i);
+    if (!exited_ok) {
+        Logger::log(LOG_ERROR, "502", "CGI Internal Error: " + script);
+        send_error_response(client_fd, 502, "Bad Gateway", 0);
+    } else if (!CGIHandler::validate_cgi_headers(output)) {
+        Logger::log(LOG_ERROR, "handle_cgi", "CGI Missing Header: " + script);
+        send_error_response(client_fd, 500, "Internal Server Error", 0);
+    } else {
+        CGIHandler::parse_cgi_output(output, cgi_headers, body);
+        Logger::log(LOG_INFO, "handle_cgi", "CGI executed successfully: " + script);
+        gzip_body(accept, *loc, body, cgi_headers);
+        send_ok_response(client_fd, body, cgi_headers, 0);
+    }
+    resumeAfterCgi(client_fd);
+}
+
+// Goes on with the requests pipelined behind a script's
+void WebServer::resumeAfterCgi(int client_fd) {
+    Connection *c = conns_.find(client_fd);
+    if (!c)
         return;
+    if (!c->readBuf.empty() && !c->shouldCloseAfterWrite) {
+        // The next request's head timeout starts now, not while it waited
+        c->read_phase = PHASE_IDLE;
+        enterReadPhase(*c, PHASE_HEADER);
+        processBufferedRequests(client_fd);
+        c = conns_.find(client_fd);
+        if (!c)
+            return;
     }
+    armTimer(client_fd, *c);
+}
 
-    Logger::log(LOG_INFO, "handle_cgi", "CGI executed successfully: " + script_path);
-    send_ok_response(client_fd, body, cgi_headers, i);
+// Closes the script's pipes and kills it unless it has been reaped
+void WebServer::stopCgi(Connection &conn) {
+    CgiState *cgi = conn.cgiState();
+    if (!cgi)
+        return;
+    closeCgiPipe(cgi->stdin_fd);
+    closeCgiPipe(cgi->stdout_fd);
+    if (cgi->pid > 0) {
+        kill(cgi->pid, SIGKILL);
+        while (waitpid(cgi->pid, NULL, 0) < 0 && errno == EINTR)
+            ;
+    }
+    conn.releaseCgi();
+}
+
+void WebServer::closeCgiPipe(int &fd) {
+    if (fd < 0)
+        return;
+    if (loop_)
+        loop_->remove(fd);
+    ::close(fd);
+    fd = -1;
 }
 
 // --- POST Handler ---
-// Handles HTTP POST requests: supports CGI, file upload, file update, or error.
-void WebServer::handle_post(const Request& request, const LocationConfig* loc, int client_fd, size_t i) {
+// Handles HTTP POST requests: file upload, file update, or error (CGI scripts
+// are run from dispatchMethodHandler()).
+void WebServer::handle_post(const Request& request, const LocationPlan* loc, int client_fd, size_t i) {
     std::string uri = request.getPath();
-    std::string path = resolve_path(uri, "POST", loc);
+    std::string path = resolve_path(request, loc);
     //Logger::log(LOG_DEBUG, "handle_post", "method=" + request.getMethod() + ", uri=" + uri + " path=" + path);
 
-    if (loc && is_cgi_request(*loc, request.getPath())) {
-        //Logger::log(LOG_DEBUG, "handle_post", "Detected CGI POST");
-        handle_cgi(loc, request, client_fd, i);
-        return;
-    }
-
     if (handle_upload(request, loc, client_fd, i)) {
         Logger::log(LOG_INFO, "handle_post", "Handled as upload: " + uri);
         return;
@@ -162,19 +316,14 @@ void WebServer::handle_post(const Request& request, const LocationConfig* loc, i
     send_error_response(client_fd, 400, "Bad POST Request", i);
 }
 
-void WebServer::handle_delete(const Request& request, const LocationConfig* loc, int client_fd, size_t i) {
+void WebServer::handle_delete(const Request& request, const LocationPlan* loc, int client_fd, size_t i) {
     std::string uri = request.getPath();
     std::string path;
 
     // If this location stores uploads in a dedicated dir, delete from there
-    if (loc && !loc->upload_dir.empty()) {
+    if (loc->kind == HANDLER_UPLOAD) {
         // derive basename from the URI relative to the location path
-        std::string suffix;
-        if (uri.size() > loc->path.size())
-            suffix = uri.substr(loc->path.size());
-        // strip one leading slash if present
-        if (!suffix.empty() && suffix[0] == '/')
-            suffix.erase(0, 1);
+        std::string suffix = request.getRelativePath();
 
         // empty basename (e.g., DELETE /new_files/) is a bad request
         if (suffix.empty()) {
@@ -196,7 +345,7 @@ void WebServer::handle_delete(const Request& request, const LocationConfig* loc,
         path += suffix;
     } else {
         // default behavior for locations without upload_dir
-        path = resolve_path(uri, "DELETE", loc);
+        path = resolve_path(request, loc);
     }
 
     //Logger::log(LOG_DEBUG, "handle_delete", "uri=" + uri + " path=" + path);
@@ -220,98 +369,33 @@ void WebServer::handle_delete(const Request& request, const LocationConfig* loc,
 }
 
 
-// --- UPLOAD Helpers (unchanged, but could be moved to upload.cpp) ---
-std::string extract_file_from_multipart(const std::string& body, std::string& filename) {
-    std::istringstream stream(body);
-    std::string line;
-    bool in_headers = true;
-    bool in_content = false;
-    std::ostringstream file_content;
-
-    filename = "upload";  // default fallback
-
-    while (std::getline(stream, line)) {
-        // Remove \r from the end if present
-        if (!line.empty() && line[line.size() - 1] == '\r')
-            line.erase(line.size() - 1);
-
-        // Boundary or end
-        if (line.find("------") == 0) {
-            if (in_content) break;
-            continue;
-        }
-
-        // Extract filename
-        if (line.find("Content-Disposition:") != std::string::npos) {
-            size_t pos = line.find("filename=");
-            if (pos != std::string::npos) {
-                size_t start = line.find('"', pos);
-                size_t end = line.find('"', start + 1);
-                if (start != std::string::npos && end != std::string::npos) {
-                    filename = line.substr(start + 1, end - start - 1);
-                }
-            }
-        }
-
-        // Headers done, content starts after blank line
-        if (line.empty() && in_headers) {
-            in_headers = false;
-            in_content = true;
-            continue;
-        }
-
-        if (in_content)
-            file_content << line << "\n";
-    }
-
-    std::string content = file_content.str();
-    if (!content.empty() && content[content.size() - 1] == '\n')
-        content.erase(content.size() - 1);
-
-    return content;
-}
-
-bool WebServer::handle_upload(const Request& request, const LocationConfig* loc, int client_fd, size_t i) {
+// --- UPLOAD Helpers ---
+bool WebServer::handle_upload(const Request& request, const LocationPlan* loc, int client_fd, size_t i) {
     // Check if the request is a POST and the location config has an upload directory.
     if (!is_valid_upload_request(request, loc)) {
         /*Logger::log(LOG_DEBUG, "is_valid_upload_request",
             "method=" + request.getMethod() +
-            " upload_dir=" + (loc? loc->upload_dir : "<none>"));
+            " upload_dir=" + loc->upload_dir);
         Logger::log(LOG_DEBUG, "handle_upload", "Not an upload request.");*/
         return false;
     }
 
-    // Extract the uploaded file’s name and content from the request body.
-    std::string filename, content;
-    process_upload_content(request, filename, content);
-
-    std::string uri = request.getPath(); // e.g. /upload/test_forbidden.txt
-    std::string upload_dir = loc->upload_dir;
-    std::string base_filename;
-
-    // If URI includes a filename (e.g., /upload/myfile.txt), use that as base
-    if (uri.length() > loc->path.length()) {
-        std::string uri_filename = uri.substr(loc->path.length());
-        if (!uri_filename.empty() && uri_filename[0] == '/')
-            uri_filename = uri_filename.substr(1);
-        if (!uri_filename.empty()) {
-            base_filename = uri_filename;
-        } else if (!filename.empty()) {
-            base_filename = make_upload_filename(filename);
-        } else {
-            base_filename = "upload";
-        }
-    } else {
-        // POST to /upload, use multipart filename if available
-        if (!filename.empty()) {
-            base_filename = make_upload_filename(filename);
-        } else {
-            base_filename = make_upload_filename("upload");;
+    // If URI includes a filename (e.g., /upload/myfile.txt), it is used as-is
+    std::string uri_filename = request.getRelativePath();
+
+    std::string content_type = request.getHeader(HDR_CONTENT_TYPE);
+    if (content_type.find("multipart/form-data") != std::string::npos) {
+        std::string boundary = get_boundary_from_content_type(content_type);
+        if (!boundary.empty()) {
+            handle_multipart_upload(request, loc, uri_filename, client_fd, i);
+            return true;
         }
+        Logger::log(LOG_ERROR, "handle_upload", "Multipart upload without boundary; storing raw body");
     }
 
-    // Always append timestamp to avoid overwrites
-    std::string target_path = upload_dir + "/" + base_filename;
+    // Anything else is a raw upload: the body itself is the file
+    std::string target_path = loc->upload_dir + "/" +
+        (uri_filename.empty() ? make_upload_filename("upload") : uri_filename);
 
     // --- Check if file exists and is writable ---
     if (file_exists(target_path) && access(target_path.c_str(), W_OK) != 0) {
@@ -320,61 +404,102 @@ bool WebServer::handle_upload(const Request& request, const LocationConfig* loc,
         return true;
     }
 
-    if (!write_upload_file(target_path, content)) {
+    if (!write_upload_file(target_path, request.body())) {
         Logger::log(LOG_ERROR, "handle_upload", "Failed to open file: " + target_path);
         send_error_response(client_fd, 500, "Failed to save upload", i);
         return true;
     }
 
     Logger::log(LOG_INFO, "handle_upload", "Upload successful: " + target_path);
-    /*
- JESS: added an if statement for the server to recognise when the post request
- is coming from the frontend, if that is the case it will send a json as a response.
- Added this change so the client can use the server directly instead of using the python script
- */
-    if (wants_json(request))
-    {
-        send_upload_success_json(client_fd, target_path, i); // sends json response if request comes from client
-    }
-    else
-    {
-        send_upload_success_response(client_fd, target_path, i); // sends response when using curl, this was previous code
-    }
+    send_upload_success(request, std::vector<std::string>(1, target_path), client_fd, i);
     return true;
 }
 
-// --- Helper functions ---
-// Checks if request is a valid upload (POST and upload_dir set).
-bool WebServer::is_valid_upload_request(const Request& request, const LocationConfig* loc) {
-    return request.getMethod() == "POST" && loc && !loc->upload_dir.empty();
-}
-
-// Processes upload content: extracts filename and file data from request body.
-void WebServer::process_upload_content(const Request& request,
-                                       std::string& filename,
-                                       std::string& content)
+// Stores every file part of a multipart/form-data body. The parts were
+// written to temp files while the body was read (streamMultipartUpload());
+// here they are renamed to their final names, so a file only ever appears
+// under its name complete. The first file takes the name from the URI when
+// there is one; the others get timestamped names made unique within the
+// upload directory.
+void WebServer::handle_multipart_upload(const Request& request, const LocationPlan* loc,
+                                        const std::string& uri_filename, int client_fd, size_t i)
 {
-    std::string content_type = request.getHeader("Content-Type");
+    MultipartUpload* upload = dynamic_cast<MultipartUpload*>(request.body().consumer());
+    if (!upload) {
+        Logger::log(LOG_ERROR, "handle_multipart_upload", "Multipart body was not parsed on arrival");
+        send_error_response(client_fd, 500, "Failed to save upload", i);
+        return;
+    }
+    const MultipartParser& parser = upload->parser();
+    UploadSink& sink = upload->sink();
 
-    if (content_type.find("multipart/form-data") != std::string::npos) {
-        //Logger::log(LOG_DEBUG, "process_upload_content", "Detected multipart upload");
-        std::string boundary = get_boundary_from_content_type(content_type);
+    MultipartParser::Status st = parser.status();
+    if (st == MultipartParser::PART_ABORTED) {
+        send_error_response(client_fd, 500, "Failed to save upload", i);
+        return;
+    }
+    if (st != MultipartParser::PART_DONE) {
+        Logger::log(LOG_ERROR, "handle_multipart_upload",
+                    st == MultipartParser::PART_ERROR ? parser.errorText() : "Truncated multipart body");
+        send_error_response(client_fd, 400, "Malformed multipart body", i);
+        return;
+    }
 
-        std::string fn, data;
-        if (extract_multipart_file_raw(request.getBody(), boundary, fn, data)) {
-            filename = fn.empty() ? "upload" : fn;   // keep original extension!
-            content  = data;                          // raw bytes
+    std::vector<UploadSink::Part>& parts = sink.parts();
+    if (parts.empty()) {
+        Logger::log(LOG_ERROR, "handle_multipart_upload", "No file part in multipart body");
+        send_error_response(client_fd, 400, "No file in upload", i);
+        return;
+    }
+
+    std::vector<std::string> stored;
+    for (size_t k = 0; k < parts.size(); ++k) {
+        std::string target;
+        if (k == 0 && !uri_filename.empty()) {
+            target = loc->upload_dir + "/" + uri_filename;
+            if (file_exists(target) && access(target.c_str(), W_OK) != 0) {
+                Logger::log(LOG_ERROR, "handle_upload", "Forbidden: cannot write to " + target);
+                send_error_response(client_fd, 403, "Forbidden", i);
+                return;
+            }
         } else {
-            // Fallback: treat entire body as "raw"
-            Logger::log(LOG_ERROR, "process_upload_content", "Multipart parse failed; using raw body");
-            filename = "upload";
-            content  = request.getBody();
+            std::string name = make_upload_filename(parts[k].filename);
+            std::string base, ext;
+            split_basename_ext(name, base, ext);
+            for (int n = 2; file_exists(loc->upload_dir + "/" + name); ++n)
+                name = base + "_" + to_str(n) + ext;
+            target = loc->upload_dir + "/" + name;
         }
-    } else {
-        //Logger::log(LOG_DEBUG, "process_upload_content", "Detected non-multipart upload");
-        filename = "upload";
-        content  = request.getBody(); // raw bytes already
+        if (rename(parts[k].tmp_path.c_str(), target.c_str()) != 0) {
+            Logger::log(LOG_ERROR, "handle_multipart_upload", "Cannot store " + target + ": " + strerror(errno));
+            send_error_response(client_fd, 500, "Failed to save upload", i);
+            return;
+        }
+        parts[k].tmp_path.clear();
+        Logger::log(LOG_INFO, "handle_upload", "Upload successful: " + target);
+        stored.push_back(target);
     }
+    send_upload_success(request, stored, client_fd, i);
+}
+
+/*
+ JESS: added an if statement for the server to recognise when the post request
+ is coming from the frontend, if that is the case it will send a json as a response.
+ Added this change so the client can use the server directly instead of using the python script
+ */
+void WebServer::send_upload_success(const Request& request, const std::vector<std::string>& paths,
+                                    int client_fd, size_t i)
+{
+    if (wants_json(request))
+        send_upload_success_json(client_fd, paths, i); // sends json response if request comes from client
+    else
+        send_upload_success_response(client_fd, paths, i); // sends response when using curl, this was previous code
+}
+
+// --- Helper functions ---
+// Checks if request is a valid upload (POST to an upload location).
+bool WebServer::is_valid_upload_request(const Request& request, const LocationPlan* loc) {
+    return methodBit(request.getMethod()) == METHOD_POST && loc->kind == HANDLER_UPLOAD;
 }
 
 // Generates a safe filename for uploads, appending timestamp.
@@ -388,23 +513,23 @@ std::string WebServer::make_upload_filename(const std::string& filename) {
     return base + "_" + timestamp() + ext;
 }
 
-// Writes uploaded file content to disk at specified path.
-bool WebServer::write_upload_file(const std::string& full_path, const std::string& content) {
-	//Opens a file stream for writing at full_path.
-	/*Uses binary mode (std::ios::binary) to ensure the file is written exactly as received 
-	(important for non-text files).*/
-    std::ofstream out(full_path.c_str(), std::ios::binary);
-    if (!out)
+// Writes a raw upload straight from the request body (memory or spool file).
+bool WebServer::write_upload_file(const std::string& full_path, const RequestBody& body) {
+    int fd = open(full_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0)
         return false;
-    out << content;
-    out.close();
-    return true;
+    bool ok = body.writeTo(fd);
+    if (close(fd) != 0)
+        ok = false;
+    return ok;
 }
 
 // Returns current timestamp as string for filenames.
 std::string WebServer::timestamp() {
     time_t now = time(NULL);
     char buf[20];
-    strftime(buf, sizeof(buf), "%Y%m%d_%H%M%S", localtime(&now));
+    struct tm tmv;
+    localtime_r(&now, &tmv); // worker threads share the static localtime() buffer
+    strftime(buf, sizeof(buf), "%Y%m%d_%H%M%S", &tmv);
     return std::string(buf);
 }
@@ -1,43 +1,540 @@
 #include "WebServer.hpp"
+#include "Gzip.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <limits>
+#include <strings.h>
+
+// Files from this size on get readahead hints: they are media or downloads,
+// read front to back
+static const off_t LARGE_FILE = 1024 * 1024;
+// More ranges than this in one request and the whole file is sent instead:
+// every part holds a descriptor until it is sent
+static const size_t MAX_RANGES = 16;
+// Compressible files up to this size are gzip coded in one go (and offered
+// to the response cache); larger ones are compressed as they are sent
+static const off_t GZIP_IN_MEMORY = 1024 * 1024;
+
+// Strong validator of a file version: inode, size and modification time, so
+// it changes whenever the bytes can have. The gzip coded representation
+// has bytes of its own, so a tag of its own.
+static std::string entityTag(const struct stat &st, bool gzip = false)
+{
+    std::ostringstream tag;
+    tag << std::hex << "\"" << st.st_ino << "-" << st.st_size << "-" << st.st_mtim.tv_sec << "."
+        << st.st_mtim.tv_nsec << (gzip ? "-gz" : "") << "\"";
+    return tag.str();
+}
+
+static std::string validatorLines(const struct stat &st, bool gzip = false)
+{
+    return "ETag: " + entityTag(st, gzip) + "\r\nLast-Modified: " + http_date(st.st_mtime) + "\r\n";
+}
+
+// Status line, entity headers and validators of a file response; the
+// location's caching headers, the connection headers and the blank line
+// follow
+static std::string fileResponseHead(const std::string &path, const struct stat &st)
+{
+    std::ostringstream head;
+    head << "HTTP/1.1 200 OK\r\nContent-Length: " << st.st_size << "\r\nContent-Type: " << get_mime_type(path)
+         << "\r\nAccept-Ranges: bytes\r\n";
+    return head.str() + validatorLines(st);
+}
+
+// Cache-Control/Expires of the location's expires and cache_control
+// directives; Expires counts from now
+static std::string cacheHeaderLines(const LocationPlan &loc)
+{
+    if (loc.expires == EXPIRES_OFF && loc.cache_control.empty())
+        return "";
+    std::string lines;
+    if (!loc.cache_control.empty())
+        lines = "Cache-Control: " + loc.cache_control + "\r\n";
+    else if (loc.expires == EXPIRES_EPOCH)
+        lines = "Cache-Control: no-cache\r\n";
+    else if (loc.expires != EXPIRES_OFF) {
+        std::ostringstream cc;
+        cc << "Cache-Control: max-age=" << loc.expires << "\r\n";
+        lines = cc.str();
+    }
+    if (loc.expires == EXPIRES_EPOCH)
+        lines += "Expires: " + http_date(1) + "\r\n";
+    else if (loc.expires != EXPIRES_OFF)
+        lines += "Expires: " + http_date(time(NULL) + loc.expires) + "\r\n";
+    return lines;
+}
+
+// If-None-Match: "*" or a list of entity tags, compared weakly (a W/ prefix
+// is ignored) as RFC 9110 asks for GET and HEAD
+static bool etagListMatches(const std::string &list, const std::string &etag)
+{
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+        size_t first = list.find_first_not_of(" \t", pos);
+        size_t last = list.find_last_not_of(" \t", end - 1);
+        if (first != std::string::npos && first < end && last >= first) {
+            std::string tag = list.substr(first, last - first + 1);
+            if (tag == "*")
+                return true;
+            if (tag.compare(0, 2, "W/") == 0)
+                tag.erase(0, 2);
+            if (tag == etag)
+                return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+// Whether the client's copy (named by its conditional headers) is current.
+// If-None-Match wins over If-Modified-Since when both are present.
+static bool notModified(const Request &req, const struct stat &st, bool gzip)
+{
+    if (req.hasHeader(HDR_IF_NONE_MATCH))
+        return etagListMatches(req.getHeader(HDR_IF_NONE_MATCH), entityTag(st, gzip));
+    time_t since;
+    if (req.hasHeader(HDR_IF_MODIFIED_SINCE) && parse_http_date(req.getHeader(HDR_IF_MODIFIED_SINCE), since))
+        return st.st_mtime <= since;
+    return false;
+}
+
+enum RangeResult {
+    RANGE_IGNORE,          // no usable Range header: send the whole file
+    RANGE_OK,              // ranges holds at least one satisfiable range
+    RANGE_UNSATISFIABLE    // none of the ranges overlaps the file: 416
+};
+
+// Decimal digits of s[pos, end) as an off_t; false when empty, not digits
+// or too large
+static bool parseOffset(const std::string &s, size_t pos, size_t end, off_t &out)
+{
+    if (pos >= end)
+        return false;
+    off_t v = 0;
+    for (; pos < end; ++pos) {
+        if (s[pos] < '0' || s[pos] > '9')
+            return false;
+        if (v > (std::numeric_limits<off_t>::max() - 9) / 10)
+            return false;
+        v = v * 10 + (s[pos] - '0');
+    }
+    out = v;
+    return true;
+}
+
+// "bytes=first-last, first-, -suffix" against a file of size bytes. A
+// malformed header is ignored as RFC 9110 asks; ranges past the end of the
+// file are dropped, and the rest clamped to it.
+static RangeResult parseRanges(const std::string &spec, off_t size, std::vector<ByteRange> &ranges)
+{
+    if (spec.size() < 6 || strncasecmp(spec.c_str(), "bytes=", 6) != 0)
+        return RANGE_IGNORE;
+    size_t pos = 6;
+    size_t specs = 0;
+    while (pos <= spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos)
+            end = spec.size();
+        size_t first = spec.find_first_not_of(" \t", pos);
+        if (first == std::string::npos || first >= end) {
+            // Empty list elements are allowed
+            pos = end + 1;
+            continue;
+        }
+        size_t last = spec.find_last_not_of(" \t", end - 1) + 1;
+        size_t dash = spec.find('-', first);
+        if (dash == std::string::npos || dash >= last || ++specs > MAX_RANGES)
+            return RANGE_IGNORE;
+
+        ByteRange r;
+        if (dash == first) {
+            off_t suffix;
+            if (!parseOffset(spec, dash + 1, last, suffix))
+                return RANGE_IGNORE;
+            if (suffix > 0 && size > 0) {
+                r.first = suffix < size ? size - suffix : 0;
+                r.last = size - 1;
+                ranges.push_back(r);
+            }
+        } else {
+            if (!parseOffset(spec, first, dash, r.first))
+                return RANGE_IGNORE;
+            if (dash + 1 == last)
+                r.last = size - 1;
+            else if (!parseOffset(spec, dash + 1, last, r.last) || r.last < r.first)
+                return RANGE_IGNORE;
+            if (r.first < size) {
+                if (r.last >= size)
+                    r.last = size - 1;
+                ranges.push_back(r);
+            }
+        }
+        pos = end + 1;
+    }
+    if (specs == 0)
+        return RANGE_IGNORE;
+    return ranges.empty() ? RANGE_UNSATISFIABLE : RANGE_OK;
+}
+
+// If-Range: the ranges are wanted only if the client's copy is this
+// version; an entity tag must match strongly, a date exactly
+static bool ifRangeMatches(const Request &req, const struct stat &st)
+{
+    if (!req.hasHeader(HDR_IF_RANGE))
+        return true;
+    const std::string &v = req.getHeader(HDR_IF_RANGE);
+    if (!v.empty() && (v[0] == '"' || v.compare(0, 2, "W/") == 0))
+        return v == entityTag(st);
+    time_t date;
+    return parse_http_date(v, date) && date == st.st_mtime;
+}
+
+static std::string contentRange(const ByteRange &r, off_t size)
+{
+    std::ostringstream line;
+    line << "Content-Range: bytes " << r.first << "-" << r.last << "/" << size << "\r\n";
+    return line.str();
+}
+
+// The whole file, or NULL when it could not be read completely
+static SharedBuffer *readWholeFile(int fd, size_t size)
+{
+    std::string data(size, '\0');
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = pread(fd, &data[got], size - got, static_cast<off_t>(got));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return NULL;
+        got += static_cast<size_t>(n);
+    }
+    return SharedBuffer::adopt(data);
+}
 
-// Send a file as a response (with correct Content-Type)
-void WebServer::send_file_response(int client_fd, const std::string &path, size_t i)
+// The whole file as one gzip stream, read a piece at a time so only the
+// compressed copy is held
+static SharedBuffer *gzipWholeFile(int fd, size_t size, int level)
 {
-    std::string body = read_file(path);
-    if (body.empty()) {
-        Logger::log(LOG_ERROR, "send_file_response", "File not found or empty: " + path);
-        send_error_response(client_fd, 404, "Not Found", i);
+    GzipEncoder enc(level);
+    std::string out;
+    char buf[64 * 1024];
+    size_t got = 0;
+    do {
+        ssize_t n = 0;
+        if (got < size) {
+            n = pread(fd, buf, size - got < sizeof(buf) ? size - got : sizeof(buf), static_cast<off_t>(got));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return NULL;
+            got += static_cast<size_t>(n);
+        }
+        if (!enc.write(buf, static_cast<size_t>(n), out, got == size ? GzipEncoder::GZ_FINISH : GzipEncoder::GZ_NONE))
+            return NULL;
+    } while (!enc.finished());
+    return SharedBuffer::adopt(out);
+}
+
+// Send a file as a response (with correct Content-Type). A client that
+// accepts zstd or gzip gets a precompressed sidecar (file.zst, file.gz)
+// when the location allows it and one is there, or else the file gzip
+// coded when the location compresses its type. A conditional request for
+// the version the client already has gets 304 from the cached stat data
+// alone, HEAD only the head, and a Range request (whose If-Range, if any,
+// names this version) the ranges it asks for, uncompressed. Popular small
+// files come from the response cache: the head is the only copy made, the
+// body is shared.
+// Otherwise only the head is built in memory and the body goes from the
+// page cache to the socket with sendfile(), so a download costs the same
+// memory whatever its size.
+// file is an open regular file from the open-file cache; the response gets
+// its own duplicate of the descriptor, as the cache may close it any time.
+void WebServer::send_file_response(int client_fd, const Request &req, const LocationPlan &loc,
+                                   const std::string &path, const std::string &rel,
+                                   const OpenFileCache::File &file, size_t i)
+{
+    const struct stat &st = file.st;
+    const std::string &accept = req.getHeader(HDR_ACCEPT_ENCODING);
+
+    // Sidecars older than the file are stale and left alone. One that
+    // exists makes the response depend on Accept-Encoding even when the
+    // client does not take it.
+    static const char *const codings[] = { "zstd", "gzip" };
+    static const char *const suffixes[] = { ".zst", ".gz" };
+    bool sidecars = false;
+    for (size_t k = 0; k < 2; ++k) {
+        if (!(k == 0 ? loc.zstd_static : loc.gzip_static))
+            continue;
+        OpenFileCache::Handle side = files_.lookup(path + suffixes[k], loc, rel + suffixes[k]);
+        if (!side->exists() || !S_ISREG(side->st.st_mode) || side->fd < 0 || side->st.st_mtime < st.st_mtime)
+            continue;
+        sidecars = true;
+        if (!req.hasHeader(HDR_RANGE) && acceptsEncoding(accept, codings[k])) {
+            send_sidecar_response(client_fd, req, loc, path, *side, codings[k], i);
+            return;
+        }
+    }
+
+    // Whether the response depends on Accept-Encoding at all
+    bool compressible = loc.compresses(get_mime_type(path), static_cast<size_t>(st.st_size));
+    bool gzip = compressible && !req.hasHeader(HDR_RANGE) && acceptsEncoding(accept, "gzip");
+    const std::string tail = std::string(compressible || sidecars ? "Vary: Accept-Encoding\r\n" : "") +
+                             cacheHeaderLines(loc) + connectionHeaderLines(client_fd) + "\r\n";
+
+    if (notModified(req, st, gzip)) {
+        Logger::log(LOG_INFO, "send_file_response", "Not modified: " + path);
+        queueResponse(client_fd, "HTTP/1.1 304 Not Modified\r\n" + validatorLines(st, gzip) + tail);
+        return;
+    }
+    if (gzip) {
+        send_gzip_file_response(client_fd, req, loc, path, file, tail, i);
+        return;
+    }
+    if (methodBit(req.getMethod()) == METHOD_HEAD) {
+        queueResponse(client_fd, fileResponseHead(path, st) + tail);
+        return;
+    }
+    if (req.hasHeader(HDR_RANGE) && ifRangeMatches(req, st)) {
+        std::vector<ByteRange> ranges;
+        RangeResult r = parseRanges(req.getHeader(HDR_RANGE), st.st_size, ranges);
+        if (r == RANGE_UNSATISFIABLE) {
+            std::ostringstream head;
+            head << "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" << st.st_size
+                 << "\r\nContent-Length: 0\r\n";
+            queueResponse(client_fd, head.str() + connectionHeaderLines(client_fd) + "\r\n");
+            return;
+        }
+        if (r == RANGE_OK) {
+            send_range_response(client_fd, path, file, ranges, tail, i);
+            return;
+        }
+    }
+
+    const std::string *cached_head;
+    SharedBuffer *body;
+    if (responses_.find(path, st, cached_head, body)) {
+        Logger::log(LOG_INFO, "send_file_response", "Sending file (cached): " + path);
+        queueSharedResponse(client_fd, *cached_head + tail, body);
+        return;
+    }
+    std::string head = fileResponseHead(path, st);
+    if (responses_.admit(path, static_cast<size_t>(st.st_size)) &&
+        (body = readWholeFile(file.fd, static_cast<size_t>(st.st_size))) != NULL) {
+        responses_.insert(path, st, head, body);
+        Logger::log(LOG_INFO, "send_file_response", "Sending file (now cached): " + path);
+        queueSharedResponse(client_fd, head + tail, body);
+        body->release();
+        return;
+    }
+
+    int fd = fcntl(file.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        Logger::log(LOG_ERROR, "send_file_response", "dup failed for: " + path);
+        send_error_response(client_fd, 500, "Internal Server Error", i);
         return;
     }
+    if (st.st_size >= LARGE_FILE) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fd, 0, LARGE_FILE, POSIX_FADV_WILLNEED);
+    }
     Logger::log(LOG_INFO, "send_file_response", "Sending file: " + path);
-    std::map<std::string, std::string> headers;
-    headers["Content-Type"] = get_mime_type(path);
-    send_ok_response(client_fd, body, headers, i);
+    queueFileResponse(client_fd, head + tail, fd, 0, static_cast<size_t>(st.st_size));
+}
+
+// A precompressed sidecar (side, next to path) sent in place of the file:
+// the file's Content-Type with the sidecar's coding, validators of its own,
+// and the body with sendfile() straight from the sidecar, so compression
+// costs nothing per request
+void WebServer::send_sidecar_response(int client_fd, const Request &req, const LocationPlan &loc,
+                                      const std::string &path, const OpenFileCache::File &side,
+                                      const char *coding, size_t i)
+{
+    const struct stat &st = side.st;
+    const std::string tail = "Vary: Accept-Encoding\r\n" + cacheHeaderLines(loc) +
+                             connectionHeaderLines(client_fd) + "\r\n";
+    if (notModified(req, st, false)) {
+        Logger::log(LOG_INFO, "send_sidecar_response", "Not modified: " + path);
+        queueResponse(client_fd, "HTTP/1.1 304 Not Modified\r\n" + validatorLines(st) + tail);
+        return;
+    }
+
+    std::ostringstream head;
+    head << "HTTP/1.1 200 OK\r\nContent-Length: " << st.st_size << "\r\nContent-Type: " << get_mime_type(path)
+         << "\r\nContent-Encoding: " << coding << "\r\n" << validatorLines(st);
+    int fd = fcntl(side.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        Logger::log(LOG_ERROR, "send_sidecar_response", "dup failed for: " + path);
+        send_error_response(client_fd, 500, "Internal Server Error", i);
+        return;
+    }
+    Logger::log(LOG_INFO, "send_sidecar_response", "Sending file (" + std::string(coding) + " sidecar): " + path);
+    queueFileResponse(client_fd, head.str() + tail, fd, 0, static_cast<size_t>(st.st_size));
+}
+
+// The gzip coded file for a client that accepts it. Files up to
+// GZIP_IN_MEMORY are compressed whole (so the response has a length) and
+// the result is offered to the response cache under a key of its own;
+// larger ones are compressed by the connection's write queue as the socket
+// takes them, in chunked transfer coding. A HEAD that misses the cache is
+// answered without compressing anything, and so without a length.
+void WebServer::send_gzip_file_response(int client_fd, const Request &req, const LocationPlan &loc,
+                                        const std::string &path, const OpenFileCache::File &file,
+                                        const std::string &tail, size_t i)
+{
+    const struct stat &st = file.st;
+    // Paths never start with a NUL, so the key cannot name a plain file's
+    // entry; the level is part of it, as locations may compress differently
+    std::string key(1, '\0');
+    key += "gzip";
+    key += static_cast<char>('0' + loc.gzip_comp_level);
+    key += '\0';
+    key += path;
+    const std::string *cached_head;
+    SharedBuffer *body;
+    if (responses_.find(key, st, cached_head, body)) {
+        Logger::log(LOG_INFO, "send_gzip_file_response", "Sending file (gzip, cached): " + path);
+        queueSharedResponse(client_fd, *cached_head + tail, body);
+        return;
+    }
+
+    std::ostringstream head;
+    head << "HTTP/1.1 200 OK\r\n";
+    if (methodBit(req.getMethod()) == METHOD_HEAD) {
+        head << "Content-Type: " << get_mime_type(path) << "\r\nContent-Encoding: gzip\r\n"
+             << validatorLines(st, true);
+        queueResponse(client_fd, head.str() + tail);
+        return;
+    }
+    if (st.st_size <= GZIP_IN_MEMORY) {
+        body = gzipWholeFile(file.fd, static_cast<size_t>(st.st_size), loc.gzip_comp_level);
+        if (!body) {
+            Logger::log(LOG_ERROR, "send_gzip_file_response", "Compression failed for: " + path);
+            send_error_response(client_fd, 500, "Internal Server Error", i);
+            return;
+        }
+        head << "Content-Length: " << body->size() << "\r\nContent-Type: " << get_mime_type(path)
+             << "\r\nContent-Encoding: gzip\r\n" << validatorLines(st, true);
+        if (responses_.admit(key, body->size()))
+            responses_.insert(key, st, head.str(), body);
+        Logger::log(LOG_INFO, "send_gzip_file_response", "Sending file (gzip): " + path);
+        queueSharedResponse(client_fd, head.str() + tail, body);
+        body->release();
+        return;
+    }
+
+    int fd = fcntl(file.fd, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        Logger::log(LOG_ERROR, "send_gzip_file_response", "dup failed for: " + path);
+        send_error_response(client_fd, 500, "Internal Server Error", i);
+        return;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    head << "Transfer-Encoding: chunked\r\nContent-Type: " << get_mime_type(path)
+         << "\r\nContent-Encoding: gzip\r\n" << validatorLines(st, true);
+    Logger::log(LOG_INFO, "send_gzip_file_response", "Sending file (gzip, streamed): " + path);
+    queueGzipFileResponse(client_fd, head.str() + tail, fd, static_cast<size_t>(st.st_size), loc.gzip_comp_level);
 }
 
-// Send a redirect response
-void WebServer::send_redirect_response(int client_fd, int code, const std::string &location, size_t i)
+// 206 for the satisfiable ranges of a Range request. Every range is sent
+// with sendfile() from its own duplicate of the file's descriptor: one
+// range as the body, several as multipart/byteranges parts whose delimiter
+// and headers are the only bytes built in memory.
+void WebServer::send_range_response(int client_fd, const std::string &path, const OpenFileCache::File &file,
+                                    const std::vector<ByteRange> &ranges, const std::string &tail, size_t i)
+{
+    const struct stat &st = file.st;
+    std::vector<int> fds;
+    for (size_t k = 0; k < ranges.size(); ++k) {
+        int fd = fcntl(file.fd, F_DUPFD_CLOEXEC, 0);
+        if (fd < 0) {
+            for (size_t j = 0; j < fds.size(); ++j)
+                close(fds[j]);
+            Logger::log(LOG_ERROR, "send_range_response", "dup failed for: " + path);
+            send_error_response(client_fd, 500, "Internal Server Error", i);
+            return;
+        }
+        fds.push_back(fd);
+    }
+    Logger::log(LOG_INFO, "send_range_response", "Sending " + to_str(static_cast<int>(ranges.size())) +
+                " range(s) of: " + path);
+
+    if (ranges.size() == 1) {
+        const ByteRange &r = ranges[0];
+        std::ostringstream head;
+        head << "HTTP/1.1 206 Partial Content\r\nContent-Length: " << (r.last - r.first + 1)
+             << "\r\nContent-Type: " << get_mime_type(path) << "\r\n"
+             << contentRange(r, st.st_size) << "Accept-Ranges: bytes\r\n";
+        queueFileResponse(client_fd, head.str() + validatorLines(st) + tail, fds[0], r.first,
+                          static_cast<size_t>(r.last - r.first + 1));
+        return;
+    }
+
+    // Derived from the file version, so it changes whenever the bytes can
+    std::string tag = entityTag(st);
+    unsigned long h = 5381;
+    for (size_t k = 0; k < tag.size(); ++k)
+        h = h * 33 + static_cast<unsigned char>(tag[k]);
+    std::ostringstream b;
+    b << std::hex << "webserv" << h;
+    const std::string boundary = b.str();
+
+    std::vector<std::string> parts;
+    off_t length = 0;
+    for (size_t k = 0; k < ranges.size(); ++k) {
+        parts.push_back("\r\n--" + boundary + "\r\nContent-Type: " + get_mime_type(path) + "\r\n" +
+                        contentRange(ranges[k], st.st_size) + "\r\n");
+        length += static_cast<off_t>(parts[k].size()) + ranges[k].last - ranges[k].first + 1;
+    }
+    const std::string closing = "\r\n--" + boundary + "--\r\n";
+    length += static_cast<off_t>(closing.size());
+
+    std::ostringstream head;
+    head << "HTTP/1.1 206 Partial Content\r\nContent-Length: " << length
+         << "\r\nContent-Type: multipart/byteranges; boundary=" << boundary << "\r\nAccept-Ranges: bytes\r\n";
+    for (size_t k = 0; k < ranges.size(); ++k)
+        queueFileResponse(client_fd, (k == 0 ? head.str() + validatorLines(st) + tail : "") + parts[k], fds[k],
+                          ranges[k].first, static_cast<size_t>(ranges[k].last - ranges[k].first + 1));
+    queueResponse(client_fd, closing);
+}
+
+// Send a location's redirect: serialized with the plan, only the connection
+// headers are added here
+void WebServer::send_redirect_response(int client_fd, const LocationPlan &loc, size_t i)
 {
     (void)i;
-    std::ostringstream body;
-    body << "<html><head><title>" << code << " Redirect</title></head><body>"
-         << "<h1>" << code << " Redirect</h1>"
-         << "<p>Redirecting to <a href=\"" << location << "\">" << location << "</a></p>"
-         << "</body></html>";
-    Logger::log(LOG_INFO, "send_redirect_response", "Redirecting to: " + location + " (code " + to_str(code) + ")");
+    Logger::log(LOG_INFO, "send_redirect_response", "Redirecting to: " + loc.redirect_url +
+                " (code " + to_str(loc.redirect_code) + ")");
 
-    Response resp;
-    resp.setStatus(code, Response::getStatusMessage(code));
-    resp.setHeader("Location", location);
-    resp.setHeader("Content-Type", "text/html");
-    resp.setHeader("Cache-Control", "no-store, no-cache, must-revalidate, max-age=0");
-    resp.setHeader("Pragma", "no-cache");
-    resp.setHeader("Expires", "0");
-    resp.setBody(body.str());
+    queueResponse(client_fd, loc.redirect_head + connectionHeaderLines(client_fd) + "\r\n" + loc.redirect_body);
+}
 
-    bool keepAlive = !conns_[client_fd].shouldCloseAfterWrite;
-    resp.applyConnectionHeaders(keepAlive);
-    queueResponse(client_fd, resp.toString());
+// A generated body (a listing, CGI output) gzip coded in place when the
+// location compresses its type and the client's Accept-Encoding allows gzip;
+// headers get Content-Encoding, and Vary whenever the outcome depended on
+// the client
+void WebServer::gzip_body(const std::string &accept_encoding, const LocationPlan &loc, std::string &body,
+                          std::map<std::string, std::string> &headers)
+{
+    std::string type = "text/html";
+    for (std::map<std::string, std::string>::const_iterator it = headers.begin(); it != headers.end(); ++it) {
+        if (strcasecmp(it->first.c_str(), "Content-Encoding") == 0)
+            return;
+        if (strcasecmp(it->first.c_str(), "Content-Type") == 0)
+            type = it->second;
+    }
+    if (!loc.compresses(type, body.size()))
+        return;
+    headers["Vary"] = "Accept-Encoding";
+    std::string out;
+    if (!acceptsEncoding(accept_encoding, "gzip") || !gzipString(body, loc.gzip_comp_level, out))
+        return;
+    body.swap(out);
+    headers["Content-Encoding"] = "gzip";
 }
 
 void WebServer::send_ok_response(int client_fd, const std::string &body, const std::map<std::string, std::string> &headers, size_t i)
@@ -45,12 +542,9 @@ void WebServer::send_ok_response(int client_fd, const std::string &body, const s
     (void)i;
     Logger::log(LOG_INFO, "send_ok_response", "Sending 200 OK response.");
     Response resp(200, "OK", body, headers);
-    bool keepAlive = !conns_[client_fd].shouldCloseAfterWrite; // <----- photobook bug?
-    keepAlive = false;                                         // <--- bug "fixed" because false
-    // Apply our new helper:
-    resp.applyConnectionHeaders(keepAlive); // <----- photobook bug?
+    applyConnectionPolicy(resp, client_fd);
     std::string raw = resp.toString();
-    // 2) Enqueue for non-blocking write; close after fully sent
+    // Enqueue for non-blocking write
     queueResponse(client_fd, raw);
 }
 
@@ -63,10 +557,8 @@ void WebServer::send_created_response(int client_fd,
     Logger::log(LOG_INFO, "send_created_response", "Sending 201 Created response.");
     Response resp(201, "Created", body, headers);
 
-    bool keepAlive = !conns_[client_fd].shouldCloseAfterWrite;
-
     // Apply connection headers (keep-alive/close)
-    resp.applyConnectionHeaders(keepAlive);
+    applyConnectionPolicy(resp, client_fd);
 
     std::string raw = resp.toString();
     queueResponse(client_fd, raw);
@@ -75,20 +567,24 @@ void WebServer::send_created_response(int client_fd,
 JESS: Sends the json file when request is done from the client
 */
 void WebServer::send_upload_success_json(int client_fd,
-                                         const std::string &full_filename,
+                                         const std::vector<std::string> &paths,
                                          size_t i)
 {
+    // "path" is the first file, kept for clients that send one file
     std::ostringstream b;
     b << "{"
       << "\"ok\":true,"
-      << "\"message\":\"File uploaded successfully\","
-      << "\"path\":\"" << full_filename << "\""
-      << "}";
+      << "\"message\":\"" << (paths.size() > 1 ? "Files" : "File") << " uploaded successfully\","
+      << "\"path\":\"" << paths[0] << "\","
+      << "\"files\":[";
+    for (size_t k = 0; k < paths.size(); ++k)
+        b << (k ? "," : "") << "\"" << paths[k] << "\"";
+    b << "]}";
     std::map<std::string, std::string> h = json_headers();
     send_created_response(client_fd, b.str(), h, i); // 201 Created is fine. Do not set Location to a filesystem path for JSON.
 }
 
-void WebServer::send_upload_success_response(int client_fd, const std::string &full_filename, size_t i)
+void WebServer::send_upload_success_response(int client_fd, const std::vector<std::string> &paths, size_t i)
 {
     std::ostringstream body;
     body << "<!DOCTYPE html><html lang=\"en\"><head><meta charset=\"UTF-8\">"
@@ -99,7 +595,10 @@ void WebServer::send_upload_success_response(int client_fd, const std::string &f
          << "style=\"font-family:sans-serif;min-height:100vh;\">"
 
          << "<h1 class=\"mb-3\">✅ File uploaded successfully!</h1>"
-         << "<p class=\"mb-4\">Saved as: <code>" << full_filename << "</code></p>"
+         << "<p class=\"mb-4\">Saved as: ";
+    for (size_t k = 0; k < paths.size(); ++k)
+        body << (k ? ", " : "") << "<code>" << paths[k] << "</code>";
+    body << "</p>"
 
          << "<div class=\"d-flex gap-3\">"
          << "<a href=\"/\" class=\"btn btn-outline-light\">Home</a>"
@@ -109,12 +608,12 @@ void WebServer::send_upload_success_response(int client_fd, const std::string &f
          << "<script src=\"https://cdn.jsdelivr.net/npm/bootstrap@5.3.2/dist/js/bootstrap.bundle.min.js\"></script>"
          << "</body></html>";
 
-    Logger::log(LOG_INFO, "send_upload_success_response", "Upload successful: " + full_filename);
+    Logger::log(LOG_INFO, "send_upload_success_response", "Upload successful: " + paths[0]);
 
     // Add headers: Content-Type + Location
     std::map<std::string, std::string> headers;
     headers["Content-Type"] = "text/html; charset=utf-8";
-    headers["Location"] = full_filename; // ideally relative URL, not filesystem path
+    headers["Location"] = paths[0]; // ideally relative URL, not filesystem path
 
     send_created_response(client_fd, body.str(), headers, i);
 }
@@ -129,9 +628,7 @@ void WebServer::send_no_content_response(int client_fd, size_t i)
     // Build response object
     Response resp(204, "No Content", "", headers);
 
-    bool closeAfter = true; // For 204, usually close after write
-    conns_[client_fd].shouldCloseAfterWrite = closeAfter;
-    resp.applyConnectionHeaders(!closeAfter);
+    applyConnectionPolicy(resp, client_fd);
 
     // Let Response::toString() handle proper formatting
     std::string raw = resp.toString();
@@ -163,11 +660,11 @@ void WebServer::send_error_response(int client_fd,
     (void)msg;
 
     // Ensure the connection still exists
-    std::map<int, Connection>::iterator it = conns_.find(client_fd);
-    if (it == conns_.end())
+    Connection *conn = conns_.find(client_fd);
+    if (!conn)
         return;
 
-    const std::string *err_page = config_->getErrorPage(code);
+    const std::string *err_page = conn->server->getErrorPage(code);
     std::string status_msg = Response::getStatusMessage(code);
 
     Response resp;
@@ -197,15 +694,16 @@ void WebServer::send_error_response(int client_fd,
         resp.setBody(oss.str());
     }
 
-    // Decide connection policy for errors:
-    // - Keep open only for informational (1xx) or 204; otherwise close after write.
-    bool closeAfter = !(code < 200 || code == 204);
-
-    // Mark connection state
-    it->second.shouldCloseAfterWrite = closeAfter;
+    // Decide connection policy for errors: when the request could not be
+    // framed (bad syntax, unread or oversized body, timeout) the rest of the
+    // stream cannot be trusted, so close. Otherwise the request was consumed
+    // whole and the connection follows the normal keep-alive policy.
+    if (code == 400 || code == 408 || code == 411 || code == 413 ||
+        code == 414 || code == 431 || code == 501 || code == 505)
+        conn->shouldCloseAfterWrite = true;
 
     // Set proper Connection header
-    resp.applyConnectionHeaders(!closeAfter);  // keepAlive = !closeAfter
+    applyConnectionPolicy(resp, client_fd);
 
     // Serialize and enqueue; DO NOT flush or close here
     std::string raw = resp.toString();
@@ -218,8 +716,7 @@ void WebServer::send_error_response(int client_fd,
 void WebServer::send_continue_response(int client_fd) {
     Response resp; resp.setStatus(100, Response::getStatusMessage(100)); resp.setBody("");
     std::string response = resp.toString();
-    Connection &conn = conns_[client_fd];
-    conn.writeBuf.append(response);
+    queueResponse(client_fd, response);
     // do NOT send now; POLLOUT will flush
 }
 
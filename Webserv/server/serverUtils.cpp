@@ -1,66 +1,39 @@
 #include "WebServer.hpp"
+#include "MultipartUpload.hpp"
 
-// Define the same constant as in utils.cpp
-#define CHUNKED_ERROR_MARKER (static_cast<size_t>(-2))
-
-std::string WebServer::resolve_path(const std::string &raw_path,
-                                    const std::string &method,
-                                    const LocationConfig *loc)
+std::string WebServer::resolve_path(const Request &request,
+                                    const LocationPlan *loc)
 {
     /*Logger::log(LOG_DEBUG, "resolve_path",
-                "raw_path = \"" + raw_path + "\", method = " + method);*/
-
-    // 1) Pick the base filesystem root:
-    //    - If the location block set a root, use it.
-    //    - Otherwise fall back to the server-level root from config_.
-    (void)method;
-	const std::string &serverRoot = config_->getRoot();
-    std::string base = (loc && !loc->root.empty())
-                           ? loc->root
-                           : serverRoot;
-
-    // 2) Strip off the location prefix from the URI, if any
-    std::string rel = raw_path;
-    if (loc && loc->path != "/" && rel.find(loc->path) == 0)
-    {
-        rel = rel.substr(loc->path.length());
-    }
-    if (!rel.empty() && rel[0] == '/')
-        rel = rel.substr(1);
+                "raw_path = \"" + request.getPath() + "\"");*/
+
+    // 1) The base filesystem root: the location's root, or the server root
+    //    (the plan already made that choice)
+    // 2) The URI below the location prefix, as found by the router
+    std::string rel = request.getRelativePath();
 
     // 3) Build the candidate filesystem path
-    std::string candidate = base;
+    std::string candidate = loc->root;
     if (!rel.empty())
         candidate += "/" + rel;
 
     //Logger::log(LOG_DEBUG, "resolve_path", "Candidate path: " + candidate);
 
-    // 4) If it’s a directory, hand it off to handle_directory_request()
-    if (is_directory(candidate))
-    {
-        /*Logger::log(LOG_DEBUG, "resolve_path",
-                    "Directory detected, returning: " + candidate);*/
-        return candidate;
-    }
-
-    // 5) If it’s an existing file, return it
-    if (file_exists(candidate))
-    {
-        /*Logger::log(LOG_DEBUG, "resolve_path",
-                    "File exists, returning: " + candidate);*/
+    // 4) An existing directory (handle_directory_request() takes it from
+    //    there) or file is returned as is; the lookup starts at the opened root
+    struct stat st;
+    if (loc->statBelowRoot(rel, st))
         return candidate;
-    }
 
-    // 6) Try adding “.html”
-    std::string html_fallback = candidate + ".html";
-    if (file_exists(html_fallback))
+    // 5) Try adding ".html"
+    if (loc->statBelowRoot(rel + ".html", st))
     {
         /*Logger::log(LOG_DEBUG, "resolve_path",
-                    "HTML fallback, returning: " + html_fallback);*/
-        return html_fallback;
+                    "HTML fallback, returning: " + candidate + ".html");*/
+        return candidate + ".html";
     }
 
-    // 7) Nothing matched: return candidate so your 404 logic fires
+    // 6) Nothing matched: return candidate so your 404 logic fires
     /*Logger::log(LOG_DEBUG, "resolve_path",
                 "Nothing found, returning: " + candidate);*/
     return candidate;
@@ -80,20 +53,6 @@ std::string extract_filename(const std::string &header)
     return header.substr(start + 1, end - start - 1);
 }
 
-// Reads the entire contents of a file into a string
-std::string WebServer::read_file(const std::string &path)
-{
-    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
-    if (!file)
-    {
-        Logger::log(LOG_ERROR, "read_file", "Failed to open file: " + path);
-        return "";
-    }
-    std::ostringstream ss;
-    ss << file.rdbuf();
-    return ss.str();
-}
-
 bool WebServer::read_and_append_client_data(int client_fd, size_t i)
 {
     char buffer[8192];
@@ -108,9 +67,12 @@ bool WebServer::read_and_append_client_data(int client_fd, size_t i)
         closeClient(client_fd);
 		return false;
     }
-    conns_[client_fd].readBuf.append(buffer, static_cast<size_t>(bytes_read));
+    Connection *conn = conns_.find(client_fd);
+    if (!conn)
+        return false;
+    conn->readBuf.append(buffer, static_cast<size_t>(bytes_read));
 
-    if (conns_[client_fd].readBuf.size() > config_->getMaxBodySize())
+    if (conn->readBuf.size() > serverFor(client_fd).getMaxBodySize())
     {
         Logger::log(LOG_ERROR, "read_and_append_client_data", "Payload Too Large for FD=" + to_str(client_fd));
         send_error_response(client_fd, 413, "Payload Too Large", i);
@@ -121,95 +83,56 @@ bool WebServer::read_and_append_client_data(int client_fd, size_t i)
     return true;
 }
 
-size_t WebServer::find_header_end(const std::string &request_data)
-{
-    return request_data.find("\r\n\r\n");
-}
-
-int WebServer::parse_content_length(const std::string &headers)
-{
-    std::istringstream stream(headers);
-    std::string line;
-    while (std::getline(stream, line))
-    {
-        if (line.find("Content-Length:") != std::string::npos)
-        {
-            std::istringstream linestream(line);
-            std::string key;
-            int content_length = 0;
-            linestream >> key >> content_length;
-            return content_length;
-        }
-    }
-    return 0;
-}
-
-// --- Helper: Check if full body is received ---
-bool WebServer::is_full_body_received(const Request &request, const std::string &request_data, size_t header_end)
-{
-    bool is_chunked = request.isChunked();
-    int content_length = request.getContentLength();
-    size_t body_start = header_end + 4;
-    size_t body_length_received = request_data.size() - body_start;
-
-    if (!is_chunked && content_length > 0 && body_length_received < static_cast<size_t>(content_length))
-    {
-        return false;
-    }
-    if (is_chunked && request.getBody().empty())
-    {
-        return false;
-    }
-    return true;
-}
-
 // ===== Helper functions for handleClientDataOn =====
 
-// Helper: Read data from client socket
+// Helper: Read data from client socket. Returns false when nothing was read:
+// bytes_read is 0 on EOF, -1 with errno set otherwise (EAGAIN = drained).
 bool WebServer::readClientData(int client_fd, char* buf, size_t buf_size, ssize_t& bytes_read)
 {
-	bytes_read = ::read(client_fd, buf, buf_size);
+	do {
+		bytes_read = ::read(client_fd, buf, buf_size);
+	} while (bytes_read < 0 && errno == EINTR);
 
-    if (bytes_read > 0) {
-        return true;
-    }
+	return bytes_read > 0;
+}
 
-    if (bytes_read == 0) {
+// Helper: Peer closed the connection (read_errno == 0) or the socket failed
+void WebServer::handlePeerGone(int client_fd, int read_errno)
+{
+    if (read_errno == 0) {
         // Peer closed - check if we have an incomplete chunked request
-        std::map<int, Connection>::iterator conn_it = conns_.find(client_fd);
-        if (conn_it != conns_.end() && !conn_it->second.readBuf.empty()) {
-            std::string& buffer = conn_it->second.readBuf;
-            size_t hdr_end = find_header_end(buffer);
-            
-            if (hdr_end != std::string::npos) {
-                const size_t header_bytes = hdr_end + 4;
-                std::string headers = buffer.substr(0, header_bytes);
-                
-                // Check if this was a chunked request
-                if (has_chunked_encoding(headers)) {
-                    // We have a chunked request but the connection closed before completion
-                    Logger::log(LOG_ERROR, "WebServer",
-                                "FD=" + to_str(client_fd) + " EOF from peer with incomplete chunked request");
-                    send_error_response(client_fd, 400, "Bad Request", 0);
-                    usleep(50000); // Give time for response to be sent
-                }
-            }
+        Connection *conn = conns_.find(client_fd);
+        // Check if this was a chunked request
+        if (conn && !conn->readBuf.empty() &&
+            conn->parser.parse(conn->readBuf) == RequestParser::PARSE_DONE && conn->parser.isChunked()) {
+            // We have a chunked request but the connection closed before completion
+            Logger::log(LOG_ERROR, "WebServer",
+                        "FD=" + to_str(client_fd) + " EOF from peer with incomplete chunked request");
+            send_error_response(client_fd, 400, "Bad Request", 0);
+        }
+
+        // A half-closed peer may still be reading: finish the queued
+        // responses, then close. Stop watching for input (EOF stays readable).
+        conn = conns_.find(client_fd);
+        if (conn && !conn->writeBuf.empty()) {
+            conn->shouldCloseAfterWrite = true;
+            conn->readBuf.clear();
+            conn->resetRequest();
+            if (loop_)
+                loop_->modify(client_fd, IO_WRITE);
+            Logger::log(LOG_INFO, "WebServer",
+                        "FD=" + to_str(client_fd) + " EOF from peer; closing after pending writes");
+            return;
         }
-        
+
         Logger::log(LOG_INFO, "WebServer",
                     "FD=" + to_str(client_fd) + " EOF from peer; closing");
-        closeClient(client_fd);
-        return false;
     }
-
-    if (bytes_read < 0) {
-        // Error (no errno check, just stop)
-        closeClient(client_fd);
-		return false;
+    else {
+        Logger::log(LOG_INFO, "WebServer",
+                    "FD=" + to_str(client_fd) + " read failed: " + std::strerror(read_errno));
     }
-
-    // Should never reach here, but keeps compiler happy
-    return false;
+    closeClient(client_fd);
 }
 
 // Helper: Check if buffer size is within limits
@@ -221,62 +144,46 @@ bool WebServer::validateBufferSize(int client_fd, size_t current_size, size_t ne
 					"Client buffer too large, possible DoS. FD=" + to_str(client_fd));
 		send_error_response(client_fd, 413, "Payload Too Large", 0);
 		
-		std::map<int, Connection>::iterator it = conns_.find(client_fd);
-		if (it != conns_.end())
-			it->second.shouldCloseAfterWrite = true;
+		markCloseAfterWrite(client_fd);
 		return false;
 	}
 	return true;
 }
 
 // Helper: Validate Content-Length against max body size
-bool WebServer::validateContentLength(int client_fd, const std::string& headers)
+bool WebServer::validateContentLength(int client_fd, long len)
 {
-	long maxBodySize = static_cast<long>(config_->getMaxBodySize());
-	long len = parse_content_length(headers);
-	
+	long maxBodySize = static_cast<long>(serverFor(client_fd).getMaxBodySize());
+
 	if (len > maxBodySize)
 	{
 		Logger::log(LOG_ERROR, "WebServer",
 					"FD=" + to_str(client_fd) + " declared Content-Length exceeds max body size");
 		send_error_response(client_fd, 413, "Payload Too Large", 0);
 		
-		std::map<int, Connection>::iterator it = conns_.find(client_fd);
-		if (it != conns_.end())
-			it->second.shouldCloseAfterWrite = true;
+		markCloseAfterWrite(client_fd);
 		return false;
 	}
 	return true;
 }
 
-// Helper: Calculate how many bytes are needed for a complete request
-size_t WebServer::calculateRequestSize(const std::string& buffer, size_t header_bytes, const std::string& headers)
+// Helper: Handle request execution
+bool WebServer::processCompleteRequest(int client_fd, Request& req)
 {
-	// This function is now only called for non-chunked requests
-	long len = parse_content_length(headers);
-	if (len < 0)
-		len = 0;
-	
-	size_t total_needed = header_bytes + static_cast<size_t>(len);
-	if (buffer.size() < total_needed)
-		return 0; // need more data
-	
-	return total_needed;
-}
+	// Every response to a HEAD request, errors included, goes without body
+	Connection *conn = conns_.find(client_fd);
+	if (conn)
+		conn->head_only = methodBit(req.getMethod()) == METHOD_HEAD;
 
-// Helper: Handle request parsing and execution
-bool WebServer::processCompleteRequest(int client_fd, const std::string& frame)
-{
+	bool ok = true;
 	try
 	{
-		Request req(frame);
 		process_request(req, client_fd, 0);
-		return true;
 	}
 	catch (const std::exception &e)
 	{
 		std::string error_msg = e.what();
-		Logger::log(LOG_ERROR, "WebServer", std::string("Request parse failed: ") + error_msg);
+		Logger::log(LOG_ERROR, "WebServer", std::string("Request failed: ") + error_msg);
 
 		// Determine appropriate error code
 		int error_code = 400;
@@ -295,11 +202,46 @@ bool WebServer::processCompleteRequest(int client_fd, const std::string& frame)
 
 		send_error_response(client_fd, error_code, error_type, 0);
 		
-		if (conns_.count(client_fd))
-			conns_[client_fd].shouldCloseAfterWrite = true;
+		markCloseAfterWrite(client_fd);
 		
-		return false;
+		ok = false;
 	}
+
+	conn = conns_.find(client_fd);
+	if (conn)
+		conn->head_only = false;
+	return ok;
+}
+
+// Helper: A multipart upload is parsed while its body is read: the body
+// hands every block to the parser and the file parts go straight to their
+// temp files, so the body is neither stored nor read back. Only a request
+// that will end up in handle_multipart_upload() is streamed: a POST with
+// one body framing to an upload location that allows it, whose
+// Content-Type has a boundary.
+void WebServer::streamMultipartUpload(Connection& conn, const Config& server)
+{
+	const std::string &buffer = conn.readBuf;
+	const RequestParser &head = conn.parser;
+	if (buffer.compare(head.method().off, head.method().len, "POST") != 0)
+		return;
+	if ((head.contentLength() != 0) == head.isChunked())
+		return;
+	const HeaderSlice *ct = head.header(HDR_CONTENT_TYPE);
+	if (!ct)
+		return;
+	std::string content_type(buffer, ct->value.off, ct->value.len);
+	if (content_type.find("multipart/form-data") == std::string::npos)
+		return;
+	std::string boundary = get_boundary_from_content_type(content_type);
+	if (boundary.empty())
+		return;
+
+	size_t rel = 0;
+	const LocationPlan *loc = server.matchLocation(std::string(buffer, head.target().off, head.target().len), rel);
+	if (!loc || loc->kind != HANDLER_UPLOAD || !loc->allows(METHOD_POST))
+		return;
+	conn.body.streamTo(new MultipartUpload(loc->upload_dir, boundary));
 }
 
 // Helper: Process all complete requests in the buffer
@@ -308,205 +250,117 @@ void WebServer::processBufferedRequests(int client_fd)
 	for (;;)
 	{
 		// Connection might have been closed by processing
-		std::map<int, Connection>::iterator it = conns_.find(client_fd);
-		if (it == conns_.end())
+		Connection *conn = conns_.find(client_fd);
+		if (!conn)
+			return;
+		// Requests pipelined behind a running script wait for its response
+		if (conn->cgiRunning())
 			return;
 
-		std::string &buffer = it->second.readBuf;
+		std::string &buffer = conn->readBuf;
+		RequestParser &head = conn->parser;
 
-		// Do we have complete headers?
-		size_t hdr_end = find_header_end(buffer);
-		if (hdr_end == std::string::npos)
+		// Do we have complete headers? (resumes where the last read stopped)
+		RequestParser::Status st = head.parse(buffer);
+		if (st == RequestParser::PARSE_NEED_MORE)
 		{
 			// Need more data to get headers
+			enterReadPhase(*conn, PHASE_HEADER);
+			return;
+		}
+		if (st == RequestParser::PARSE_ERROR)
+		{
+			Logger::log(LOG_ERROR, "WebServer", std::string("Request parse failed: ") + head.errorText() +
+						" FD=" + to_str(client_fd));
+			int code = head.errorCode();
+			send_error_response(client_fd, code, Response::getStatusMessage(code), 0);
+			markCloseAfterWrite(client_fd);
 			return;
 		}
 
-		const size_t header_bytes = hdr_end + 4;
-		std::string headers = buffer.substr(0, header_bytes);
-
-		// Check if chunked encoding
-		bool is_chunked = has_chunked_encoding(headers);
-		size_t needed = 0;
-		std::string frame;
-
-		if (is_chunked) {
-			// Find end of chunked body
-			needed = find_chunked_terminator(buffer, header_bytes);
-			if (needed == CHUNKED_ERROR_MARKER) {
-				// Malformed chunked body detected
-				Logger::log(LOG_ERROR, "WebServer",
-							"Malformed chunked body detected! FD=" + to_str(client_fd));
-				send_error_response(client_fd, 400, "Bad Request", 0);
-				it->second.shouldCloseAfterWrite = true;
+		// The server block named by Host sets the body limits and handles
+		// the request
+		if (vhosts_->size() > 1)
+		{
+			const HeaderSlice *host = head.header(HDR_HOST);
+			conn->server = host ? &vhosts_->select(buffer.data() + host->value.off, host->value.len)
+								: config_;
+		}
+		const Config &server = *conn->server;
+
+		// The body leaves readBuf as it arrives: the buffer keeps only the
+		// head (and whatever was pipelined after the body)
+		const size_t header_bytes = head.headBytes();
+		conn->body.setSpillThreshold(server.getBodyBufferSize());
+		if (conn->body.empty() && !conn->body.consumer() && !conn->chunks.inProgress())
+			streamMultipartUpload(*conn, server);
+
+		if (head.isChunked()) {
+			// Decode what arrived since the last read straight into the body
+			size_t consumed = 0;
+			ChunkedDecoder::Status cs = conn->chunks.decode(buffer.data() + header_bytes,
+															buffer.size() - header_bytes, conn->body,
+															server.getMaxBodySize(), consumed);
+			buffer.erase(header_bytes, consumed);
+			if (cs == ChunkedDecoder::CHUNK_ERROR) {
+				Logger::log(LOG_ERROR, "WebServer", std::string("Chunked body rejected: ") +
+							conn->chunks.errorText() + " FD=" + to_str(client_fd));
+				int code = conn->chunks.errorCode();
+				send_error_response(client_fd, code, Response::getStatusMessage(code), 0);
+				markCloseAfterWrite(client_fd);
 				return;
 			}
-			if (needed == std::string::npos) {
-				// For chunked requests, we need to validate if what we have so far is potentially malformed
-				// Check if we can see obvious malformed patterns
-				std::string body_part = buffer.substr(header_bytes);
-				
-				// Look for incomplete chunk patterns that indicate malformed data
-				size_t first_crlf = body_part.find("\r\n");
-				if (first_crlf != std::string::npos) {
-					std::string first_chunk_line = body_part.substr(0, first_crlf);
-					
-					// Try to parse the first chunk size
-					size_t chunk_size = 0;
-					bool valid_hex = true;
-					for (size_t i = 0; i < first_chunk_line.size() && valid_hex; ++i) {
-						char c = first_chunk_line[i];
-						if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
-							chunk_size = chunk_size * 16;
-							if (c >= '0' && c <= '9') chunk_size += (c - '0');
-							else if (c >= 'a' && c <= 'f') chunk_size += (c - 'a' + 10);
-							else chunk_size += (c - 'A' + 10);
-						} else if (c == ' ' || c == '\t') {
-							continue;
-						} else {
-							valid_hex = false;
-						}
-					}
-					
-					if (!valid_hex) {
-						// Invalid hex in chunk size line
-						Logger::log(LOG_ERROR, "WebServer",
-									"Invalid chunk size format detected! FD=" + to_str(client_fd));
-						send_error_response(client_fd, 400, "Bad Request", 0);
-						it->second.shouldCloseAfterWrite = true;
-						return;
-					}
-					
-					// Check if we have enough data to validate the first chunk
-					size_t expected_chunk_end = header_bytes + first_crlf + 2 + chunk_size + 2; // headers + chunk_size_line + data + \r\n
-					if (buffer.size() >= expected_chunk_end) {
-						// We have enough data to check if the chunk is properly formatted
-						size_t chunk_data_start = header_bytes + first_crlf + 2;
-						size_t chunk_data_end = chunk_data_start + chunk_size;
-						
-						if (chunk_data_end + 2 <= buffer.size()) {
-							// Check if chunk data is followed by \r\n
-							if (buffer.substr(chunk_data_end, 2) != "\r\n") {
-								Logger::log(LOG_ERROR, "WebServer",
-											"Chunk size mismatch detected! FD=" + to_str(client_fd));
-								send_error_response(client_fd, 400, "Bad Request", 0);
-								it->second.shouldCloseAfterWrite = true;
-								return;
-							}
-							
-							// Now check what comes after this chunk
-							size_t next_chunk_start = chunk_data_end + 2;
-							if (next_chunk_start < buffer.size()) {
-								// We have more data - check if it's a valid next chunk
-								std::string remaining = buffer.substr(next_chunk_start);
-								size_t next_crlf = remaining.find("\r\n");
-								
-								if (next_crlf == std::string::npos && remaining.size() > 0) {
-									// We have partial data that doesn't contain a complete line
-									// This might be incomplete, wait for more unless it's clearly invalid
-									if (remaining.size() > 20) { // If we have > 20 chars without \r\n, it's likely malformed
-										Logger::log(LOG_ERROR, "WebServer",
-													"Malformed chunk size line detected! FD=" + to_str(client_fd));
-										send_error_response(client_fd, 400, "Bad Request", 0);
-										it->second.shouldCloseAfterWrite = true;
-										return;
-									}
-								}
-							} else if (next_chunk_start == buffer.size()) {
-								// We have exactly one complete chunk, but no indication of what follows
-								// This is suspicious - in a proper chunked request, we should see either:
-								// 1. Another chunk size line, or 2. The final "0\r\n\r\n"
-								// If we've been waiting for a while without more data, consider it malformed
-								
-								// Check if this looks like it might be the end of incomplete data
-								// For a quick detection, if we have waited enough time, assume malformed
-								// We can use a heuristic: if buffer hasn't grown in a certain period
-								
-								// For now, let's be more aggressive about incomplete single chunks
-								if (chunk_size > 0) {
-									// Non-zero chunk with nothing following is likely incomplete
-									Logger::log(LOG_ERROR, "WebServer",
-												"Incomplete chunked request: single chunk with no terminator! FD=" + to_str(client_fd));
-									send_error_response(client_fd, 400, "Bad Request", 0);
-									it->second.shouldCloseAfterWrite = true;
-									return;
-								}
-							}
-						}
-					}
-				}
-				
-				// If the buffer is getting large without finding a terminator, it might be malformed
-				if (buffer.size() > header_bytes + 1000) { // reasonable threshold
-					Logger::log(LOG_ERROR, "WebServer",
-								"Chunked body too large without terminator! FD=" + to_str(client_fd));
-					send_error_response(client_fd, 400, "Bad Request", 0);
-					it->second.shouldCloseAfterWrite = true;
-					return;
-				}
-				
+			if (cs == ChunkedDecoder::CHUNK_NEED_MORE) {
 				// Need more data for full chunked body
+				enterReadPhase(*conn, PHASE_BODY);
 				return;
 			}
-			
-			// Validate buffer consistency for chunked
-			if (needed > buffer.size()) {
-				Logger::log(LOG_ERROR, "WebServer",
-							"Chunked body incomplete! FD=" + to_str(client_fd));
-				send_error_response(client_fd, 400, "Bad Request", 0);
-				it->second.shouldCloseAfterWrite = true;
-				return;
-			}
-
-			// Extract and decode chunked body
-			std::string raw_chunked_body = buffer.substr(header_bytes, needed - header_bytes);
-			std::string decoded_body;
-			try {
-				decoded_body = decode_chunked_body(raw_chunked_body);
-			} catch (const std::exception& e) {
-				Logger::log(LOG_ERROR, "WebServer", std::string("Chunked body decode failed: ") + e.what());
-				send_error_response(client_fd, 400, "Bad Request", 0);
-				it->second.shouldCloseAfterWrite = true;
-				return;
-			}
-			
-			// Rebuild frame: headers + decoded body
-			frame = buffer.substr(0, header_bytes) + decoded_body;
 		} else {
 			// Validate Content-Length for non-chunked
-			if (!validateContentLength(client_fd, headers))
+			if (!validateContentLength(client_fd, head.contentLength()))
 				return;
-			
-			// Calculate how many bytes we need for a complete request
-			needed = calculateRequestSize(buffer, header_bytes, headers);
-			if (needed == 0) {
-				// Need more data
+
+			// Move the body bytes read so far into the body sink
+			const size_t body_len = static_cast<size_t>(head.contentLength());
+			size_t take = std::min(body_len - conn->body.size(), buffer.size() - header_bytes);
+			if (!conn->body.append(buffer.data() + header_bytes, take)) {
+				Logger::log(LOG_ERROR, "WebServer", std::string("Could not store request body: ") +
+							std::strerror(errno) + " FD=" + to_str(client_fd));
+				send_error_response(client_fd, 500, "Internal Server Error", 0);
+				markCloseAfterWrite(client_fd);
 				return;
 			}
-			
-			// Validate buffer consistency for non-chunked
-			if (needed > buffer.size()) {
-				Logger::log(LOG_ERROR, "WebServer",
-							"Needed bytes exceed buffer size! FD=" + to_str(client_fd));
-				send_error_response(client_fd, 400, "Bad Request", 0);
-				it->second.shouldCloseAfterWrite = true;
+			buffer.erase(header_bytes, take);
+			if (conn->body.size() < body_len) {
+				// Need more data
+				enterReadPhase(*conn, PHASE_BODY);
 				return;
 			}
-			
-			// Extract complete request frame as-is
-			frame = buffer.substr(0, needed);
 		}
+		const size_t needed = header_bytes;
+
+		// Build the request straight from the parsed offsets
+		Request req(buffer, head, conn->body);
 
 		// Process the request
-		if (!processCompleteRequest(client_fd, frame))
+		if (!processCompleteRequest(client_fd, req))
 			return;
 
 		// Re-fetch connection (might have been closed)
-		std::map<int, Connection>::iterator it2 = conns_.find(client_fd);
-		if (it2 == conns_.end())
+		conn = conns_.find(client_fd);
+		if (!conn)
+			return;
+		// Request done; anything left in the buffer starts the next one
+		enterReadPhase(*conn, PHASE_IDLE);
+		if (conn->shouldCloseAfterWrite)
+		{
+			// Pipelined requests after a closing response are not answered
+			conn->readBuf.clear();
+			conn->resetRequest();
 			return;
+		}
 
-		std::string &buffer2 = it2->second.readBuf;
+		std::string &buffer2 = conn->readBuf;
 
 		// Validate buffer state after processing
 		if (needed > buffer2.size()) {
@@ -517,6 +371,7 @@ void WebServer::processBufferedRequests(int client_fd)
 
 		// Consume processed request and continue with any remaining pipelined requests
 		buffer2.erase(0, needed);
+		conn->resetRequest();
 		if (buffer2.empty())
 			return;
 	}
@@ -527,52 +382,53 @@ void WebServer::processBufferedRequests(int client_fd)
 // Helper: Setup connection policy based on HTTP version and Connection header
 void WebServer::setupConnectionPolicy(Request& request, int client_fd)
 {
+	Connection *conn = conns_.find(client_fd);
+	if (!conn)
+		return;
+
 	std::string ver = request.getVersion();
-	std::string connHdr = request.getHeader("Connection");
-	bool close_conn = (connHdr == "close") || (ver == "HTTP/1.0" && connHdr != "keep-alive");
-	conns_[client_fd].shouldCloseAfterWrite = close_conn;
+	++conn->requests;
+	bool close_conn = request.headerEquals(HDR_CONNECTION, "close") ||
+					  (ver == "HTTP/1.0" && !request.headerEquals(HDR_CONNECTION, "keep-alive")) ||
+					  conn->requests >= static_cast<unsigned>(serverFor(client_fd).getKeepaliveRequests());
+	conn->shouldCloseAfterWrite = close_conn;
 
 	Logger::log(LOG_INFO, "POLICY",
 				"fd=" + to_str(client_fd) +
 					" path=" + request.getPath() +
 					" ver=" + ver +
-					" conn=" + (connHdr.empty() ? std::string("<none>") : connHdr) +
+					" conn=" + (request.hasHeader(HDR_CONNECTION) ? request.getHeader(HDR_CONNECTION) : std::string("<none>")) +
 					" closeAfter=" + (close_conn ? "true" : "false"));
 }
 
 // Helper: Perform basic request validation (method, body size, location permissions)
-bool WebServer::performBasicValidation(Request& request, int client_fd, size_t i)
+bool WebServer::performBasicValidation(Request& request, const LocationPlan* loc, int client_fd, size_t i)
 {
-	std::string method = request.getMethod();
-	std::string uri = request.getPath();
-	const LocationConfig *loc = match_location(config_->getLocations(), uri);
+	const unsigned method = methodBit(request.getMethod());
 
-	/*if (loc)
-		Logger::log(LOG_DEBUG, "WebServer", "Matched location: " + loc->path);
-	else
-		Logger::log(LOG_DEBUG, "WebServer", "No location matched!");*/
+	//Logger::log(LOG_DEBUG, "WebServer", "Matched location: " + loc->path);
 
 	// Check if method is supported
-	if (method != "GET" && method != "POST" && method != "DELETE")
+	if (!method)
 	{
 		send_error_response(client_fd, 501, "Not Implemented", i);
 		return false;
 	}
 
 	// Check body size limits
-	if (request.getContentLength() > static_cast<int>(config_->getMaxBodySize()))
+	if (static_cast<unsigned long>(request.getContentLength()) > serverFor(client_fd).getMaxBodySize())
 	{
 		send_error_response(client_fd, 413, "Payload Too Large", i);
 		return false;
 	}
-	if (request.getBody().size() > config_->getMaxBodySize())
+	if (request.getBodySize() > serverFor(client_fd).getMaxBodySize())
 	{
 		send_error_response(client_fd, 413, "Payload Too Large", i);
 		return false;
 	}
 
 	// Check if method is allowed for this location
-	if (loc && std::find(loc->allowed_methods.begin(), loc->allowed_methods.end(), method) == loc->allowed_methods.end())
+	if (!loc->allows(method))
 	{
 		send_error_response(client_fd, 405, "Method Not Allowed", i);
 		return false;
@@ -596,12 +452,12 @@ bool WebServer::handleExpectContinue(Request& request, int client_fd, size_t i)
 }
 
 // Helper: Handle CGI requests for GET/DELETE methods
-bool WebServer::handleCGIRequest(Request& request, const LocationConfig* loc, int client_fd, size_t i)
+bool WebServer::handleCGIRequest(Request& request, const LocationPlan* loc, int client_fd, size_t i)
 {
-	std::string method = request.getMethod();
-	int is_cgi = (loc && !loc->cgi_extension.empty() && is_cgi_request(*loc, request.getPath())) ? 1 : 0;
+	const unsigned method = methodBit(request.getMethod());
+	int is_cgi = (loc->kind == HANDLER_CGI && is_cgi_request(*loc, request.getRelativePath())) ? 1 : 0;
 	
-	if ((method == "GET" || method == "DELETE") && loc && is_cgi)
+	if ((method & (METHOD_GET | METHOD_DELETE)) && is_cgi)
 	{
 		//Logger::log(LOG_DEBUG, "WebServer", "is_cgi_request: " + to_str(is_cgi));
 		handle_cgi(loc, request, client_fd, i);
@@ -611,16 +467,15 @@ bool WebServer::handleCGIRequest(Request& request, const LocationConfig* loc, in
 }
 
 // Helper: Handle location-based redirections
-bool WebServer::handleRedirection(Request& request, const LocationConfig* loc, int client_fd, size_t i)
+bool WebServer::handleRedirection(Request& request, const LocationPlan* loc, int client_fd, size_t i)
 {
-	if (loc && !loc->redirect_url.empty())
+	if (loc->kind == HANDLER_REDIRECT)
 	{
-		const std::string hostHdr = request.getHeader("Host");
-		const bool external = isExternalRedirect(loc->redirect_url, hostHdr);
+		const bool external = loc->redirectLeavesHost(request.getHeader(HDR_HOST));
 		
 		if (external)
 		{
-			conns_[client_fd].shouldCloseAfterWrite = true;
+			markCloseAfterWrite(client_fd);
 			Logger::log(LOG_INFO, "redirect", "External → " + loc->redirect_url + " (will close)");
 		}
 		else
@@ -628,37 +483,39 @@ bool WebServer::handleRedirection(Request& request, const LocationConfig* loc, i
 			Logger::log(LOG_INFO, "redirect", "Internal → " + loc->redirect_url + " (keep-alive)");
 		}
 		
-		send_redirect_response(client_fd, loc->redirect_code == 0 ? 301 : loc->redirect_code, loc->redirect_url, i);
+		send_redirect_response(client_fd, *loc, i);
 		
-		if (!conns_[client_fd].shouldCloseAfterWrite)
-		{
-			conns_[client_fd].readBuf.clear();
-			//Logger::log(LOG_DEBUG, "RESET", "fd=" + to_str(client_fd) + " cleared readBuf after internal redirect");
-		}
 		return true; // request handled
 	}
 	return false; // no redirection
 }
 
 // Helper: Dispatch to appropriate method handler
-void WebServer::dispatchMethodHandler(Request& request, const LocationConfig* loc, int client_fd, size_t i)
+void WebServer::dispatchMethodHandler(Request& request, const LocationPlan* loc, int client_fd, size_t i)
 {
-	std::string method = request.getMethod();
+	const unsigned method = methodBit(request.getMethod());
 	
-	Logger::log(LOG_INFO, "request", "Ver=" + request.getVersion() + " ConnHdr=" + request.getHeader("Connection"));
+	Logger::log(LOG_INFO, "request", "Ver=" + request.getVersion() + " ConnHdr=" + request.getHeader(HDR_CONNECTION));
+
+	// POST and DELETE change files: what the open-file cache remembers has
+	// to be checked again (in this worker; others notice within
+	// open_file_cache_valid)
+	if (method & (METHOD_POST | METHOD_DELETE))
+		files_.invalidate();
 
-	if (method == "GET")
+	// HEAD runs the GET handler; the connection drops the bodies
+	if (method & (METHOD_GET | METHOD_HEAD))
 	{
 		handle_get(request, loc, client_fd, i);
 	}
-	else if (method == "POST")
+	else if (method == METHOD_POST)
 	{
 		if (!validate_post_request(request, client_fd, i))
 			return;
 		
 		// Check CGI for POST
-		int is_cgi = (loc && !loc->cgi_extension.empty() && is_cgi_request(*loc, request.getPath())) ? 1 : 0;
-		if (loc && is_cgi)
+		int is_cgi = (loc->kind == HANDLER_CGI && is_cgi_request(*loc, request.getRelativePath())) ? 1 : 0;
+		if (is_cgi)
 		{
 			//Logger::log(LOG_DEBUG, "WebServer", "is_cgi_request: " + to_str(is_cgi));
 			handle_cgi(loc, request, client_fd, i);
@@ -667,22 +524,12 @@ void WebServer::dispatchMethodHandler(Request& request, const LocationConfig* lo
 		
 		/*Logger::log(LOG_DEBUG, "process_request",
 					"POST " + request.getPath() +
-						" matched to location " + (loc ? loc->path : "NULL") +
-						" upload_dir=" + (loc ? loc->upload_dir : "<none>"));*/
+						" matched to location " + loc->path +
+						" upload_dir=" + loc->upload_dir);*/
 		handle_post(request, loc, client_fd, i);
 	}
-	else if (method == "DELETE")
+	else if (method == METHOD_DELETE)
 	{
 		handle_delete(request, loc, client_fd, i);
 	}
 }
-
-// Helper: Finalize request processing (cleanup for keep-alive connections)
-void WebServer::finalizeRequestProcessing(int client_fd)
-{
-	if (!conns_[client_fd].shouldCloseAfterWrite)
-	{
-		conns_[client_fd].readBuf.clear();
-		//Logger::log(LOG_DEBUG, "RESET", "fd=" + to_str(client_fd) + " keeping alive; cleared readBuf");
-	}
-}
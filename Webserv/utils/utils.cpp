@@ -1,7 +1,6 @@
 #include "utils.hpp"
-
-// Define a constant for malformed chunked data error
-#define CHUNKED_ERROR_MARKER (static_cast<size_t>(-2))
+#include <cstring>
+#include <ctime>
 
 bool file_exists(const std::string& path) {
     struct stat buffer;
@@ -23,8 +22,7 @@ bool wants_json(const Request &req)
         return true;
 
     // 2) Accept header
-    std::string acc = req.getHeader("Accept");
-    if (acc.find("application/json") != std::string::npos)
+    if (req.headerContains(HDR_ACCEPT, "application/json"))
         return true;
 
     // 3) query flag ?json=1
@@ -75,141 +73,20 @@ std::string get_mime_type(const std::string& path) {
     return mime;
 }
 
-const LocationConfig* match_location(
-    const std::vector<LocationConfig>& locations,
-    const std::string& path)
-{
-    const LocationConfig* best = NULL;
-    size_t bestLen = 0;
-
-    for (size_t i = 0; i < locations.size(); ++i) {
-        const std::string& loc = locations[i].path;
-
-        // 1) must be prefix …
-        if (path.compare(0, loc.length(), loc) != 0)
-            continue;
-
-        // 2) … and either exact match, or next char is '/'
-        if (path.length() > loc.length() &&
-            loc != "/" &&
-            path[loc.length()] != '/')
-        {
-            continue;
-        }
-
-        // 3) take the longest valid prefix
-        if (loc.length() > bestLen) {
-            bestLen = loc.length();
-            best    = &locations[i];
-        }
-    }
-
-    /*if (best)
-        Logger::log(LOG_DEBUG,
-                    "match_location",
-                    "Matched: " + best->path + " for path: " + path);
-    else
-        Logger::log(LOG_DEBUG,
-                    "match_location",
-                    "No match for path: " + path);*/
-
-    return best;
-}
-
-
-bool is_cgi_request(const LocationConfig& loc, const std::string& uri) {
-    std::string cgi_uri = loc.path;  // e.g. /cgi-bin
-    std::string cgi_root = loc.root; // e.g. www/cgi-bin
-
-    if (uri.find(cgi_uri) != 0)
-        return false;
-
-    // Get the path after the location prefix
-    std::string rel_uri = uri.substr(cgi_uri.length());
-    if (!rel_uri.empty() && rel_uri[0] == '/')
-        rel_uri = rel_uri.substr(1);
-
+bool is_cgi_request(const LocationPlan& loc, const std::string& rel_uri) {
     // Only check the first segment as the script
     size_t slash = rel_uri.find('/');
     std::string script_name = (slash == std::string::npos) ? rel_uri : rel_uri.substr(0, slash);
     if (script_name.empty())
         return false;
 
-    std::string abs_script = cgi_root;
-    if (!abs_script.empty() && abs_script[abs_script.size() - 1] != '/')
-        abs_script += "/";
-    abs_script += script_name;
-
-    //Logger::log(LOG_DEBUG, "is_cgi_request", "abs_script: [" + abs_script + "]");
-    bool valid = file_exists(abs_script) && access(abs_script.c_str(), X_OK) == 0;
+    // Looked up below the location's opened root (e.g. www/cgi-bin)
+    struct stat st;
+    bool valid = loc.statBelowRoot(script_name, st) && loc.accessBelowRoot(script_name, X_OK);
     //Logger::log(LOG_DEBUG, "is_cgi_request", std::string("CGI valid: ") + (valid ? "true" : "false"));
     return valid;
 }
 
-std::string decode_chunked_body(const std::string& raw) {
-    std::istringstream in(raw);
-    std::string decoded;
-    std::string line;
-    bool first_line = true;
-    while (true) {
-        // Read chunk size line
-        if (!std::getline(in, line))
-            throw std::runtime_error("400: Malformed chunked body (missing chunk size line)");
-        if (!line.empty() && line[line.size() - 1] == '\r')
-            line.erase(line.size() - 1);
-        // Ignore chunk extensions
-        size_t semi = line.find(';');
-        std::string size_str = (semi == std::string::npos) ? line : line.substr(0, semi);
-        size_str.erase(0, size_str.find_first_not_of(" \t"));
-        size_str.erase(size_str.find_last_not_of(" \t") + 1);
-        if (size_str.empty())
-            throw std::runtime_error("400: Malformed chunked body (empty chunk size)");
-        int chunk_size = 0;
-        std::istringstream iss;
-        iss.str(size_str);
-        iss >> std::hex >> chunk_size;
-        if (iss.fail() || chunk_size < 0) {
-            if (first_line) {
-                throw std::runtime_error("400: Malformed chunked body (body does not start with valid chunk size line)");
-            } else {
-                throw std::runtime_error("400: Malformed chunked body (invalid chunk size)");
-            }
-        }
-        first_line = false;
-        if (chunk_size == 0) {
-            // Last chunk, expect CRLF after
-            if (!std::getline(in, line))
-                throw std::runtime_error("400: Malformed chunked body (missing final CRLF)");
-            if (!line.empty() && line[line.size() - 1] == '\r')
-                line.erase(line.size() - 1);
-            if (!line.empty())
-                throw std::runtime_error("400: Malformed chunked body (extra data after last chunk)");
-            break;
-        }
-        // Read chunk data
-        std::string chunk(chunk_size, '\0');
-        in.read(&chunk[0], chunk_size);
-        if (in.gcount() != chunk_size)
-            throw std::runtime_error("400: Malformed chunked body (incomplete chunk data)");
-        decoded += chunk;
-        // Expect CRLF after chunk data
-        if (!std::getline(in, line))
-            throw std::runtime_error("400: Malformed chunked body (missing CRLF after chunk data)");
-        if (!line.empty() && line[line.size() - 1] == '\r')
-            line.erase(line.size() - 1);
-        if (!line.empty())
-            throw std::runtime_error("400: Malformed chunked body (extra data after chunk data)");
-    }
-    // If any data remains, it's a malformed chunked body
-    if (in.peek() != EOF) {
-        std::string extra;
-        std::getline(in, extra);
-        if (!extra.empty())
-            throw std::runtime_error("400: Malformed chunked body (unexpected data after last chunk)");
-    }
-    return decoded;
-}
-
 bool is_directory(const std::string& path) {
     struct stat statbuf;
     bool dir = stat(path.c_str(), &statbuf) == 0 && S_ISDIR(statbuf.st_mode);
@@ -305,197 +182,40 @@ std::string get_boundary_from_content_type(const std::string& contentType) {
     const std::string key = "boundary=";
     size_t pos = contentType.find(key);
     if (pos == std::string::npos) return "";
-    std::string b = contentType.substr(pos + key.size());
-    if (!b.empty() && b[0] == '"' && b[b.size()-1] == '"')
-        b = b.substr(1, b.size() - 2);
-    return b;
-}
-
-bool extract_multipart_file_raw(const std::string& body,
-                                       const std::string& boundary,
-                                       std::string& outFilename,
-                                       std::string& outContent)
-{
-    if (boundary.empty()) return false;
-
-    const std::string dashBoundary = std::string("--") + boundary;
-    const std::string CRLF = "\r\n";
-
-    // Find first boundary line
-    size_t pos = body.find(dashBoundary + CRLF);
-    if (pos == std::string::npos) return false;
-    pos += dashBoundary.size() + CRLF.size();
-
-    while (true) {
-        // Find headers end
-        size_t headersEnd = body.find(CRLF + CRLF, pos);
-        if (headersEnd == std::string::npos) return false;
-
-        std::string headers = body.substr(pos, headersEnd - pos);
-
-        // Parse filename from Content-Disposition
-        std::string filename;
-        size_t cd = headers.find("Content-Disposition:");
-        if (cd != std::string::npos) {
-            size_t fn = headers.find("filename=", cd);
-            if (fn != std::string::npos) {
-                size_t q1 = headers.find('"', fn);
-                if (q1 != std::string::npos) {
-                    size_t q2 = headers.find('"', q1 + 1);
-                    if (q2 != std::string::npos) {
-                        filename = headers.substr(q1 + 1, q2 - q1 - 1);
-                    }
-                }
-            }
-        }
-
-        size_t contentStart = headersEnd + 4; // skip \r\n\r\n
-
-        // Next boundary (either middle or closing)
-        size_t next = body.find(CRLF + dashBoundary, contentStart);
-        if (next == std::string::npos) {
-            // Try without preceding CRLF (edge case)
-            next = body.find(dashBoundary, contentStart);
-            if (next == std::string::npos) return false;
-        }
-
-        // Content ends just before the CRLF preceding the next boundary (if present)
-        size_t contentEnd = next;
-        if (contentEnd >= 2 && body.substr(contentEnd - 2, 2) == CRLF)
-            contentEnd -= 2;
-
-        // If this part has a filename, we treat it as the file part
-        if (!filename.empty()) {
-            // strip any path components
-            size_t slash = filename.find_last_of("/\\");
-            if (slash != std::string::npos) filename = filename.substr(slash + 1);
-
-            outFilename = sanitize_filename(filename);
-            outContent.assign(body.data() + contentStart, body.data() + contentEnd);
-            return true;
-        }
-
-        // Move to the start of the next part
-        size_t afterBoundary = body.find(CRLF, next + dashBoundary.size());
-        if (afterBoundary == std::string::npos) return false;
-        // closing boundary ends with "--"
-        if (body.compare(next, dashBoundary.size() + 2, dashBoundary + "--") == 0)
-            return false; // reached end without finding a file
-        pos = afterBoundary + CRLF.size();
+    pos += key.size();
+    if (pos < contentType.size() && contentType[pos] == '"') {
+        size_t end = contentType.find('"', pos + 1);
+        return end == std::string::npos ? "" : contentType.substr(pos + 1, end - pos - 1);
     }
-}
-
-// 1) Check "Transfer-Encoding: chunked" in a header substring (case-insensitive)
-bool has_chunked_encoding(const std::string& headers) {
-    std::string h = headers; // copy
-    for (size_t i = 0; i < h.size(); ++i) {
-        char c = h[i];
-        if (c >= 'A' && c <= 'Z') h[i] = char(c - 'A' + 'a');
-    }
-    return h.find("transfer-encoding:") != std::string::npos
-        && h.find("chunked") != std::string::npos;
-}
-
-// 2) Find the end of a chunked body quickly (looks for the 0-chunk terminator)
-size_t find_chunked_terminator(const std::string& buf, size_t body_start) {
-    size_t pos = body_start;
-    
-    while (pos < buf.size()) {
-        // Find the next chunk size line
-        size_t line_end = buf.find("\r\n", pos);
-        if (line_end == std::string::npos) {
-            return std::string::npos; // need more data
-        }
-        
-        // Extract chunk size line
-        std::string chunk_line = buf.substr(pos, line_end - pos);
-        
-        // Parse chunk size (ignore chunk extensions after semicolon)
-        size_t semicolon_pos = chunk_line.find(';');
-        if (semicolon_pos != std::string::npos) {
-            chunk_line = chunk_line.substr(0, semicolon_pos);
-        }
-        
-        // Convert hex chunk size - validate it's proper hex
-        size_t chunk_size = 0;
-        
-        // Check for unreasonably long chunk size lines (security measure)
-        if (chunk_line.size() > 16) { // Max 16 hex digits is reasonable (2^64)
-            return CHUNKED_ERROR_MARKER;
-        }
-        
-        // Define a reasonable maximum for chunk size to prevent overflow
-        const size_t MAX_CHUNK_SIZE = static_cast<size_t>(-1) / 16; // SIZE_MAX / 16 in C++98
-        
-        for (size_t i = 0; i < chunk_line.size(); ++i) {
-            char c = chunk_line[i];
-            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')) {
-                // Check for potential overflow before multiplication
-                if (chunk_size > MAX_CHUNK_SIZE) {
-                    return CHUNKED_ERROR_MARKER; // Would overflow
-                }
-                
-                size_t old_size = chunk_size;
-                chunk_size = chunk_size * 16;
-                
-                if (c >= '0' && c <= '9') chunk_size += (c - '0');
-                else if (c >= 'a' && c <= 'f') chunk_size += (c - 'a' + 10);
-                else chunk_size += (c - 'A' + 10);
-                
-                // Additional overflow check
-                if (chunk_size < old_size) {
-                    return CHUNKED_ERROR_MARKER; // Overflow detected
-                }
-            } else if (c == ' ' || c == '\t') {
-                // Skip whitespace
-                continue;
-            } else {
-                // Invalid hex character
-                return CHUNKED_ERROR_MARKER;
-            }
-        }
-        
-        // If chunk size is 0, this is the final chunk
-        if (chunk_size == 0) {
-            // Look for the final \r\n\r\n after possible trailing headers
-            size_t final_pos = line_end + 2; // after chunk size line
-            
-            // Skip any trailing headers
-            while (final_pos < buf.size()) {
-                size_t header_end = buf.find("\r\n", final_pos);
-                if (header_end == std::string::npos) {
-                    return std::string::npos; // need more data
-                }
-                
-                // If we found an empty line, we're done
-                if (header_end == final_pos) {
-                    return header_end + 2; // return position after final \r\n
-                }
-                
-                final_pos = header_end + 2;
-            }
-            return std::string::npos; // need more data for final \r\n
-        }
-        
-        // Calculate where this chunk's data should end
-        size_t chunk_data_start = line_end + 2;
-        size_t chunk_data_end = chunk_data_start + chunk_size;
-        size_t chunk_end_with_crlf = chunk_data_end + 2; // + \r\n after data
-        
-        // Check if we have enough data for this chunk
-        if (chunk_end_with_crlf > buf.size()) {
-            return std::string::npos; // need more data
-        }
-        
-        // Validate that the chunk data is followed by \r\n
-        if (buf.substr(chunk_data_end, 2) != "\r\n") {
-            return CHUNKED_ERROR_MARKER; // malformed - chunk size doesn't match data
+    // An unquoted boundary ends at the next parameter or whitespace
+    size_t end = contentType.find_first_of("; \t", pos);
+    return contentType.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+}
+
+
+std::string http_date(time_t t) {
+    struct tm tmv;
+    gmtime_r(&t, &tmv);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tmv);
+    return buf;
+}
+
+bool parse_http_date(const std::string& s, time_t& out) {
+    // IMF-fixdate, then the obsolete RFC 850 and asctime() forms
+    static const char* const formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",
+        "%A, %d-%b-%y %H:%M:%S GMT",
+        "%a %b %e %H:%M:%S %Y"
+    };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        struct tm tmv;
+        std::memset(&tmv, 0, sizeof(tmv));
+        const char* end = strptime(s.c_str(), formats[i], &tmv);
+        if (end && *end == '\0') {
+            out = timegm(&tmv);
+            return true;
         }
-        
-        // Move to the next chunk
-        pos = chunk_end_with_crlf;
     }
-    
-    return std::string::npos; // need more data
+    return false;
 }
-